@@ -0,0 +1,214 @@
+/**
+ * @file Arena.c
+ * @author biko
+ * @date 2026-10-17
+ *
+ * Bump allocator - implementation.
+ */
+
+/** Headers *************************************************************/
+#include <ntifs.h>
+#include <ntintsafe.h>
+
+#include <Common.h>
+
+#include "Util.h"
+
+#include "Arena.h"
+
+
+/** Typedefs ************************************************************/
+
+/**
+ * Header of a chunk. The memory handed out follows it.
+ */
+struct _ARENA_CHUNK
+{
+	PARENA_CHUNK	ptNext;
+
+	// Bytes following the header.
+	SIZE_T			cbSize;
+
+	// Bytes already handed out.
+	SIZE_T			cbUsed;
+};
+
+
+/** Constants ***********************************************************/
+
+/**
+ * Size of a chunk's header, such that the memory
+ * following it is aligned.
+ */
+#define ARENA_CHUNK_HEADER_SIZE \
+	(ALIGN_UP_BY(sizeof(ARENA_CHUNK), MEMORY_ALLOCATION_ALIGNMENT))
+
+/**
+ * Size, in bytes, of the first chunk of an arena.
+ * Each chunk after it is twice as large as the one before,
+ * up to ARENA_MAX_CHUNK_SIZE.
+ */
+#define ARENA_MIN_CHUNK_SIZE (PAGE_SIZE)
+
+/**
+ * Size, in bytes, chunks stop growing at.
+ */
+#define ARENA_MAX_CHUNK_SIZE (16 * PAGE_SIZE)
+C_ASSERT(ARENA_MIN_CHUNK_SIZE > ARENA_CHUNK_HEADER_SIZE);
+
+
+/** Functions ***********************************************************/
+
+/**
+ * Allocates a new chunk for an arena.
+ *
+ * @param[in]	ptArena		Arena to add the chunk to.
+ * @param[in]	cbMinimum	Number of bytes the chunk must have room for.
+ *
+ * @returns PARENA_CHUNK
+ *
+ * @remark	Returns NULL if the chunk can't be allocated.
+ */
+_IRQL_requires_max_(APC_LEVEL)
+STATIC
+PAGEABLE
+PARENA_CHUNK
+arena_AllocateChunk(
+	_Inout_	PARENA	ptArena,
+	_In_	SIZE_T	cbMinimum
+)
+{
+	NTSTATUS		eStatus		= STATUS_UNSUCCESSFUL;
+	SIZE_T			cbData		= 0;
+	SIZE_T			cbChunk		= 0;
+	BOOLEAN			bOversized	= FALSE;
+	PARENA_CHUNK	ptChunk		= NULL;
+
+	PAGED_CODE();
+
+	ASSERT(NULL != ptArena);
+
+	cbData = ptArena->cbNextChunk - ARENA_CHUNK_HEADER_SIZE;
+	if (cbMinimum > cbData)
+	{
+		cbData = cbMinimum;
+		bOversized = TRUE;
+	}
+
+	eStatus = RtlSIZETAdd(cbData, ARENA_CHUNK_HEADER_SIZE, &cbChunk);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+
+	ptChunk = ExAllocatePoolWithTag(PagedPool, cbChunk, ptArena->nPoolTag);
+	if (NULL == ptChunk)
+	{
+		goto lblCleanup;
+	}
+	ptChunk->cbSize = cbData;
+	ptChunk->cbUsed = 0;
+
+	if (bOversized && (NULL != ptArena->ptChunks))
+	{
+		// A chunk made for one large allocation is full as soon as
+		// it is made. The current chunk may still have room,
+		// so it stays first.
+		ptChunk->ptNext = ptArena->ptChunks->ptNext;
+		ptArena->ptChunks->ptNext = ptChunk;
+	}
+	else
+	{
+		ptChunk->ptNext = ptArena->ptChunks;
+		ptArena->ptChunks = ptChunk;
+
+		ptArena->cbNextChunk = min(ptArena->cbNextChunk * 2, ARENA_MAX_CHUNK_SIZE);
+	}
+
+lblCleanup:
+	return ptChunk;
+}
+
+_Use_decl_annotations_
+PAGEABLE
+VOID
+ARENA_Initialize(
+	PARENA	ptArena,
+	ULONG	nPoolTag
+)
+{
+	PAGED_CODE();
+
+	ASSERT(NULL != ptArena);
+
+	RtlZeroMemory(ptArena, sizeof(*ptArena));
+	ptArena->cbNextChunk = ARENA_MIN_CHUNK_SIZE;
+	ptArena->nPoolTag = nPoolTag;
+}
+
+_Use_decl_annotations_
+PAGEABLE
+PVOID
+ARENA_Allocate(
+	PARENA	ptArena,
+	SIZE_T	cbSize
+)
+{
+	NTSTATUS		eStatus		= STATUS_UNSUCCESSFUL;
+	SIZE_T			cbAligned	= 0;
+	PARENA_CHUNK	ptChunk		= NULL;
+	PVOID			pvMemory	= NULL;
+
+	PAGED_CODE();
+
+	ASSERT(NULL != ptArena);
+	ASSERT(0 != cbSize);
+
+	eStatus = RtlSIZETAdd(cbSize, MEMORY_ALLOCATION_ALIGNMENT - 1, &cbAligned);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+	cbAligned &= ~((SIZE_T)MEMORY_ALLOCATION_ALIGNMENT - 1);
+
+	ptChunk = ptArena->ptChunks;
+	if ((NULL == ptChunk) ||
+		(ptChunk->cbSize - ptChunk->cbUsed < cbAligned))
+	{
+		ptChunk = arena_AllocateChunk(ptArena, cbAligned);
+		if (NULL == ptChunk)
+		{
+			goto lblCleanup;
+		}
+	}
+
+	pvMemory = RtlOffsetToPointer(ptChunk, ARENA_CHUNK_HEADER_SIZE + ptChunk->cbUsed);
+	ptChunk->cbUsed += cbAligned;
+
+lblCleanup:
+	return pvMemory;
+}
+
+_Use_decl_annotations_
+PAGEABLE
+VOID
+ARENA_Release(
+	PARENA	ptArena
+)
+{
+	PARENA_CHUNK	ptChunk	= NULL;
+	PARENA_CHUNK	ptNext	= NULL;
+
+	PAGED_CODE();
+
+	ASSERT(NULL != ptArena);
+
+	for (ptChunk = ptArena->ptChunks; NULL != ptChunk; ptChunk = ptNext)
+	{
+		ptNext = ptChunk->ptNext;
+		ExFreePool(ptChunk);
+	}
+
+	ptArena->ptChunks = NULL;
+	ptArena->cbNextChunk = ARENA_MIN_CHUNK_SIZE;
+}
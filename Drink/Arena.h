@@ -0,0 +1,97 @@
+/**
+ * @file Arena.h
+ * @author biko
+ * @date 2026-10-17
+ *
+ * Bump allocator for many small allocations
+ * that are all freed together.
+ */
+#pragma once
+
+/** Headers *************************************************************/
+#include <ntifs.h>
+
+#include "Util.h"
+
+
+/** Typedefs ************************************************************/
+
+/**
+ * A block of memory allocations are carved out of.
+ */
+typedef struct _ARENA_CHUNK ARENA_CHUNK, *PARENA_CHUNK;
+
+/**
+ * Contains the state of an arena.
+ *
+ * @remark	Initialize with ARENA_Initialize,
+ *			and release with ARENA_Release.
+ */
+typedef struct _ARENA
+{
+	// The chunk allocations are currently made from comes first.
+	PARENA_CHUNK	ptChunks;
+
+	// Size of the next chunk to allocate, in bytes.
+	SIZE_T			cbNextChunk;
+
+	ULONG			nPoolTag;
+} ARENA, *PARENA;
+typedef ARENA CONST *PCARENA;
+
+
+/** Functions ***********************************************************/
+
+/**
+ * Initializes an empty arena.
+ *
+ * @param[out]	ptArena		Arena to initialize.
+ * @param[in]	nPoolTag	Pool tag for the chunks of the arena.
+ *
+ * @remark	The chunks are allocated from the _paged_ pool.
+ */
+_IRQL_requires_max_(APC_LEVEL)
+PAGEABLE
+VOID
+ARENA_Initialize(
+	_Out_	PARENA	ptArena,
+	_In_	ULONG	nPoolTag
+);
+
+/**
+ * Allocates memory from an arena.
+ *
+ * @param[in]	ptArena	Arena to allocate from.
+ * @param[in]	cbSize	Size to allocate, in bytes.
+ *
+ * @returns PVOID
+ *
+ * @remark	The memory is aligned to MEMORY_ALLOCATION_ALIGNMENT,
+ *			and is not zeroed.
+ * @remark	The memory can't be freed on its own.
+ *			It is freed along with the whole arena by ARENA_Release.
+ * @remark	Returns NULL if the memory can't be allocated.
+ */
+_IRQL_requires_max_(APC_LEVEL)
+PAGEABLE
+_Ret_maybenull_
+_Post_writable_byte_size_(cbSize)
+PVOID
+ARENA_Allocate(
+	_Inout_	PARENA	ptArena,
+	_In_	SIZE_T	cbSize
+);
+
+/**
+ * Frees all memory allocated from an arena.
+ *
+ * @param[in,out]	ptArena	Arena to release.
+ *
+ * @remark	The arena is left empty, and can be allocated from again.
+ */
+_IRQL_requires_max_(APC_LEVEL)
+PAGEABLE
+VOID
+ARENA_Release(
+	_Inout_	PARENA	ptArena
+);
@@ -26,6 +26,13 @@
  */
 #define CARPENTER_POOL_TAG (RtlUlongByteSwap('Carp'))
 
+/**
+ * Number of staged messages whose IDs are remembered,
+ * so that they can be patched one by one.
+ * Staging more messages falls back to rewriting the whole table.
+ */
+#define CARPENTER_MAX_STAGED_MESSAGES (16)
+
 
 /** Typedefs ************************************************************/
 
@@ -37,6 +44,11 @@ typedef struct _CARPENTER
 	PVOID			pvInImageMessageTable;
 	ULONG			cbInImageMessageTable;
 	HMESSAGETABLE	hMessageTable;
+
+	// IDs of the messages staged so far. If there are more than fit,
+	// only nStagedMessages keeps counting.
+	ULONG			anStagedMessageIds[CARPENTER_MAX_STAGED_MESSAGES];
+	ULONG			nStagedMessages;
 } CARPENTER, *PCARPENTER;
 typedef CONST CARPENTER *PCCARPENTER;
 
@@ -76,6 +88,99 @@ carpenter_PointerToPathComponent(
 	}
 }
 
+/**
+ * Remembers the ID of a staged message.
+ *
+ * @param[in]	ptCarpenter	A patcher instance.
+ * @param[in]	nMessageId	The ID of the staged message.
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+STATIC
+PAGEABLE
+VOID
+carpenter_RecordStagedMessage(
+	_Inout_	PCARPENTER	ptCarpenter,
+	_In_	ULONG		nMessageId
+)
+{
+	ULONG	nCurrent	= 0;
+
+	PAGED_CODE();
+
+	ASSERT(NULL != ptCarpenter);
+
+	for (nCurrent = 0;
+		 nCurrent < min(ptCarpenter->nStagedMessages, ARRAYSIZE(ptCarpenter->anStagedMessageIds));
+		 ++nCurrent)
+	{
+		if (nMessageId == ptCarpenter->anStagedMessageIds[nCurrent])
+		{
+			goto lblCleanup;
+		}
+	}
+
+	if (ptCarpenter->nStagedMessages < ARRAYSIZE(ptCarpenter->anStagedMessageIds))
+	{
+		ptCarpenter->anStagedMessageIds[ptCarpenter->nStagedMessages] = nMessageId;
+	}
+	if (MAXULONG != ptCarpenter->nStagedMessages)
+	{
+		++(ptCarpenter->nStagedMessages);
+	}
+
+lblCleanup:
+	return;
+}
+
+/**
+ * Determines whether every staged message can be written
+ * over its original entry, leaving the rest of the table as is.
+ *
+ * @param[in]	ptCarpenter	A patcher instance.
+ *
+ * @returns BOOLEAN
+ *
+ * @remark	If this returns FALSE, the whole table
+ *			has to be serialized again.
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+STATIC
+PAGEABLE
+BOOLEAN
+carpenter_CanPatchInPlace(
+	_In_	PCCARPENTER	ptCarpenter
+)
+{
+	BOOLEAN	bCanPatch	= FALSE;
+	ULONG	nCurrent	= 0;
+
+	PAGED_CODE();
+
+	ASSERT(NULL != ptCarpenter);
+
+	if (ptCarpenter->nStagedMessages > ARRAYSIZE(ptCarpenter->anStagedMessageIds))
+	{
+		goto lblCleanup;
+	}
+
+	for (nCurrent = 0; nCurrent < ptCarpenter->nStagedMessages; ++nCurrent)
+	{
+		if (!NT_SUCCESS(MESSAGETABLE_PatchResourceEntry(ptCarpenter->hMessageTable,
+														ptCarpenter->anStagedMessageIds[nCurrent],
+														ptCarpenter->pvInImageMessageTable,
+														ptCarpenter->cbInImageMessageTable,
+														TRUE)))
+		{
+			goto lblCleanup;
+		}
+	}
+
+	bCanPatch = TRUE;
+
+lblCleanup:
+	return bCanPatch;
+}
+
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGEABLE
 NTSTATUS
@@ -125,10 +230,10 @@ CARPENTER_Create(
 		goto lblCleanup;
 	}
 
-	eStatus = MESSAGETABLE_CreateFromResource(ptCarpenter->pvInImageMessageTable,
-											  ptCarpenter->cbInImageMessageTable,
-											  FALSE,
-											  &(ptCarpenter->hMessageTable));
+	// Only the staged messages are copied out of the resource.
+	eStatus = MESSAGETABLE_CreateViewOfResource(ptCarpenter->pvInImageMessageTable,
+												ptCarpenter->cbInImageMessageTable,
+												&(ptCarpenter->hMessageTable));
 	if (!NT_SUCCESS(eStatus))
 	{
 		goto lblCleanup;
@@ -180,10 +285,10 @@ CARPENTER_CreateFromResource(
 	}
 	RtlSecureZeroMemory(ptCarpenter, sizeof(*ptCarpenter));
 
-	eStatus = MESSAGETABLE_CreateFromResource(pvMessageTableResource,
-											  cbMessageTableResource,
-											  FALSE,
-											  &(ptCarpenter->hMessageTable));
+	// Only the staged messages are copied out of the resource.
+	eStatus = MESSAGETABLE_CreateViewOfResource(pvMessageTableResource,
+												cbMessageTableResource,
+												&(ptCarpenter->hMessageTable));
 	if (!NT_SUCCESS(eStatus))
 	{
 		goto lblCleanup;
@@ -308,8 +413,14 @@ CARPENTER_StageMessage(
 									  nMessageId,
 									  &sDuplicateString,
 									  FALSE);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
 
-	// Keep last status
+	carpenter_RecordStagedMessage(ptCarpenter, nMessageId);
+
+	eStatus = STATUS_SUCCESS;
 
 lblCleanup:
 	CLOSE(pcDuplicateString, ExFreePool);
@@ -333,6 +444,8 @@ CARPENTER_ApplyPatch(
 	PMDL		ptMdl				= NULL;
 	BOOLEAN		bMdlLocked			= FALSE;
 	PVOID		pvNewMapping		= NULL;
+	BOOLEAN		bPatchInPlace		= FALSE;
+	ULONG		nCurrent			= 0;
 
 	PAGED_CODE();
 	ASSERT(PASSIVE_LEVEL == KeGetCurrentIrql());
@@ -342,29 +455,36 @@ CARPENTER_ApplyPatch(
 		goto lblCleanup;
 	}
 
-	eStatus = MESSAGETABLE_Serialize(ptCarpenter->hMessageTable,
-									 &pvNewMessageTable,
-									 &cbNewMessageTable);
-	if (!NT_SUCCESS(eStatus))
+	// If every staged message fits its original entry, only those entries
+	// are rewritten, and the table keeps its size. Otherwise, the layout
+	// of the table changes, and the whole table is serialized again.
+	bPatchInPlace = carpenter_CanPatchInPlace(ptCarpenter);
+	if (!bPatchInPlace)
 	{
-		goto lblCleanup;
-	}
-
-	// Make sure the new table has the same size as the old one.
-	if (bEnforceOriginalSize)
-	{
-		if (cbNewMessageTable != ptCarpenter->cbInImageMessageTable)
+		eStatus = MESSAGETABLE_Serialize(ptCarpenter->hMessageTable,
+										 &pvNewMessageTable,
+										 &cbNewMessageTable);
+		if (!NT_SUCCESS(eStatus))
 		{
-			eStatus = STATUS_BUFFER_TOO_SMALL;
 			goto lblCleanup;
 		}
-	}
-	else
-	{
-		if (cbNewMessageTable > ptCarpenter->cbInImageMessageTable)
+
+		// Make sure the new table has the same size as the old one.
+		if (bEnforceOriginalSize)
 		{
-			eStatus = STATUS_BUFFER_TOO_SMALL;
-			goto lblCleanup;
+			if (cbNewMessageTable != ptCarpenter->cbInImageMessageTable)
+			{
+				eStatus = STATUS_BUFFER_TOO_SMALL;
+				goto lblCleanup;
+			}
+		}
+		else
+		{
+			if (cbNewMessageTable > ptCarpenter->cbInImageMessageTable)
+			{
+				eStatus = STATUS_BUFFER_TOO_SMALL;
+				goto lblCleanup;
+			}
 		}
 	}
 
@@ -404,7 +524,24 @@ CARPENTER_ApplyPatch(
 	}
 
 	// Patch the message table
-	RtlMoveMemory(pvNewMapping, pvNewMessageTable, cbNewMessageTable);
+	if (bPatchInPlace)
+	{
+		for (nCurrent = 0; nCurrent < ptCarpenter->nStagedMessages; ++nCurrent)
+		{
+			eStatus = MESSAGETABLE_PatchResourceEntry(ptCarpenter->hMessageTable,
+													  ptCarpenter->anStagedMessageIds[nCurrent],
+													  pvNewMapping,
+													  ptCarpenter->cbInImageMessageTable,
+													  FALSE);
+
+			// Already checked, so this can't fail.
+			ASSERT(NT_SUCCESS(eStatus));
+		}
+	}
+	else
+	{
+		RtlMoveMemory(pvNewMapping, pvNewMessageTable, cbNewMessageTable);
+	}
 
 	// That's it!
 
@@ -72,6 +72,8 @@ CARPENTER_Create(
  * @param[out]	phCarpenter				Will receive a patcher handle.
  *
  * @returns NTSTATUS
+ *
+ * @remark	The resource must outlive the patcher.
  */
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGEABLE
@@ -129,6 +131,8 @@ CARPENTER_StageMessage(
  *
  * @remark	If the function fails, the patch
  *			is not applied.
+ * @remark	When every staged message fits the entry it replaces,
+ *			only those entries are rewritten.
  */
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGEABLE
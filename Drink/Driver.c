@@ -75,6 +75,13 @@ STATIC BOOLEAN g_bVgaDumpInitialized = FALSE;
 _Guarded_by_(g_tDumpLock)
 STATIC BOOLEAN g_bFramebufferDumpInitialized = FALSE;
 
+/**
+ * Number of frames the history of the screen was set up with.
+ * Valid only if g_bFramebufferDumpInitialized.
+ */
+_Guarded_by_(g_tDumpLock)
+STATIC ULONG g_nHistoryFrames = 0;
+
 /**
  * Synchronizes access to the IOCTL_DRINK_VANITY handler.
  */
@@ -202,17 +209,18 @@ driver_HandleBugshot(
 	_In_	ULONG	cbInputBuffer
 )
 {
-	NTSTATUS	eStatus			= STATUS_UNSUCCESSFUL;
-	PRESOLUTION	ptResolution	= pvInputBuffer;
-	BOOLEAN		bLockAcquired	= FALSE;
-	BOOLEAN		bShutdownVga	= FALSE;
-	BOOLEAN		bShutdownFb		= FALSE;
+	NTSTATUS			eStatus			= STATUS_UNSUCCESSFUL;
+	PBUGSHOT_PARAMETERS	ptParameters	= pvInputBuffer;
+	BOOLEAN				bLockAcquired	= FALSE;
+	BOOLEAN				bShutdownVga	= FALSE;
+	BOOLEAN				bShutdownFb		= FALSE;
 
 	ASSERT(DISPATCH_LEVEL >= KeGetCurrentIrql());
 
 	// We can't actually run above PASSIVE_LEVEL.
 	if ((NULL == pvInputBuffer) ||
-		(cbInputBuffer != sizeof(*ptResolution)) ||
+		(cbInputBuffer != sizeof(*ptParameters)) ||
+		(ptParameters->nHistoryFrames > FRAMEBUFFER_MAX_HISTORY_FRAMES) ||
 		(PASSIVE_LEVEL != KeGetCurrentIrql()))
 	{
 		eStatus = STATUS_INVALID_PARAMETER;
@@ -231,7 +239,22 @@ driver_HandleBugshot(
 	}
 	bLockAcquired = TRUE;
 
-	if (g_bVgaDumpInitialized || g_bFramebufferDumpInitialized)
+	// Once the framebuffers are hooked, only their size can change,
+	// to follow the display mode. The history stays as it was set up.
+	if (g_bFramebufferDumpInitialized)
+	{
+		if (ptParameters->nHistoryFrames != g_nHistoryFrames)
+		{
+			eStatus = STATUS_ALREADY_COMMITTED;
+			goto lblCleanup;
+		}
+
+		eStatus = DXDUMP_Resize(ptParameters->tResolution.nWidth,
+								ptParameters->tResolution.nHeight);
+		goto lblCleanup;
+	}
+
+	if (g_bVgaDumpInitialized)
 	{
 		eStatus = STATUS_ALREADY_COMMITTED;
 		goto lblCleanup;
@@ -247,7 +270,9 @@ driver_HandleBugshot(
 
 	if (UTIL_IsWindows10OrGreater())
 	{
-		eStatus = DXDUMP_Initialize(ptResolution->nWidth, ptResolution->nHeight);
+		eStatus = DXDUMP_Initialize(ptParameters->tResolution.nWidth,
+									ptParameters->tResolution.nHeight,
+									ptParameters->nHistoryFrames);
 		if (!NT_SUCCESS(eStatus))
 		{
 			goto lblCleanup;
@@ -255,6 +280,7 @@ driver_HandleBugshot(
 		VGADUMP_Disable();
 		bShutdownFb = TRUE;
 		g_bFramebufferDumpInitialized = TRUE;
+		g_nHistoryFrames = ptParameters->nHistoryFrames;
 	}
 
 	// Transfer ownership:
@@ -12,21 +12,34 @@
 
 #include <Common.h>
 #include <Drink.h>
+#include <Rle.h>
 
 #include "DxUtil.h"
 #include "VgaDump.h"
 
 #include "DxDump.h"
 
+// The hook runs at HIGH_LEVEL, where the floating point state can't be saved.
+// Only x64 lets the kernel use SSE registers without saving them first,
+// and every x64 processor has SSE2.
+#if defined(_M_X64)
+#include <emmintrin.h>
+#define DXDUMP_STREAMING_STORES
+#endif
+
 
 /** Macros **************************************************************/
 
-#define TRAMPOLINE_NAME(nIndex) dxdump_HookTrampoline ## nIndex
+/**
+ * The trampolines are defined in banks of 16, and numbered in hex:
+ * the first digit is the bank, and the second the slot within it.
+ */
+#define TRAMPOLINE_NAME(nBank, nSlot) dxdump_HookTrampoline ## nBank ## nSlot
 
-#define DEFINE_TRAMPOLINE(nIndex)												\
+#define DEFINE_TRAMPOLINE(nBank, nSlot)											\
 	STATIC																		\
 	VOID																		\
-	TRAMPOLINE_NAME(nIndex) (													\
+	TRAMPOLINE_NAME(nBank, nSlot) (												\
 		PVOID	MiniportDeviceContext,											\
 	    PVOID	Source,															\
 	    UINT	SourceWidth,													\
@@ -36,7 +49,7 @@
 	    UINT	PositionY														\
 	)																			\
 	{																			\
-		C_ASSERT((nIndex) < ARRAYSIZE(g_atHookContexts));						\
+		NT_ASSERT((0x ## nBank ## nSlot) < g_nHookContexts);					\
 		dxdump_SystemDisplayWriteHook(MiniportDeviceContext,					\
 									  Source,									\
 									  SourceWidth,								\
@@ -44,42 +57,609 @@
 									  SourceStride,								\
 									  PositionX,								\
 									  PositionY,								\
-									  g_atHookContexts[nIndex].pfnOriginal);	\
+									  &g_ptHookContexts[0x ## nBank ## nSlot]);	\
 	}
 
+#define DEFINE_TRAMPOLINE_BANK(nBank)											\
+	DEFINE_TRAMPOLINE(nBank, 0)													\
+	DEFINE_TRAMPOLINE(nBank, 1)													\
+	DEFINE_TRAMPOLINE(nBank, 2)													\
+	DEFINE_TRAMPOLINE(nBank, 3)													\
+	DEFINE_TRAMPOLINE(nBank, 4)													\
+	DEFINE_TRAMPOLINE(nBank, 5)													\
+	DEFINE_TRAMPOLINE(nBank, 6)													\
+	DEFINE_TRAMPOLINE(nBank, 7)													\
+	DEFINE_TRAMPOLINE(nBank, 8)													\
+	DEFINE_TRAMPOLINE(nBank, 9)													\
+	DEFINE_TRAMPOLINE(nBank, A)													\
+	DEFINE_TRAMPOLINE(nBank, B)													\
+	DEFINE_TRAMPOLINE(nBank, C)													\
+	DEFINE_TRAMPOLINE(nBank, D)													\
+	DEFINE_TRAMPOLINE(nBank, E)													\
+	DEFINE_TRAMPOLINE(nBank, F)
+
+#define TRAMPOLINE_BANK(nBank)													\
+	TRAMPOLINE_NAME(nBank, 0),													\
+	TRAMPOLINE_NAME(nBank, 1),													\
+	TRAMPOLINE_NAME(nBank, 2),													\
+	TRAMPOLINE_NAME(nBank, 3),													\
+	TRAMPOLINE_NAME(nBank, 4),													\
+	TRAMPOLINE_NAME(nBank, 5),													\
+	TRAMPOLINE_NAME(nBank, 6),													\
+	TRAMPOLINE_NAME(nBank, 7),													\
+	TRAMPOLINE_NAME(nBank, 8),													\
+	TRAMPOLINE_NAME(nBank, 9),													\
+	TRAMPOLINE_NAME(nBank, A),													\
+	TRAMPOLINE_NAME(nBank, B),													\
+	TRAMPOLINE_NAME(nBank, C),													\
+	TRAMPOLINE_NAME(nBank, D),													\
+	TRAMPOLINE_NAME(nBank, E),													\
+	TRAMPOLINE_NAME(nBank, F)
+
 
 /** Typedefs ************************************************************/
 
+/**
+ * The shadow framebuffer the bugcheck screen is copied into.
+ */
+typedef struct _SHADOW_FRAMEBUFFER
+{
+	// The dump that will be written.
+	PFRAMEBUFFER_DUMP_EX	ptDump;
+
+	// The tiles that were drawn on. Lives in the same allocation as the dump,
+	// where the pixels go, and is compressed into place.
+	PUCHAR					pcPool;
+
+	// One entry for each tile, in raster order.
+	// Lives in the same allocation, after the pool.
+	PFRAMEBUFFER_TILE		ptTiles;
+	ULONG					nTileColumns;
+	ULONG					nTileRows;
+
+	// The tiles of the pool are handed out in order.
+	ULONG					nPoolTiles;
+	ULONG					nUsedTiles;
+
+	// Colours of 4 BPP pixels, read from the VGA on first use.
+	ULONG					anPalette[VGA_16_COLOR_PALETTE_ENTRIES];
+	BOOLEAN					bPaletteRead;
+
+	// Appended to the dump, after the tile directory.
+	BUGSHOT_STATISTICS		tStatistics;
+} SHADOW_FRAMEBUFFER, *PSHADOW_FRAMEBUFFER;
+typedef SHADOW_FRAMEBUFFER CONST *PCSHADOW_FRAMEBUFFER;
+
+/**
+ * A hooked display driver.
+ * Each display is dumped separately, so that they don't draw over each other.
+ */
 typedef struct _HOOK_CONTEXT
 {
-	PDRIVER_OBJECT					ptDriverObject;
-	PDRIVER_INITIALIZATION_DATA		ptInitializationData;
-	PDXGKDDI_SYSTEM_DISPLAY_WRITE	pfnOriginal;
+	PDRIVER_OBJECT						ptDriverObject;
+	PDRIVER_INITIALIZATION_DATA			ptInitializationData;
+	PDXGKDDI_SYSTEM_DISPLAY_WRITE		pfnOriginal;
+
+	SHADOW_FRAMEBUFFER					tShadowFramebuffer;
+
+	KBUGCHECK_REASON_CALLBACK_RECORD	tCallbackRecord;
+	BOOLEAN								bCallbackRegistered;
+
+	// What the display's dump is tagged with.
+	GUID								tDumpGuid;
+
+	// The display's number in the history of the screen.
+	ULONG								nDisplay;
 } HOOK_CONTEXT, *PHOOK_CONTEXT;
 typedef HOOK_CONTEXT CONST *PCHOOK_CONTEXT;
 
+/**
+ * The history of the screen, kept as a ring of frames.
+ */
+typedef struct _FRAME_HISTORY
+{
+	// The history that will be written.
+	PFRAMEBUFFER_HISTORY				ptHistory;
+
+	// Each frame is drawn into a slot of its own in the history's frames,
+	// overwriting the oldest one once they run out.
+	ULONG								nSlots;
+	ULONG								cbSlot;
+
+	// Set once the frames are packed together for the dump.
+	// No more frames are kept after that.
+	BOOLEAN								bPacked;
+
+	KBUGCHECK_REASON_CALLBACK_RECORD	tCallbackRecord;
+	BOOLEAN								bCallbackRegistered;
+} FRAME_HISTORY, *PFRAME_HISTORY;
+typedef FRAME_HISTORY CONST *PCFRAME_HISTORY;
+
 
 /** Constants ***********************************************************/
 
 #define DXDUMP_POOL_TAG ('mDxD')
 
+/**
+ * Size of a tile in the tile pool, in bytes.
+ */
+#define DXDUMP_TILE_BYTES (FRAMEBUFFER_TILE_PIXELS * 4)
 
-/** Globals *************************************************************/
+/**
+ * Alignment of the tile pool, in bytes.
+ * The pixels in the dump itself aren't aligned.
+ */
+#define DXDUMP_POOL_ALIGNMENT (16)
 
-STATIC PFRAMEBUFFER_DUMP g_ptShadowFramebuffer = NULL;
+/**
+ * The tile pool has room for this fraction of the framebuffer's tiles.
+ * The bugcheck screen is mostly a solid background, which takes no room.
+ */
+#define DXDUMP_POOL_FRACTION (4)
 
-STATIC HOOK_CONTEXT g_atHookContexts[5] = { 0 };
+/**
+ * Minimal number of tiles in the tile pool.
+ * Enough for the whole of a 640x480 screen.
+ */
+#define DXDUMP_MIN_POOL_TILES (80)
 
-STATIC KBUGCHECK_REASON_CALLBACK_RECORD g_tCallbackRecord = { 0 };
+/**
+ * Room for the frames in the history of the screen, in bytes,
+ * however many frames it holds.
+ */
+#define DXDUMP_HISTORY_BYTES (2 * 1024 * 1024)
+C_ASSERT(DXDUMP_HISTORY_BYTES / FRAMEBUFFER_MAX_HISTORY_FRAMES >= PAGE_SIZE);
 
-STATIC BOOLEAN g_bCallbackRegistered = FALSE;
+
+/** Globals *************************************************************/
+
+/**
+ * A context for each hooked display driver,
+ * passed to the hook by the trampoline of the same number.
+ */
+STATIC PHOOK_CONTEXT g_ptHookContexts = NULL;
+STATIC ULONG g_nHookContexts = 0;
+
+/**
+ * Shared by all the hooked displays.
+ */
+STATIC FRAME_HISTORY g_tHistory = { 0 };
 
 
 /** Functions ***********************************************************/
 
+/**
+ * Reads a pixel drawn on the screen.
+ *
+ * @param[in]	pcRow		Row of the pixel.
+ * @param[in]	nColumn		Column of the pixel.
+ * @param[in]	anPalette	Colours of 4 BPP pixels.
+ *							NULL if the pixels are 32 BPP.
+ *
+ * @returns The pixel's colour, without the padding byte.
+ *
+ * @remark 4 BPP pixels are packed two to a byte,
+ *         with the leftmost one in the high nibble.
+ */
+STATIC
+FORCEINLINE
+ULONG
+dxdump_ReadPixel(
+	_In_		CONST UCHAR *	pcRow,
+	_In_		ULONG			nColumn,
+	_In_opt_	CONST ULONG *	anPalette
+)
+{
+	if (NULL == anPalette)
+	{
+		// The padding byte is junk.
+		return ((CONST ULONG *)pcRow)[nColumn] & 0x00FFFFFF;
+	}
+
+	return anPalette[(pcRow[nColumn / 2] >> ((0 == nColumn % 2) ? 4 : 0)) & 0x0F];
+}
+
+/**
+ * Checks whether a rectangle of pixels is all a single colour.
+ *
+ * @param[in]	pcPixels	First row of the rectangle.
+ * @param[in]	cbStride	Distance between rows, in bytes.
+ * @param[in]	nColumn		Column of the rectangle's left edge in its rows.
+ * @param[in]	nWidth		Width of the rectangle, in pixels.
+ * @param[in]	nHeight		Height of the rectangle, in pixels.
+ * @param[in]	anPalette	Colours of 4 BPP pixels.
+ *							NULL if the pixels are 32 BPP.
+ * @param[out]	pnColor		Will receive the colour, if it is single.
+ *
+ * @returns BOOLEAN
+ */
+STATIC
+BOOLEAN
+dxdump_IsSolid(
+	_In_		CONST UCHAR *	pcPixels,
+	_In_		ULONG			cbStride,
+	_In_		ULONG			nColumn,
+	_In_		ULONG			nWidth,
+	_In_		ULONG			nHeight,
+	_In_opt_	CONST ULONG *	anPalette,
+	_Out_		PULONG			pnColor
+)
+{
+	BOOLEAN			bSolid	= FALSE;
+	ULONG			nColor	= 0;
+	CONST UCHAR *	pcRow	= NULL;
+	ULONG			nRow	= 0;
+	ULONG			nPixel	= 0;
+
+	NT_ASSERT(NULL != pcPixels);
+	NT_ASSERT(0 != nWidth);
+	NT_ASSERT(0 != nHeight);
+	NT_ASSERT(NULL != pnColor);
+
+	nColor = dxdump_ReadPixel(pcPixels, nColumn, anPalette);
+
+	for (nRow = 0; nRow < nHeight; ++nRow)
+	{
+		pcRow = pcPixels + nRow * cbStride;
+		for (nPixel = nColumn; nPixel < nColumn + nWidth; ++nPixel)
+		{
+			if (nColor != dxdump_ReadPixel(pcRow, nPixel, anPalette))
+			{
+				goto lblCleanup;
+			}
+		}
+	}
+
+	*pnColor = nColor;
+	bSolid = TRUE;
+
+lblCleanup:
+	return bSolid;
+}
+
+/**
+ * Gives a tile room in the tile pool.
+ *
+ * @param[in,out]	ptFramebuffer	The framebuffer the tile belongs to.
+ * @param[in,out]	ptTile			The tile.
+ *
+ * @returns TRUE on success, FALSE if the pool has no more room.
+ *
+ * @remark The pool's room is already zeroed, which is what
+ *         a clean tile looks like. A solid tile is filled with its colour.
+ */
+STATIC
+BOOLEAN
+dxdump_PoolTile(
+	_Inout_	PSHADOW_FRAMEBUFFER	ptFramebuffer,
+	_Inout_	PFRAMEBUFFER_TILE	ptTile
+)
+{
+	BOOLEAN	bPooled		= FALSE;
+	ULONG	nPoolTile	= 0;
+	PULONG	pnPixels	= NULL;
+	ULONG	nPixel		= 0;
+
+	NT_ASSERT(NULL != ptFramebuffer);
+	NT_ASSERT(NULL != ptTile);
+	NT_ASSERT(FRAMEBUFFER_TILE_STATE_POOLED != ptTile->eState);
+
+	if (ptFramebuffer->nUsedTiles >= ptFramebuffer->nPoolTiles)
+	{
+		goto lblCleanup;
+	}
+
+	nPoolTile = ptFramebuffer->nUsedTiles;
+	++(ptFramebuffer->nUsedTiles);
+
+	if (FRAMEBUFFER_TILE_STATE_SOLID == ptTile->eState)
+	{
+		pnPixels = (PULONG)&ptFramebuffer->pcPool[nPoolTile * DXDUMP_TILE_BYTES];
+		for (nPixel = 0; nPixel < FRAMEBUFFER_TILE_PIXELS; ++nPixel)
+		{
+			pnPixels[nPixel] = ptTile->nValue;
+		}
+	}
+
+	ptTile->eState = FRAMEBUFFER_TILE_STATE_POOLED;
+	ptTile->nValue = nPoolTile;
+
+	bPooled = TRUE;
+
+lblCleanup:
+	return bPooled;
+}
+
+/**
+ * Copies a row of 32 BPP pixels into the tile pool.
+ *
+ * @param[out]	pcDestination	Where the pixels go. Must be 4-byte aligned.
+ * @param[in]	pcSource		The pixels.
+ * @param[in]	nPixels			Number of pixels.
+ *
+ * @remark Where supported, the pixels bypass the cache, since they are only read
+ *         again when the dump is written. Call dxdump_FinishCopies before that.
+ */
+STATIC
+FORCEINLINE
+VOID
+dxdump_CopyRow(
+	_Out_writes_bytes_all_(nPixels * 4)	PUCHAR			pcDestination,
+	_In_reads_bytes_(nPixels * 4)		CONST UCHAR *	pcSource,
+	_In_								ULONG			nPixels
+)
+{
+#ifdef DXDUMP_STREAMING_STORES
+	ULONG	nPixel	= 0;
+
+	NT_ASSERT(0 == (ULONG_PTR)pcDestination % 4);
+
+	// Single pixels until the destination is aligned...
+	for (; (nPixel < nPixels) && (0 != (ULONG_PTR)&pcDestination[nPixel * 4] % 16); ++nPixel)
+	{
+		_mm_stream_si32((PINT)&pcDestination[nPixel * 4], *(CONST INT UNALIGNED *)&pcSource[nPixel * 4]);
+	}
+
+	// ...then four at a time...
+	for (; nPixel + 4 <= nPixels; nPixel += 4)
+	{
+		_mm_stream_si128((__m128i *)&pcDestination[nPixel * 4],
+						 _mm_loadu_si128((CONST __m128i *)&pcSource[nPixel * 4]));
+	}
+
+	// ...and whatever is left.
+	for (; nPixel < nPixels; ++nPixel)
+	{
+		_mm_stream_si32((PINT)&pcDestination[nPixel * 4], *(CONST INT UNALIGNED *)&pcSource[nPixel * 4]);
+	}
+#else // DXDUMP_STREAMING_STORES
+	RtlMoveMemory(pcDestination, pcSource, nPixels * 4);
+#endif // DXDUMP_STREAMING_STORES
+}
+
+/**
+ * Makes the pixels copied with dxdump_CopyRow visible to all processors.
+ */
+STATIC
+FORCEINLINE
+VOID
+dxdump_FinishCopies(VOID)
+{
+#ifdef DXDUMP_STREAMING_STORES
+	// Streaming stores aren't ordered with the rest.
+	_mm_sfence();
+#endif // DXDUMP_STREAMING_STORES
+}
+
+/**
+ * Copies pixels drawn on the screen into a tile.
+ *
+ * @param[in,out]	ptFramebuffer	The framebuffer the tile belongs to.
+ * @param[in]		nTileColumn		Column of the tile.
+ * @param[in]		nTileRow		Row of the tile.
+ * @param[in]		pcSource		First row of the drawn pixels.
+ * @param[in]		cbSourceStride	Distance between rows of the drawn pixels, in bytes.
+ * @param[in]		nSourceColumn	Column of the drawn pixels in their rows.
+ * @param[in]		anPalette		Colours of 4 BPP pixels.
+ *									NULL if the drawn pixels are 32 BPP.
+ * @param[in]		nLeft			Left edge of the drawn pixels, in pixels.
+ * @param[in]		nTop			Top edge of the drawn pixels, in pixels.
+ * @param[in]		nWidth			Width of the drawn pixels.
+ * @param[in]		nHeight			Height of the drawn pixels.
+ *
+ * @remark The drawn pixels must lie within the tile.
+ */
+STATIC
+VOID
+dxdump_WriteTile(
+	_Inout_		PSHADOW_FRAMEBUFFER	ptFramebuffer,
+	_In_		ULONG				nTileColumn,
+	_In_		ULONG				nTileRow,
+	_In_		CONST UCHAR *		pcSource,
+	_In_		ULONG				cbSourceStride,
+	_In_		ULONG				nSourceColumn,
+	_In_opt_	CONST ULONG *		anPalette,
+	_In_		ULONG				nLeft,
+	_In_		ULONG				nTop,
+	_In_		ULONG				nWidth,
+	_In_		ULONG				nHeight
+)
+{
+	PFRAMEBUFFER_DUMP	ptDump		= NULL;
+	PFRAMEBUFFER_TILE	ptTile		= NULL;
+	ULONG				nTileLeft	= 0;
+	ULONG				nTileTop	= 0;
+	ULONG				nColor		= 0;
+	PUCHAR				pcDstRow	= NULL;
+	ULONG				nRow		= 0;
+	ULONG				nPixel		= 0;
+
+	NT_ASSERT(NULL != ptFramebuffer);
+	NT_ASSERT(nTileColumn < ptFramebuffer->nTileColumns);
+	NT_ASSERT(nTileRow < ptFramebuffer->nTileRows);
+	NT_ASSERT(NULL != pcSource);
+
+	ptDump = &ptFramebuffer->ptDump->tDump;
+	ptTile = &ptFramebuffer->ptTiles[nTileRow * ptFramebuffer->nTileColumns + nTileColumn];
+	nTileLeft = nTileColumn * FRAMEBUFFER_TILE_SIZE;
+	nTileTop = nTileRow * FRAMEBUFFER_TILE_SIZE;
+
+	NT_ASSERT(nLeft >= nTileLeft && nLeft + nWidth <= nTileLeft + FRAMEBUFFER_TILE_SIZE);
+	NT_ASSERT(nTop >= nTileTop && nTop + nHeight <= nTileTop + FRAMEBUFFER_TILE_SIZE);
+
+	// Filling the whole of a tile with a single colour needs no room in the pool.
+	// Tiles on the edges are only partly inside the framebuffer.
+	if ((FRAMEBUFFER_TILE_STATE_POOLED != ptTile->eState) &&
+		(nWidth == min(FRAMEBUFFER_TILE_SIZE, ptDump->nWidth - nTileLeft)) &&
+		(nHeight == min(FRAMEBUFFER_TILE_SIZE, ptDump->nHeight - nTileTop)) &&
+		dxdump_IsSolid(pcSource, cbSourceStride, nSourceColumn, nWidth, nHeight, anPalette, &nColor))
+	{
+		ptTile->eState = FRAMEBUFFER_TILE_STATE_SOLID;
+		ptTile->nValue = nColor;
+		goto lblCleanup;
+	}
+
+	if (FRAMEBUFFER_TILE_STATE_DROPPED == ptTile->eState)
+	{
+		goto lblCleanup;
+	}
+
+	if ((FRAMEBUFFER_TILE_STATE_POOLED != ptTile->eState) && !dxdump_PoolTile(ptFramebuffer, ptTile))
+	{
+		ptTile->eState = FRAMEBUFFER_TILE_STATE_DROPPED;
+		goto lblCleanup;
+	}
+
+	pcDstRow = &ptFramebuffer->pcPool[ptTile->nValue * DXDUMP_TILE_BYTES +
+									  ((nTop - nTileTop) * FRAMEBUFFER_TILE_SIZE + (nLeft - nTileLeft)) * 4];
+
+	for (nRow = 0; nRow < nHeight; ++nRow)
+	{
+		if (NULL == anPalette)
+		{
+			dxdump_CopyRow(pcDstRow, pcSource + nSourceColumn * 4, nWidth);
+		}
+		else
+		{
+			for (nPixel = 0; nPixel < nWidth; ++nPixel)
+			{
+				((PULONG)pcDstRow)[nPixel] = dxdump_ReadPixel(pcSource, nSourceColumn + nPixel, anPalette);
+			}
+		}
+
+		pcDstRow += FRAMEBUFFER_TILE_SIZE * 4;
+		pcSource += cbSourceStride;
+	}
+
+lblCleanup:
+	return;
+}
+
+/**
+ * Keeps pixels drawn on the screen in the history of the screen.
+ *
+ * @param[in]	nDisplay		Number of the display drawn on.
+ * @param[in]	pcSource		First row of the drawn pixels.
+ * @param[in]	cbSourceStride	Distance between rows of the drawn pixels, in bytes.
+ * @param[in]	anPalette		Colours of 4 BPP pixels.
+ *								NULL if the drawn pixels are 32 BPP.
+ * @param[in]	nLeft			Left edge of the drawn pixels, in pixels.
+ * @param[in]	nTop			Top edge of the drawn pixels, in pixels.
+ * @param[in]	nWidth			Width of the drawn pixels.
+ * @param[in]	nHeight			Height of the drawn pixels.
+ *
+ * @remark The frame takes the place of the oldest one if the history is full.
+ *         Only the first rows that fit in its slot, once compressed, are stored.
+ */
+STATIC
+VOID
+dxdump_RecordFrame(
+	_In_		ULONG			nDisplay,
+	_In_		CONST UCHAR *	pcSource,
+	_In_		ULONG			cbSourceStride,
+	_In_opt_	CONST ULONG *	anPalette,
+	_In_		ULONG			nLeft,
+	_In_		ULONG			nTop,
+	_In_		ULONG			nWidth,
+	_In_		ULONG			nHeight
+)
+{
+	PFRAMEBUFFER_HISTORY	ptHistory	= g_tHistory.ptHistory;
+	PFRAMEBUFFER_FRAME		ptFrame		= NULL;
+	ULONG					cbRoom		= 0;
+	ULONG					nRow		= 0;
+	ULONG					nPixel		= 0;
+	ULONG					nColor		= 0;
+	RLE_ENCODER				tEncoder;
+	RLE_ENCODER				tRowEnd;
+
+	NT_ASSERT(NULL != pcSource);
+
+	if ((NULL == ptHistory) || g_tHistory.bPacked)
+	{
+		goto lblCleanup;
+	}
+
+	ptFrame = (PFRAMEBUFFER_FRAME)&ptHistory->acFrames[(ptHistory->nFramesDrawn % g_tHistory.nSlots) *
+														g_tHistory.cbSlot];
+	cbRoom = g_tHistory.cbSlot - FIELD_OFFSET(FRAMEBUFFER_FRAME, acTokens);
+
+	ptFrame->nSequence = ptHistory->nFramesDrawn;
+	ptFrame->nTimestamp = (ULONGLONG)KeQueryPerformanceCounter(NULL).QuadPart;
+	ptFrame->nDisplay = nDisplay;
+	ptFrame->nLeft = nLeft;
+	ptFrame->nTop = nTop;
+	ptFrame->nWidth = nWidth;
+	ptFrame->nHeight = nHeight;
+
+	RLE_InitializeEncoder(&tEncoder, ptFrame->acTokens, cbRoom);
+	tRowEnd = tEncoder;
+	for (nRow = 0; nRow < nHeight; ++nRow)
+	{
+		for (nPixel = 0; nPixel < nWidth; ++nPixel)
+		{
+			nColor = dxdump_ReadPixel(pcSource, nPixel, anPalette);
+			if (!RLE_EncodePixels(&tEncoder, (CONST UCHAR *)&nColor, 1))
+			{
+				break;
+			}
+		}
+
+		if (nPixel < nWidth)
+		{
+			// Only whole rows are stored, so forget the part of this one that fit.
+			// The tokens written past the previous row are simply overwritten.
+			tEncoder = tRowEnd;
+			break;
+		}
+		tRowEnd = tEncoder;
+
+		pcSource += cbSourceStride;
+	}
+	ptFrame->nStoredRows = nRow;
+	ptFrame->cbTokens = RLE_FinishEncoder(&tEncoder);
+	ptFrame->cbFrame = ALIGN_UP_BY(FIELD_OFFSET(FRAMEBUFFER_FRAME, acTokens) + ptFrame->cbTokens,
+								   FRAMEBUFFER_FRAME_ALIGNMENT);
+
+	++(ptHistory->nFramesDrawn);
+
+lblCleanup:
+	return;
+}
+
+/**
+ * Reads the colours of 4 BPP pixels from the VGA.
+ *
+ * @param[out]	anPalette	Will receive the colours, as 32 BPP pixels.
+ */
+STATIC
+VOID
+dxdump_ReadPalette(
+	_Out_writes_all_(VGA_16_COLOR_PALETTE_ENTRIES)	PULONG	anPalette
+)
+{
+	PALETTE_ENTRY	atEntries[VGA_16_COLOR_PALETTE_ENTRIES];
+	ULONG			nEntry	= 0;
+
+	NT_ASSERT(NULL != anPalette);
+
+	VGADUMP_ReadPalette(atEntries, ARRAYSIZE(atEntries));
+
+	// The DAC's components are 6 bits wide.
+	for (nEntry = 0; nEntry < ARRAYSIZE(atEntries); ++nEntry)
+	{
+		anPalette[nEntry] = ((ULONG)atEntries[nEntry].nRed << 18) |
+							((ULONG)atEntries[nEntry].nGreen << 10) |
+							((ULONG)atEntries[nEntry].nBlue << 2);
+	}
+}
+
 /**
  * @brief Hook for the function that draws the bugcheck screen.
  *
+ * The last parameter is the hooked display driver,
+ * whose shadow framebuffer receives the drawn pixels.
+ *
  * @see https://docs.microsoft.com/en-us/windows-hardware/drivers/ddi/dispmprt/nc-dispmprt-dxgkddi_system_display_write
 */
 STATIC
@@ -92,93 +672,160 @@ dxdump_SystemDisplayWriteHook(
     _In_											UINT							SourceStride,
     _In_											UINT							PositionX,
     _In_											UINT							PositionY,
-	_In_											PDXGKDDI_SYSTEM_DISPLAY_WRITE	pfnOriginal
+	_Inout_										PHOOK_CONTEXT					ptContext
 )
 {
-	UINT	cbFramebufferStride	= 0;
-	PUCHAR	pcDstRow			= NULL;
-	PUCHAR	pcSrcRow			= NULL;
-	ULONG	cbToCopy			= 0;
-	ULONG	nRows				= 0;
-	ULONG	nCols				= 0;
-	ULONG	nRow				= 0;
-
-	NT_ASSERT(NULL != pfnOriginal);
-
-	if (NULL == g_ptShadowFramebuffer || !g_ptShadowFramebuffer->bValid)
+	PSHADOW_FRAMEBUFFER	ptShadow		= NULL;
+	PFRAMEBUFFER_DUMP	ptFramebuffer	= NULL;
+	ULONG				nRows			= 0;
+	ULONG				nCols			= 0;
+	ULONG				nTileRow		= 0;
+	ULONG				nTileColumn		= 0;
+	ULONG				nTop			= 0;
+	ULONG				nBottom			= 0;
+	ULONG				nLeft			= 0;
+	ULONG				nRight			= 0;
+	CONST ULONG *		anPalette		= NULL;
+	ULONGLONG			nStartCycles	= 0;
+
+	NT_ASSERT(NULL != ptContext);
+	NT_ASSERT(NULL != ptContext->pfnOriginal);
+
+	ptShadow = &ptContext->tShadowFramebuffer;
+
+	if (NULL == ptShadow->ptDump || !ptShadow->ptDump->tDump.bValid)
 	{
 		goto lblCleanup;
 	}
 
-	g_ptShadowFramebuffer->nMaxSeenWidth = max(g_ptShadowFramebuffer->nMaxSeenWidth, SourceWidth + PositionX);
-	g_ptShadowFramebuffer->nMaxSeenHeight = max(g_ptShadowFramebuffer->nMaxSeenHeight, SourceHeight + PositionY);
+	ptFramebuffer = &ptShadow->ptDump->tDump;
 
-	// The source is always 32 BPP, but sometimes it isn't, like when the output is actually to VGA.
+	++(ptShadow->tStatistics.nBlits);
+
+	// NOTE: The assumption here is that the MSDN is correct and the source image is
+	// always 32 BPP. The only exception I know of is when the output is to VGA using
+	// BasicDisplay.sys, then the source is actually 4 BPP, two pixels to a byte.
+	// The source stride seems to be a good indicator for this case, since in the case
+	// of 32 BPP the stride must be at least cbToCopy. But I may be wrong.
 	if (SourceStride < SourceWidth * 4)
 	{
-		// NOTE: The assumption here is that the MSDN is correct and the source image is
-		// always 32 BPP. The only exception I know of is when the output is to VGA using
-		// BasicDisplay.sys, then the source is actually 4 BPP. The source stride seems to be
-		// a good indicator for this case, since in the case of 32 BPP the stride must be at
-		// least cbToCopy. But I may be wrong.
+		if (SourceStride < (SourceWidth + 1) / 2)
+		{
+			// Not 4 BPP either, so there's no telling what's in the source.
+			// Don't touch the framebuffer no more, since it would only
+			// hold part of the screen, and hand off to the VGA dump module.
+			ptFramebuffer->bValid = FALSE;
+			(VOID)VGADUMP_Enable();
+			goto lblCleanup;
+		}
+
+		// The pixels are indices into the first entries of the DAC palette.
+		if (!ptShadow->bPaletteRead)
+		{
+			dxdump_ReadPalette(ptShadow->anPalette);
+			ptShadow->bPaletteRead = TRUE;
+		}
+		anPalette = ptShadow->anPalette;
+	}
 
-		// Don't touch the framebuffer no more.
-		g_ptShadowFramebuffer->bValid = FALSE;
+	dxdump_RecordFrame(ptContext->nDisplay,
+					   Source,
+					   SourceStride,
+					   anPalette,
+					   PositionX,
+					   PositionY,
+					   SourceWidth,
+					   SourceHeight);
+
+	// The screen keeps being updated while the dump is written,
+	// but by then the pixels have already been compressed.
+	if (FRAMEBUFFER_COMPRESSION_NONE != ptShadow->ptDump->eCompression)
+	{
+		goto lblCleanup;
+	}
 
-		// Hand off to VGA dump module.
-		(VOID)VGADUMP_Enable();
+	ptFramebuffer->nMaxSeenWidth = max(ptFramebuffer->nMaxSeenWidth, SourceWidth + PositionX);
+	ptFramebuffer->nMaxSeenHeight = max(ptFramebuffer->nMaxSeenHeight, SourceHeight + PositionY);
 
-		// Time to leave.
+	if (PositionY >= ptFramebuffer->nHeight || PositionX >= ptFramebuffer->nWidth)
+	{
+		++(ptShadow->tStatistics.nClippedBlits);
 		goto lblCleanup;
 	}
 
-	if (PositionY >= g_ptShadowFramebuffer->nHeight || PositionX >= g_ptShadowFramebuffer->nWidth)
+	nRows = min(SourceHeight, ptFramebuffer->nHeight - PositionY);
+	nCols = min(SourceWidth, ptFramebuffer->nWidth - PositionX);
+
+	if ((nRows < SourceHeight) || (nCols < SourceWidth))
+	{
+		++(ptShadow->tStatistics.nClippedBlits);
+	}
+
+	if ((0 == nRows) || (0 == nCols))
 	{
 		goto lblCleanup;
 	}
 
-	cbFramebufferStride = g_ptShadowFramebuffer->nWidth * 4;
+	nStartCycles = ReadTimeStampCounter();
 
-	pcDstRow = &g_ptShadowFramebuffer->acPixels[PositionY * cbFramebufferStride + PositionX * 4];
-	pcSrcRow = Source;
+	// Split the drawn rectangle between the tiles it covers.
+	for (nTileRow = PositionY / FRAMEBUFFER_TILE_SIZE;
+		 nTileRow <= (PositionY + nRows - 1) / FRAMEBUFFER_TILE_SIZE;
+		 ++nTileRow)
+	{
+		nTop = max(PositionY, nTileRow * FRAMEBUFFER_TILE_SIZE);
+		nBottom = min(PositionY + nRows, (nTileRow + 1) * FRAMEBUFFER_TILE_SIZE);
 
-	nRows = min(SourceHeight, g_ptShadowFramebuffer->nHeight - PositionY);
-	nCols = min(SourceWidth, g_ptShadowFramebuffer->nWidth - PositionX);
+		for (nTileColumn = PositionX / FRAMEBUFFER_TILE_SIZE;
+			 nTileColumn <= (PositionX + nCols - 1) / FRAMEBUFFER_TILE_SIZE;
+			 ++nTileColumn)
+		{
+			nLeft = max(PositionX, nTileColumn * FRAMEBUFFER_TILE_SIZE);
+			nRight = min(PositionX + nCols, (nTileColumn + 1) * FRAMEBUFFER_TILE_SIZE);
+
+			dxdump_WriteTile(ptShadow,
+							 nTileColumn,
+							 nTileRow,
+							 (CONST UCHAR *)Source + (nTop - PositionY) * SourceStride,
+							 SourceStride,
+							 nLeft - PositionX,
+							 anPalette,
+							 nLeft,
+							 nTop,
+							 nRight - nLeft,
+							 nBottom - nTop);
+		}
+	}
 
-	cbToCopy = nCols * 4;
+	dxdump_FinishCopies();
 
-	for (nRow = 0; nRow < nRows; ++nRow)
-    {
-        RtlMoveMemory(pcDstRow, pcSrcRow, cbToCopy);
-        pcDstRow += cbFramebufferStride;
-        pcSrcRow += SourceStride;
-    }
+	ptShadow->tStatistics.cbCopied += (ULONGLONG)nRows * nCols * 4;
+	ptShadow->tStatistics.nCopyCycles += ReadTimeStampCounter() - nStartCycles;
 
 lblCleanup:
-	pfnOriginal(MiniportDeviceContext,
-				Source,
-				SourceWidth,
-				SourceHeight,
-				SourceStride,
-				PositionX,
-				PositionY);
+	ptContext->pfnOriginal(MiniportDeviceContext,
+						   Source,
+						   SourceWidth,
+						   SourceHeight,
+						   SourceStride,
+						   PositionX,
+						   PositionY);
 }
 
-DEFINE_TRAMPOLINE(0)
-DEFINE_TRAMPOLINE(1)
-DEFINE_TRAMPOLINE(2)
-DEFINE_TRAMPOLINE(3)
-DEFINE_TRAMPOLINE(4)
+DEFINE_TRAMPOLINE_BANK(0)
+DEFINE_TRAMPOLINE_BANK(1)
+DEFINE_TRAMPOLINE_BANK(2)
+DEFINE_TRAMPOLINE_BANK(3)
 
 STATIC PDXGKDDI_SYSTEM_DISPLAY_WRITE CONST g_apfnTrampolines[] = {
-	TRAMPOLINE_NAME(0),
-	TRAMPOLINE_NAME(1),
-	TRAMPOLINE_NAME(2),
-	TRAMPOLINE_NAME(3),
-	TRAMPOLINE_NAME(4)
+	TRAMPOLINE_BANK(0),
+	TRAMPOLINE_BANK(1),
+	TRAMPOLINE_BANK(2),
+	TRAMPOLINE_BANK(3)
 };
 
-C_ASSERT(ARRAYSIZE(g_apfnTrampolines) == ARRAYSIZE(g_atHookContexts));
+// To hook more displays, add banks here and raise FRAMEBUFFER_MAX_DISPLAYS.
+C_ASSERT(ARRAYSIZE(g_apfnTrampolines) == FRAMEBUFFER_MAX_DISPLAYS);
 
 /**
  * Bugcheck callback for dumping the framebuffer memory.
@@ -200,11 +847,16 @@ dxdump_BugCheckSecondaryDumpDataCallback(
 )
 {
 	PKBUGCHECK_SECONDARY_DUMP_DATA	ptSecondaryDumpData	= pvReasonSpecificData;
+	PHOOK_CONTEXT					ptContext			= NULL;
+	PSHADOW_FRAMEBUFFER				ptShadow			= NULL;
+	PFRAMEBUFFER_DUMP_EX			ptDump				= NULL;
 	ULONG							cbData				= 0;
+	ULONG							cbTiles				= 0;
+	RLE_ENCODER						tEncoder;
+	ULONGLONG						nStartCycles		= 0;
 
 #ifndef DBG
 	UNREFERENCED_PARAMETER(eReason);
-	UNREFERENCED_PARAMETER(ptRecord);
 	UNREFERENCED_PARAMETER(cbReasonSpecificData);
 #endif // !DBG
 
@@ -213,7 +865,14 @@ dxdump_BugCheckSecondaryDumpDataCallback(
 	NT_ASSERT(NULL != pvReasonSpecificData);
 	NT_ASSERT(sizeof(*ptSecondaryDumpData) == cbReasonSpecificData);
 
-	if (NULL == g_ptShadowFramebuffer || !g_ptShadowFramebuffer->bValid)
+	nStartCycles = ReadTimeStampCounter();
+
+	// Each hooked display registers its own callback.
+	ptContext = CONTAINING_RECORD(ptRecord, HOOK_CONTEXT, tCallbackRecord);
+	ptShadow = &ptContext->tShadowFramebuffer;
+	ptDump = ptShadow->ptDump;
+
+	if (NULL == ptDump || !ptDump->tDump.bValid)
 	{
 		ptSecondaryDumpData->OutBuffer = NULL;
 		ptSecondaryDumpData->OutBufferLength = 0;
@@ -221,7 +880,36 @@ dxdump_BugCheckSecondaryDumpDataCallback(
 	}
 
 	// This is safe since validation has already been performed in dxdump_AllocateFramebuffer
-	cbData = UFIELD_OFFSET(FRAMEBUFFER_DUMP, acPixels[g_ptShadowFramebuffer->nWidth * g_ptShadowFramebuffer->nHeight * 4]);
+	cbTiles = ptShadow->nTileColumns * ptShadow->nTileRows * sizeof(FRAMEBUFFER_TILE);
+
+	// Compress the used part of the tile pool into the dump's pixels,
+	// which start a little before it, so that large screens still fit
+	// and less has to be written. This needs no memory, so it is safe
+	// at this point. The callback may be invoked more than once,
+	// so only the first invocation does it.
+	if (FRAMEBUFFER_COMPRESSION_NONE == ptDump->eCompression)
+	{
+		// A token is never larger than the pixels it describes, so this can't fail.
+		RLE_InitializeEncoder(&tEncoder,
+							  ptDump->tDump.acPixels,
+							  (ULONG)(ptShadow->pcPool - ptDump->tDump.acPixels) +
+							  ptShadow->nUsedTiles * DXDUMP_TILE_BYTES);
+		(VOID)RLE_EncodePixels(&tEncoder,
+							   ptShadow->pcPool,
+							   ptShadow->nUsedTiles * FRAMEBUFFER_TILE_PIXELS);
+		ptDump->cbPixels = RLE_FinishEncoder(&tEncoder);
+
+		// The tile directory goes right after the compressed pixels.
+		RtlMoveMemory(&ptDump->tDump.acPixels[ptDump->cbPixels], ptShadow->ptTiles, cbTiles);
+
+		ptDump->eCompression = FRAMEBUFFER_COMPRESSION_RLE_TILE_POOL;
+	}
+
+	++(ptShadow->tStatistics.nCallbacks);
+
+	// The statistics go right after the tile directory.
+	cbData = UFIELD_OFFSET(FRAMEBUFFER_DUMP_EX,
+						   tDump.acPixels[ptDump->cbPixels + cbTiles + sizeof(BUGSHOT_STATISTICS)]);
 
 	if (cbData > ptSecondaryDumpData->MaximumAllowed)
 	{
@@ -235,55 +923,288 @@ dxdump_BugCheckSecondaryDumpDataCallback(
 		(ptSecondaryDumpData->InBuffer == ptSecondaryDumpData->OutBuffer)
 	);
 
-	ptSecondaryDumpData->OutBuffer = g_ptShadowFramebuffer;
+	// Written on every invocation, so that they cover everything drawn so far.
+	ptShadow->tStatistics.nCallbackCycles += ReadTimeStampCounter() - nStartCycles;
+	RtlCopyMemory(&ptDump->tDump.acPixels[ptDump->cbPixels + cbTiles],
+				  &ptShadow->tStatistics,
+				  sizeof(ptShadow->tStatistics));
+
+	ptSecondaryDumpData->OutBuffer = ptDump;
 	ptSecondaryDumpData->OutBufferLength = cbData;
-	ptSecondaryDumpData->Guid = g_tFramebufferDumpGuid;
+	ptSecondaryDumpData->Guid = ptContext->tDumpGuid;
 
 lblCleanup:
 	return;
 }
 
+/**
+ * Bugcheck callback for dumping the history of the screen.
+ *
+ * @param[in]		eReason					Specifies the situation in which the callback is executed.
+ *											Always KbCallbackSecondaryDumpData.
+ * @param[in]		ptRecord				Pointer to the registration record for this callback.
+ * @param[in,out]	pvReasonSpecificData	Pointer to a KBUGCHECK_SECONDARY_DUMP_DATA structure.
+ * @param[in]		cbReasonSpecificData	Size of the buffer pointer to by pvReasonSpecificData.
+ *											Always sizeof(KBUGCHECK_SECONDARY_DUMP_DATA).
+ */
+STATIC
+VOID
+dxdump_BugCheckHistoryCallback(
+	_In_	KBUGCHECK_CALLBACK_REASON			eReason,
+	_In_	PKBUGCHECK_REASON_CALLBACK_RECORD	ptRecord,
+	_Inout_	PVOID								pvReasonSpecificData,
+	_In_	ULONG								cbReasonSpecificData
+)
+{
+	PKBUGCHECK_SECONDARY_DUMP_DATA	ptSecondaryDumpData	= pvReasonSpecificData;
+	PFRAMEBUFFER_HISTORY			ptHistory			= g_tHistory.ptHistory;
+	PFRAMEBUFFER_FRAME				ptFrame				= NULL;
+	ULONG							nSlot				= 0;
+	ULONG							cbFrame				= 0;
+	ULONG							cbData				= 0;
+
+#ifndef DBG
+	UNREFERENCED_PARAMETER(eReason);
+	UNREFERENCED_PARAMETER(ptRecord);
+	UNREFERENCED_PARAMETER(cbReasonSpecificData);
+#endif // !DBG
+
+	NT_ASSERT(KbCallbackSecondaryDumpData == eReason);
+	NT_ASSERT(&g_tHistory.tCallbackRecord == ptRecord);
+	NT_ASSERT(NULL != pvReasonSpecificData);
+	NT_ASSERT(sizeof(*ptSecondaryDumpData) == cbReasonSpecificData);
+
+	if (NULL == ptHistory)
+	{
+		ptSecondaryDumpData->OutBuffer = NULL;
+		ptSecondaryDumpData->OutBufferLength = 0;
+		goto lblCleanup;
+	}
+
+	// Move the frames out of their slots to right after one another,
+	// so that only what was drawn is written. Each frame only moves back,
+	// so this needs no memory either. The callback may be invoked
+	// more than once, so only the first invocation does it.
+	if (!g_tHistory.bPacked)
+	{
+		ptHistory->nFrames = min(ptHistory->nFramesDrawn, g_tHistory.nSlots);
+		ptHistory->cbFrames = 0;
+		for (nSlot = 0; nSlot < ptHistory->nFrames; ++nSlot)
+		{
+			// The move may overwrite the frame's own header.
+			ptFrame = (PFRAMEBUFFER_FRAME)&ptHistory->acFrames[nSlot * g_tHistory.cbSlot];
+			cbFrame = ptFrame->cbFrame;
+			RtlMoveMemory(&ptHistory->acFrames[ptHistory->cbFrames], ptFrame, cbFrame);
+			ptHistory->cbFrames += cbFrame;
+		}
+
+		g_tHistory.bPacked = TRUE;
+	}
+
+	cbData = UFIELD_OFFSET(FRAMEBUFFER_HISTORY, acFrames[ptHistory->cbFrames]);
+
+	if (cbData > ptSecondaryDumpData->MaximumAllowed)
+	{
+		ptSecondaryDumpData->OutBuffer = NULL;
+		ptSecondaryDumpData->OutBufferLength = 0;
+		goto lblCleanup;
+	}
+
+	NT_ASSERT(
+		(NULL == ptSecondaryDumpData->OutBuffer) ||
+		(ptSecondaryDumpData->InBuffer == ptSecondaryDumpData->OutBuffer)
+	);
+
+	ptSecondaryDumpData->OutBuffer = ptHistory;
+	ptSecondaryDumpData->OutBufferLength = cbData;
+	ptSecondaryDumpData->Guid = g_tFramebufferHistoryGuid;
+
+lblCleanup:
+	return;
+}
+
+/**
+ * @brief Allocates the history of the screen.
+ *
+ * @param[in]	nFrames		Number of frames to keep.
+ * @param[out]	ptHistory	Will receive the allocated history.
+ *
+ * @return NTSTATUS
+ *
+ * @remark The history is allocated from non-paged pool.
+ *         Its size doesn't depend on the number of frames.
+ * @remark Free the history with dxdump_FreeHistory.
+*/
+_IRQL_requires_max_(DISPATCH_LEVEL)
+STATIC
+NTSTATUS
+dxdump_AllocateHistory(
+	_In_	ULONG			nFrames,
+	_Out_	PFRAME_HISTORY	ptHistory
+)
+{
+	NTSTATUS				eStatus		= STATUS_UNSUCCESSFUL;
+	ULONG					cbSlot		= 0;
+	ULONG					cbSize		= 0;
+	PFRAMEBUFFER_HISTORY	ptFrames	= NULL;
+	LARGE_INTEGER			tFrequency;
+
+	NT_ASSERT(DISPATCH_LEVEL >= KeGetCurrentIrql());
+	NT_ASSERT(NULL != ptHistory);
+
+	if ((0 == nFrames) || (nFrames > FRAMEBUFFER_MAX_HISTORY_FRAMES))
+	{
+		eStatus = STATUS_INVALID_PARAMETER;
+		goto lblCleanup;
+	}
+
+	// This can't overflow, since the slots divide a fixed size between them.
+	cbSlot = ALIGN_DOWN_BY(DXDUMP_HISTORY_BYTES / nFrames, FRAMEBUFFER_FRAME_ALIGNMENT);
+	cbSize = UFIELD_OFFSET(FRAMEBUFFER_HISTORY, acFrames[nFrames * cbSlot]);
+
+	// Buffer has to be page-aligned, due to bugcheck callback requirements.
+	// Its size is always at least a page, so ExAllocatePool makes it so.
+	ptFrames = ExAllocatePoolWithTag(NonPagedPoolNx, cbSize, DXDUMP_POOL_TAG);
+	if (NULL == ptFrames)
+	{
+		eStatus = STATUS_INSUFFICIENT_RESOURCES;
+		goto lblCleanup;
+	}
+	RtlZeroMemory(ptFrames, cbSize);
+	ptFrames->nVersion = FRAMEBUFFER_HISTORY_VERSION;
+
+	(VOID)KeQueryPerformanceCounter(&tFrequency);
+	ptFrames->nFrequency = (ULONGLONG)tFrequency.QuadPart;
+
+	ptHistory->nSlots = nFrames;
+	ptHistory->cbSlot = cbSlot;
+	ptHistory->bPacked = FALSE;
+
+	// Transfer ownership:
+	ptHistory->ptHistory = ptFrames;
+	ptFrames = NULL;
+
+	eStatus = STATUS_SUCCESS;
+
+lblCleanup:
+	CLOSE(ptFrames, ExFreePool);
+
+	return eStatus;
+}
+
+/**
+ * @brief Frees a history allocated with dxdump_AllocateHistory.
+ *
+ * @param[in,out]	ptHistory	The history to free.
+ *								May have never been allocated.
+ *
+ * @remark The history's callback must already be deregistered.
+*/
+_IRQL_requires_max_(DISPATCH_LEVEL)
+STATIC
+VOID
+dxdump_FreeHistory(
+	_Inout_	PFRAME_HISTORY	ptHistory
+)
+{
+	NT_ASSERT(DISPATCH_LEVEL >= KeGetCurrentIrql());
+	NT_ASSERT(NULL != ptHistory);
+	NT_ASSERT(!ptHistory->bCallbackRegistered);
+
+	CLOSE(ptHistory->ptHistory, ExFreePool);
+	RtlZeroMemory(ptHistory, sizeof(*ptHistory));
+}
+
 /**
  * @brief Allocates a framebuffer to be used when saving a screenshot.
  *
- * @param[in]	nMaxWidth			Width of the framebuffer, in pixels.
+ * @param[in]	nMaxWidth		Width of the framebuffer, in pixels.
  * @param[in]	nMaxHeight		Height of the framebuffer, in pixels.
- * @param[out]	pptFramebuffer	Will receive the allocated framebuffer.
+ * @param[out]	ptFramebuffer	Will receive the allocated framebuffer.
  *
  * @return NTSTATUS
  *
  * @remark The framebuffer is allocated from non-paged pool.
+ *         Only a fraction of its tiles has room, and the room is handed out
+ *         as the tiles are drawn on.
+ * @remark Free the framebuffer with dxdump_FreeFramebuffer.
 */
 _IRQL_requires_max_(DISPATCH_LEVEL)
 STATIC
 NTSTATUS
 dxdump_AllocateFramebuffer(
-	_In_		ULONG				nMaxWidth,
-	_In_		ULONG				nMaxHeight,
-	_Outptr_	PFRAMEBUFFER_DUMP *	pptFramebuffer
+	_In_	ULONG				nMaxWidth,
+	_In_	ULONG				nMaxHeight,
+	_Out_	PSHADOW_FRAMEBUFFER	ptFramebuffer
 )
 {
-	NTSTATUS			eStatus			= STATUS_UNSUCCESSFUL;
-	ULONG				cbSize			= 0;
-	PFRAMEBUFFER_DUMP	ptFramebuffer	= NULL;
+	NTSTATUS				eStatus			= STATUS_UNSUCCESSFUL;
+	ULONG					cbSize			= 0;
+	ULONG					nTiles			= 0;
+	ULONG					nPoolTiles		= 0;
+	ULONG					cbPoolOffset	= 0;
+	ULONG					cbTilesOffset	= 0;
+	ULONG					cbTiles			= 0;
+	PFRAMEBUFFER_DUMP_EX	ptDump			= NULL;
 
 	NT_ASSERT(DISPATCH_LEVEL >= KeGetCurrentIrql());
+	NT_ASSERT(NULL != ptFramebuffer);
 
+	// The pixels are never all stored, but the dump
+	// must still describe an image that can be decompressed.
 	eStatus = RtlULongMult(nMaxWidth, nMaxHeight, &cbSize);
 	if (!NT_SUCCESS(eStatus))
 	{
 		goto lblCleanup;
 	}
 
-	// Allocate 4 bytes per pixel, as that's what Windows gives us
 	eStatus = RtlULongMult(cbSize, 4, &cbSize);
 	if (!NT_SUCCESS(eStatus))
 	{
 		goto lblCleanup;
 	}
 
-	// Add the header
-	eStatus = RtlULongAdd(cbSize, FIELD_OFFSET(FRAMEBUFFER_DUMP, acPixels), &cbSize);
+	// This can't overflow, since there are fewer tiles than pixels.
+	nTiles = FRAMEBUFFER_TILES(nMaxWidth) * FRAMEBUFFER_TILES(nMaxHeight);
+	nPoolTiles = max(nTiles / DXDUMP_POOL_FRACTION, min(nTiles, DXDUMP_MIN_POOL_TILES));
+
+	// Header, then the tile pool, aligned...
+	cbPoolOffset = ALIGN_UP_BY(FIELD_OFFSET(FRAMEBUFFER_DUMP_EX, tDump.acPixels), DXDUMP_POOL_ALIGNMENT);
+
+	eStatus = RtlULongMult(nPoolTiles, DXDUMP_TILE_BYTES, &cbSize);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+
+	eStatus = RtlULongAdd(cbSize, cbPoolOffset, &cbSize);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+
+	// ...then the tile directory, aligned.
+	eStatus = RtlULongAdd(cbSize, TYPE_ALIGNMENT(FRAMEBUFFER_TILE) - 1, &cbTilesOffset);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+	cbTilesOffset &= ~(TYPE_ALIGNMENT(FRAMEBUFFER_TILE) - 1);
+
+	eStatus = RtlULongMult(nTiles, sizeof(FRAMEBUFFER_TILE), &cbTiles);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+
+	eStatus = RtlULongAdd(cbTilesOffset, cbTiles, &cbSize);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+
+	// ...and the statistics, after wherever the tile directory ends up.
+	eStatus = RtlULongAdd(cbSize, sizeof(BUGSHOT_STATISTICS), &cbSize);
 	if (!NT_SUCCESS(eStatus))
 	{
 		goto lblCleanup;
@@ -296,94 +1217,211 @@ dxdump_AllocateFramebuffer(
 		cbSize = PAGE_SIZE;
 	}
 
-	ptFramebuffer = ExAllocatePoolWithTag(NonPagedPoolNx, cbSize, DXDUMP_POOL_TAG);
-	if (NULL == ptFramebuffer)
+	ptDump = ExAllocatePoolWithTag(NonPagedPoolNx, cbSize, DXDUMP_POOL_TAG);
+	if (NULL == ptDump)
 	{
 		eStatus = STATUS_INSUFFICIENT_RESOURCES;
 		goto lblCleanup;
 	}
-	RtlZeroMemory(ptFramebuffer, cbSize);
-	ptFramebuffer->nWidth = nMaxWidth;
-	ptFramebuffer->nHeight = nMaxHeight;
-	ptFramebuffer->bValid = TRUE;
+	RtlZeroMemory(ptDump, cbSize);
+	ptDump->nVersion = FRAMEBUFFER_DUMP_EX_VERSION;
+	ptDump->eCompression = FRAMEBUFFER_COMPRESSION_NONE;
+	ptDump->tDump.nWidth = nMaxWidth;
+	ptDump->tDump.nHeight = nMaxHeight;
+	ptDump->tDump.bValid = TRUE;
+
+	ptFramebuffer->pcPool = (PUCHAR)ptDump + cbPoolOffset;
+	ptFramebuffer->ptTiles = (PFRAMEBUFFER_TILE)((PUCHAR)ptDump + cbTilesOffset);
+	ptFramebuffer->nTileColumns = FRAMEBUFFER_TILES(nMaxWidth);
+	ptFramebuffer->nTileRows = FRAMEBUFFER_TILES(nMaxHeight);
+	ptFramebuffer->nPoolTiles = nPoolTiles;
+	ptFramebuffer->nUsedTiles = 0;
+	RtlZeroMemory(&ptFramebuffer->tStatistics, sizeof(ptFramebuffer->tStatistics));
+	ptFramebuffer->tStatistics.nSignature = BUGSHOT_STATISTICS_SIGNATURE;
 
 	// Transfer ownership:
-	*pptFramebuffer = ptFramebuffer;
-	ptFramebuffer = NULL;
+	ptFramebuffer->ptDump = ptDump;
+	ptDump = NULL;
 
 	eStatus = STATUS_SUCCESS;
 
 lblCleanup:
-	CLOSE(ptFramebuffer, ExFreePool);
+	CLOSE(ptDump, ExFreePool);
 
 	return eStatus;
 }
 
+/**
+ * @brief Frees a framebuffer allocated with dxdump_AllocateFramebuffer.
+ *
+ * @param[in,out]	ptFramebuffer	The framebuffer to free.
+ *									May have never been allocated.
+*/
+_IRQL_requires_max_(DISPATCH_LEVEL)
+STATIC
+VOID
+dxdump_FreeFramebuffer(
+	_Inout_	PSHADOW_FRAMEBUFFER	ptFramebuffer
+)
+{
+	NT_ASSERT(DISPATCH_LEVEL >= KeGetCurrentIrql());
+	NT_ASSERT(NULL != ptFramebuffer);
+
+	CLOSE(ptFramebuffer->ptDump, ExFreePool);
+	RtlZeroMemory(ptFramebuffer, sizeof(*ptFramebuffer));
+}
+
+/**
+ * @brief Checks whether a display driver can be hooked.
+ *
+ * @param[in]	ptDisplayDriver	The display driver.
+ *
+ * @return BOOLEAN
+*/
+_IRQL_requires_(PASSIVE_LEVEL)
+STATIC
+PAGEABLE
+BOOLEAN
+dxdump_IsHookable(
+	_In_	PCDISPLAY_DRIVER	ptDisplayDriver
+)
+{
+	PAGED_CODE();
+	NT_ASSERT(NULL != ptDisplayDriver);
+
+	return (ptDisplayDriver->ptInitializationData->Version >= DXGKDDI_INTERFACE_VERSION_WIN8) &&
+		   (NULL != ptDisplayDriver->ptInitializationData->DxgkDdiSystemDisplayWrite);
+}
+
 _Use_decl_annotations_
 NTSTATUS
 PAGEABLE
 DXDUMP_Initialize(
 	ULONG	nMaxWidth,
-	ULONG	nMaxHeight
+	ULONG	nMaxHeight,
+	ULONG	nFrames
 )
 {
 	NTSTATUS			eStatus				= STATUS_UNSUCCESSFUL;
 	PDISPLAY_DRIVER		ptDisplayDrivers	= NULL;
 	ULONG				nDisplayDrivers		= 0;
 	ULONG				nIndex				= 0;
+	ULONG				nHooks				= 0;
+	ULONG				nHook				= 0;
+	PHOOK_CONTEXT		ptContext			= NULL;
 
 	PAGED_CODE();
 	NT_ASSERT(PASSIVE_LEVEL == KeGetCurrentIrql());
 
-	eStatus = dxdump_AllocateFramebuffer(nMaxWidth, nMaxHeight, &g_ptShadowFramebuffer);
+	eStatus = DXUTIL_FindAllDisplayDrivers(&ptDisplayDrivers, &nDisplayDrivers);
 	if (!NT_SUCCESS(eStatus))
 	{
 		goto lblCleanup;
 	}
 
-	eStatus = DXUTIL_FindAllDisplayDrivers(&ptDisplayDrivers, &nDisplayDrivers);
-	if (!NT_SUCCESS(eStatus))
+	for (nIndex = 0; nIndex < nDisplayDrivers; ++nIndex)
 	{
-		goto lblCleanup;
+		if (dxdump_IsHookable(&ptDisplayDrivers[nIndex]))
+		{
+			++nHooks;
+		}
 	}
 
-	if (nDisplayDrivers > ARRAYSIZE(g_atHookContexts))
+	// Displays beyond the last trampoline are left alone,
+	// rather than giving up on all of them.
+	nHooks = min(nHooks, (ULONG)ARRAYSIZE(g_apfnTrampolines));
+	if (0 == nHooks)
 	{
-		eStatus = STATUS_TOO_MANY_ADDRESSES;
+		eStatus = STATUS_SUCCESS;
 		goto lblCleanup;
 	}
 
-	KeInitializeCallbackRecord(&g_tCallbackRecord);
-	if (!KeRegisterBugCheckReasonCallback(&g_tCallbackRecord,
-										  &dxdump_BugCheckSecondaryDumpDataCallback,
-										  KbCallbackSecondaryDumpData,
-										  (PUCHAR)"DxDump"))
+	// The contexts are used at bugcheck time, so they can't be paged.
+	g_ptHookContexts = ExAllocatePoolWithTag(NonPagedPoolNx, nHooks * sizeof(g_ptHookContexts[0]), DXDUMP_POOL_TAG);
+	if (NULL == g_ptHookContexts)
 	{
-		eStatus = STATUS_BAD_DATA;
+		eStatus = STATUS_INSUFFICIENT_RESOURCES;
 		goto lblCleanup;
 	}
-	g_bCallbackRegistered = TRUE;
-
-	// NO FAILURE PAST THIS POINT
-	// Unhooking is a pain here, so we prefer to not do that.
+	RtlZeroMemory(g_ptHookContexts, nHooks * sizeof(g_ptHookContexts[0]));
+	g_nHookContexts = nHooks;
 
-	for (nIndex = 0; nIndex < nDisplayDrivers; ++nIndex)
+	// Each display gets its own framebuffer and callback,
+	// all prepared before anything is hooked.
+	nHook = 0;
+	for (nIndex = 0; (nIndex < nDisplayDrivers) && (nHook < nHooks); ++nIndex)
 	{
-		if (ptDisplayDrivers[nIndex].ptInitializationData->Version < DXGKDDI_INTERFACE_VERSION_WIN8)
+		if (!dxdump_IsHookable(&ptDisplayDrivers[nIndex]))
 		{
 			continue;
 		}
 
-		if (NULL == ptDisplayDrivers[nIndex].ptInitializationData->DxgkDdiSystemDisplayWrite)
+		ptContext = &g_ptHookContexts[nHook];
+
+		eStatus = dxdump_AllocateFramebuffer(nMaxWidth, nMaxHeight, &ptContext->tShadowFramebuffer);
+		if (!NT_SUCCESS(eStatus))
+		{
+			goto lblCleanup;
+		}
+
+		ptContext->nDisplay = nHook;
+		FRAMEBUFFER_GetDisplayDumpGuid(nHook, &ptContext->tDumpGuid);
+
+		KeInitializeCallbackRecord(&ptContext->tCallbackRecord);
+		if (!KeRegisterBugCheckReasonCallback(&ptContext->tCallbackRecord,
+											  &dxdump_BugCheckSecondaryDumpDataCallback,
+											  KbCallbackSecondaryDumpData,
+											  (PUCHAR)"DxDump"))
+		{
+			eStatus = STATUS_BAD_DATA;
+			goto lblCleanup;
+		}
+		ptContext->bCallbackRegistered = TRUE;
+
+		++nHook;
+	}
+
+	// The history is shared by all the displays, and has a callback of its own.
+	if (0 != nFrames)
+	{
+		eStatus = dxdump_AllocateHistory(nFrames, &g_tHistory);
+		if (!NT_SUCCESS(eStatus))
+		{
+			goto lblCleanup;
+		}
+
+		KeInitializeCallbackRecord(&g_tHistory.tCallbackRecord);
+		if (!KeRegisterBugCheckReasonCallback(&g_tHistory.tCallbackRecord,
+											  &dxdump_BugCheckHistoryCallback,
+											  KbCallbackSecondaryDumpData,
+											  (PUCHAR)"DxDump"))
+		{
+			eStatus = STATUS_BAD_DATA;
+			goto lblCleanup;
+		}
+		g_tHistory.bCallbackRegistered = TRUE;
+	}
+
+	// NO FAILURE PAST THIS POINT
+	// Unhooking is a pain here, so we prefer to not do that.
+
+	nHook = 0;
+	for (nIndex = 0; (nIndex < nDisplayDrivers) && (nHook < nHooks); ++nIndex)
+	{
+		if (!dxdump_IsHookable(&ptDisplayDrivers[nIndex]))
 		{
 			continue;
 		}
 
-		g_atHookContexts[nIndex].ptDriverObject = ptDisplayDrivers[nIndex].ptDriverObject;
-		g_atHookContexts[nIndex].ptInitializationData = ptDisplayDrivers[nIndex].ptInitializationData;
-		g_atHookContexts[nIndex].pfnOriginal = ptDisplayDrivers[nIndex].ptInitializationData->DxgkDdiSystemDisplayWrite;
-		ptDisplayDrivers[nIndex].ptInitializationData->DxgkDdiSystemDisplayWrite = g_apfnTrampolines[nIndex];
+		ptContext = &g_ptHookContexts[nHook];
+
+		ptContext->ptDriverObject = ptDisplayDrivers[nIndex].ptDriverObject;
+		ptContext->ptInitializationData = ptDisplayDrivers[nIndex].ptInitializationData;
+		ptContext->pfnOriginal = ptDisplayDrivers[nIndex].ptInitializationData->DxgkDdiSystemDisplayWrite;
+		ptDisplayDrivers[nIndex].ptInitializationData->DxgkDdiSystemDisplayWrite = g_apfnTrampolines[nHook];
 		ObReferenceObject(ptDisplayDrivers[nIndex].ptDriverObject);
+
+		++nHook;
 	}
 
 	eStatus = STATUS_SUCCESS;
@@ -398,6 +1436,93 @@ lblCleanup:
 	return eStatus;
 }
 
+_Use_decl_annotations_
+NTSTATUS
+PAGEABLE
+DXDUMP_Resize(
+	ULONG	nMaxWidth,
+	ULONG	nMaxHeight
+)
+{
+	NTSTATUS				eStatus				= STATUS_UNSUCCESSFUL;
+	PSHADOW_FRAMEBUFFER		ptNewFramebuffers	= NULL;
+	ULONG					nIndex				= 0;
+	PSHADOW_FRAMEBUFFER		ptShadow			= NULL;
+	SHADOW_FRAMEBUFFER		tNewFramebuffer;
+	PFRAMEBUFFER_DUMP_EX	ptOldDump			= NULL;
+	PFRAMEBUFFER_DUMP_EX	ptNewDump			= NULL;
+
+	PAGED_CODE();
+	NT_ASSERT(PASSIVE_LEVEL == KeGetCurrentIrql());
+
+	RtlZeroMemory(&tNewFramebuffer, sizeof(tNewFramebuffer));
+
+	if (0 == g_nHookContexts)
+	{
+		eStatus = STATUS_SUCCESS;
+		goto lblCleanup;
+	}
+
+	// The new framebuffers are only held here until they are swapped in,
+	// so the array itself can be paged.
+	ptNewFramebuffers = ExAllocatePoolWithTag(PagedPool,
+											  g_nHookContexts * sizeof(ptNewFramebuffers[0]),
+											  DXDUMP_POOL_TAG);
+	if (NULL == ptNewFramebuffers)
+	{
+		eStatus = STATUS_INSUFFICIENT_RESOURCES;
+		goto lblCleanup;
+	}
+	RtlZeroMemory(ptNewFramebuffers, g_nHookContexts * sizeof(ptNewFramebuffers[0]));
+
+	for (nIndex = 0; nIndex < g_nHookContexts; ++nIndex)
+	{
+		eStatus = dxdump_AllocateFramebuffer(nMaxWidth, nMaxHeight, &ptNewFramebuffers[nIndex]);
+		if (!NT_SUCCESS(eStatus))
+		{
+			goto lblCleanup;
+		}
+	}
+
+	// NO FAILURE PAST THIS POINT
+
+	for (nIndex = 0; nIndex < g_nHookContexts; ++nIndex)
+	{
+		ptShadow = &g_ptHookContexts[nIndex].tShadowFramebuffer;
+
+		// The hook and the callback skip a framebuffer that has no dump,
+		// so a bugcheck in the middle of the swap finds either no framebuffer
+		// or a whole one, never half of each.
+		ptOldDump = InterlockedExchangePointer((PVOID *)&ptShadow->ptDump, NULL);
+
+		// The new dump is only published once the rest of the framebuffer is in place.
+		tNewFramebuffer = ptNewFramebuffers[nIndex];
+		ptNewDump = tNewFramebuffer.ptDump;
+		tNewFramebuffer.ptDump = NULL;
+		ptNewFramebuffers[nIndex].ptDump = NULL;
+		*ptShadow = tNewFramebuffer;
+
+		(VOID)InterlockedExchangePointer((PVOID *)&ptShadow->ptDump, ptNewDump);
+
+		// The old dump is freed along with any leftovers.
+		ptNewFramebuffers[nIndex].ptDump = ptOldDump;
+	}
+
+	eStatus = STATUS_SUCCESS;
+
+lblCleanup:
+	if (NULL != ptNewFramebuffers)
+	{
+		for (nIndex = 0; nIndex < g_nHookContexts; ++nIndex)
+		{
+			dxdump_FreeFramebuffer(&ptNewFramebuffers[nIndex]);
+		}
+	}
+	CLOSE(ptNewFramebuffers, ExFreePool);
+
+	return eStatus;
+}
+
 _Use_decl_annotations_
 VOID
 PAGEABLE
@@ -406,23 +1531,35 @@ DXDUMP_Shutdown(VOID)
 	PAGED_CODE();
 	NT_ASSERT(PASSIVE_LEVEL == KeGetCurrentIrql());
 
-	ULONG	nIndex	= 0;
+	ULONG			nIndex		= 0;
+	PHOOK_CONTEXT	ptContext	= NULL;
 
-	for (nIndex = 0; nIndex < ARRAYSIZE(g_atHookContexts); ++nIndex)
+	for (nIndex = 0; nIndex < g_nHookContexts; ++nIndex)
 	{
-		if (NULL != g_atHookContexts[nIndex].ptInitializationData)
+		ptContext = &g_ptHookContexts[nIndex];
+
+		if (NULL != ptContext->ptInitializationData)
+		{
+			ptContext->ptInitializationData->DxgkDdiSystemDisplayWrite = ptContext->pfnOriginal;
+		}
+		CLOSE(ptContext->ptDriverObject, ObfDereferenceObject);
+
+		if (ptContext->bCallbackRegistered)
 		{
-			g_atHookContexts[nIndex].ptInitializationData->DxgkDdiSystemDisplayWrite = g_atHookContexts[nIndex].pfnOriginal;
+			(VOID)KeDeregisterBugCheckReasonCallback(&ptContext->tCallbackRecord);
+			ptContext->bCallbackRegistered = FALSE;
 		}
-		CLOSE(g_atHookContexts[nIndex].ptDriverObject, ObfDereferenceObject);
-		RtlZeroMemory(&g_atHookContexts[nIndex], sizeof(g_atHookContexts[nIndex]));
+
+		dxdump_FreeFramebuffer(&ptContext->tShadowFramebuffer);
 	}
 
-	if (g_bCallbackRegistered)
+	CLOSE(g_ptHookContexts, ExFreePool);
+	g_nHookContexts = 0;
+
+	if (g_tHistory.bCallbackRegistered)
 	{
-		(VOID)KeDeregisterBugCheckReasonCallback(&g_tCallbackRecord);
-		g_bCallbackRegistered = FALSE;
+		(VOID)KeDeregisterBugCheckReasonCallback(&g_tHistory.tCallbackRecord);
+		g_tHistory.bCallbackRegistered = FALSE;
 	}
-
-	CLOSE(g_ptShadowFramebuffer, ExFreePool);
+	dxdump_FreeHistory(&g_tHistory);
 }
@@ -20,16 +20,49 @@
  *
  * @param[in] nMaxWidth		Maximum width of the saved framebuffer.
  * @param[in] nMaxHeight	Maximum height of the saved framebuffer.
+ * @param[in] nFrames		Number of frames to keep in the history of the screen.
+ *							0 keeps no history.
  *
  * @return NTSTATUS
  *
  * @remark Prior to initializing the module, make sure VgaDump is initialized as well.
  * @remark If the resulting image is truncated, increase the resolution specified here.
+ * @remark Each hooked display driver gets a framebuffer of its own,
+ *         tagged as FRAMEBUFFER_GetDisplayDumpGuid describes. Display drivers
+ *         beyond FRAMEBUFFER_MAX_DISPLAYS are not hooked.
+ * @remark Only a fraction of the framebuffer is kept in memory, and given out as the
+ *         bugcheck screen is drawn. Tiles that don't fit are missing from the image.
+ * @remark The history holds the last frames drawn on all displays, including those
+ *         drawn while the dump is written, up to when it is saved. However many
+ *         frames it holds, it takes the same fixed amount of memory.
 */
 _IRQL_requires_(PASSIVE_LEVEL)
 NTSTATUS
 PAGEABLE
 DXDUMP_Initialize(
+	_In_	ULONG	nMaxWidth,
+	_In_	ULONG	nMaxHeight,
+	_In_	ULONG	nFrames
+);
+
+/**
+ * @brief Replaces the framebuffers of all the hooked displays with new ones.
+ *
+ * @param[in] nMaxWidth		Maximum width of the saved framebuffer.
+ * @param[in] nMaxHeight	Maximum height of the saved framebuffer.
+ *
+ * @return NTSTATUS
+ *
+ * @remark Use this when the display mode changes, so that the screenshot
+ *         is neither truncated nor larger than it needs to be.
+ * @remark Whatever was drawn on the old framebuffers is lost.
+ *         The history of the screen is kept.
+ * @remark On failure, the old framebuffers are kept as they were.
+*/
+_IRQL_requires_(PASSIVE_LEVEL)
+NTSTATUS
+PAGEABLE
+DXDUMP_Resize(
 	_In_	ULONG	nMaxWidth,
 	_In_	ULONG	nMaxHeight
 );
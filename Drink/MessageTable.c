@@ -14,6 +14,7 @@
 #include <Common.h>
 
 #include "Util.h"
+#include "Arena.h"
 
 #include "MessageTable.h"
 
@@ -25,12 +26,29 @@
  */
 typedef struct _MESSAGE_TABLE
 {
-	ERESOURCE		tLock;
-	BOOLEAN			bLockInitialized;
+	ERESOURCE				tLock;
+	BOOLEAN					bLockInitialized;
 
+	// Sorted by ID, so that each run of consecutive IDs
+	// is laid out just as its MESSAGE_RESOURCE_BLOCK will be.
 	_Guarded_by_(tLock)
-	RTL_AVL_TABLE	tTable;
-	BOOLEAN			bTableInitialized;
+	PMESSAGE_TABLE_ENTRY	ptEntries;
+	_Guarded_by_(tLock)
+	ULONG					nEntries;
+	_Guarded_by_(tLock)
+	ULONG					nCapacity;
+
+	// Kept up to date on insertion, so that serializing
+	// doesn't need a pass of its own to size the resource.
+	_Guarded_by_(tLock)
+	ULONG					nBlocks;
+	_Guarded_by_(tLock)
+	SIZE_T					cbTotalStrings;
+
+	// The strings of the entries. Parsing a resource inserts
+	// thousands of them, and they are all freed together.
+	_Guarded_by_(tLock)
+	ARENA					tStrings;
 } MESSAGE_TABLE, *PMESSAGE_TABLE;
 typedef CONST MESSAGE_TABLE *PCMESSAGE_TABLE;
 
@@ -71,36 +89,6 @@ typedef struct _MESSAGE_RESOURCE_DATA
 typedef CONST MESSAGE_RESOURCE_DATA *PCMESSAGE_RESOURCE_DATA;
 C_ASSERT(__alignof(MESSAGE_RESOURCE_DATA) >= __alignof(MESSAGE_RESOURCE_ENTRY));
 
-/**
- * Context for the counting callback.
- *
- * @see messagetable_CountingCallback.
- */
-typedef struct _COUNTING_CALLBACK_CONTEXT
-{
-	// Total blocks required to serialize the table.
-	ULONG	nBlocks;
-
-	// Total bytes required to serialize the strings in the table.
-	SIZE_T	cbTotalStrings;
-} COUNTING_CALLBACK_CONTEXT, *PCOUNTING_CALLBACK_CONTEXT;
-typedef CONST COUNTING_CALLBACK_CONTEXT *PCCOUNTING_CALLBACK_CONTEXT;
-
-/**
- * Context for the serializing callback.
- *
- * @see messagetable_SerializingCallback.
- */
-typedef struct _SERIALIZING_CALLBACK_CONTEXT
-{
-	PMESSAGE_RESOURCE_DATA	ptMessageData;
-
-	PMESSAGE_RESOURCE_BLOCK	ptCurrentBlock;
-
-	PUCHAR					pcCurrentStringPosition;
-} SERIALIZING_CALLBACK_CONTEXT, *PSERIALIZING_CALLBACK_CONTEXT;
-typedef CONST SERIALIZING_CALLBACK_CONTEXT *PCSERIALIZING_CALLBACK_CONTEXT;
-
 
 /** Constants ***********************************************************/
 
@@ -109,6 +97,12 @@ typedef CONST SERIALIZING_CALLBACK_CONTEXT *PCSERIALIZING_CALLBACK_CONTEXT;
  */
 #define MESSAGE_TABLE_POOL_TAG (RtlUlongByteSwap('MsgT'))
 
+/**
+ * Number of entries a message table
+ * has room for when it is first inserted into.
+ */
+#define MESSAGE_TABLE_INITIAL_CAPACITY (64)
+
 /**
  * Maximum size, in bytes, of a MESSAGE_RESOURCE_ENTRY,
  * including the string data.
@@ -135,157 +129,6 @@ C_ASSERT(MESSAGE_TABLE_STRING_MAX_SIZE > 0);
 
 /** Functions ***********************************************************/
 
-/**
- * Comparison routine for the AVL tree.
- *
- * @param[in]	ptTable			The tree structure.
- * @param[in]	pvFirstStruct	First structure to compare.
- * @param[in]	pvSecondStruct	Second structure to compare.
- *
- * @returns RTL_GENERIC_COMPARE_RESULTS
- */
-_IRQL_requires_max_(APC_LEVEL)
-STATIC
-PAGEABLE
-RTL_GENERIC_COMPARE_RESULTS
-messagetable_CompareRoutine(
-	_In_	PRTL_AVL_TABLE	ptTable,
-	_In_	PVOID			pvFirstStruct,
-	_In_	PVOID			pvSecondStruct
-)
-{
-	RTL_GENERIC_COMPARE_RESULTS	eResult			= GenericLessThan;
-	PCMESSAGE_TABLE_ENTRY		ptFirstEntry	= (PCMESSAGE_TABLE_ENTRY)pvFirstStruct;
-	PCMESSAGE_TABLE_ENTRY		ptSecondEntry	= (PCMESSAGE_TABLE_ENTRY)pvSecondStruct;
-
-	PAGED_CODE();
-
-#ifndef DBG
-	UNREFERENCED_PARAMETER(ptTable);
-#endif // !DBG
-
-	ASSERT(NULL != ptTable);
-	ASSERT(NULL != pvFirstStruct);
-	ASSERT(NULL != pvSecondStruct);
-
-	if (ptFirstEntry->nEntryId < ptSecondEntry->nEntryId)
-	{
-		eResult = GenericLessThan;
-	}
-	else if (ptFirstEntry->nEntryId > ptSecondEntry->nEntryId)
-	{
-		eResult = GenericGreaterThan;
-	}
-	else
-	{
-		eResult = GenericEqual;
-	}
-
-	return eResult;
-}
-
-/**
- * Memory allocation routine for the AVL tree.
- *
- * @param[in]	ptTable	The tree structure.
- * @param[in]	cbSize	Size to allocate.
- *
- * @returns PVOID
- */
-_IRQL_requires_max_(APC_LEVEL)
-STATIC
-PAGEABLE
-PVOID
-messagetable_AllocateRoutine(
-	_In_	PRTL_AVL_TABLE	ptTable,
-	_In_	CLONG			cbSize
-)
-{
-	PAGED_CODE();
-
-#ifndef DBG
-	UNREFERENCED_PARAMETER(ptTable);
-#endif // !DBG
-
-	ASSERT(NULL != ptTable);
-	ASSERT(0 != cbSize);
-
-	return ExAllocatePoolWithTag(PagedPool,
-								 cbSize,
-								 MESSAGE_TABLE_POOL_TAG);
-}
-
-/**
- * Memory deallocation routine for the AVL tree.
- *
- * @param[in]	ptTable		The tree structure.
- * @param[in]	pvBuffer	The buffer to free.
- */
-_IRQL_requires_max_(APC_LEVEL)
-STATIC
-PAGEABLE
-VOID
-messagetable_FreeRoutine(
-	_In_	PRTL_AVL_TABLE	ptTable,
-	_In_	PVOID			pvBuffer
-)
-{
-	PAGED_CODE();
-
-#ifndef DBG
-	UNREFERENCED_PARAMETER(ptTable);
-#endif // !DBG
-
-	ASSERT(NULL != ptTable);
-	ASSERT(NULL != pvBuffer);
-
-	CLOSE(pvBuffer, ExFreePool);
-}
-
-/**
- * Clears a message table entry.
- *
- * @param[in]	ptEntry	Entry to clear.
- *
- * @remark	This does not actually free the entry
- *			itself, only the pointers within.
- */
-_IRQL_requires_max_(APC_LEVEL)
-STATIC
-PAGEABLE
-VOID
-messagetable_ClearEntry(
-	_In_	PMESSAGE_TABLE_ENTRY	ptEntry
-)
-{
-	PAGED_CODE();
-
-	if (NULL == ptEntry)
-	{
-		goto lblCleanup;
-	}
-
-	if (ptEntry->bUnicode)
-	{
-		CLOSE(ptEntry->tData.tUnicode.Buffer, ExFreePool);
-	}
-	else
-	{
-		CLOSE(ptEntry->tData.tAnsi.Buffer, ExFreePool);
-	}
-
-	//
-	// NOTE: DO NOT ZERO THE STRUCTURE!
-	// This function is called before element removal,
-	// and so the rest of the structure's members
-	// are used by the comparison routine
-	// to find the entry to remove.
-	//
-
-lblCleanup:
-	return;
-}
-
 /**
  * Determines whether an ANSI_STRING structure
  * is valid for use in a message table.
@@ -420,146 +263,6 @@ lblCleanup:
 	return bIsValid;
 }
 
-/**
- * Inserts an ANSI message resource entry
- * into a message table.
- *
- * @param[in]	hMessageTable	Message table to insert into.
- * @param[in]	nEntryId		ID of the string to insert.
- * @param[in]	ptResourceEntry	The resource entry.
- * @param[in]	bCompact		Indicates whether the entry
- *								should be compacted.
- *
- * @returns NTSTATUS
- *
- * @remark	It is up to the caller to verify that
- *			the resource entry is indeed an ANSI
- *			resource entry.
- */
-_IRQL_requires_(PASSIVE_LEVEL)
-STATIC
-PAGEABLE
-NTSTATUS
-messagetable_InsertResourceEntryAnsi(
-	_In_	HMESSAGETABLE				hMessageTable,
-	_In_	ULONG						nEntryId,
-	_In_	PCMESSAGE_RESOURCE_ENTRY	ptResourceEntry,
-	_In_	BOOLEAN						bCompact
-)
-{
-	NTSTATUS	eStatus		= STATUS_UNSUCCESSFUL;
-	SIZE_T		cbStringMax	= 0;
-	ANSI_STRING	sString		= { 0 };
-
-	PAGED_CODE();
-
-	ASSERT(NULL != hMessageTable);
-	ASSERT(NULL != ptResourceEntry);
-	ASSERT(0 == ptResourceEntry->fFlags);
-	ASSERT(PASSIVE_LEVEL == KeGetCurrentIrql());
-
-	// Calculate the string's maximum size (buffer size).
-	eStatus = RtlSIZETSub(ptResourceEntry->cbLength,
-						  UFIELD_OFFSET(MESSAGE_RESOURCE_ENTRY, acText),
-						  &cbStringMax);
-	if (!NT_SUCCESS(eStatus))
-	{
-		goto lblCleanup;
-	}
-
-	eStatus = UTIL_InitAnsiStringCb((PCHAR)&(ptResourceEntry->acText[0]),
-									cbStringMax,
-									&sString);
-	if (!NT_SUCCESS(eStatus))
-	{
-		goto lblCleanup;
-	}
-
-	eStatus = MESSAGETABLE_InsertAnsi(hMessageTable,
-									  nEntryId,
-									  &sString,
-									  bCompact);
-	if (!NT_SUCCESS(eStatus))
-	{
-		goto lblCleanup;
-	}
-
-	eStatus = STATUS_SUCCESS;
-
-lblCleanup:
-	return eStatus;
-}
-
-/**
- * Inserts a Unicode message resource entry
- * into a message table.
- *
- * @param[in]	hMessageTable	Message table to insert into.
- * @param[in]	nEntryId		ID of the string to insert.
- * @param[in]	ptResourceEntry	The resource entry.
- * @param[in]	bCompact		Indicates whether the entry
- *								should be compacted.
- *
- * @returns NTSTATUS
- *
- * @remark	It is up to the caller to verify that
- *			the resource entry is indeed a Unicode
- *			resource entry.
- */
-_IRQL_requires_(PASSIVE_LEVEL)
-STATIC
-PAGEABLE
-NTSTATUS
-messagetable_InsertResourceEntryUnicode(
-	_In_	HMESSAGETABLE				hMessageTable,
-	_In_	ULONG						nEntryId,
-	_In_	PCMESSAGE_RESOURCE_ENTRY	ptResourceEntry,
-	_In_	BOOLEAN						bCompact
-)
-{
-	NTSTATUS		eStatus		= STATUS_UNSUCCESSFUL;
-	SIZE_T			cbStringMax	= 0;
-	UNICODE_STRING	usString	= { 0 };
-
-	PAGED_CODE();
-
-	ASSERT(NULL != hMessageTable);
-	ASSERT(NULL != ptResourceEntry);
-	ASSERT(1 == ptResourceEntry->fFlags);
-	ASSERT(PASSIVE_LEVEL == KeGetCurrentIrql());
-
-	// Calculate the string's maximum size (buffer size).
-	eStatus = RtlSIZETSub(ptResourceEntry->cbLength,
-						  UFIELD_OFFSET(MESSAGE_RESOURCE_ENTRY, acText),
-						  &cbStringMax);
-	if (!NT_SUCCESS(eStatus))
-	{
-		goto lblCleanup;
-	}
-
-	eStatus = UTIL_InitUnicodeStringCb((PWCHAR)&(ptResourceEntry->acText[0]),
-									   cbStringMax,
-									   &usString);
-	if (!NT_SUCCESS(eStatus))
-	{
-		goto lblCleanup;
-	}
-
-	eStatus = MESSAGETABLE_InsertUnicode(hMessageTable,
-										 nEntryId,
-										 &usString,
-										 bCompact);
-	if (!NT_SUCCESS(eStatus))
-	{
-		goto lblCleanup;
-	}
-
-	eStatus = STATUS_SUCCESS;
-
-lblCleanup:
-	return eStatus;
-}
-
 /**
  * Calculates the size of a message table entry
  * in its serialized form.
@@ -612,144 +315,529 @@ messagetable_SizeofSerializedEntry(
 }
 
 /**
- * Callback for counting the number of blocks
- * in the serialized message table and the
- * total size required for the serialized strings.
+ * Calculates the size of a message table in its serialized form.
  *
- * @param[in]	ptEntry					Entry currently being enumerated.
- *										Previous entry, or NULL if this is the first
- *										invocation of the callback.
- * @param[in]	pvContext				Alias for PCOUNTING_CALLBACK_CONTEXT.
- * @param[out]	pbContinueEnumeration	Ignored. Enumeration always continues.
+ * @param[in]	ptMessageTable	Message table to operate on.
+ * @param[out]	pcbHeader		Will receive the size of the resource's header,
+ *								where the strings begin.
  *
- * @see COUNTING_CALLBACK_CONTEXT.
+ * @returns SIZE_T
+ *
+ * @remark	The caller must hold the message table lock.
  */
 _IRQL_requires_max_(APC_LEVEL)
 STATIC
 PAGEABLE
-VOID
-messagetable_CountingCallback(
-	_In_		PCMESSAGE_TABLE_ENTRY	ptEntry,
-	_In_opt_	PCMESSAGE_TABLE_ENTRY	ptPreviousEntry,
-	_In_		PVOID					pvContext,
-	_Inout_		PBOOLEAN				pbContinueEnumeration
+SIZE_T
+messagetable_SizeofSerializedTable(
+	_In_	PCMESSAGE_TABLE	ptMessageTable,
+	_Out_	PSIZE_T			pcbHeader
 )
 {
-	NTSTATUS					eStatus		= STATUS_UNSUCCESSFUL;
-	PCOUNTING_CALLBACK_CONTEXT	ptContext	= (PCOUNTING_CALLBACK_CONTEXT)pvContext;
+	NTSTATUS	eStatus	= STATUS_UNSUCCESSFUL;
+	SIZE_T		cbTotal	= 0;
 
 	PAGED_CODE();
 
-#ifndef DBG
-	UNREFERENCED_PARAMETER(pbContinueEnumeration);
-#endif // !DBG
+	ASSERT(NULL != ptMessageTable);
+	ASSERT(NULL != pcbHeader);
 
-	ASSERT(NULL != ptEntry);
-	ASSERT(NULL != pvContext);
-	ASSERT(NULL != pbContinueEnumeration);
-	ASSERT(*pbContinueEnumeration);
-
-	if ((NULL == ptPreviousEntry) ||
-		(1 != ptEntry->nEntryId - ptPreviousEntry->nEntryId))
-	{
-		// This is either the first time we entered the callback,
-		// or the current ID begins a new block.
-		eStatus = RtlULongAdd(ptContext->nBlocks,
-							  1,
-							  &(ptContext->nBlocks));
-		ASSERT(NT_SUCCESS(eStatus));
-	}
+	// The totals are kept up to date on insertion,
+	// so there is nothing to count here.
+	eStatus = RtlSIZETAdd(UFIELD_OFFSET(MESSAGE_RESOURCE_DATA, atBlocks),
+						  ptMessageTable->nBlocks * sizeof(MESSAGE_RESOURCE_BLOCK),
+						  pcbHeader);
+	ASSERT(NT_SUCCESS(eStatus));
 
-	// Add the size for the current string.
-	eStatus = RtlSIZETAdd(ptContext->cbTotalStrings,
-						  messagetable_SizeofSerializedEntry(ptEntry),
-						  &(ptContext->cbTotalStrings));
+	eStatus = RtlSIZETAdd(ptMessageTable->cbTotalStrings,
+						  *pcbHeader,
+						  &cbTotal);
 	ASSERT(NT_SUCCESS(eStatus));
+
+	return cbTotal;
 }
 
 /**
- * Callback for serializing message table entries.
- * Writes each entry to an allocated buffer.
+ * Writes a message table entry out as a message resource entry.
  *
- * @param[in]	ptEntry					Entry currently being enumerated.
- *										Previous entry, or NULL if this is the first
- *										invocation of the callback.
- * @param[in]	pvContext				Alias for PSERIALIZING_CALLBACK_CONTEXT.
- * @param[out]	pbContinueEnumeration	Ignored. Enumeration always continues.
+ * @param[in]	ptEntry			Entry to write.
+ * @param[out]	ptResourceEntry	Receives the entry. Must have room for
+ *								messagetable_SizeofSerializedEntry bytes.
  *
- * @see SERIALIZING_CALLBACK_CONTEXT.
+ * @remark	The rest of the string's buffer, and the padding,
+ *			are zeroed.
  */
 _IRQL_requires_max_(APC_LEVEL)
 STATIC
 PAGEABLE
 VOID
-messagetable_SerializingCallback(
-	_In_		PCMESSAGE_TABLE_ENTRY	ptEntry,
-	_In_opt_	PCMESSAGE_TABLE_ENTRY	ptPreviousEntry,
-	_In_		PVOID					pvContext,
-	_Inout_		PBOOLEAN				pbContinueEnumeration
+messagetable_WriteEntry(
+	_In_	PCMESSAGE_TABLE_ENTRY	ptEntry,
+	_Out_	PMESSAGE_RESOURCE_ENTRY	ptResourceEntry
 )
 {
-	PSERIALIZING_CALLBACK_CONTEXT	ptContext		= (PSERIALIZING_CALLBACK_CONTEXT)pvContext;
-	PMESSAGE_RESOURCE_ENTRY			ptCurrentEntry	= NULL;
+	PVOID	pvString	= NULL;
+	USHORT	cbString	= 0;
 
 	PAGED_CODE();
 
-#ifndef DBG
-	UNREFERENCED_PARAMETER(pbContinueEnumeration);
-#endif // !DBG
-
 	ASSERT(NULL != ptEntry);
-	ASSERT(NULL != pvContext);
-	ASSERT(NULL != pbContinueEnumeration);
-	ASSERT(*pbContinueEnumeration);
-
-	// If there is a new block, set it up
-	if ((NULL == ptPreviousEntry) ||
-		(1 != ptEntry->nEntryId - ptPreviousEntry->nEntryId))
-	{
-		//
-		// New block!
-		//
-
-		// Safe to increment the pointer because we already
-		// ASSERTed the block count inside messagetable_CountingCallback.
-		++ptContext->ptCurrentBlock;
-
-		ptContext->ptCurrentBlock->nLowId = ptEntry->nEntryId;
-		ptContext->ptCurrentBlock->cbOffsetToEntries = RtlPointerToOffset(ptContext->ptMessageData,
-																		  ptContext->pcCurrentStringPosition);
-	}
-
-	// Update the last ID for the current block
-	ptContext->ptCurrentBlock->nHighId = ptEntry->nEntryId;
+	ASSERT(NULL != ptResourceEntry);
 
-	// Copy
-	ptCurrentEntry = (PMESSAGE_RESOURCE_ENTRY)(ptContext->pcCurrentStringPosition);
-	ptCurrentEntry->cbLength = messagetable_SizeofSerializedEntry(ptEntry);
 	if (ptEntry->bUnicode)
 	{
-		ptCurrentEntry->fFlags = 1;
-		RtlMoveMemory(ptCurrentEntry->acText,
-					  ptEntry->tData.tUnicode.Buffer,
-					  ptEntry->tData.tUnicode.Length);
+		pvString = ptEntry->tData.tUnicode.Buffer;
+		cbString = ptEntry->tData.tUnicode.Length;
 	}
 	else
 	{
-		ptCurrentEntry->fFlags = 0;
-		RtlMoveMemory(ptCurrentEntry->acText,
-					  ptEntry->tData.tAnsi.Buffer,
-					  ptEntry->tData.tAnsi.Length);
+		pvString = ptEntry->tData.tAnsi.Buffer;
+		cbString = ptEntry->tData.tAnsi.Length;
 	}
-	ptContext->pcCurrentStringPosition += ptCurrentEntry->cbLength;
+
+	ptResourceEntry->cbLength = messagetable_SizeofSerializedEntry(ptEntry);
+	ptResourceEntry->fFlags = (ptEntry->bUnicode) ? (1) : (0);
+	RtlMoveMemory(ptResourceEntry->acText, pvString, cbString);
+	RtlZeroMemory(&(ptResourceEntry->acText[cbString]),
+				  ptResourceEntry->cbLength - UFIELD_OFFSET(MESSAGE_RESOURCE_ENTRY, acText) - cbString);
 }
 
 /**
- * Acquires the message table lock.
+ * Writes a message table out as a message table resource.
  *
- * @param[in]	ptMessageTable	Message table to lock.
- * @param[in]	bExclusive		Indicates whether the lock
- *								is to be acquired exclusively.
+ * @param[in]	ptMessageTable	Message table to serialize.
+ * @param[in]	cbHeader		Size of the resource's header,
+ *								as returned by messagetable_SizeofSerializedTable.
+ * @param[out]	ptMessageData	Receives the resource. Must be large enough
+ *								for the size returned by
+ *								messagetable_SizeofSerializedTable.
+ *
+ * @remark	Every byte of the resource is written, including the padding,
+ *			so the buffer needn't be zeroed beforehand.
+ * @remark	The caller must hold the message table lock.
+ */
+_IRQL_requires_max_(APC_LEVEL)
+STATIC
+PAGEABLE
+VOID
+messagetable_WriteResource(
+	_In_	PCMESSAGE_TABLE			ptMessageTable,
+	_In_	SIZE_T					cbHeader,
+	_Out_	PMESSAGE_RESOURCE_DATA	ptMessageData
+)
+{
+	ULONG					nIndex			= 0;
+	PCMESSAGE_TABLE_ENTRY	ptEntry			= NULL;
+	PCMESSAGE_TABLE_ENTRY	ptPreviousEntry	= NULL;
+	PMESSAGE_RESOURCE_BLOCK	ptCurrentBlock	= NULL;
+	PUCHAR					pcCurrent		= NULL;
+	PMESSAGE_RESOURCE_ENTRY	ptCurrentEntry	= NULL;
+
+	PAGED_CODE();
+
+	ASSERT(NULL != ptMessageTable);
+	ASSERT(NULL != ptMessageData);
+
+	ptMessageData->nBlocks = ptMessageTable->nBlocks;
+	pcCurrent = (PUCHAR)RtlOffsetToPointer(ptMessageData, cbHeader);
+
+	for (nIndex = 0; nIndex < ptMessageTable->nEntries; ++nIndex)
+	{
+		ptEntry = &(ptMessageTable->ptEntries[nIndex]);
+
+		// If there is a new block, set it up
+		if ((NULL == ptPreviousEntry) ||
+			(1 != ptEntry->nEntryId - ptPreviousEntry->nEntryId))
+		{
+			ptCurrentBlock =
+				(NULL == ptCurrentBlock)
+				? (&(ptMessageData->atBlocks[0]))
+				: (ptCurrentBlock + 1);
+
+			ptCurrentBlock->nLowId = ptEntry->nEntryId;
+			ptCurrentBlock->cbOffsetToEntries = RtlPointerToOffset(ptMessageData, pcCurrent);
+		}
+
+		// Update the last ID for the current block
+		ptCurrentBlock->nHighId = ptEntry->nEntryId;
+
+		ptCurrentEntry = (PMESSAGE_RESOURCE_ENTRY)pcCurrent;
+		messagetable_WriteEntry(ptEntry, ptCurrentEntry);
+
+		pcCurrent += ptCurrentEntry->cbLength;
+		ptPreviousEntry = ptEntry;
+	}
+
+	ASSERT(ptCurrentBlock == ((0 == ptMessageData->nBlocks)
+							  ? (NULL)
+							  : (&(ptMessageData->atBlocks[ptMessageData->nBlocks - 1]))));
+	ASSERT(pcCurrent == (PUCHAR)RtlOffsetToPointer(ptMessageData, cbHeader + ptMessageTable->cbTotalStrings));
+}
+
+/**
+ * Looks up an entry in a message table resource.
+ *
+ * @param[in]	pvMessageTableResource	Resource to search.
+ * @param[in]	cbMessageTableResource	Size of the resource, in bytes.
+ * @param[in]	nEntryId				ID of the entry to look up.
+ * @param[out]	pptResourceEntry		Will receive the entry.
+ *
+ * @returns NTSTATUS
+ *
+ * @remark	Only the blocks and entries on the way to the one
+ *			looked up are checked to be within the resource.
+ */
+_IRQL_requires_max_(APC_LEVEL)
+STATIC
+PAGEABLE
+NTSTATUS
+messagetable_FindResourceEntry(
+	_In_reads_bytes_(cbMessageTableResource)	PVOID						pvMessageTableResource,
+	_In_										ULONG						cbMessageTableResource,
+	_In_										ULONG						nEntryId,
+	_Outptr_									PMESSAGE_RESOURCE_ENTRY *	pptResourceEntry
+)
+{
+	NTSTATUS					eStatus			= STATUS_UNSUCCESSFUL;
+	PCMESSAGE_RESOURCE_DATA		ptResourceData	= (PCMESSAGE_RESOURCE_DATA)pvMessageTableResource;
+	ULONG						nCurrentBlock	= 0;
+	PCMESSAGE_RESOURCE_BLOCK	ptCurrentBlock	= NULL;
+	ULONG						cbOffset		= 0;
+	ULONG						nCurrentId		= 0;
+	PMESSAGE_RESOURCE_ENTRY		ptCurrentEntry	= NULL;
+
+	PAGED_CODE();
+
+	ASSERT(NULL != pvMessageTableResource);
+	ASSERT(NULL != pptResourceEntry);
+
+	if (cbMessageTableResource < UFIELD_OFFSET(MESSAGE_RESOURCE_DATA, atBlocks))
+	{
+		eStatus = STATUS_INTERNAL_DB_CORRUPTION;
+		goto lblCleanup;
+	}
+
+	for (nCurrentBlock = 0;
+		 nCurrentBlock < ptResourceData->nBlocks;
+		 ++nCurrentBlock)
+	{
+		if ((cbMessageTableResource - UFIELD_OFFSET(MESSAGE_RESOURCE_DATA, atBlocks)) / sizeof(MESSAGE_RESOURCE_BLOCK) <= nCurrentBlock)
+		{
+			eStatus = STATUS_INTERNAL_DB_CORRUPTION;
+			goto lblCleanup;
+		}
+
+		ptCurrentBlock = &(ptResourceData->atBlocks[nCurrentBlock]);
+		if ((nEntryId >= ptCurrentBlock->nLowId) &&
+			(nEntryId <= ptCurrentBlock->nHighId))
+		{
+			break;
+		}
+	}
+	if (nCurrentBlock == ptResourceData->nBlocks)
+	{
+		eStatus = STATUS_NOT_FOUND;
+		goto lblCleanup;
+	}
+
+	// The entries of a block have different lengths,
+	// so walk them up to the one looked up.
+	cbOffset = ptCurrentBlock->cbOffsetToEntries;
+	for (nCurrentId = ptCurrentBlock->nLowId; ; ++nCurrentId)
+	{
+		if ((cbOffset > cbMessageTableResource) ||
+			(cbMessageTableResource - cbOffset < UFIELD_OFFSET(MESSAGE_RESOURCE_ENTRY, acText)))
+		{
+			eStatus = STATUS_INTERNAL_DB_CORRUPTION;
+			goto lblCleanup;
+		}
+
+		ptCurrentEntry = (PMESSAGE_RESOURCE_ENTRY)RtlOffsetToPointer(pvMessageTableResource, cbOffset);
+		if ((ptCurrentEntry->cbLength < UFIELD_OFFSET(MESSAGE_RESOURCE_ENTRY, acText)) ||
+			(ptCurrentEntry->cbLength > cbMessageTableResource - cbOffset))
+		{
+			eStatus = STATUS_INTERNAL_DB_CORRUPTION;
+			goto lblCleanup;
+		}
+
+		if (nCurrentId == nEntryId)
+		{
+			break;
+		}
+
+		cbOffset += ptCurrentEntry->cbLength;
+	}
+
+	// Transfer ownership:
+	*pptResourceEntry = ptCurrentEntry;
+
+	eStatus = STATUS_SUCCESS;
+
+lblCleanup:
+	return eStatus;
+}
+
+/**
+ * Looks up an entry in a message table.
+ *
+ * @param[in]	ptMessageTable	Message table to search.
+ * @param[in]	nEntryId		ID of the entry to look up.
+ * @param[out]	pnIndex			Will receive the index of the entry,
+ *								or the index an entry with this ID
+ *								should be inserted at if there is none.
+ *
+ * @returns BOOLEAN
+ *
+ * @remark	The caller must hold the message table lock.
+ */
+_IRQL_requires_max_(APC_LEVEL)
+STATIC
+PAGEABLE
+BOOLEAN
+messagetable_FindEntry(
+	_In_	PCMESSAGE_TABLE	ptMessageTable,
+	_In_	ULONG			nEntryId,
+	_Out_	PULONG			pnIndex
+)
+{
+	BOOLEAN	bFound	= FALSE;
+	ULONG	nLow	= 0;
+	ULONG	nHigh	= 0;
+	ULONG	nMiddle	= 0;
+
+	PAGED_CODE();
+
+	ASSERT(NULL != ptMessageTable);
+	ASSERT(NULL != pnIndex);
+
+	nHigh = ptMessageTable->nEntries;
+
+	// Resources are parsed in ascending ID order,
+	// so most insertions go at the end.
+	if ((0 == nHigh) ||
+		(ptMessageTable->ptEntries[nHigh - 1].nEntryId < nEntryId))
+	{
+		nLow = nHigh;
+		goto lblCleanup;
+	}
+
+	while (nLow < nHigh)
+	{
+		nMiddle = nLow + (nHigh - nLow) / 2;
+		if (ptMessageTable->ptEntries[nMiddle].nEntryId < nEntryId)
+		{
+			nLow = nMiddle + 1;
+		}
+		else
+		{
+			nHigh = nMiddle;
+		}
+	}
+
+	bFound = (nLow < ptMessageTable->nEntries) &&
+			 (ptMessageTable->ptEntries[nLow].nEntryId == nEntryId);
+
+lblCleanup:
+	*pnIndex = nLow;
+
+	return bFound;
+}
+
+/**
+ * Makes sure a message table has room for a number of entries.
+ *
+ * @param[in]	ptMessageTable	Message table to grow.
+ * @param[in]	nEntries		Number of entries to make room for.
+ *
+ * @returns NTSTATUS
+ *
+ * @remark	The caller must hold the message table lock exclusively.
+ */
+_IRQL_requires_max_(APC_LEVEL)
+STATIC
+PAGEABLE
+NTSTATUS
+messagetable_Reserve(
+	_In_	PMESSAGE_TABLE	ptMessageTable,
+	_In_	ULONG			nEntries
+)
+{
+	NTSTATUS				eStatus		= STATUS_UNSUCCESSFUL;
+	ULONG					nCapacity	= 0;
+	ULONG					nDoubled	= 0;
+	SIZE_T					cbEntries	= 0;
+	PMESSAGE_TABLE_ENTRY	ptEntries	= NULL;
+
+	PAGED_CODE();
+
+	ASSERT(NULL != ptMessageTable);
+
+	if (nEntries <= ptMessageTable->nCapacity)
+	{
+		eStatus = STATUS_SUCCESS;
+		goto lblCleanup;
+	}
+
+	// Grow geometrically, so that building a table
+	// one entry at a time copies each entry only a few times.
+	nCapacity = max(nEntries, MESSAGE_TABLE_INITIAL_CAPACITY);
+	if (NT_SUCCESS(RtlULongMult(ptMessageTable->nCapacity, 2, &nDoubled)))
+	{
+		nCapacity = max(nCapacity, nDoubled);
+	}
+
+	eStatus = RtlSIZETMult(nCapacity, sizeof(ptEntries[0]), &cbEntries);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+
+	ptEntries = ExAllocatePoolWithTag(PagedPool,
+									  cbEntries,
+									  MESSAGE_TABLE_POOL_TAG);
+	if (NULL == ptEntries)
+	{
+		eStatus = STATUS_INSUFFICIENT_RESOURCES;
+		goto lblCleanup;
+	}
+
+	if (0 != ptMessageTable->nEntries)
+	{
+		RtlMoveMemory(ptEntries,
+					  ptMessageTable->ptEntries,
+					  ptMessageTable->nEntries * sizeof(ptEntries[0]));
+	}
+
+	CLOSE(ptMessageTable->ptEntries, ExFreePool);
+
+	// Transfer ownership:
+	ptMessageTable->ptEntries = ptEntries;
+	ptEntries = NULL;
+	ptMessageTable->nCapacity = nCapacity;
+
+	eStatus = STATUS_SUCCESS;
+
+lblCleanup:
+	CLOSE(ptEntries, ExFreePool);
+
+	return eStatus;
+}
+
+/**
+ * Inserts an entry into a message table.
+ *
+ * @param[in]	ptMessageTable	Message table to insert into.
+ * @param[in]	ptEntry			Entry to insert.
+ *
+ * @returns NTSTATUS
+ *
+ * @remark	The entry's string must be allocated from the table's arena.
+ * @remark	If an entry with the same ID already exists,
+ *			it is overwritten.
+ * @remark	The caller must hold the message table lock exclusively.
+ */
+_IRQL_requires_max_(APC_LEVEL)
+STATIC
+PAGEABLE
+NTSTATUS
+messagetable_InsertEntry(
+	_In_	PMESSAGE_TABLE			ptMessageTable,
+	_In_	PCMESSAGE_TABLE_ENTRY	ptEntry
+)
+{
+	NTSTATUS				eStatus			= STATUS_UNSUCCESSFUL;
+	ULONG					nIndex			= 0;
+	PMESSAGE_TABLE_ENTRY	ptExisting		= NULL;
+	SIZE_T					cbTotalStrings	= 0;
+	ULONG					nEntries		= 0;
+	BOOLEAN					bJoinsPrevious	= FALSE;
+	BOOLEAN					bJoinsNext		= FALSE;
+
+	PAGED_CODE();
+
+	ASSERT(NULL != ptMessageTable);
+	ASSERT(NULL != ptEntry);
+
+	if (messagetable_FindEntry(ptMessageTable, ptEntry->nEntryId, &nIndex))
+	{
+		ptExisting = &(ptMessageTable->ptEntries[nIndex]);
+
+		// The blocks stay as they are, only the string changes.
+		cbTotalStrings = ptMessageTable->cbTotalStrings - messagetable_SizeofSerializedEntry(ptExisting);
+		eStatus = RtlSIZETAdd(cbTotalStrings,
+							  messagetable_SizeofSerializedEntry(ptEntry),
+							  &cbTotalStrings);
+		if (!NT_SUCCESS(eStatus))
+		{
+			goto lblCleanup;
+		}
+
+		// The old string stays in the arena until the table is destroyed.
+		RtlMoveMemory(ptExisting, ptEntry, sizeof(*ptExisting));
+		ptMessageTable->cbTotalStrings = cbTotalStrings;
+
+		eStatus = STATUS_SUCCESS;
+		goto lblCleanup;
+	}
+
+	eStatus = RtlSIZETAdd(ptMessageTable->cbTotalStrings,
+						  messagetable_SizeofSerializedEntry(ptEntry),
+						  &cbTotalStrings);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+
+	eStatus = RtlULongAdd(ptMessageTable->nEntries, 1, &nEntries);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+
+	eStatus = messagetable_Reserve(ptMessageTable, nEntries);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+
+	// Neither of these can overflow, since the neighbours
+	// are strictly less than and greater than the new ID.
+	bJoinsPrevious = (nIndex > 0) &&
+					 (ptMessageTable->ptEntries[nIndex - 1].nEntryId + 1 == ptEntry->nEntryId);
+	bJoinsNext = (nIndex < ptMessageTable->nEntries) &&
+				 (ptMessageTable->ptEntries[nIndex].nEntryId - 1 == ptEntry->nEntryId);
+
+	RtlMoveMemory(&(ptMessageTable->ptEntries[nIndex + 1]),
+				  &(ptMessageTable->ptEntries[nIndex]),
+				  (ptMessageTable->nEntries - nIndex) * sizeof(ptMessageTable->ptEntries[0]));
+	RtlMoveMemory(&(ptMessageTable->ptEntries[nIndex]), ptEntry, sizeof(*ptEntry));
+	ptMessageTable->nEntries = nEntries;
+	ptMessageTable->cbTotalStrings = cbTotalStrings;
+
+	// The entry starts a block of its own, unless it extends
+	// a neighbouring one. If it extends both, they become one.
+	++ptMessageTable->nBlocks;
+	if (bJoinsPrevious)
+	{
+		--ptMessageTable->nBlocks;
+	}
+	if (bJoinsNext)
+	{
+		--ptMessageTable->nBlocks;
+	}
+
+	eStatus = STATUS_SUCCESS;
+
+lblCleanup:
+	return eStatus;
+}
+
+/**
+ * Acquires the message table lock.
+ *
+ * @param[in]	ptMessageTable	Message table to lock.
+ * @param[in]	bExclusive		Indicates whether the lock
+ *								is to be acquired exclusively.
  *
  * @returns NTSTATUS
  */
@@ -783,53 +871,291 @@ messagetable_AcquireLock(
 		: (ExAcquireResourceSharedLite(&(ptMessageTable->tLock), TRUE));
 	if (!bResult)
 	{
-		eStatus = STATUS_LOCK_NOT_GRANTED;
+		eStatus = STATUS_LOCK_NOT_GRANTED;
+		goto lblCleanup;
+	}
+	bReleaseLock = TRUE;
+
+	// All done!
+	bReleaseLock = FALSE;
+	bLeaveCriticalRegion = FALSE;
+
+	eStatus = STATUS_SUCCESS;
+
+lblCleanup:
+	if (bReleaseLock)
+	{
+		ExReleaseResourceLite(&(ptMessageTable->tLock));
+		bReleaseLock = FALSE;
+	}
+	if (bLeaveCriticalRegion)
+	{
+		KeLeaveCriticalRegion();
+		bLeaveCriticalRegion = FALSE;
+	}
+
+	return eStatus;
+}
+
+/**
+ * Releases the message table lock.
+ *
+ * @param[in]	ptMessageTable	Message table to unlock.
+ */
+_IRQL_requires_max_(APC_LEVEL)
+_Releases_lock_(ptMessageTable->tLock)
+_Releases_lock_(_Global_critical_region_)
+STATIC
+PAGEABLE
+VOID
+messagetable_ReleaseLock(
+	_In_	PMESSAGE_TABLE	ptMessageTable
+)
+{
+	PAGED_CODE();
+
+	ASSERT(NULL != ptMessageTable);
+
+	ExReleaseResourceLite(&(ptMessageTable->tLock));
+	KeLeaveCriticalRegion();
+}
+
+/**
+ * Inserts an entry that refers to a string it doesn't own
+ * into a message table.
+ *
+ * @param[in]	ptMessageTable	Message table to insert into.
+ * @param[in]	ptEntry			Entry to insert.
+ *
+ * @returns NTSTATUS
+ *
+ * @remark	The string must outlive the table.
+ * @remark	If an entry with the same ID already exists,
+ *			it is overwritten.
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+STATIC
+PAGEABLE
+NTSTATUS
+messagetable_InsertView(
+	_In_	PMESSAGE_TABLE			ptMessageTable,
+	_In_	PCMESSAGE_TABLE_ENTRY	ptEntry
+)
+{
+	NTSTATUS	eStatus			= STATUS_UNSUCCESSFUL;
+	BOOLEAN		bLockAcquired	= FALSE;
+
+	PAGED_CODE();
+
+	ASSERT(NULL != ptMessageTable);
+	ASSERT(NULL != ptEntry);
+	ASSERT(PASSIVE_LEVEL == KeGetCurrentIrql());
+
+	eStatus = messagetable_AcquireLock(ptMessageTable, TRUE);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+	bLockAcquired = TRUE;
+
+	eStatus = messagetable_InsertEntry(ptMessageTable, ptEntry);
+
+	// Keep last status
+
+lblCleanup:
+	if (bLockAcquired)
+	{
+		messagetable_ReleaseLock(ptMessageTable);
+		bLockAcquired = FALSE;
+	}
+
+	return eStatus;
+}
+
+/**
+ * Inserts an ANSI message resource entry
+ * into a message table.
+ *
+ * @param[in]	hMessageTable	Message table to insert into.
+ * @param[in]	nEntryId		ID of the string to insert.
+ * @param[in]	ptResourceEntry	The resource entry.
+ * @param[in]	bCompact		Indicates whether the entry
+ *								should be compacted.
+ * @param[in]	bView			Indicates whether the entry should
+ *								refer to the resource, rather than
+ *								to a copy of the string.
+ *
+ * @returns NTSTATUS
+ *
+ * @remark	It is up to the caller to verify that
+ *			the resource entry is indeed an ANSI
+ *			resource entry.
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+STATIC
+PAGEABLE
+NTSTATUS
+messagetable_InsertResourceEntryAnsi(
+	_In_	HMESSAGETABLE				hMessageTable,
+	_In_	ULONG						nEntryId,
+	_In_	PCMESSAGE_RESOURCE_ENTRY	ptResourceEntry,
+	_In_	BOOLEAN						bCompact,
+	_In_	BOOLEAN						bView
+)
+{
+	NTSTATUS			eStatus		= STATUS_UNSUCCESSFUL;
+	SIZE_T				cbStringMax	= 0;
+	ANSI_STRING			sString		= { 0 };
+	MESSAGE_TABLE_ENTRY	tEntry		= { 0 };
+
+	PAGED_CODE();
+
+	ASSERT(NULL != hMessageTable);
+	ASSERT(NULL != ptResourceEntry);
+	ASSERT(0 == ptResourceEntry->fFlags);
+	ASSERT(PASSIVE_LEVEL == KeGetCurrentIrql());
+
+	// Calculate the string's maximum size (buffer size).
+	eStatus = RtlSIZETSub(ptResourceEntry->cbLength,
+						  UFIELD_OFFSET(MESSAGE_RESOURCE_ENTRY, acText),
+						  &cbStringMax);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+
+	eStatus = UTIL_InitAnsiStringCb((PCHAR)&(ptResourceEntry->acText[0]),
+									cbStringMax,
+									&sString);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+
+	if (bView)
+	{
+		// A view is never compacted, since that would mean copying.
+		if (!messagetable_IsValidAnsiString(&sString, FALSE))
+		{
+			eStatus = STATUS_INVALID_PARAMETER;
+			goto lblCleanup;
+		}
+
+		tEntry.nEntryId = nEntryId;
+		tEntry.bUnicode = FALSE;
+		tEntry.tData.tAnsi = sString;
+
+		eStatus = messagetable_InsertView((PMESSAGE_TABLE)hMessageTable, &tEntry);
+	}
+	else
+	{
+		eStatus = MESSAGETABLE_InsertAnsi(hMessageTable,
+										  nEntryId,
+										  &sString,
+										  bCompact);
+	}
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+
+	eStatus = STATUS_SUCCESS;
+
+lblCleanup:
+	return eStatus;
+}
+
+/**
+ * Inserts a Unicode message resource entry
+ * into a message table.
+ *
+ * @param[in]	hMessageTable	Message table to insert into.
+ * @param[in]	nEntryId		ID of the string to insert.
+ * @param[in]	ptResourceEntry	The resource entry.
+ * @param[in]	bCompact		Indicates whether the entry
+ *								should be compacted.
+ * @param[in]	bView			Indicates whether the entry should
+ *								refer to the resource, rather than
+ *								to a copy of the string.
+ *
+ * @returns NTSTATUS
+ *
+ * @remark	It is up to the caller to verify that
+ *			the resource entry is indeed a Unicode
+ *			resource entry.
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+STATIC
+PAGEABLE
+NTSTATUS
+messagetable_InsertResourceEntryUnicode(
+	_In_	HMESSAGETABLE				hMessageTable,
+	_In_	ULONG						nEntryId,
+	_In_	PCMESSAGE_RESOURCE_ENTRY	ptResourceEntry,
+	_In_	BOOLEAN						bCompact,
+	_In_	BOOLEAN						bView
+)
+{
+	NTSTATUS			eStatus		= STATUS_UNSUCCESSFUL;
+	SIZE_T				cbStringMax	= 0;
+	UNICODE_STRING		usString	= { 0 };
+	MESSAGE_TABLE_ENTRY	tEntry		= { 0 };
+
+	PAGED_CODE();
+
+	ASSERT(NULL != hMessageTable);
+	ASSERT(NULL != ptResourceEntry);
+	ASSERT(1 == ptResourceEntry->fFlags);
+	ASSERT(PASSIVE_LEVEL == KeGetCurrentIrql());
+
+	// Calculate the string's maximum size (buffer size).
+	eStatus = RtlSIZETSub(ptResourceEntry->cbLength,
+						  UFIELD_OFFSET(MESSAGE_RESOURCE_ENTRY, acText),
+						  &cbStringMax);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+
+	eStatus = UTIL_InitUnicodeStringCb((PWCHAR)&(ptResourceEntry->acText[0]),
+									   cbStringMax,
+									   &usString);
+	if (!NT_SUCCESS(eStatus))
+	{
 		goto lblCleanup;
 	}
-	bReleaseLock = TRUE;
 
-	// All done!
-	bReleaseLock = FALSE;
-	bLeaveCriticalRegion = FALSE;
+	if (bView)
+	{
+		// A view is never compacted, since that would mean copying.
+		if (!messagetable_IsValidUnicodeString(&usString, FALSE))
+		{
+			eStatus = STATUS_INVALID_PARAMETER;
+			goto lblCleanup;
+		}
 
-	eStatus = STATUS_SUCCESS;
+		tEntry.nEntryId = nEntryId;
+		tEntry.bUnicode = TRUE;
+		tEntry.tData.tUnicode = usString;
 
-lblCleanup:
-	if (bReleaseLock)
+		eStatus = messagetable_InsertView((PMESSAGE_TABLE)hMessageTable, &tEntry);
+	}
+	else
 	{
-		ExReleaseResourceLite(&(ptMessageTable->tLock));
-		bReleaseLock = FALSE;
+		eStatus = MESSAGETABLE_InsertUnicode(hMessageTable,
+											 nEntryId,
+											 &usString,
+											 bCompact);
 	}
-	if (bLeaveCriticalRegion)
+	if (!NT_SUCCESS(eStatus))
 	{
-		KeLeaveCriticalRegion();
-		bLeaveCriticalRegion = FALSE;
+		goto lblCleanup;
 	}
 
-	return eStatus;
-}
-
-/**
- * Releases the message table lock.
- *
- * @param[in]	ptMessageTable	Message table to unlock.
- */
-_IRQL_requires_max_(APC_LEVEL)
-_Releases_lock_(ptMessageTable->tLock)
-_Releases_lock_(_Global_critical_region_)
-STATIC
-PAGEABLE
-VOID
-messagetable_ReleaseLock(
-	_In_	PMESSAGE_TABLE	ptMessageTable
-)
-{
-	PAGED_CODE();
-
-	ASSERT(NULL != ptMessageTable);
+	eStatus = STATUS_SUCCESS;
 
-	ExReleaseResourceLite(&(ptMessageTable->tLock));
-	KeLeaveCriticalRegion();
+lblCleanup:
+	return eStatus;
 }
 
 _IRQL_requires_(PASSIVE_LEVEL)
@@ -861,12 +1187,7 @@ MESSAGETABLE_Create(
 	}
 	RtlSecureZeroMemory(ptMessageTable, sizeof(*ptMessageTable));
 
-	RtlInitializeGenericTableAvl(&(ptMessageTable->tTable),
-								 &messagetable_CompareRoutine,
-								 &messagetable_AllocateRoutine,
-								 &messagetable_FreeRoutine,
-								 NULL);
-	ptMessageTable->bTableInitialized = TRUE;
+	ARENA_Initialize(&(ptMessageTable->tStrings), MESSAGE_TABLE_POOL_TAG);
 
 	eStatus = ExInitializeResourceLite(&(ptMessageTable->tLock));
 	if (!NT_SUCCESS(eStatus))
@@ -888,13 +1209,34 @@ lblCleanup:
 	return eStatus;
 }
 
+/**
+ * Creates a message table by parsing a message table resource.
+ *
+ * @param[in]	pvMessageTableResource	Resource buffer to parse.
+ * @param[in]	cbMessageTableResource	Size of the buffer, in bytes.
+ * @param[in]	bCompact				Indicates whether the strings
+ *										should be compacted. Ignored
+ *										if bView is TRUE.
+ * @param[in]	bView					Indicates whether the entries
+ *										should refer to the resource,
+ *										rather than to copies of its strings.
+ * @param[out]	phMessageTable			Will receive a handle
+										to the message table.
+ *
+ * @returns NTSTATUS
+ *
+ * @see MESSAGETABLE_CreateFromResource
+ * @see MESSAGETABLE_CreateViewOfResource
+ */
 _IRQL_requires_(PASSIVE_LEVEL)
+STATIC
 PAGEABLE
 NTSTATUS
-MESSAGETABLE_CreateFromResource(
+messagetable_CreateFromResource(
 	_In_reads_bytes_(cbMessageTableResource)	PVOID			pvMessageTableResource,
 	_In_										ULONG			cbMessageTableResource,
 	_In_										BOOLEAN			bCompact,
+	_In_										BOOLEAN			bView,
 	_Out_										PHMESSAGETABLE	phMessageTable
 )
 {
@@ -905,6 +1247,8 @@ MESSAGETABLE_CreateFromResource(
 	PCMESSAGE_RESOURCE_BLOCK	ptCurrentBlock	= NULL;
 	ULONG						nCurrentId		= 0;
 	PCMESSAGE_RESOURCE_ENTRY	ptCurrentEntry	= NULL;
+	ULONG						nEntries		= 0;
+	BOOLEAN						bLockAcquired	= FALSE;
 
 	PAGED_CODE();
 	ASSERT(PASSIVE_LEVEL == KeGetCurrentIrql());
@@ -923,6 +1267,47 @@ MESSAGETABLE_CreateFromResource(
 		goto lblCleanup;
 	}
 
+	// Make room for all the entries at once,
+	// rather than growing the table as they are inserted.
+	for (nCurrentBlock = 0;
+		 nCurrentBlock < ptResourceData->nBlocks;
+		 ++nCurrentBlock)
+	{
+		ptCurrentBlock = &(ptResourceData->atBlocks[nCurrentBlock]);
+		if (ptCurrentBlock->nHighId < ptCurrentBlock->nLowId)
+		{
+			continue;
+		}
+
+		eStatus = RtlULongAdd(nEntries,
+							  ptCurrentBlock->nHighId - ptCurrentBlock->nLowId,
+							  &nEntries);
+		if (NT_SUCCESS(eStatus))
+		{
+			eStatus = RtlULongAdd(nEntries, 1, &nEntries);
+		}
+		if (!NT_SUCCESS(eStatus))
+		{
+			goto lblCleanup;
+		}
+	}
+
+	eStatus = messagetable_AcquireLock((PMESSAGE_TABLE)hMessageTable, TRUE);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+	bLockAcquired = TRUE;
+
+	eStatus = messagetable_Reserve((PMESSAGE_TABLE)hMessageTable, nEntries);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+
+	messagetable_ReleaseLock((PMESSAGE_TABLE)hMessageTable);
+	bLockAcquired = FALSE;
+
 	for (nCurrentBlock = 0;
 		 nCurrentBlock < ptResourceData->nBlocks;
 		 ++nCurrentBlock)
@@ -940,7 +1325,8 @@ MESSAGETABLE_CreateFromResource(
 				eStatus = messagetable_InsertResourceEntryUnicode(hMessageTable,
 																  nCurrentId,
 																  ptCurrentEntry,
-																  bCompact);
+																  bCompact,
+																  bView);
 			}
 			else if (0 == ptCurrentEntry->fFlags)
 			{
@@ -948,7 +1334,8 @@ MESSAGETABLE_CreateFromResource(
 				eStatus = messagetable_InsertResourceEntryAnsi(hMessageTable,
 															   nCurrentId,
 															   ptCurrentEntry,
-															   bCompact);
+															   bCompact,
+															   bView);
 			}
 			else
 			{
@@ -974,11 +1361,55 @@ MESSAGETABLE_CreateFromResource(
 	eStatus = STATUS_SUCCESS;
 
 lblCleanup:
+	if (bLockAcquired)
+	{
+		messagetable_ReleaseLock((PMESSAGE_TABLE)hMessageTable);
+		bLockAcquired = FALSE;
+	}
 	CLOSE(hMessageTable, MESSAGETABLE_Destroy);
 
 	return eStatus;
 }
 
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGEABLE
+NTSTATUS
+MESSAGETABLE_CreateFromResource(
+	_In_reads_bytes_(cbMessageTableResource)	PVOID			pvMessageTableResource,
+	_In_										ULONG			cbMessageTableResource,
+	_In_										BOOLEAN			bCompact,
+	_Out_										PHMESSAGETABLE	phMessageTable
+)
+{
+	PAGED_CODE();
+	ASSERT(PASSIVE_LEVEL == KeGetCurrentIrql());
+
+	return messagetable_CreateFromResource(pvMessageTableResource,
+										   cbMessageTableResource,
+										   bCompact,
+										   FALSE,
+										   phMessageTable);
+}
+
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGEABLE
+NTSTATUS
+MESSAGETABLE_CreateViewOfResource(
+	_In_reads_bytes_(cbMessageTableResource)	PVOID			pvMessageTableResource,
+	_In_										ULONG			cbMessageTableResource,
+	_Out_										PHMESSAGETABLE	phMessageTable
+)
+{
+	PAGED_CODE();
+	ASSERT(PASSIVE_LEVEL == KeGetCurrentIrql());
+
+	return messagetable_CreateFromResource(pvMessageTableResource,
+										   cbMessageTableResource,
+										   FALSE,
+										   TRUE,
+										   phMessageTable);
+}
+
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGEABLE
 VOID
@@ -987,7 +1418,6 @@ MESSAGETABLE_Destroy(
 )
 {
 	PMESSAGE_TABLE	ptMessageTable	= (PMESSAGE_TABLE)hMessageTable;
-	PVOID			pvData			= NULL;
 
 	PAGED_CODE();
 	ASSERT(PASSIVE_LEVEL == KeGetCurrentIrql());
@@ -1003,24 +1433,9 @@ MESSAGETABLE_Destroy(
 		ptMessageTable->bLockInitialized = FALSE;
 	}
 
-	if (ptMessageTable->bTableInitialized)
-	{
-		for (pvData = RtlEnumerateGenericTableAvl(&(ptMessageTable->tTable), TRUE);
-			 NULL != pvData;
-			 pvData = RtlEnumerateGenericTableAvl(&(ptMessageTable->tTable), FALSE))
-		{
-			// Clear the current entry ...
-			messagetable_ClearEntry((PMESSAGE_TABLE_ENTRY)pvData);
-
-			// ... and delete it from the tree.
-			(VOID)RtlDeleteElementGenericTableAvl(&(ptMessageTable->tTable),
-												  pvData);
-		}
-
-		ASSERT(RtlIsGenericTableEmptyAvl(&(ptMessageTable->tTable)));
-
-		ptMessageTable->bTableInitialized = FALSE;
-	}
+	ptMessageTable->nEntries = 0;
+	CLOSE(ptMessageTable->ptEntries, ExFreePool);
+	ARENA_Release(&(ptMessageTable->tStrings));
 
 	CLOSE(ptMessageTable, ExFreePool);
 
@@ -1043,8 +1458,6 @@ MESSAGETABLE_InsertAnsi(
 	BOOLEAN					bLockAcquired		= FALSE;
 	MESSAGE_TABLE_ENTRY		tEntry				= { 0 };
 	PCHAR					pcDuplicateString	= NULL;
-	BOOLEAN					bNewElement			= FALSE;
-	PMESSAGE_TABLE_ENTRY	ptInserted			= NULL;
 
 	PAGED_CODE();
 	ASSERT(PASSIVE_LEVEL == KeGetCurrentIrql());
@@ -1071,9 +1484,9 @@ MESSAGETABLE_InsertAnsi(
 		: (psString->MaximumLength);
 
 	// Allocate memory for the duplicate string.
-	pcDuplicateString = ExAllocatePoolWithTag(PagedPool,
-											  tEntry.tData.tAnsi.MaximumLength,
-											  MESSAGE_TABLE_POOL_TAG);
+	// If the insertion fails, it is freed along with the table.
+	pcDuplicateString = ARENA_Allocate(&(ptMessageTable->tStrings),
+									   tEntry.tData.tAnsi.MaximumLength);
 	if (NULL == pcDuplicateString)
 	{
 		eStatus = STATUS_INSUFFICIENT_RESOURCES;
@@ -1091,35 +1504,17 @@ MESSAGETABLE_InsertAnsi(
 	tEntry.nEntryId = nEntryId;
 	tEntry.bUnicode = FALSE;
 
-	// Try to insert it into the tree.
-	ptInserted =
-		(PMESSAGE_TABLE_ENTRY)RtlInsertElementGenericTableAvl(&(ptMessageTable->tTable),
-															  &tEntry,
-															  sizeof(tEntry),
-															  &bNewElement);
-	if (NULL == ptInserted)
-	{
-		eStatus = STATUS_INSUFFICIENT_RESOURCES;
-		goto lblCleanup;
-	}
-
 	// If an element with the same ID already exists,
-	// overwrite it.
-	if (!bNewElement)
+	// it is overwritten.
+	eStatus = messagetable_InsertEntry(ptMessageTable, &tEntry);
+	if (!NT_SUCCESS(eStatus))
 	{
-		ASSERT(ptInserted->nEntryId == tEntry.nEntryId);
-
-		messagetable_ClearEntry(ptInserted);
-		RtlMoveMemory(ptInserted, &tEntry, sizeof(*ptInserted));
+		goto lblCleanup;
 	}
 
-	// Transfer ownership:
-	pcDuplicateString = NULL;
-
 	eStatus = STATUS_SUCCESS;
 
 lblCleanup:
-	CLOSE(pcDuplicateString, ExFreePool);
 	if (bLockAcquired)
 	{
 		messagetable_ReleaseLock(ptMessageTable);
@@ -1144,8 +1539,6 @@ MESSAGETABLE_InsertUnicode(
 	BOOLEAN					bLockAcquired		= FALSE;
 	MESSAGE_TABLE_ENTRY		tEntry				= { 0 };
 	PWCHAR					pwcDuplicateString	= NULL;
-	BOOLEAN					bNewElement			= FALSE;
-	PMESSAGE_TABLE_ENTRY	ptInserted			= NULL;
 
 	PAGED_CODE();
 	ASSERT(PASSIVE_LEVEL == KeGetCurrentIrql());
@@ -1172,9 +1565,9 @@ MESSAGETABLE_InsertUnicode(
 		: (pusString->MaximumLength);
 
 	// Allocate memory for the duplicate string.
-	pwcDuplicateString = ExAllocatePoolWithTag(PagedPool,
-											   tEntry.tData.tUnicode.MaximumLength,
-											   MESSAGE_TABLE_POOL_TAG);
+	// If the insertion fails, it is freed along with the table.
+	pwcDuplicateString = ARENA_Allocate(&(ptMessageTable->tStrings),
+										tEntry.tData.tUnicode.MaximumLength);
 	if (NULL == pwcDuplicateString)
 	{
 		eStatus = STATUS_INSUFFICIENT_RESOURCES;
@@ -1192,35 +1585,17 @@ MESSAGETABLE_InsertUnicode(
 	tEntry.nEntryId = nEntryId;
 	tEntry.bUnicode = TRUE;
 
-	// Try to insert it into the tree.
-	ptInserted =
-		(PMESSAGE_TABLE_ENTRY)RtlInsertElementGenericTableAvl(&(ptMessageTable->tTable),
-															  &tEntry,
-															  sizeof(tEntry),
-															  &bNewElement);
-	if (NULL == ptInserted)
-	{
-		eStatus = STATUS_INSUFFICIENT_RESOURCES;
-		goto lblCleanup;
-	}
-
 	// If an element with the same ID already exists,
-	// overwrite it.
-	if (!bNewElement)
+	// it is overwritten.
+	eStatus = messagetable_InsertEntry(ptMessageTable, &tEntry);
+	if (!NT_SUCCESS(eStatus))
 	{
-		ASSERT(ptInserted->nEntryId == tEntry.nEntryId);
-
-		messagetable_ClearEntry(ptInserted);
-		RtlMoveMemory(ptInserted, &tEntry, sizeof(*ptInserted));
+		goto lblCleanup;
 	}
 
-	// Transfer ownership:
-	pwcDuplicateString = NULL;
-
 	eStatus = STATUS_SUCCESS;
 
 lblCleanup:
-	CLOSE(pwcDuplicateString, ExFreePool);
 	if (bLockAcquired)
 	{
 		messagetable_ReleaseLock(ptMessageTable);
@@ -1242,7 +1617,7 @@ MESSAGETABLE_GetEntry(
 	NTSTATUS				eStatus			= STATUS_UNSUCCESSFUL;
 	PMESSAGE_TABLE			ptMessageTable	= (PMESSAGE_TABLE)hMessageTable;
 	BOOLEAN					bLockAcquired	= FALSE;
-	MESSAGE_TABLE_ENTRY		tDummyEntry		= { 0 };
+	ULONG					nIndex			= 0;
 	PCMESSAGE_TABLE_ENTRY	ptFoundEntry	= NULL;
 	PVOID					pvFoundString	= NULL;
 	USHORT					cbDuplicate		= 0;
@@ -1266,15 +1641,12 @@ MESSAGETABLE_GetEntry(
 	bLockAcquired = TRUE;
 
 	// Find the entry.
-	tDummyEntry.nEntryId = nEntryId;
-	ptFoundEntry =
-		(PCMESSAGE_TABLE_ENTRY)RtlLookupElementGenericTableAvl(&(ptMessageTable->tTable),
-															   &tDummyEntry);
-	if (NULL == ptFoundEntry)
+	if (!messagetable_FindEntry(ptMessageTable, nEntryId, &nIndex))
 	{
 		eStatus = STATUS_NOT_FOUND;
 		goto lblCleanup;
 	}
+	ptFoundEntry = &(ptMessageTable->ptEntries[nIndex]);
 	pvFoundString =
 		(ptFoundEntry->bUnicode)
 		? ((PVOID)(ptFoundEntry->tData.tUnicode.Buffer))
@@ -1335,8 +1707,7 @@ MESSAGETABLE_EnumerateEntries(
 	NTSTATUS				eStatus			= STATUS_UNSUCCESSFUL;
 	PMESSAGE_TABLE			ptMessageTable	= (PMESSAGE_TABLE)hMessageTable;
 	BOOLEAN					bLockAcquired	= FALSE;
-	PVOID					pvRestartKey	= NULL;
-	PVOID					pvData			= NULL;
+	ULONG					nIndex			= 0;
 	PCMESSAGE_TABLE_ENTRY	ptPrevious		= NULL;
 	PCMESSAGE_TABLE_ENTRY	ptCurrent		= NULL;
 	BOOLEAN					bContinue		= FALSE;
@@ -1358,13 +1729,9 @@ MESSAGETABLE_EnumerateEntries(
 	}
 	bLockAcquired = TRUE;
 
-	for (pvData = RtlEnumerateGenericTableWithoutSplayingAvl(&(ptMessageTable->tTable),
-															 &pvRestartKey);
-		 NULL != pvData;
-		 pvData = RtlEnumerateGenericTableWithoutSplayingAvl(&(ptMessageTable->tTable),
-															 &pvRestartKey))
+	for (nIndex = 0; nIndex < ptMessageTable->nEntries; ++nIndex)
 	{
-		ptCurrent = (PCMESSAGE_TABLE_ENTRY)pvData;
+		ptCurrent = &(ptMessageTable->ptEntries[nIndex]);
 
 		bContinue = TRUE;
 		pfnCallback(ptCurrent,
@@ -1400,14 +1767,12 @@ MESSAGETABLE_Serialize(
 	_Out_													PSIZE_T			pcbMessageTableResource
 )
 {
-	NTSTATUS						eStatus				= STATUS_UNSUCCESSFUL;
-	PMESSAGE_TABLE					ptMessageTable		= (PMESSAGE_TABLE)hMessageTable;
-	BOOLEAN							bLockAcquired		= FALSE;
-	COUNTING_CALLBACK_CONTEXT		tCountingContext	= { 0 };
-	SIZE_T							cbHeader			= 0;
-	SIZE_T							cbTotal				= 0;
-	PMESSAGE_RESOURCE_DATA			ptMessageData		= NULL;
-	SERIALIZING_CALLBACK_CONTEXT	tSerializingContext	= { 0 };
+	NTSTATUS				eStatus			= STATUS_UNSUCCESSFUL;
+	PMESSAGE_TABLE			ptMessageTable	= (PMESSAGE_TABLE)hMessageTable;
+	BOOLEAN					bLockAcquired	= FALSE;
+	SIZE_T					cbHeader		= 0;
+	SIZE_T					cbTotal			= 0;
+	PMESSAGE_RESOURCE_DATA	ptMessageData	= NULL;
 
 	PAGED_CODE();
 	ASSERT(PASSIVE_LEVEL == KeGetCurrentIrql());
@@ -1427,60 +1792,162 @@ MESSAGETABLE_Serialize(
 	}
 	bLockAcquired = TRUE;
 
-	eStatus = MESSAGETABLE_EnumerateEntries(hMessageTable,
-											&messagetable_CountingCallback,
-											&tCountingContext);
+	cbTotal = messagetable_SizeofSerializedTable(ptMessageTable, &cbHeader);
+
+	// Allocate memory for everything
+	ptMessageData = ExAllocatePoolWithTag(PagedPool, cbTotal, MESSAGE_TABLE_POOL_TAG);
+	if (NULL == ptMessageData)
+	{
+		eStatus = STATUS_INSUFFICIENT_RESOURCES;
+		goto lblCleanup;
+	}
+
+	// Serialize
+	messagetable_WriteResource(ptMessageTable, cbHeader, ptMessageData);
+
+	// Transfer ownership:
+	*ppvMessageTableResource = ptMessageData;
+	ptMessageData = NULL;
+	*pcbMessageTableResource = cbTotal;
+
+	eStatus = STATUS_SUCCESS;
+
+lblCleanup:
+	CLOSE(ptMessageData, ExFreePool);
+	if (bLockAcquired)
+	{
+		messagetable_ReleaseLock(ptMessageTable);
+		bLockAcquired = FALSE;
+	}
+
+	return eStatus;
+}
+
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGEABLE
+NTSTATUS
+MESSAGETABLE_SerializeToBuffer(
+	_In_									HMESSAGETABLE	hMessageTable,
+	_Out_writes_bytes_opt_(cbBuffer)		PVOID			pvBuffer,
+	_In_									SIZE_T			cbBuffer,
+	_Out_									PSIZE_T			pcbMessageTableResource
+)
+{
+	NTSTATUS		eStatus			= STATUS_UNSUCCESSFUL;
+	PMESSAGE_TABLE	ptMessageTable	= (PMESSAGE_TABLE)hMessageTable;
+	BOOLEAN			bLockAcquired	= FALSE;
+	SIZE_T			cbHeader		= 0;
+	SIZE_T			cbTotal			= 0;
+
+	PAGED_CODE();
+	ASSERT(PASSIVE_LEVEL == KeGetCurrentIrql());
+
+	if ((NULL == hMessageTable) ||
+		((NULL == pvBuffer) && (0 != cbBuffer)) ||
+		(NULL == pcbMessageTableResource))
+	{
+		eStatus = STATUS_INVALID_PARAMETER;
+		goto lblCleanup;
+	}
+
+	eStatus = messagetable_AcquireLock(ptMessageTable, FALSE);
 	if (!NT_SUCCESS(eStatus))
 	{
 		goto lblCleanup;
 	}
+	bLockAcquired = TRUE;
 
-	// Calculate the size of the header
-	eStatus = RtlSIZETAdd(UFIELD_OFFSET(MESSAGE_RESOURCE_DATA, atBlocks),
-						  tCountingContext.nBlocks * sizeof(ptMessageData->atBlocks[0]),
-						  &cbHeader);
-	ASSERT(NT_SUCCESS(eStatus));
+	cbTotal = messagetable_SizeofSerializedTable(ptMessageTable, &cbHeader);
+	*pcbMessageTableResource = cbTotal;
 
-	// Calculate the total size
-	eStatus = RtlSIZETAdd(tCountingContext.cbTotalStrings,
-						  cbHeader,
-						  &cbTotal);
-	ASSERT(NT_SUCCESS(eStatus));
+	if (cbBuffer < cbTotal)
+	{
+		eStatus = STATUS_BUFFER_TOO_SMALL;
+		goto lblCleanup;
+	}
 
-	// Allocate memory for everything
-	ptMessageData = ExAllocatePoolWithTag(PagedPool, cbTotal, MESSAGE_TABLE_POOL_TAG);
-	if (NULL == ptMessageData)
+	messagetable_WriteResource(ptMessageTable, cbHeader, (PMESSAGE_RESOURCE_DATA)pvBuffer);
+
+	eStatus = STATUS_SUCCESS;
+
+lblCleanup:
+	if (bLockAcquired)
 	{
-		eStatus = STATUS_INSUFFICIENT_RESOURCES;
+		messagetable_ReleaseLock(ptMessageTable);
+		bLockAcquired = FALSE;
+	}
+
+	return eStatus;
+}
+
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGEABLE
+NTSTATUS
+MESSAGETABLE_PatchResourceEntry(
+	_In_											HMESSAGETABLE	hMessageTable,
+	_In_											ULONG			nEntryId,
+	_Inout_updates_bytes_(cbMessageTableResource)	PVOID			pvMessageTableResource,
+	_In_											ULONG			cbMessageTableResource,
+	_In_											BOOLEAN			bCheckOnly
+)
+{
+	NTSTATUS				eStatus			= STATUS_UNSUCCESSFUL;
+	PMESSAGE_TABLE			ptMessageTable	= (PMESSAGE_TABLE)hMessageTable;
+	BOOLEAN					bLockAcquired	= FALSE;
+	ULONG					nIndex			= 0;
+	PCMESSAGE_TABLE_ENTRY	ptEntry			= NULL;
+	PMESSAGE_RESOURCE_ENTRY	ptResourceEntry	= NULL;
+
+	PAGED_CODE();
+	ASSERT(PASSIVE_LEVEL == KeGetCurrentIrql());
+
+	if ((NULL == hMessageTable) ||
+		(NULL == pvMessageTableResource) ||
+		(0 == cbMessageTableResource))
+	{
+		eStatus = STATUS_INVALID_PARAMETER;
 		goto lblCleanup;
 	}
-	RtlSecureZeroMemory(ptMessageData, cbTotal);
 
-	// Initialize the header
-	ptMessageData->nBlocks = tCountingContext.nBlocks;
+	eStatus = messagetable_AcquireLock(ptMessageTable, FALSE);
+	if (!NT_SUCCESS(eStatus))
+	{
+		goto lblCleanup;
+	}
+	bLockAcquired = TRUE;
 
-	// Serialize
-	tSerializingContext.ptMessageData = ptMessageData;
-	tSerializingContext.ptCurrentBlock = &ptMessageData->atBlocks[-1];
-	tSerializingContext.pcCurrentStringPosition = (PUCHAR)RtlOffsetToPointer(tSerializingContext.ptMessageData,
-																			 cbHeader);
-	eStatus = MESSAGETABLE_EnumerateEntries(hMessageTable,
-											&messagetable_SerializingCallback,
-											&tSerializingContext);
+	if (!messagetable_FindEntry(ptMessageTable, nEntryId, &nIndex))
+	{
+		eStatus = STATUS_NOT_FOUND;
+		goto lblCleanup;
+	}
+	ptEntry = &(ptMessageTable->ptEntries[nIndex]);
+
+	eStatus = messagetable_FindResourceEntry(pvMessageTableResource,
+											 cbMessageTableResource,
+											 nEntryId,
+											 &ptResourceEntry);
 	if (!NT_SUCCESS(eStatus))
 	{
 		goto lblCleanup;
 	}
 
-	// Transfer ownership:
-	*ppvMessageTableResource = ptMessageData;
-	ptMessageData = NULL;
-	*pcbMessageTableResource = cbTotal;
+	// Any other size moves the entries after it,
+	// and every block after them.
+	if (messagetable_SizeofSerializedEntry(ptEntry) != ptResourceEntry->cbLength)
+	{
+		eStatus = STATUS_INVALID_BUFFER_SIZE;
+		goto lblCleanup;
+	}
+
+	if (!bCheckOnly)
+	{
+		messagetable_WriteEntry(ptEntry, ptResourceEntry);
+	}
 
 	eStatus = STATUS_SUCCESS;
 
 lblCleanup:
-	CLOSE(ptMessageData, ExFreePool);
 	if (bLockAcquired)
 	{
 		messagetable_ReleaseLock(ptMessageTable);
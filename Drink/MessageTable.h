@@ -108,6 +108,35 @@ MESSAGETABLE_CreateFromResource(
 	_Out_										PHMESSAGETABLE	phMessageTable
 );
 
+/**
+ * Creates a message table that refers to the strings
+ * of a message table resource, rather than copying them.
+ *
+ * @param[in]	pvMessageTableResource	Resource buffer to parse.
+ * @param[in]	cbMessageTableResource	Size of the buffer, in bytes.
+ * @param[out]	phMessageTable			Will receive a handle
+										to the message table.
+ *
+ * @returns NTSTATUS
+ *
+ * @remark	The resource must outlive the table,
+ *			and must not change while the table is in use.
+ * @remark	The strings are treated as if they were not compacted.
+ * @remark	Entries inserted into the table later are copied as usual,
+ *			so only the strings that change take up memory.
+ *			The resource itself is never written to.
+ *
+ * @see MESSAGETABLE_CreateFromResource
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGEABLE
+NTSTATUS
+MESSAGETABLE_CreateViewOfResource(
+	_In_reads_bytes_(cbMessageTableResource)	PVOID			pvMessageTableResource,
+	_In_										ULONG			cbMessageTableResource,
+	_Out_										PHMESSAGETABLE	phMessageTable
+);
+
 /**
  * Destroys a message table.
  *
@@ -250,3 +279,67 @@ MESSAGETABLE_Serialize(
 	_Outptr_result_bytebuffer_(*pcbMessageTableResource)	PVOID *			ppvMessageTableResource,
 	_Out_													PSIZE_T			pcbMessageTableResource
 );
+
+/**
+ * Serializes a message table to a message table resource,
+ * in a buffer supplied by the caller.
+ *
+ * @param[in]	hMessageTable			Message table to serialize.
+ * @param[out]	pvBuffer				Will receive the serialized message table.
+ *										May be NULL if cbBuffer is 0.
+ * @param[in]	cbBuffer				Size of the buffer, in bytes.
+ * @param[out]	pcbMessageTableResource	Will receive the serialized table's size, in bytes,
+ *										even if the buffer is too small.
+ *
+ * @returns NTSTATUS
+ *
+ * @remark	Returns STATUS_BUFFER_TOO_SMALL if the table doesn't fit.
+ *			Pass a NULL buffer to find out how large it should be.
+ * @remark	The buffer needn't be zeroed beforehand.
+ *			Bytes past the serialized table are left untouched.
+ * @remark	The strings are stored as MESSAGETABLE_Serialize describes.
+ * @remark	The buffer must not overlap any string in the table,
+ *			including the resource a table created by
+ *			MESSAGETABLE_CreateViewOfResource refers to.
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGEABLE
+NTSTATUS
+MESSAGETABLE_SerializeToBuffer(
+	_In_									HMESSAGETABLE	hMessageTable,
+	_Out_writes_bytes_opt_(cbBuffer)		PVOID			pvBuffer,
+	_In_									SIZE_T			cbBuffer,
+	_Out_									PSIZE_T			pcbMessageTableResource
+);
+
+/**
+ * Writes a single entry of a message table over the same entry
+ * in a message table resource, without serializing the whole table.
+ *
+ * @param[in]		hMessageTable			Message table to take the entry from.
+ * @param[in]		nEntryId				ID of the entry to write.
+ * @param[in,out]	pvMessageTableResource	Resource to write the entry into.
+ * @param[in]		cbMessageTableResource	Size of the resource, in bytes.
+ * @param[in]		bCheckOnly				Indicates whether to only check
+ *											that the entry can be written,
+ *											without writing it.
+ *
+ * @returns NTSTATUS
+ *
+ * @remark	The entry can only be written if it serializes to the same size
+ *			as the entry already in the resource. Otherwise, the function
+ *			returns STATUS_INVALID_BUFFER_SIZE, and the whole table
+ *			should be serialized instead.
+ * @remark	Returns STATUS_NOT_FOUND if either the table
+ *			or the resource has no entry with the ID.
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGEABLE
+NTSTATUS
+MESSAGETABLE_PatchResourceEntry(
+	_In_											HMESSAGETABLE	hMessageTable,
+	_In_											ULONG			nEntryId,
+	_Inout_updates_bytes_(cbMessageTableResource)	PVOID			pvMessageTableResource,
+	_In_											ULONG			cbMessageTableResource,
+	_In_											BOOLEAN			bCheckOnly
+);
@@ -55,6 +55,23 @@
 #define GC_MODE_INDEX (5)
 
 
+/** Typedefs ************************************************************/
+
+/**
+ * What is written to the dump file.
+ */
+typedef struct _VGA_DUMP_DATA
+{
+	VGA_DUMP			tDump;
+
+	// Right after the dump, with no padding.
+	BUGSHOT_STATISTICS	tStatistics;
+} VGA_DUMP_DATA, *PVGA_DUMP_DATA;
+typedef VGA_DUMP_DATA CONST *PCVGA_DUMP_DATA;
+C_ASSERT(FIELD_OFFSET(VGA_DUMP_DATA, tStatistics) == sizeof(VGA_DUMP));
+C_ASSERT(sizeof(VGA_DUMP_DATA) == sizeof(VGA_DUMP) + sizeof(BUGSHOT_STATISTICS));
+
+
 /** Globals *************************************************************/
 
 STATIC LONG g_bEnabled = FALSE;
@@ -79,7 +96,7 @@ STATIC BOOLEAN g_bCallbackRegistered = FALSE;
  * Special alignment is due to bugcheck callback requirements.
  * See the MSDN for more information.
  */
-STATIC DECLSPEC_ALIGN(PAGE_SIZE) VGA_DUMP g_tDump = { 0 };
+STATIC DECLSPEC_ALIGN(PAGE_SIZE) VGA_DUMP_DATA g_tDump = { 0 };
 
 /**
  * Counts how many times interrupts have been disabled.
@@ -209,18 +226,20 @@ vgadump_WriteRegisterByte(
  * Dumps the VGA's DAC palette to the given buffer.
  *
  * @param[out]	ptPaletteEntries	Will receive the palette's contents.
- *									This buffer must be large enough to contain
- *									the whole palette.
+ * @param[in]	nEntries			Number of entries to dump,
+ *									starting from the first.
  */
 STATIC
 VOID
 vgadump_DumpPalette(
-	_Out_writes_all_(VGA_DAC_PALETTE_ENTRIES)	PPALETTE_ENTRY	ptPaletteEntries
+	_Out_writes_all_(nEntries)	PPALETTE_ENTRY	ptPaletteEntries,
+	_In_						ULONG			nEntries
 )
 {
 	ULONG	nEntry	= 0;
 
 	ASSERT(NULL != ptPaletteEntries);
+	ASSERT(nEntries <= VGA_DAC_PALETTE_ENTRIES);
 
 	//
 	// NOTE: We don't use the safe register functions
@@ -233,7 +252,7 @@ vgadump_DumpPalette(
 		// Set the first DAC index to read from
 		__outbyte(DAC_READ_INDEX_REG, 0);
 
-		for (nEntry = 0; nEntry < VGA_DAC_PALETTE_ENTRIES; ++nEntry)
+		for (nEntry = 0; nEntry < nEntries; ++nEntry)
 		{
 			ptPaletteEntries[nEntry].nRed =  __inbyte(DAC_DATA_REG);
 			ptPaletteEntries[nEntry].nGreen = __inbyte(DAC_DATA_REG);
@@ -322,6 +341,8 @@ vgadump_BugCheckSecondaryDumpDataCallback(
 {
 	PKBUGCHECK_SECONDARY_DUMP_DATA	ptSecondaryDumpData	= (PKBUGCHECK_SECONDARY_DUMP_DATA)pvReasonSpecificData;
 	ULONG							nPlane				= 0;
+	ULONGLONG						nStartCycles		= 0;
+	ULONGLONG						nCopyStartCycles	= 0;
 
 #ifndef DBG
 	UNREFERENCED_PARAMETER(eReason);
@@ -334,6 +355,8 @@ vgadump_BugCheckSecondaryDumpDataCallback(
 	ASSERT(NULL != pvReasonSpecificData);
 	ASSERT(sizeof(*ptSecondaryDumpData) == cbReasonSpecificData);
 
+	nStartCycles = ReadTimeStampCounter();
+
 	if (!VGADUMP_IsEnabled())
 	{
 		ptSecondaryDumpData->OutBuffer = NULL;
@@ -359,19 +382,29 @@ vgadump_BugCheckSecondaryDumpDataCallback(
 		(ptSecondaryDumpData->InBuffer == ptSecondaryDumpData->OutBuffer)
 	);
 
+	++(g_tDump.tStatistics.nCallbacks);
+
 	// First time around, fill the dump data.
 	if (NULL == ptSecondaryDumpData->OutBuffer)
 	{
-		vgadump_DumpPalette(g_tDump.atPaletteEntries);
+		nCopyStartCycles = ReadTimeStampCounter();
+
+		vgadump_DumpPalette(g_tDump.tDump.atPaletteEntries, ARRAYSIZE(g_tDump.tDump.atPaletteEntries));
 
 		for (nPlane = 0; nPlane < VGA_PLANES; ++nPlane)
 		{
 			vgadump_DumpPlane(nPlane,
-							  g_tDump.atPlanes[nPlane],
-							  sizeof(g_tDump.atPlanes[nPlane]));
+							  g_tDump.tDump.atPlanes[nPlane],
+							  sizeof(g_tDump.tDump.atPlanes[nPlane]));
 		}
+
+		g_tDump.tStatistics.cbCopied += sizeof(g_tDump.tDump);
+		g_tDump.tStatistics.nCopyCycles += ReadTimeStampCounter() - nCopyStartCycles;
 	}
 
+	g_tDump.tStatistics.nSignature = BUGSHOT_STATISTICS_SIGNATURE;
+	g_tDump.tStatistics.nCallbackCycles += ReadTimeStampCounter() - nStartCycles;
+
 	ptSecondaryDumpData->OutBuffer = &g_tDump;
 	ptSecondaryDumpData->OutBufferLength = sizeof(g_tDump);
 	ptSecondaryDumpData->Guid = g_tVgaDumpGuid;
@@ -466,3 +499,19 @@ VGADUMP_IsEnabled(VOID)
 {
 	return !!InterlockedCompareExchange(&g_bEnabled, TRUE, TRUE);
 }
+
+VOID
+VGADUMP_ReadPalette(
+	_Out_writes_all_(nEntries)	PPALETTE_ENTRY	ptPaletteEntries,
+	_In_						ULONG			nEntries
+)
+{
+	ASSERT(NULL != ptPaletteEntries);
+	ASSERT(nEntries <= VGA_DAC_PALETTE_ENTRIES);
+
+	// Same as in vgadump_BugCheckSecondaryDumpDataCallback,
+	// since this is also called while the system is crashing.
+	g_nInterruptDisableCount = vgadump_AreInterruptsEnabled() ? 0 : 1;
+
+	vgadump_DumpPalette(ptPaletteEntries, nEntries);
+}
@@ -13,6 +13,8 @@
 /** Headers *************************************************************/
 #include <ntifs.h>
 
+#include <Drink.h>
+
 
 /** Functions ***********************************************************/
 
@@ -57,3 +59,18 @@ VGADUMP_Disable(VOID);
 */
 BOOLEAN
 VGADUMP_IsEnabled(VOID);
+
+/**
+ * @brief Reads the VGA's DAC palette.
+ *
+ * @param[out]	ptPaletteEntries	Will receive the palette's contents.
+ * @param[in]	nEntries			Number of entries to read,
+ *									starting from the first.
+ *
+ * @remark Works whether the module is enabled or not.
+*/
+VOID
+VGADUMP_ReadPalette(
+	_Out_writes_all_(nEntries)	PPALETTE_ENTRY	ptPaletteEntries,
+	_In_						ULONG			nEntries
+);
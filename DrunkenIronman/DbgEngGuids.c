@@ -1,2 +0,0 @@
-#include <initguid.h>
-#include <DbgEng.h>
@@ -0,0 +1,908 @@
+/**
+ * @file Deflate.c
+ * @author biko
+ * @date 2026-10-17
+ *
+ * Deflate module implementation.
+ *
+ * The compressor emits a single block using the fixed Huffman codes
+ * of RFC 1951, with hash-chain LZ77 matching over a 32 KB window.
+ * Screenshots are mostly flat colour, so the long matches
+ * matter far more than the codes.
+ */
+
+/** Headers *************************************************************/
+#include <Windows.h>
+#include <assert.h>
+
+#include "Util.h"
+
+#include "Deflate.h"
+
+
+/** Constants ***********************************************************/
+
+/**
+ * Size of the LZ77 window.
+ */
+#define DEFLATE_WINDOW_SIZE (32 * 1024)
+#define DEFLATE_WINDOW_MASK (DEFLATE_WINDOW_SIZE - 1)
+
+/**
+ * Limits on the length of a match.
+ */
+#define DEFLATE_MIN_MATCH (3)
+#define DEFLATE_MAX_MATCH (258)
+
+/**
+ * Input is only compressed while at least this much of it is buffered,
+ * so that matches are never cut short. Except when finishing, of course.
+ */
+#define DEFLATE_MIN_LOOKAHEAD (DEFLATE_MAX_MATCH + DEFLATE_MIN_MATCH + 1)
+
+/**
+ * Size of the hash table heading the match chains.
+ */
+#define DEFLATE_HASH_BITS (15)
+#define DEFLATE_HASH_SIZE (1 << DEFLATE_HASH_BITS)
+#define DEFLATE_HASH_MASK (DEFLATE_HASH_SIZE - 1)
+
+/**
+ * Marks the end of a match chain.
+ */
+#define DEFLATE_NIL (-1)
+
+/**
+ * Maximal size of a stored block.
+ */
+#define DEFLATE_MAX_STORED_BLOCK (0xFFFF)
+
+/**
+ * Block types.
+ */
+#define DEFLATE_BLOCK_STORED (0)
+#define DEFLATE_BLOCK_FIXED (1)
+
+/**
+ * The end-of-block symbol.
+ */
+#define DEFLATE_END_OF_BLOCK (256)
+
+/**
+ * Modulus of the Adler-32 checksum.
+ */
+#define DEFLATE_ADLER_BASE (65521)
+
+/**
+ * zlib stream header: deflate with a 32 KB window, no dictionary.
+ */
+#define DEFLATE_ZLIB_CMF (0x78)
+#define DEFLATE_ZLIB_FLG (0x01)
+
+/**
+ * Maximal match chain lengths, per compression level.
+ */
+STATIC CONST DWORD g_anMaxChain[DEFLATE_MAX_LEVEL + 1] = {
+	0, 4, 8, 16, 32, 64, 128, 256, 1024, 4096
+};
+
+/**
+ * Base lengths and extra bits of the length symbols (257-285).
+ */
+STATIC CONST WORD g_anLengthBase[29] = {
+	  3,   4,   5,   6,   7,   8,   9,  10,  11,  13,
+	 15,  17,  19,  23,  27,  31,  35,  43,  51,  59,
+	 67,  83,  99, 115, 131, 163, 195, 227, 258
+};
+STATIC CONST BYTE g_anLengthExtraBits[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+	1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+	4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+/**
+ * Base distances and extra bits of the distance symbols.
+ */
+STATIC CONST WORD g_anDistanceBase[30] = {
+	    1,     2,     3,     4,     5,     7,     9,    13,
+	   17,    25,    33,    49,    65,    97,   129,   193,
+	  257,   385,   513,   769,  1025,  1537,  2049,  3073,
+	 4097,  6145,  8193, 12289, 16385, 24577
+};
+STATIC CONST BYTE g_anDistanceExtraBits[30] = {
+	 0,  0,  0,  0,  1,  1,  2,  2,  3,  3,
+	 4,  4,  5,  5,  6,  6,  7,  7,  8,  8,
+	 9,  9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/**
+ * Maps (length - DEFLATE_MIN_MATCH) to a length symbol index.
+ */
+STATIC CONST BYTE g_anLengthSymbol[256] = {
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  8,  9,  9, 10, 10, 11, 11,
+	12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15,
+	16, 16, 16, 16, 16, 16, 16, 16, 17, 17, 17, 17, 17, 17, 17, 17,
+	18, 18, 18, 18, 18, 18, 18, 18, 19, 19, 19, 19, 19, 19, 19, 19,
+	20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20,
+	21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21,
+	22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22,
+	23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23,
+	24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+	24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+	25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25,
+	25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25,
+	26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26,
+	26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26,
+	27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27,
+	27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 28
+};
+
+/**
+ * Maps a distance to a distance symbol.
+ * Distances up to 256 are looked up with (distance - 1),
+ * the rest with 256 + ((distance - 1) >> 7).
+ */
+STATIC CONST BYTE g_anDistanceSymbol[512] = {
+	 0,  1,  2,  3,  4,  4,  5,  5,  6,  6,  6,  6,  7,  7,  7,  7,
+	 8,  8,  8,  8,  8,  8,  8,  8,  9,  9,  9,  9,  9,  9,  9,  9,
+	10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,
+	11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+	13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+	14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+	14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+	14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+	14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+	15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+	15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+	15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+	15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+	 0,  0, 16, 17, 18, 18, 19, 19, 20, 20, 20, 20, 21, 21, 21, 21,
+	22, 22, 22, 22, 22, 22, 22, 22, 23, 23, 23, 23, 23, 23, 23, 23,
+	24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+	25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25,
+	26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26,
+	26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26,
+	27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27,
+	27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27,
+	28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29,
+	29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29,
+	29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29,
+	29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29
+};
+
+/**
+ * The fixed literal/length codes, bit-reversed for LSB-first output.
+ */
+STATIC CONST WORD g_anFixedLiteralCodes[288] = {
+	0x00C, 0x08C, 0x04C, 0x0CC, 0x02C, 0x0AC, 0x06C, 0x0EC,
+	0x01C, 0x09C, 0x05C, 0x0DC, 0x03C, 0x0BC, 0x07C, 0x0FC,
+	0x002, 0x082, 0x042, 0x0C2, 0x022, 0x0A2, 0x062, 0x0E2,
+	0x012, 0x092, 0x052, 0x0D2, 0x032, 0x0B2, 0x072, 0x0F2,
+	0x00A, 0x08A, 0x04A, 0x0CA, 0x02A, 0x0AA, 0x06A, 0x0EA,
+	0x01A, 0x09A, 0x05A, 0x0DA, 0x03A, 0x0BA, 0x07A, 0x0FA,
+	0x006, 0x086, 0x046, 0x0C6, 0x026, 0x0A6, 0x066, 0x0E6,
+	0x016, 0x096, 0x056, 0x0D6, 0x036, 0x0B6, 0x076, 0x0F6,
+	0x00E, 0x08E, 0x04E, 0x0CE, 0x02E, 0x0AE, 0x06E, 0x0EE,
+	0x01E, 0x09E, 0x05E, 0x0DE, 0x03E, 0x0BE, 0x07E, 0x0FE,
+	0x001, 0x081, 0x041, 0x0C1, 0x021, 0x0A1, 0x061, 0x0E1,
+	0x011, 0x091, 0x051, 0x0D1, 0x031, 0x0B1, 0x071, 0x0F1,
+	0x009, 0x089, 0x049, 0x0C9, 0x029, 0x0A9, 0x069, 0x0E9,
+	0x019, 0x099, 0x059, 0x0D9, 0x039, 0x0B9, 0x079, 0x0F9,
+	0x005, 0x085, 0x045, 0x0C5, 0x025, 0x0A5, 0x065, 0x0E5,
+	0x015, 0x095, 0x055, 0x0D5, 0x035, 0x0B5, 0x075, 0x0F5,
+	0x00D, 0x08D, 0x04D, 0x0CD, 0x02D, 0x0AD, 0x06D, 0x0ED,
+	0x01D, 0x09D, 0x05D, 0x0DD, 0x03D, 0x0BD, 0x07D, 0x0FD,
+	0x013, 0x113, 0x093, 0x193, 0x053, 0x153, 0x0D3, 0x1D3,
+	0x033, 0x133, 0x0B3, 0x1B3, 0x073, 0x173, 0x0F3, 0x1F3,
+	0x00B, 0x10B, 0x08B, 0x18B, 0x04B, 0x14B, 0x0CB, 0x1CB,
+	0x02B, 0x12B, 0x0AB, 0x1AB, 0x06B, 0x16B, 0x0EB, 0x1EB,
+	0x01B, 0x11B, 0x09B, 0x19B, 0x05B, 0x15B, 0x0DB, 0x1DB,
+	0x03B, 0x13B, 0x0BB, 0x1BB, 0x07B, 0x17B, 0x0FB, 0x1FB,
+	0x007, 0x107, 0x087, 0x187, 0x047, 0x147, 0x0C7, 0x1C7,
+	0x027, 0x127, 0x0A7, 0x1A7, 0x067, 0x167, 0x0E7, 0x1E7,
+	0x017, 0x117, 0x097, 0x197, 0x057, 0x157, 0x0D7, 0x1D7,
+	0x037, 0x137, 0x0B7, 0x1B7, 0x077, 0x177, 0x0F7, 0x1F7,
+	0x00F, 0x10F, 0x08F, 0x18F, 0x04F, 0x14F, 0x0CF, 0x1CF,
+	0x02F, 0x12F, 0x0AF, 0x1AF, 0x06F, 0x16F, 0x0EF, 0x1EF,
+	0x01F, 0x11F, 0x09F, 0x19F, 0x05F, 0x15F, 0x0DF, 0x1DF,
+	0x03F, 0x13F, 0x0BF, 0x1BF, 0x07F, 0x17F, 0x0FF, 0x1FF,
+	0x000, 0x040, 0x020, 0x060, 0x010, 0x050, 0x030, 0x070,
+	0x008, 0x048, 0x028, 0x068, 0x018, 0x058, 0x038, 0x078,
+	0x004, 0x044, 0x024, 0x064, 0x014, 0x054, 0x034, 0x074,
+	0x003, 0x083, 0x043, 0x0C3, 0x023, 0x0A3, 0x063, 0x0E3
+};
+STATIC CONST BYTE g_anFixedLiteralBits[288] = {
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+	9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+	9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+	9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+	9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+	9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+	9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+	7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 8, 8, 8, 8, 8, 8, 8
+};
+
+/**
+ * The fixed distance codes (5 bits each), bit-reversed.
+ */
+STATIC CONST BYTE g_anFixedDistanceCodes[30] = {
+	0x00, 0x10, 0x08, 0x18, 0x04, 0x14, 0x0C, 0x1C, 0x02, 0x12,
+	0x0A, 0x1A, 0x06, 0x16, 0x0E, 0x1E, 0x01, 0x11, 0x09, 0x19,
+	0x05, 0x15, 0x0D, 0x1D, 0x03, 0x13, 0x0B, 0x1B, 0x07, 0x17
+};
+
+
+/** Typedefs ************************************************************/
+
+typedef struct _DEFLATE_CONTEXT
+{
+	DWORD				nLevel;
+	DWORD				nMaxChain;
+
+	PFN_DEFLATE_OUTPUT	pfnOutput;
+	PVOID				pvContext;
+
+	// First failure of the output callback.
+	// Once set, all output is dropped.
+	HRESULT				hrError;
+
+	// Two windows' worth of input.
+	// The lower half is the history, the upper half the lookahead.
+	PBYTE				pcWindow;
+
+	// Next position to compress, and end of the buffered input.
+	DWORD				nPosition;
+	DWORD				nEnd;
+
+	// Heads of the match chains, and the links between them.
+	PLONG				pnHead;
+	PLONG				pnPrevious;
+
+	// Bits not yet written out.
+	ULONGLONG			nBitBuffer;
+	DWORD				nBitCount;
+
+	PBYTE				pcOutput;
+	DWORD				cbOutput;
+
+	ULONG				nAdlerLow;
+	ULONG				nAdlerHigh;
+
+	BOOL				bStarted;
+} DEFLATE_CONTEXT, *PDEFLATE_CONTEXT;
+typedef DEFLATE_CONTEXT CONST *PCDEFLATE_CONTEXT;
+
+
+/** Functions ***********************************************************/
+
+/**
+ * Hands the buffered output to the callback.
+ *
+ * @param[in,out]	ptContext	The compressor.
+ */
+STATIC
+VOID
+deflate_FlushOutput(
+	_Inout_	PDEFLATE_CONTEXT	ptContext
+)
+{
+	assert(NULL != ptContext);
+
+	if ((0 != ptContext->cbOutput) && SUCCEEDED(ptContext->hrError))
+	{
+		ptContext->hrError = ptContext->pfnOutput(ptContext->pvContext,
+												  ptContext->pcOutput,
+												  ptContext->cbOutput);
+	}
+
+	ptContext->cbOutput = 0;
+}
+
+/**
+ * Appends a byte to the output.
+ *
+ * @param[in,out]	ptContext	The compressor.
+ * @param[in]		nByte		The byte.
+ */
+STATIC
+FORCEINLINE
+VOID
+deflate_PutByte(
+	_Inout_	PDEFLATE_CONTEXT	ptContext,
+	_In_	BYTE				nByte
+)
+{
+	ptContext->pcOutput[ptContext->cbOutput] = nByte;
+	++(ptContext->cbOutput);
+
+	if (DEFLATE_OUTPUT_BUFFER_SIZE == ptContext->cbOutput)
+	{
+		deflate_FlushOutput(ptContext);
+	}
+}
+
+/**
+ * Appends bits to the output, LSB first.
+ *
+ * @param[in,out]	ptContext	The compressor.
+ * @param[in]		nBits		The bits.
+ * @param[in]		nCount		Number of bits (at most 32).
+ */
+STATIC
+FORCEINLINE
+VOID
+deflate_PutBits(
+	_Inout_	PDEFLATE_CONTEXT	ptContext,
+	_In_	DWORD				nBits,
+	_In_	DWORD				nCount
+)
+{
+	ptContext->nBitBuffer |= (ULONGLONG)nBits << ptContext->nBitCount;
+	ptContext->nBitCount += nCount;
+
+	while (ptContext->nBitCount >= 8)
+	{
+		deflate_PutByte(ptContext, (BYTE)(ptContext->nBitBuffer));
+		ptContext->nBitBuffer >>= 8;
+		ptContext->nBitCount -= 8;
+	}
+}
+
+/**
+ * Pads the output to a byte boundary.
+ *
+ * @param[in,out]	ptContext	The compressor.
+ */
+STATIC
+VOID
+deflate_AlignToByte(
+	_Inout_	PDEFLATE_CONTEXT	ptContext
+)
+{
+	if (0 != ptContext->nBitCount)
+	{
+		deflate_PutBits(ptContext, 0, 8 - ptContext->nBitCount);
+	}
+}
+
+/**
+ * Writes a literal byte with the fixed codes.
+ *
+ * @param[in,out]	ptContext	The compressor.
+ * @param[in]		nLiteral	The literal.
+ */
+STATIC
+FORCEINLINE
+VOID
+deflate_PutLiteral(
+	_Inout_	PDEFLATE_CONTEXT	ptContext,
+	_In_	DWORD				nLiteral
+)
+{
+	deflate_PutBits(ptContext, g_anFixedLiteralCodes[nLiteral], g_anFixedLiteralBits[nLiteral]);
+}
+
+/**
+ * Writes a match with the fixed codes.
+ *
+ * @param[in,out]	ptContext	The compressor.
+ * @param[in]		cbLength	Length of the match.
+ * @param[in]		nDistance	Distance of the match.
+ */
+STATIC
+VOID
+deflate_PutMatch(
+	_Inout_	PDEFLATE_CONTEXT	ptContext,
+	_In_	DWORD				cbLength,
+	_In_	DWORD				nDistance
+)
+{
+	DWORD	nSymbol	= 0;
+
+	assert((cbLength >= DEFLATE_MIN_MATCH) && (cbLength <= DEFLATE_MAX_MATCH));
+	assert((nDistance >= 1) && (nDistance <= DEFLATE_WINDOW_SIZE));
+
+	nSymbol = g_anLengthSymbol[cbLength - DEFLATE_MIN_MATCH];
+	deflate_PutLiteral(ptContext, DEFLATE_END_OF_BLOCK + 1 + nSymbol);
+	deflate_PutBits(ptContext, cbLength - g_anLengthBase[nSymbol], g_anLengthExtraBits[nSymbol]);
+
+	nSymbol =
+		(nDistance <= 256)
+		? (g_anDistanceSymbol[nDistance - 1])
+		: (g_anDistanceSymbol[256 + ((nDistance - 1) >> 7)]);
+	deflate_PutBits(ptContext, g_anFixedDistanceCodes[nSymbol], 5);
+	deflate_PutBits(ptContext, nDistance - g_anDistanceBase[nSymbol], g_anDistanceExtraBits[nSymbol]);
+}
+
+/**
+ * Computes the hash of the 3 bytes at a position.
+ *
+ * @param[in]	pcData	The bytes.
+ *
+ * @returns The hash.
+ */
+STATIC
+FORCEINLINE
+DWORD
+deflate_Hash(
+	_In_reads_bytes_(DEFLATE_MIN_MATCH)	CONST BYTE *	pcData
+)
+{
+	return ((pcData[0] << 10) ^ (pcData[1] << 5) ^ pcData[2]) & DEFLATE_HASH_MASK;
+}
+
+/**
+ * Inserts a position into its match chain.
+ *
+ * @param[in,out]	ptContext	The compressor.
+ * @param[in]		nPosition	The position.
+ *
+ * @returns Head of the chain before the insertion.
+ */
+STATIC
+FORCEINLINE
+LONG
+deflate_Insert(
+	_Inout_	PDEFLATE_CONTEXT	ptContext,
+	_In_	DWORD				nPosition
+)
+{
+	DWORD	nHash	= 0;
+	LONG	nHead	= 0;
+
+	nHash = deflate_Hash(&(ptContext->pcWindow[nPosition]));
+	nHead = ptContext->pnHead[nHash];
+
+	ptContext->pnPrevious[nPosition & DEFLATE_WINDOW_MASK] = nHead;
+	ptContext->pnHead[nHash] = (LONG)nPosition;
+
+	return nHead;
+}
+
+/**
+ * Finds the longest match for the current position.
+ *
+ * @param[in]	ptContext	The compressor.
+ * @param[in]	nCandidate	Head of the current position's match chain.
+ * @param[out]	pnDistance	Will receive the distance of the match.
+ *
+ * @returns Length of the match, 0 if none was found.
+ */
+STATIC
+DWORD
+deflate_LongestMatch(
+	_In_	PCDEFLATE_CONTEXT	ptContext,
+	_In_	LONG				nCandidate,
+	_Out_	PDWORD				pnDistance
+)
+{
+	CONST BYTE *	pcCurrent	= NULL;
+	CONST BYTE *	pcCandidate	= NULL;
+	DWORD			cbMaxLength	= 0;
+	LONG			nLimit		= 0;
+	DWORD			nChain		= 0;
+	DWORD			cbLength	= 0;
+	DWORD			cbBest		= 0;
+
+	assert(NULL != pnDistance);
+
+	*pnDistance = 0;
+
+	pcCurrent = &(ptContext->pcWindow[ptContext->nPosition]);
+	cbMaxLength = min(DEFLATE_MAX_MATCH, ptContext->nEnd - ptContext->nPosition);
+
+	// Distances of a full window are avoided, so that a stale link
+	// can never lead back to the current position.
+	nLimit = (LONG)(ptContext->nPosition) - DEFLATE_WINDOW_SIZE;
+
+	for (nChain = ptContext->nMaxChain;
+		 (nChain > 0) && (DEFLATE_NIL != nCandidate) && (nCandidate > nLimit);
+		 --nChain)
+	{
+		pcCandidate = &(ptContext->pcWindow[nCandidate]);
+
+		// Quick rejection: a better match must extend past the current best.
+		if ((pcCandidate[cbBest] == pcCurrent[cbBest]) &&
+			(pcCandidate[0] == pcCurrent[0]))
+		{
+			for (cbLength = 1;
+				 (cbLength < cbMaxLength) && (pcCandidate[cbLength] == pcCurrent[cbLength]);
+				 ++cbLength)
+			{
+			}
+
+			if (cbLength > cbBest)
+			{
+				cbBest = cbLength;
+				*pnDistance = ptContext->nPosition - (DWORD)nCandidate;
+
+				if (cbLength == cbMaxLength)
+				{
+					break;
+				}
+			}
+		}
+
+		nCandidate = ptContext->pnPrevious[nCandidate & DEFLATE_WINDOW_MASK];
+	}
+
+	return (cbBest >= DEFLATE_MIN_MATCH) ? (cbBest) : (0);
+}
+
+/**
+ * Moves the upper half of the window to the lower half,
+ * making room for more input.
+ *
+ * @param[in,out]	ptContext	The compressor.
+ */
+STATIC
+VOID
+deflate_SlideWindow(
+	_Inout_	PDEFLATE_CONTEXT	ptContext
+)
+{
+	DWORD	nIndex	= 0;
+
+	assert(ptContext->nPosition >= DEFLATE_WINDOW_SIZE);
+
+	MoveMemory(ptContext->pcWindow,
+			   ptContext->pcWindow + DEFLATE_WINDOW_SIZE,
+			   ptContext->nEnd - DEFLATE_WINDOW_SIZE);
+	ptContext->nPosition -= DEFLATE_WINDOW_SIZE;
+	ptContext->nEnd -= DEFLATE_WINDOW_SIZE;
+
+	for (nIndex = 0; nIndex < DEFLATE_HASH_SIZE; ++nIndex)
+	{
+		ptContext->pnHead[nIndex] =
+			(ptContext->pnHead[nIndex] >= DEFLATE_WINDOW_SIZE)
+			? (ptContext->pnHead[nIndex] - DEFLATE_WINDOW_SIZE)
+			: (DEFLATE_NIL);
+	}
+	for (nIndex = 0; nIndex < DEFLATE_WINDOW_SIZE; ++nIndex)
+	{
+		ptContext->pnPrevious[nIndex] =
+			(ptContext->pnPrevious[nIndex] >= DEFLATE_WINDOW_SIZE)
+			? (ptContext->pnPrevious[nIndex] - DEFLATE_WINDOW_SIZE)
+			: (DEFLATE_NIL);
+	}
+}
+
+/**
+ * Writes the buffered input as stored blocks.
+ *
+ * @param[in,out]	ptContext	The compressor.
+ * @param[in]		bFinish		Whether this is the end of the input.
+ */
+STATIC
+VOID
+deflate_CompressStored(
+	_Inout_	PDEFLATE_CONTEXT	ptContext,
+	_In_	BOOL				bFinish
+)
+{
+	DWORD	cbBlock	= 0;
+	BOOL	bFinal	= FALSE;
+	DWORD	nIndex	= 0;
+
+	// Blocks are kept under a window in size,
+	// so that the window can always slide.
+	for (;;)
+	{
+		cbBlock = min(ptContext->nEnd - ptContext->nPosition, DEFLATE_WINDOW_SIZE);
+		bFinal = bFinish && (ptContext->nEnd - ptContext->nPosition == cbBlock);
+		if ((!bFinal) && (cbBlock < DEFLATE_WINDOW_SIZE))
+		{
+			break;
+		}
+
+		deflate_PutBits(ptContext, bFinal, 1);
+		deflate_PutBits(ptContext, DEFLATE_BLOCK_STORED, 2);
+		deflate_AlignToByte(ptContext);
+		deflate_PutBits(ptContext, cbBlock, 16);
+		deflate_PutBits(ptContext, ~cbBlock & DEFLATE_MAX_STORED_BLOCK, 16);
+
+		for (nIndex = 0; nIndex < cbBlock; ++nIndex)
+		{
+			deflate_PutByte(ptContext, ptContext->pcWindow[ptContext->nPosition + nIndex]);
+		}
+		ptContext->nPosition += cbBlock;
+
+		if (bFinal)
+		{
+			break;
+		}
+	}
+}
+
+/**
+ * Compresses the buffered input into the fixed-code block.
+ *
+ * @param[in,out]	ptContext	The compressor.
+ * @param[in]		bFinish		Whether this is the end of the input.
+ */
+STATIC
+VOID
+deflate_CompressFixed(
+	_Inout_	PDEFLATE_CONTEXT	ptContext,
+	_In_	BOOL				bFinish
+)
+{
+	DWORD	cbLookahead	= 0;
+	LONG	nCandidate	= DEFLATE_NIL;
+	DWORD	cbMatch		= 0;
+	DWORD	nDistance	= 0;
+	DWORD	nEnd		= 0;
+
+	if (!ptContext->bStarted)
+	{
+		// Everything goes into a single, final block.
+		deflate_PutBits(ptContext, TRUE, 1);
+		deflate_PutBits(ptContext, DEFLATE_BLOCK_FIXED, 2);
+		ptContext->bStarted = TRUE;
+	}
+
+	while (ptContext->nPosition < ptContext->nEnd)
+	{
+		cbLookahead = ptContext->nEnd - ptContext->nPosition;
+		if ((!bFinish) && (cbLookahead < DEFLATE_MIN_LOOKAHEAD))
+		{
+			break;
+		}
+
+		cbMatch = 0;
+		if (cbLookahead >= DEFLATE_MIN_MATCH)
+		{
+			nCandidate = deflate_Insert(ptContext, ptContext->nPosition);
+			cbMatch = deflate_LongestMatch(ptContext, nCandidate, &nDistance);
+		}
+
+		if (0 == cbMatch)
+		{
+			deflate_PutLiteral(ptContext, ptContext->pcWindow[ptContext->nPosition]);
+			++(ptContext->nPosition);
+			continue;
+		}
+
+		deflate_PutMatch(ptContext, cbMatch, nDistance);
+
+		// Keep the chains complete for the positions inside the match.
+		nEnd = ptContext->nPosition + cbMatch;
+		for (++(ptContext->nPosition); ptContext->nPosition < nEnd; ++(ptContext->nPosition))
+		{
+			if (ptContext->nEnd - ptContext->nPosition >= DEFLATE_MIN_MATCH)
+			{
+				(VOID)deflate_Insert(ptContext, ptContext->nPosition);
+			}
+		}
+	}
+}
+
+/**
+ * Compresses the buffered input.
+ *
+ * @param[in,out]	ptContext	The compressor.
+ * @param[in]		bFinish		Whether this is the end of the input.
+ */
+STATIC
+VOID
+deflate_Compress(
+	_Inout_	PDEFLATE_CONTEXT	ptContext,
+	_In_	BOOL				bFinish
+)
+{
+	if (0 == ptContext->nLevel)
+	{
+		deflate_CompressStored(ptContext, bFinish);
+	}
+	else
+	{
+		deflate_CompressFixed(ptContext, bFinish);
+	}
+}
+
+HRESULT
+DEFLATE_Create(
+	_In_		DWORD				nLevel,
+	_In_		PFN_DEFLATE_OUTPUT	pfnOutput,
+	_In_opt_	PVOID				pvContext,
+	_Out_		PHDEFLATE			phDeflate
+)
+{
+	HRESULT				hrResult	= E_FAIL;
+	PDEFLATE_CONTEXT	ptContext	= NULL;
+	DWORD				nIndex		= 0;
+
+	if ((nLevel > DEFLATE_MAX_LEVEL) ||
+		(NULL == pfnOutput) ||
+		(NULL == phDeflate))
+	{
+		hrResult = E_INVALIDARG;
+		goto lblCleanup;
+	}
+
+	ptContext = HEAPALLOC(sizeof(*ptContext));
+	if (NULL == ptContext)
+	{
+		hrResult = E_OUTOFMEMORY;
+		goto lblCleanup;
+	}
+
+	ptContext->nLevel = nLevel;
+	ptContext->nMaxChain = g_anMaxChain[nLevel];
+	ptContext->pfnOutput = pfnOutput;
+	ptContext->pvContext = pvContext;
+	ptContext->hrError = S_OK;
+	ptContext->nAdlerLow = 1;
+	ptContext->nAdlerHigh = 0;
+
+	ptContext->pcWindow = HEAPALLOC(2 * DEFLATE_WINDOW_SIZE);
+	ptContext->pnHead = HEAPALLOC(DEFLATE_HASH_SIZE * sizeof(*(ptContext->pnHead)));
+	ptContext->pnPrevious = HEAPALLOC(DEFLATE_WINDOW_SIZE * sizeof(*(ptContext->pnPrevious)));
+	ptContext->pcOutput = HEAPALLOC(DEFLATE_OUTPUT_BUFFER_SIZE);
+	if ((NULL == ptContext->pcWindow) ||
+		(NULL == ptContext->pnHead) ||
+		(NULL == ptContext->pnPrevious) ||
+		(NULL == ptContext->pcOutput))
+	{
+		hrResult = E_OUTOFMEMORY;
+		goto lblCleanup;
+	}
+
+	for (nIndex = 0; nIndex < DEFLATE_HASH_SIZE; ++nIndex)
+	{
+		ptContext->pnHead[nIndex] = DEFLATE_NIL;
+	}
+	for (nIndex = 0; nIndex < DEFLATE_WINDOW_SIZE; ++nIndex)
+	{
+		ptContext->pnPrevious[nIndex] = DEFLATE_NIL;
+	}
+
+	deflate_PutByte(ptContext, DEFLATE_ZLIB_CMF);
+	deflate_PutByte(ptContext, DEFLATE_ZLIB_FLG);
+
+	// Transfer ownership:
+	*phDeflate = (HDEFLATE)ptContext;
+	ptContext = NULL;
+
+	hrResult = S_OK;
+
+lblCleanup:
+	if (NULL != ptContext)
+	{
+		DEFLATE_Close((HDEFLATE)ptContext);
+		ptContext = NULL;
+	}
+
+	return hrResult;
+}
+
+VOID
+DEFLATE_Close(
+	_In_	HDEFLATE	hDeflate
+)
+{
+	PDEFLATE_CONTEXT	ptContext	= (PDEFLATE_CONTEXT)hDeflate;
+
+	if (NULL == hDeflate)
+	{
+		goto lblCleanup;
+	}
+
+	HEAPFREE(ptContext->pcOutput);
+	HEAPFREE(ptContext->pnPrevious);
+	HEAPFREE(ptContext->pnHead);
+	HEAPFREE(ptContext->pcWindow);
+	HEAPFREE(ptContext);
+
+lblCleanup:
+	return;
+}
+
+HRESULT
+DEFLATE_Write(
+	_In_						HDEFLATE	hDeflate,
+	_In_reads_bytes_(cbData)	LPCVOID		pvData,
+	_In_						DWORD		cbData
+)
+{
+	HRESULT				hrResult	= E_FAIL;
+	PDEFLATE_CONTEXT	ptContext	= (PDEFLATE_CONTEXT)hDeflate;
+	CONST BYTE *		pcData		= (CONST BYTE *)pvData;
+	DWORD				cbToCopy	= 0;
+	DWORD				nIndex		= 0;
+
+	if ((NULL == hDeflate) ||
+		((NULL == pvData) && (0 != cbData)))
+	{
+		hrResult = E_INVALIDARG;
+		goto lblCleanup;
+	}
+
+	while (cbData > 0)
+	{
+		if (2 * DEFLATE_WINDOW_SIZE == ptContext->nEnd)
+		{
+			deflate_SlideWindow(ptContext);
+		}
+
+		cbToCopy = min(cbData, 2 * DEFLATE_WINDOW_SIZE - ptContext->nEnd);
+		CopyMemory(ptContext->pcWindow + ptContext->nEnd, pcData, cbToCopy);
+
+		// The Adler-32 sums are reduced often enough not to overflow.
+		for (nIndex = 0; nIndex < cbToCopy; ++nIndex)
+		{
+			ptContext->nAdlerLow += pcData[nIndex];
+			ptContext->nAdlerHigh += ptContext->nAdlerLow;
+			if (0 == (nIndex & 0xFFF))
+			{
+				ptContext->nAdlerLow %= DEFLATE_ADLER_BASE;
+				ptContext->nAdlerHigh %= DEFLATE_ADLER_BASE;
+			}
+		}
+		ptContext->nAdlerLow %= DEFLATE_ADLER_BASE;
+		ptContext->nAdlerHigh %= DEFLATE_ADLER_BASE;
+
+		ptContext->nEnd += cbToCopy;
+		pcData += cbToCopy;
+		cbData -= cbToCopy;
+
+		deflate_Compress(ptContext, FALSE);
+	}
+
+	hrResult = ptContext->hrError;
+
+lblCleanup:
+	return hrResult;
+}
+
+HRESULT
+DEFLATE_Finish(
+	_In_	HDEFLATE	hDeflate
+)
+{
+	HRESULT				hrResult	= E_FAIL;
+	PDEFLATE_CONTEXT	ptContext	= (PDEFLATE_CONTEXT)hDeflate;
+
+	if (NULL == hDeflate)
+	{
+		hrResult = E_INVALIDARG;
+		goto lblCleanup;
+	}
+
+	deflate_Compress(ptContext, TRUE);
+	if (0 != ptContext->nLevel)
+	{
+		deflate_PutLiteral(ptContext, DEFLATE_END_OF_BLOCK);
+	}
+	deflate_AlignToByte(ptContext);
+
+	// The checksum is big-endian.
+	deflate_PutByte(ptContext, (BYTE)(ptContext->nAdlerHigh >> 8));
+	deflate_PutByte(ptContext, (BYTE)(ptContext->nAdlerHigh));
+	deflate_PutByte(ptContext, (BYTE)(ptContext->nAdlerLow >> 8));
+	deflate_PutByte(ptContext, (BYTE)(ptContext->nAdlerLow));
+
+	deflate_FlushOutput(ptContext);
+
+	hrResult = ptContext->hrError;
+
+lblCleanup:
+	return hrResult;
+}
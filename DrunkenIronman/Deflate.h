@@ -0,0 +1,117 @@
+/**
+ * @file Deflate.h
+ * @author biko
+ * @date 2026-10-17
+ *
+ * Deflate module public header.
+ * Contains a streaming compressor producing zlib (RFC 1950) streams.
+ */
+#pragma once
+
+/** Headers *************************************************************/
+#include <Windows.h>
+
+
+/** Constants ***********************************************************/
+
+/**
+ * Compression levels.
+ * Level 0 stores the data uncompressed. Higher levels search
+ * longer for matches, trading speed for size.
+ */
+#define DEFLATE_MIN_LEVEL (0)
+#define DEFLATE_MAX_LEVEL (9)
+#define DEFLATE_DEFAULT_LEVEL (1)
+
+/**
+ * Maximal size of a single piece of compressed output, in bytes.
+ */
+#define DEFLATE_OUTPUT_BUFFER_SIZE (64 * 1024)
+
+
+/** Typedefs ************************************************************/
+
+/**
+ * Handle to a compressor.
+ */
+DECLARE_HANDLE(HDEFLATE);
+typedef HDEFLATE *PHDEFLATE;
+
+/**
+ * Receives compressed output.
+ *
+ * @param[in]	pvContext	Context passed to DEFLATE_Create.
+ * @param[in]	pvData		Compressed data.
+ * @param[in]	cbData		Size of the data, in bytes.
+ *
+ * @returns HRESULT
+ */
+typedef
+HRESULT
+FN_DEFLATE_OUTPUT(
+	_In_opt_					PVOID	pvContext,
+	_In_reads_bytes_(cbData)	LPCVOID	pvData,
+	_In_						DWORD	cbData
+);
+typedef FN_DEFLATE_OUTPUT *PFN_DEFLATE_OUTPUT;
+
+
+/** Functions ***********************************************************/
+
+/**
+ * Creates a compressor.
+ *
+ * @param[in]	nLevel		Compression level.
+ * @param[in]	pfnOutput	Callback receiving the compressed output.
+ * @param[in]	pvContext	Context for the callback.
+ * @param[out]	phDeflate	Will receive a handle to the compressor.
+ *
+ * @returns HRESULT
+ */
+HRESULT
+DEFLATE_Create(
+	_In_		DWORD				nLevel,
+	_In_		PFN_DEFLATE_OUTPUT	pfnOutput,
+	_In_opt_	PVOID				pvContext,
+	_Out_		PHDEFLATE			phDeflate
+);
+
+/**
+ * Destroys a compressor.
+ *
+ * @param[in]	hDeflate	Compressor to destroy.
+ */
+VOID
+DEFLATE_Close(
+	_In_	HDEFLATE	hDeflate
+);
+
+/**
+ * Compresses data.
+ *
+ * @param[in]	hDeflate	The compressor.
+ * @param[in]	pvData		Data to compress.
+ * @param[in]	cbData		Size of the data, in bytes.
+ *
+ * @returns HRESULT
+ *
+ * @remark The output callback is invoked as output becomes available.
+ */
+HRESULT
+DEFLATE_Write(
+	_In_						HDEFLATE	hDeflate,
+	_In_reads_bytes_(cbData)	LPCVOID		pvData,
+	_In_						DWORD		cbData
+);
+
+/**
+ * Compresses the remaining data and terminates the stream.
+ *
+ * @param[in]	hDeflate	The compressor.
+ *
+ * @returns HRESULT
+ */
+HRESULT
+DEFLATE_Finish(
+	_In_	HDEFLATE	hDeflate
+);
@@ -4,43 +4,1133 @@
  * @date 2016-07-30
  *
  * DumpParse module implementation.
+ *
+ * The secondary dump data (the tagged blobs written by
+ * KeRegisterBugCheckReasonCallback callbacks) is located directly
+ * in the dump file, without going through the debugger engine.
+ */
+
+/** Headers *************************************************************/
+#include <Windows.h>
+#include <intsafe.h>
+#include <strsafe.h>
+#include <assert.h>
+
+#include "Util.h"
+#include "Debug.h"
+
+#include "DumpParse.h"
+
+
+/** Constants ***********************************************************/
+
+/**
+ * Signature at the start of every kernel dump file ("PAGE").
+ */
+#define DUMP_SIGNATURE ('EGAP')
+
+/**
+ * Validity signature of a 32-bit kernel dump file ("DUMP").
+ */
+#define DUMP_VALID_DUMP32 ('PMUD')
+
+/**
+ * Validity signature of a 64-bit kernel dump file ("DU64").
+ */
+#define DUMP_VALID_DUMP64 ('46UD')
+
+/**
+ * Signature of the header following the main header
+ * in summary and kernel bitmap dumps ("SDMP").
+ */
+#define DUMP_SUMMARY_SIGNATURE ('PMDS')
+
+/**
+ * Signature of the header following the main header
+ * in full bitmap dumps ("FDMP").
+ */
+#define DUMP_FULL_BITMAP_SIGNATURE ('PMDF')
+
+/**
+ * Signatures at the start of the secondary data area ("DumpBlob").
+ */
+#define DUMP_BLOB_SIGNATURE1 ('pmuD')
+#define DUMP_BLOB_SIGNATURE2 ('bolB')
+
+/**
+ * Size of a page of physical memory in the dump file.
+ */
+#define DUMP_PAGE_SIZE (0x1000)
+
+/**
+ * Initial capacity of the blob index, in entries.
+ */
+#define DUMP_INDEX_INITIAL_CAPACITY (8)
+
+/**
+ * Signature of an index cache file ("DIDX").
+ */
+#define DUMP_INDEX_CACHE_SIGNATURE ('XDID')
+
+/**
+ * Version of the index cache file format.
+ */
+#define DUMP_INDEX_CACHE_VERSION (1)
+
+/**
+ * Extension appended to the dump's path to obtain the index cache's path.
+ */
+#define DUMP_INDEX_CACHE_EXTENSION (L".idx")
+
+
+/** Enums ***************************************************************/
+
+/**
+ * Dump types, as stored in the dump header.
+ */
+typedef enum _DUMP_TYPE
+{
+	DUMP_TYPE_FULL = 1,
+	DUMP_TYPE_SUMMARY = 2,
+	DUMP_TYPE_HEADER = 3,
+	DUMP_TYPE_TRIAGE = 4,
+	DUMP_TYPE_BITMAP_FULL = 5,
+	DUMP_TYPE_BITMAP_KERNEL = 6,
+	DUMP_TYPE_AUTOMATIC = 7,
+} DUMP_TYPE, *PDUMP_TYPE;
+
+
+/** Typedefs ************************************************************/
+
+#pragma pack(push, 1)
+
+/**
+ * A run of physical pages in a 32-bit dump.
+ */
+typedef struct _PHYSICAL_MEMORY_RUN32
+{
+	ULONG	nBasePage;
+	ULONG	nPageCount;
+} PHYSICAL_MEMORY_RUN32, *PPHYSICAL_MEMORY_RUN32;
+typedef PHYSICAL_MEMORY_RUN32 CONST *PCPHYSICAL_MEMORY_RUN32;
+
+/**
+ * Physical memory layout of a 32-bit dump.
+ */
+typedef struct _PHYSICAL_MEMORY_DESCRIPTOR32
+{
+	ULONG					nRuns;
+	ULONG					nPages;
+	PHYSICAL_MEMORY_RUN32	atRuns[ANYSIZE_ARRAY];
+} PHYSICAL_MEMORY_DESCRIPTOR32, *PPHYSICAL_MEMORY_DESCRIPTOR32;
+typedef PHYSICAL_MEMORY_DESCRIPTOR32 CONST *PCPHYSICAL_MEMORY_DESCRIPTOR32;
+
+/**
+ * A run of physical pages in a 64-bit dump.
+ */
+typedef struct _PHYSICAL_MEMORY_RUN64
+{
+	ULONGLONG	nBasePage;
+	ULONGLONG	nPageCount;
+} PHYSICAL_MEMORY_RUN64, *PPHYSICAL_MEMORY_RUN64;
+typedef PHYSICAL_MEMORY_RUN64 CONST *PCPHYSICAL_MEMORY_RUN64;
+
+/**
+ * Physical memory layout of a 64-bit dump.
+ */
+typedef struct _PHYSICAL_MEMORY_DESCRIPTOR64
+{
+	ULONG					nRuns;
+	ULONG					nPadding;
+	ULONGLONG				nPages;
+	PHYSICAL_MEMORY_RUN64	atRuns[ANYSIZE_ARRAY];
+} PHYSICAL_MEMORY_DESCRIPTOR64, *PPHYSICAL_MEMORY_DESCRIPTOR64;
+typedef PHYSICAL_MEMORY_DESCRIPTOR64 CONST *PCPHYSICAL_MEMORY_DESCRIPTOR64;
+
+/**
+ * Header of a 32-bit kernel dump file.
+ * Only the fields we care about are spelled out.
+ */
+typedef struct _DUMP_HEADER32
+{
+	ULONG	nSignature;
+	ULONG	nValidDump;
+	ULONG	nMajorVersion;
+	ULONG	nMinorVersion;
+	UCHAR	acReserved0[0x64 - 0x10];
+	UCHAR	acPhysicalMemoryBlock[700];
+	UCHAR	acReserved1[0xF88 - 0x320];
+	ULONG	eDumpType;
+	UCHAR	acReserved2[0x1000 - 0xF8C];
+} DUMP_HEADER32, *PDUMP_HEADER32;
+typedef DUMP_HEADER32 CONST *PCDUMP_HEADER32;
+C_ASSERT(0x064 == FIELD_OFFSET(DUMP_HEADER32, acPhysicalMemoryBlock));
+C_ASSERT(0xF88 == FIELD_OFFSET(DUMP_HEADER32, eDumpType));
+C_ASSERT(0x1000 == sizeof(DUMP_HEADER32));
+
+/**
+ * Header of a 64-bit kernel dump file.
+ * Only the fields we care about are spelled out.
+ */
+typedef struct _DUMP_HEADER64
+{
+	ULONG	nSignature;
+	ULONG	nValidDump;
+	ULONG	nMajorVersion;
+	ULONG	nMinorVersion;
+	UCHAR	acReserved0[0x88 - 0x10];
+	UCHAR	acPhysicalMemoryBlock[700];
+	UCHAR	acReserved1[0xF98 - 0x344];
+	ULONG	eDumpType;
+	UCHAR	acReserved2[0x2000 - 0xF9C];
+} DUMP_HEADER64, *PDUMP_HEADER64;
+typedef DUMP_HEADER64 CONST *PCDUMP_HEADER64;
+C_ASSERT(0x088 == FIELD_OFFSET(DUMP_HEADER64, acPhysicalMemoryBlock));
+C_ASSERT(0xF98 == FIELD_OFFSET(DUMP_HEADER64, eDumpType));
+C_ASSERT(0x2000 == sizeof(DUMP_HEADER64));
+
+/**
+ * Header following the main header in 32-bit summary dumps.
+ * Followed by the bitmap of present pages, and then by the pages themselves.
+ */
+typedef struct _SUMMARY_DUMP32
+{
+	ULONG	nSignature;
+	ULONG	nValidDump;
+	ULONG	fDumpOptions;
+
+	// Offset of the first page from the start of the file.
+	ULONG	cbHeader;
+
+	// Number of bits in the bitmap.
+	ULONG	nBitmapBits;
+
+	// Number of pages present in the dump.
+	ULONG	nPresentPages;
+} SUMMARY_DUMP32, *PSUMMARY_DUMP32;
+typedef SUMMARY_DUMP32 CONST *PCSUMMARY_DUMP32;
+
+/**
+ * Header following the main header in 64-bit bitmap dumps.
+ * Followed by the bitmap of present pages, and then by the pages themselves.
+ */
+typedef struct _BITMAP_DUMP64
+{
+	ULONG		nSignature;
+	ULONG		nValidDump;
+	UCHAR		acReserved0[0x20 - 0x08];
+
+	// Offset of the first page from the start of the file.
+	ULONGLONG	cbFirstPage;
+
+	// Number of pages present in the dump.
+	ULONGLONG	nPresentPages;
+
+	// Number of bits in the bitmap.
+	ULONGLONG	nBitmapBits;
+} BITMAP_DUMP64, *PBITMAP_DUMP64;
+typedef BITMAP_DUMP64 CONST *PCBITMAP_DUMP64;
+C_ASSERT(0x20 == FIELD_OFFSET(BITMAP_DUMP64, cbFirstPage));
+C_ASSERT(0x38 == sizeof(BITMAP_DUMP64));
+
+/**
+ * Header following the main header in triage dumps (minidumps).
+ * Only the fields we care about are spelled out.
+ */
+typedef struct _TRIAGE_DUMP
+{
+	ULONG	nServicePackBuild;
+
+	// Size of the triage dump, including the main header.
+	ULONG	cbDump;
+} TRIAGE_DUMP, *PTRIAGE_DUMP;
+typedef TRIAGE_DUMP CONST *PCTRIAGE_DUMP;
+
+/**
+ * Header at the start of the secondary data area.
+ */
+typedef struct _DUMP_BLOB_FILE_HEADER
+{
+	ULONG	nSignature1;
+	ULONG	nSignature2;
+	ULONG	cbHeader;
+	ULONG	nBuildNumber;
+} DUMP_BLOB_FILE_HEADER, *PDUMP_BLOB_FILE_HEADER;
+typedef DUMP_BLOB_FILE_HEADER CONST *PCDUMP_BLOB_FILE_HEADER;
+
+/**
+ * Header preceding each blob in the secondary data area.
+ * The header is followed by cbPrePad bytes of padding,
+ * the data itself, and then cbPostPad bytes of padding.
+ */
+typedef struct _DUMP_BLOB_HEADER
+{
+	ULONG	cbHeader;
+	GUID	tTag;
+	ULONG	cbData;
+	ULONG	cbPrePad;
+	ULONG	cbPostPad;
+} DUMP_BLOB_HEADER, *PDUMP_BLOB_HEADER;
+typedef DUMP_BLOB_HEADER CONST *PCDUMP_BLOB_HEADER;
+
+#pragma pack(pop)
+
+/**
+ * Either of the dump headers.
+ */
+typedef union _DUMP_HEADER
+{
+	DUMP_HEADER32	tHeader32;
+	DUMP_HEADER64	tHeader64;
+} DUMP_HEADER, *PDUMP_HEADER;
+typedef DUMP_HEADER CONST *PCDUMP_HEADER;
+
+/**
+ * Location of a single blob in the secondary data area.
+ */
+typedef struct _DUMP_INDEX_ENTRY
+{
+	GUID		tTag;
+	ULONGLONG	cbDataOffset;
+	DWORD		cbData;
+	DWORD		nReserved;
+} DUMP_INDEX_ENTRY, *PDUMP_INDEX_ENTRY;
+typedef DUMP_INDEX_ENTRY CONST *PCDUMP_INDEX_ENTRY;
+
+/**
+ * Header of an index cache file.
+ * Followed by nEntries DUMP_INDEX_ENTRY structures.
+ *
+ * The cache is valid only if the size, last write time,
+ * and header checksum all match the dump file.
+ */
+typedef struct _DUMP_INDEX_CACHE_HEADER
+{
+	ULONG		nSignature;
+	ULONG		nVersion;
+	ULONGLONG	cbFile;
+	FILETIME	tLastWriteTime;
+	ULONGLONG	nHeaderChecksum;
+	ULONG		nEntries;
+	ULONG		nReserved;
+} DUMP_INDEX_CACHE_HEADER, *PDUMP_INDEX_CACHE_HEADER;
+typedef DUMP_INDEX_CACHE_HEADER CONST *PCDUMP_INDEX_CACHE_HEADER;
+
+typedef struct _DUMP_FILE_CONTEXT
+{
+	HANDLE				hFile;
+	ULONGLONG			cbFile;
+
+	// Read-only mapping of the whole file.
+	// Created on first use.
+	HANDLE				hMapping;
+
+	// Locations of all the blobs in the secondary data area.
+	PDUMP_INDEX_ENTRY	ptIndex;
+	DWORD				nIndexEntries;
+} DUMP_FILE_CONTEXT, *PDUMP_FILE_CONTEXT;
+typedef CONST DUMP_FILE_CONTEXT *PCDUMP_FILE_CONTEXT;
+
+
+/** Functions ***********************************************************/
+
+/**
+ * Reads a range of bytes from the dump file.
+ *
+ * @param[in]	hFile		The dump file.
+ * @param[in]	cbOffset	Offset to read from.
+ * @param[out]	pvBuffer	Will receive the data.
+ * @param[in]	cbBuffer	Number of bytes to read.
+ *
+ * @returns HRESULT
+ *
+ * @remark Fails if the file is too short.
+ */
+STATIC
+HRESULT
+dumpparse_ReadAt(
+	_In_							HANDLE		hFile,
+	_In_							ULONGLONG	cbOffset,
+	_Out_writes_bytes_(cbBuffer)	PVOID		pvBuffer,
+	_In_							DWORD		cbBuffer
+)
+{
+	HRESULT		hrResult	= E_FAIL;
+	OVERLAPPED	tOverlapped	= { 0 };
+	DWORD		cbRead		= 0;
+
+	assert(INVALID_HANDLE_VALUE != hFile);
+	assert(NULL != pvBuffer);
+
+	tOverlapped.Offset = (DWORD)(cbOffset & MAXDWORD);
+	tOverlapped.OffsetHigh = (DWORD)(cbOffset >> 32);
+
+	if (!ReadFile(hFile, pvBuffer, cbBuffer, &cbRead, &tOverlapped))
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+
+	if (cbRead != cbBuffer)
+	{
+		hrResult = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+		goto lblCleanup;
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+/**
+ * Computes the offset of the secondary data area
+ * in a full kernel dump.
+ *
+ * @param[in]	cbHeader		Size of the dump header.
+ * @param[in]	nPages			Number of physical pages in the dump.
+ * @param[out]	pcbOffset		Will receive the offset.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+dumpparse_GetFullDumpSecondaryDataOffset(
+	_In_	ULONGLONG	cbHeader,
+	_In_	ULONGLONG	nPages,
+	_Out_	PULONGLONG	pcbOffset
+)
+{
+	HRESULT		hrResult	= E_FAIL;
+	ULONGLONG	cbPages		= 0;
+
+	assert(NULL != pcbOffset);
+
+	// The physical pages follow the header back to back,
+	// and the secondary data follows the pages.
+	hrResult = ULongLongMult(nPages, DUMP_PAGE_SIZE, &cbPages);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	hrResult = ULongLongAdd(cbHeader, cbPages, pcbOffset);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+/**
+ * Computes the offset of the secondary data area
+ * in a summary or bitmap dump.
+ *
+ * @param[in]	ptContext		The dump file.
+ * @param[in]	bIs64Bit		Whether this is a 64-bit dump.
+ * @param[in]	cbMainHeader	Size of the main dump header.
+ * @param[out]	pcbOffset		Will receive the offset.
+ *
+ * @returns HRESULT
+ *
+ * @remark The present pages are stored back to back after the bitmap,
+ *         so their count is enough to skip them. The bitmap itself
+ *         is never read.
+ */
+STATIC
+HRESULT
+dumpparse_GetBitmapDumpSecondaryDataOffset(
+	_In_	PCDUMP_FILE_CONTEXT	ptContext,
+	_In_	BOOL				bIs64Bit,
+	_In_	ULONGLONG			cbMainHeader,
+	_Out_	PULONGLONG			pcbOffset
+)
+{
+	HRESULT			hrResult		= E_FAIL;
+	SUMMARY_DUMP32	tSummary32		= { 0 };
+	BITMAP_DUMP64	tBitmap64		= { 0 };
+	ULONG			nSignature		= 0;
+	ULONGLONG		cbFirstPage		= 0;
+	ULONGLONG		nPresentPages	= 0;
+
+	assert(NULL != ptContext);
+	assert(NULL != pcbOffset);
+
+	if (bIs64Bit)
+	{
+		hrResult = dumpparse_ReadAt(ptContext->hFile, cbMainHeader, &tBitmap64, sizeof(tBitmap64));
+		nSignature = tBitmap64.nSignature;
+		cbFirstPage = tBitmap64.cbFirstPage;
+		nPresentPages = tBitmap64.nPresentPages;
+	}
+	else
+	{
+		hrResult = dumpparse_ReadAt(ptContext->hFile, cbMainHeader, &tSummary32, sizeof(tSummary32));
+		nSignature = tSummary32.nSignature;
+		cbFirstPage = tSummary32.cbHeader;
+		nPresentPages = tSummary32.nPresentPages;
+	}
+	if (FAILED(hrResult))
+	{
+		PROGRESS("The bitmap header is truncated.");
+		goto lblCleanup;
+	}
+
+	if ((DUMP_SUMMARY_SIGNATURE != nSignature) &&
+		(DUMP_FULL_BITMAP_SIGNATURE != nSignature))
+	{
+		PROGRESS("The bitmap header is corrupt.");
+		hrResult = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+		goto lblCleanup;
+	}
+
+	if (cbFirstPage < cbMainHeader)
+	{
+		PROGRESS("The bitmap header is corrupt.");
+		hrResult = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+		goto lblCleanup;
+	}
+
+	hrResult = dumpparse_GetFullDumpSecondaryDataOffset(cbFirstPage, nPresentPages, pcbOffset);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+/**
+ * Computes the offset of the secondary data area
+ * in a triage dump (minidump).
+ *
+ * @param[in]	ptContext		The dump file.
+ * @param[in]	cbMainHeader	Size of the main dump header.
+ * @param[out]	pcbOffset		Will receive the offset.
+ *
+ * @returns HRESULT
+ *
+ * @remark The secondary data follows the triage data,
+ *         possibly aligned to a page boundary.
+ */
+STATIC
+HRESULT
+dumpparse_GetTriageDumpSecondaryDataOffset(
+	_In_	PCDUMP_FILE_CONTEXT	ptContext,
+	_In_	ULONGLONG			cbMainHeader,
+	_Out_	PULONGLONG			pcbOffset
+)
+{
+	HRESULT					hrResult		= E_FAIL;
+	TRIAGE_DUMP				tTriage			= { 0 };
+	ULONGLONG				acbCandidates[2];
+	DWORD					nCandidate		= 0;
+	DUMP_BLOB_FILE_HEADER	tFileHeader		= { 0 };
+
+	assert(NULL != ptContext);
+	assert(NULL != pcbOffset);
+
+	hrResult = dumpparse_ReadAt(ptContext->hFile, cbMainHeader, &tTriage, sizeof(tTriage));
+	if (FAILED(hrResult))
+	{
+		PROGRESS("The triage header is truncated.");
+		goto lblCleanup;
+	}
+
+	if (tTriage.cbDump < cbMainHeader)
+	{
+		PROGRESS("The triage header is corrupt.");
+		hrResult = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+		goto lblCleanup;
+	}
+
+	acbCandidates[0] = tTriage.cbDump;
+	acbCandidates[1] = ((ULONGLONG)(tTriage.cbDump) + DUMP_PAGE_SIZE - 1) & ~((ULONGLONG)DUMP_PAGE_SIZE - 1);
+
+	for (nCandidate = 0; nCandidate < ARRAYSIZE(acbCandidates); ++nCandidate)
+	{
+		if (FAILED(dumpparse_ReadAt(ptContext->hFile,
+									acbCandidates[nCandidate],
+									&tFileHeader,
+									sizeof(tFileHeader))))
+		{
+			continue;
+		}
+
+		if ((DUMP_BLOB_SIGNATURE1 == tFileHeader.nSignature1) &&
+			(DUMP_BLOB_SIGNATURE2 == tFileHeader.nSignature2))
+		{
+			break;
+		}
+	}
+
+	// If neither candidate has secondary data,
+	// the index will simply come out empty.
+	*pcbOffset =
+		(nCandidate < ARRAYSIZE(acbCandidates))
+		? (acbCandidates[nCandidate])
+		: (acbCandidates[0]);
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+/**
+ * Locates the secondary data area of a dump file.
+ *
+ * @param[in]	ptContext	The dump file.
+ * @param[in]	ptHeader	The dump header.
+ * @param[in]	cbHeader	Number of valid bytes in the header.
+ * @param[out]	pcbOffset	Will receive the offset of the secondary data.
+ *
+ * @returns HRESULT
+ *
+ * @remark The offset is computed from the page counts in the headers,
+ *         without walking the physical memory runs or the page bitmap.
+ */
+STATIC
+HRESULT
+dumpparse_LocateSecondaryData(
+	_In_						PCDUMP_FILE_CONTEXT	ptContext,
+	_In_reads_bytes_(cbHeader)	PCDUMP_HEADER		ptHeader,
+	_In_						DWORD				cbHeader,
+	_Out_						PULONGLONG			pcbOffset
+)
+{
+	HRESULT							hrResult		= E_FAIL;
+	BOOL							bIs64Bit		= FALSE;
+	ULONG							eDumpType		= 0;
+	ULONGLONG						cbMainHeader	= 0;
+	ULONGLONG						nPages			= 0;
+	PCPHYSICAL_MEMORY_DESCRIPTOR32	ptMemory32		= NULL;
+	PCPHYSICAL_MEMORY_DESCRIPTOR64	ptMemory64		= NULL;
+
+	assert(NULL != ptContext);
+	assert(NULL != ptHeader);
+	assert(NULL != pcbOffset);
+
+	if ((cbHeader < sizeof(ptHeader->tHeader32)) ||
+		(DUMP_SIGNATURE != ptHeader->tHeader32.nSignature))
+	{
+		PROGRESS("Not a kernel dump file.");
+		hrResult = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+		goto lblCleanup;
+	}
+
+	switch (ptHeader->tHeader32.nValidDump)
+	{
+	case DUMP_VALID_DUMP32:
+		bIs64Bit = FALSE;
+		eDumpType = ptHeader->tHeader32.eDumpType;
+		cbMainHeader = sizeof(ptHeader->tHeader32);
+		ptMemory32 = (PCPHYSICAL_MEMORY_DESCRIPTOR32)&(ptHeader->tHeader32.acPhysicalMemoryBlock);
+		nPages = ptMemory32->nPages;
+		break;
+
+	case DUMP_VALID_DUMP64:
+		if (cbHeader < sizeof(ptHeader->tHeader64))
+		{
+			PROGRESS("The dump header is truncated.");
+			hrResult = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+			goto lblCleanup;
+		}
+
+		bIs64Bit = TRUE;
+		eDumpType = ptHeader->tHeader64.eDumpType;
+		cbMainHeader = sizeof(ptHeader->tHeader64);
+		ptMemory64 = (PCPHYSICAL_MEMORY_DESCRIPTOR64)&(ptHeader->tHeader64.acPhysicalMemoryBlock);
+		nPages = ptMemory64->nPages;
+		break;
+
+	default:
+		PROGRESS("Not a kernel dump file.");
+		hrResult = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+		goto lblCleanup;
+	}
+
+	switch (eDumpType)
+	{
+	case DUMP_TYPE_FULL:
+		hrResult = dumpparse_GetFullDumpSecondaryDataOffset(cbMainHeader, nPages, pcbOffset);
+		if (FAILED(hrResult))
+		{
+			PROGRESS("The physical memory descriptor is corrupt.");
+			goto lblCleanup;
+		}
+		break;
+
+	case DUMP_TYPE_SUMMARY:
+	case DUMP_TYPE_BITMAP_FULL:
+	case DUMP_TYPE_BITMAP_KERNEL:
+	case DUMP_TYPE_AUTOMATIC:
+		hrResult = dumpparse_GetBitmapDumpSecondaryDataOffset(ptContext, bIs64Bit, cbMainHeader, pcbOffset);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+		break;
+
+	case DUMP_TYPE_TRIAGE:
+		hrResult = dumpparse_GetTriageDumpSecondaryDataOffset(ptContext, cbMainHeader, pcbOffset);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+		break;
+
+	default:
+		PROGRESS("Unsupported dump type %lu.", eDumpType);
+		hrResult = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+		goto lblCleanup;
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+/**
+ * Appends an entry to the dump's blob index.
+ *
+ * @param[in,out]	ptContext		The dump file.
+ * @param[in,out]	pnCapacity		Capacity of the index, in entries.
+ * @param[in]		ptTag			Tag of the blob.
+ * @param[in]		cbDataOffset	Offset of the blob's data.
+ * @param[in]		cbData			Size of the blob's data.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+dumpparse_AppendIndexEntry(
+	_Inout_	PDUMP_FILE_CONTEXT	ptContext,
+	_Inout_	PDWORD				pnCapacity,
+	_In_	LPCGUID				ptTag,
+	_In_	ULONGLONG			cbDataOffset,
+	_In_	DWORD				cbData
+)
+{
+	HRESULT				hrResult		= E_FAIL;
+	DWORD				nNewCapacity	= 0;
+	DWORD				cbNewIndex		= 0;
+	PDUMP_INDEX_ENTRY	ptNewIndex		= NULL;
+	PDUMP_INDEX_ENTRY	ptEntry			= NULL;
+
+	assert(NULL != ptContext);
+	assert(NULL != pnCapacity);
+	assert(NULL != ptTag);
+
+	if (ptContext->nIndexEntries == *pnCapacity)
+	{
+		nNewCapacity = max(*pnCapacity * 2, DUMP_INDEX_INITIAL_CAPACITY);
+
+		hrResult = DWordMult(nNewCapacity, sizeof(*ptNewIndex), &cbNewIndex);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+
+		ptNewIndex =
+			(NULL == ptContext->ptIndex)
+			? (HEAPALLOC(cbNewIndex))
+			: (HeapReAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, ptContext->ptIndex, cbNewIndex));
+		if (NULL == ptNewIndex)
+		{
+			PROGRESS("Oops. Ran out of memory.");
+			hrResult = E_OUTOFMEMORY;
+			goto lblCleanup;
+		}
+
+		ptContext->ptIndex = ptNewIndex;
+		*pnCapacity = nNewCapacity;
+	}
+
+	ptEntry = &(ptContext->ptIndex[ptContext->nIndexEntries]);
+	ptEntry->tTag = *ptTag;
+	ptEntry->cbDataOffset = cbDataOffset;
+	ptEntry->cbData = cbData;
+	++(ptContext->nIndexEntries);
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+/**
+ * Walks the secondary data area once and indexes all the blobs in it.
+ *
+ * @param[in,out]	ptContext	The dump file.
+ * @param[in]		cbOffset	Offset of the secondary data area.
+ *
+ * @returns HRESULT
+ *
+ * @remark If there is no secondary data area, the index is left empty.
+ */
+STATIC
+HRESULT
+dumpparse_BuildIndex(
+	_Inout_	PDUMP_FILE_CONTEXT	ptContext,
+	_In_	ULONGLONG			cbOffset
+)
+{
+	HRESULT					hrResult		= E_FAIL;
+	DUMP_BLOB_FILE_HEADER	tFileHeader		= { 0 };
+	DUMP_BLOB_HEADER		tBlobHeader		= { 0 };
+	ULONGLONG				cbDataOffset	= 0;
+	DWORD					nCapacity		= 0;
+
+	assert(NULL != ptContext);
+	assert(NULL == ptContext->ptIndex);
+
+	if ((cbOffset >= ptContext->cbFile) ||
+		(ptContext->cbFile - cbOffset < sizeof(tFileHeader)))
+	{
+		PROGRESS("The dump file contains no secondary data.");
+		hrResult = S_OK;
+		goto lblCleanup;
+	}
+
+	hrResult = dumpparse_ReadAt(ptContext->hFile, cbOffset, &tFileHeader, sizeof(tFileHeader));
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	if ((DUMP_BLOB_SIGNATURE1 != tFileHeader.nSignature1) ||
+		(DUMP_BLOB_SIGNATURE2 != tFileHeader.nSignature2) ||
+		(tFileHeader.cbHeader < sizeof(tFileHeader)))
+	{
+		PROGRESS("The dump file contains no secondary data.");
+		hrResult = S_OK;
+		goto lblCleanup;
+	}
+
+	cbOffset += tFileHeader.cbHeader;
+	while ((cbOffset < ptContext->cbFile) &&
+		   (ptContext->cbFile - cbOffset >= sizeof(tBlobHeader)))
+	{
+		hrResult = dumpparse_ReadAt(ptContext->hFile, cbOffset, &tBlobHeader, sizeof(tBlobHeader));
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+
+		if (tBlobHeader.cbHeader < sizeof(tBlobHeader))
+		{
+			// Either the end of the blobs, or garbage.
+			break;
+		}
+
+		// Blob sizes are 32-bit, so this can't overflow.
+		cbDataOffset = cbOffset + tBlobHeader.cbHeader + tBlobHeader.cbPrePad;
+		if ((cbDataOffset > ptContext->cbFile) ||
+			(ptContext->cbFile - cbDataOffset < tBlobHeader.cbData))
+		{
+			PROGRESS("The secondary data area is truncated.");
+			break;
+		}
+
+		hrResult = dumpparse_AppendIndexEntry(ptContext,
+											  &nCapacity,
+											  &(tBlobHeader.tTag),
+											  cbDataOffset,
+											  tBlobHeader.cbData);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+
+		cbOffset = cbDataOffset + tBlobHeader.cbData + tBlobHeader.cbPostPad;
+	}
+
+	PROGRESS("Indexed %lu blobs of secondary data.", ptContext->nIndexEntries);
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+/**
+ * Computes a checksum of the dump header (64-bit FNV-1a).
+ *
+ * @param[in]	pvHeader	The header.
+ * @param[in]	cbHeader	Size of the header, in bytes.
+ *
+ * @returns ULONGLONG
  */
+STATIC
+ULONGLONG
+dumpparse_ChecksumHeader(
+	_In_reads_bytes_(cbHeader)	LPCVOID	pvHeader,
+	_In_						DWORD	cbHeader
+)
+{
+	ULONGLONG		nChecksum	= 0xCBF29CE484222325ULL;
+	CONST BYTE *	pcCurrent	= (CONST BYTE *)pvHeader;
+	DWORD			nIndex		= 0;
 
-/** Headers *************************************************************/
-#include <Windows.h>
-#include <DbgEng.h>
+	assert(NULL != pvHeader);
 
-#include "Util.h"
-#include "Debug.h"
+	for (nIndex = 0; nIndex < cbHeader; ++nIndex)
+	{
+		nChecksum ^= pcCurrent[nIndex];
+		nChecksum *= 0x100000001B3ULL;
+	}
 
-#include "DumpParse.h"
+	return nChecksum;
+}
 
+/**
+ * Loads the blob index from a sidecar cache file.
+ *
+ * @param[in,out]	ptContext		The dump file.
+ * @param[in]		pwszCachePath	Path to the cache file.
+ * @param[in]		ptKey			Header the cache file is expected to have.
+ *
+ * @returns HRESULT
+ *
+ * @remark Fails if the cache file doesn't describe this exact dump file.
+ */
+STATIC
+HRESULT
+dumpparse_LoadIndexCache(
+	_Inout_	PDUMP_FILE_CONTEXT				ptContext,
+	_In_	PCWSTR							pwszCachePath,
+	_In_	PCDUMP_INDEX_CACHE_HEADER		ptKey
+)
+{
+	HRESULT						hrResult	= E_FAIL;
+	PVOID						pvCache		= NULL;
+	SIZE_T						cbCache		= 0;
+	PCDUMP_INDEX_CACHE_HEADER	ptHeader	= NULL;
+	PDUMP_INDEX_ENTRY			ptIndex		= NULL;
+	SIZE_T						cbIndex		= 0;
 
-/** Typedefs ************************************************************/
+	assert(NULL != ptContext);
+	assert(NULL != pwszCachePath);
+	assert(NULL != ptKey);
+	assert(NULL == ptContext->ptIndex);
 
-typedef struct _DUMP_FILE_CONTEXT
+	hrResult = UTIL_ReadFile(pwszCachePath, &pvCache, &cbCache);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	ptHeader = (PCDUMP_INDEX_CACHE_HEADER)pvCache;
+	if ((cbCache < sizeof(*ptHeader)) ||
+		(ptKey->nSignature != ptHeader->nSignature) ||
+		(ptKey->nVersion != ptHeader->nVersion) ||
+		(ptKey->cbFile != ptHeader->cbFile) ||
+		(0 != CompareFileTime(&(ptKey->tLastWriteTime), &(ptHeader->tLastWriteTime))) ||
+		(ptKey->nHeaderChecksum != ptHeader->nHeaderChecksum))
+	{
+		PROGRESS("The index cache is stale.");
+		hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		goto lblCleanup;
+	}
+
+	// The file must hold exactly the entries the header promises.
+	if (FAILED(SIZETMult(ptHeader->nEntries, sizeof(*ptIndex), &cbIndex)) ||
+		(cbCache - sizeof(*ptHeader) != cbIndex))
+	{
+		PROGRESS("The index cache is corrupt.");
+		hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		goto lblCleanup;
+	}
+
+	// Keep the allocation non-empty even if there are no entries.
+	ptIndex = HEAPALLOC(max(cbIndex, 1));
+	if (NULL == ptIndex)
+	{
+		PROGRESS("Oops. Ran out of memory.");
+		hrResult = E_OUTOFMEMORY;
+		goto lblCleanup;
+	}
+	CopyMemory(ptIndex, ptHeader + 1, cbIndex);
+
+	// Transfer ownership:
+	ptContext->ptIndex = ptIndex;
+	ptIndex = NULL;
+	ptContext->nIndexEntries = ptHeader->nEntries;
+
+	hrResult = S_OK;
+
+lblCleanup:
+	HEAPFREE(ptIndex);
+	HEAPFREE(pvCache);
+
+	return hrResult;
+}
+
+/**
+ * Saves the blob index to a sidecar cache file.
+ *
+ * @param[in]	ptContext		The dump file.
+ * @param[in]	pwszCachePath	Path to the cache file.
+ * @param[in]	ptKey			Header to write to the cache file.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+dumpparse_SaveIndexCache(
+	_In_	PCDUMP_FILE_CONTEXT			ptContext,
+	_In_	PCWSTR						pwszCachePath,
+	_In_	PCDUMP_INDEX_CACHE_HEADER	ptKey
+)
 {
-	IDebugClient *	piDebugClient;
-} DUMP_FILE_CONTEXT, *PDUMP_FILE_CONTEXT;
-typedef CONST DUMP_FILE_CONTEXT *PCDUMP_FILE_CONTEXT;
+	HRESULT					hrResult	= E_FAIL;
+	DUMP_INDEX_CACHE_HEADER	tHeader		= { 0 };
+	HANDLE					hCacheFile	= INVALID_HANDLE_VALUE;
+	DWORD					cbIndex		= 0;
+	DWORD					cbWritten	= 0;
 
+	assert(NULL != ptContext);
+	assert(NULL != pwszCachePath);
+	assert(NULL != ptKey);
 
-/** Functions ***********************************************************/
+	tHeader = *ptKey;
+	tHeader.nEntries = ptContext->nIndexEntries;
+	cbIndex = ptContext->nIndexEntries * sizeof(*(ptContext->ptIndex));
+
+	hCacheFile = CreateFileW(pwszCachePath,
+							 GENERIC_WRITE,
+							 0,
+							 NULL,
+							 CREATE_ALWAYS,
+							 FILE_ATTRIBUTE_NORMAL,
+							 NULL);
+	if (INVALID_HANDLE_VALUE == hCacheFile)
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+
+	if (!WriteFile(hCacheFile, &tHeader, sizeof(tHeader), &cbWritten, NULL))
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+	if (sizeof(tHeader) != cbWritten)
+	{
+		hrResult = E_UNEXPECTED;
+		goto lblCleanup;
+	}
+
+	if (cbIndex > 0)
+	{
+		if (!WriteFile(hCacheFile, ptContext->ptIndex, cbIndex, &cbWritten, NULL))
+		{
+			hrResult = HRESULT_FROM_WIN32(GetLastError());
+			goto lblCleanup;
+		}
+		if (cbIndex != cbWritten)
+		{
+			hrResult = E_UNEXPECTED;
+			goto lblCleanup;
+		}
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	CLOSE_FILE_HANDLE(hCacheFile);
+	if (FAILED(hrResult))
+	{
+		// Don't leave a partial cache behind.
+		(VOID)DeleteFileW(pwszCachePath);
+	}
+
+	return hrResult;
+}
+
+/**
+ * Finds a blob in the secondary data area.
+ *
+ * @param[in]	ptContext		The dump file.
+ * @param[in]	ptTag			Tag of the blob to find.
+ * @param[out]	pcbDataOffset	Will receive the offset of the blob's data.
+ * @param[out]	pcbData			Will receive the size of the blob's data.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+dumpparse_FindBlob(
+	_In_	PCDUMP_FILE_CONTEXT	ptContext,
+	_In_	LPCGUID				ptTag,
+	_Out_	PULONGLONG			pcbDataOffset,
+	_Out_	PDWORD				pcbData
+)
+{
+	HRESULT					hrResult	= E_FAIL;
+	DWORD					nEntry		= 0;
+	PCDUMP_INDEX_ENTRY		ptEntry		= NULL;
+
+	assert(NULL != ptContext);
+	assert(NULL != ptTag);
+	assert(NULL != pcbDataOffset);
+	assert(NULL != pcbData);
+
+	for (nEntry = 0; nEntry < ptContext->nIndexEntries; ++nEntry)
+	{
+		ptEntry = &(ptContext->ptIndex[nEntry]);
+
+		// The index may come from a cache file, so don't trust it blindly.
+		if (IsEqualGUID(ptTag, &(ptEntry->tTag)) &&
+			(ptEntry->cbDataOffset <= ptContext->cbFile) &&
+			(ptContext->cbFile - ptEntry->cbDataOffset >= ptEntry->cbData))
+		{
+			// Transfer ownership:
+			*pcbDataOffset = ptEntry->cbDataOffset;
+			*pcbData = ptEntry->cbData;
+
+			hrResult = S_OK;
+			goto lblCleanup;
+		}
+	}
+
+	// Not necessarily an error, so it's up to the caller to complain.
+	hrResult = HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+
+lblCleanup:
+	return hrResult;
+}
 
 HRESULT
 DUMPPARSE_Open(
 	_In_opt_	PCWSTR	pwszPath,
+	_In_		DWORD	fFlags,
 	_Out_		PHDUMP	phDump
 )
 {
-	HRESULT				hrResult			= E_FAIL;
-	PDUMP_FILE_CONTEXT	ptContext			= NULL;
-	IDebugClient *		piDebugClient		= NULL;
-	DWORD				eType				= REG_NONE;
-	DWORD				cbSystemDumpFile	= 0;
-	PWSTR				pwszSystemDumpFile	= NULL;
-	PWSTR				pwszExpandedPath	= NULL;
-	PSTR				pszExpandedPath		= NULL;
+	HRESULT					hrResult			= E_FAIL;
+	PDUMP_FILE_CONTEXT		ptContext			= NULL;
+	DWORD					eType				= REG_NONE;
+	DWORD					cbSystemDumpFile	= 0;
+	PWSTR					pwszSystemDumpFile	= NULL;
+	PWSTR					pwszExpandedPath	= NULL;
+	LARGE_INTEGER			cbFile				= { 0 };
+	PDUMP_HEADER			ptHeader			= NULL;
+	DWORD					cbHeader			= 0;
+	ULONGLONG				cbSecondaryData		= 0;
+	DUMP_INDEX_CACHE_HEADER	tCacheKey			= { 0 };
+	SIZE_T					cchCachePath		= 0;
+	PWSTR					pwszCachePath		= NULL;
+	BOOL					bIndexLoaded		= FALSE;
 
 	if (NULL == phDump)
 	{
@@ -58,13 +1148,7 @@ DUMPPARSE_Open(
 		hrResult = E_OUTOFMEMORY;
 		goto lblCleanup;
 	}
-
-	hrResult = DebugCreate(&IID_IDebugClient, &piDebugClient);
-	if (FAILED(hrResult))
-	{
-		PROGRESS("Failed obtaining the IDebugClient4.");
-		goto lblCleanup;
-	}
+	ptContext->hFile = INVALID_HANDLE_VALUE;
 
 	if (NULL == pwszPath)
 	{
@@ -97,32 +1181,122 @@ DUMPPARSE_Open(
 		goto lblCleanup;
 	}
 
-	hrResult = UTIL_DuplicateStringUnicodeToAnsi(pwszExpandedPath, &pszExpandedPath);
-	if (FAILED(hrResult))
+	ptContext->hFile = CreateFileW(pwszExpandedPath,
+								   GENERIC_READ,
+								   FILE_SHARE_READ | FILE_SHARE_DELETE,
+								   NULL,
+								   OPEN_EXISTING,
+								   FILE_ATTRIBUTE_NORMAL,
+								   NULL);
+	if (INVALID_HANDLE_VALUE == ptContext->hFile)
+	{
+		PROGRESS("Failed opening the dump file.");
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+
+	if (!GetFileSizeEx(ptContext->hFile, &cbFile))
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+	assert(cbFile.QuadPart >= 0);
+	ptContext->cbFile = (ULONGLONG)(cbFile.QuadPart);
+
+	ptHeader = HEAPALLOC(sizeof(*ptHeader));
+	if (NULL == ptHeader)
 	{
+		PROGRESS("Oops. Ran out of memory.");
+		hrResult = E_OUTOFMEMORY;
 		goto lblCleanup;
 	}
 
-	hrResult = piDebugClient->lpVtbl->OpenDumpFile(piDebugClient, pszExpandedPath);
+	// 32-bit dumps have a smaller header, so read as much as we can.
+	cbHeader = (DWORD)min(ptContext->cbFile, sizeof(*ptHeader));
+	hrResult = dumpparse_ReadAt(ptContext->hFile, 0, ptHeader, cbHeader);
 	if (FAILED(hrResult))
 	{
-		PROGRESS("Failed opening the dump file.");
+		PROGRESS("Failed reading the dump header.");
 		goto lblCleanup;
 	}
 
+	if (0 != (fFlags & DUMPPARSE_OPEN_INDEX_CACHE))
+	{
+		tCacheKey.nSignature = DUMP_INDEX_CACHE_SIGNATURE;
+		tCacheKey.nVersion = DUMP_INDEX_CACHE_VERSION;
+		tCacheKey.cbFile = ptContext->cbFile;
+		tCacheKey.nHeaderChecksum = dumpparse_ChecksumHeader(ptHeader, cbHeader);
+		if (!GetFileTime(ptContext->hFile, NULL, NULL, &(tCacheKey.tLastWriteTime)))
+		{
+			hrResult = HRESULT_FROM_WIN32(GetLastError());
+			goto lblCleanup;
+		}
+
+		cchCachePath = wcslen(pwszExpandedPath) + ARRAYSIZE(DUMP_INDEX_CACHE_EXTENSION);
+		pwszCachePath = HEAPALLOC(cchCachePath * sizeof(*pwszCachePath));
+		if (NULL == pwszCachePath)
+		{
+			PROGRESS("Oops. Ran out of memory.");
+			hrResult = E_OUTOFMEMORY;
+			goto lblCleanup;
+		}
+
+		hrResult = StringCchPrintfW(pwszCachePath,
+									cchCachePath,
+									L"%s%s",
+									pwszExpandedPath,
+									DUMP_INDEX_CACHE_EXTENSION);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+
+		bIndexLoaded = SUCCEEDED(dumpparse_LoadIndexCache(ptContext, pwszCachePath, &tCacheKey));
+		if (bIndexLoaded)
+		{
+			PROGRESS("Loaded the secondary data index from '%S'.", pwszCachePath);
+		}
+	}
+
+	if (!bIndexLoaded)
+	{
+		hrResult = dumpparse_LocateSecondaryData(ptContext, ptHeader, cbHeader, &cbSecondaryData);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+
+		hrResult = dumpparse_BuildIndex(ptContext, cbSecondaryData);
+		if (FAILED(hrResult))
+		{
+			PROGRESS("Failed indexing the secondary data.");
+			goto lblCleanup;
+		}
+
+		// The cache is only an optimization, so failing to write it is fine.
+		if ((NULL != pwszCachePath) &&
+			FAILED(dumpparse_SaveIndexCache(ptContext, pwszCachePath, &tCacheKey)))
+		{
+			PROGRESS("Failed writing the index cache to '%S'.", pwszCachePath);
+		}
+	}
+
 	// Transfer ownership:
-	ptContext->piDebugClient = piDebugClient;
-	piDebugClient = NULL;
 	*phDump = (HDUMP)ptContext;
 	ptContext = NULL;
 
 	hrResult = S_OK;
 
 lblCleanup:
-	HEAPFREE(pszExpandedPath);
+	HEAPFREE(pwszCachePath);
+	HEAPFREE(ptHeader);
 	HEAPFREE(pwszExpandedPath);
 	HEAPFREE(pwszSystemDumpFile);
-	RELEASE(piDebugClient);
+	if (NULL != ptContext)
+	{
+		HEAPFREE(ptContext->ptIndex);
+		CLOSE_FILE_HANDLE(ptContext->hFile);
+	}
 	HEAPFREE(ptContext);
 
 	return hrResult;
@@ -140,7 +1314,9 @@ DUMPPARSE_Close(
 		goto lblCleanup;
 	}
 
-	RELEASE(ptContext->piDebugClient);
+	HEAPFREE(ptContext->ptIndex);
+	CLOSE_HANDLE(ptContext->hMapping);
+	CLOSE_FILE_HANDLE(ptContext->hFile);
 	HEAPFREE(ptContext);
 
 lblCleanup:
@@ -155,14 +1331,11 @@ DUMPPARSE_ReadTagged(
 	_Out_									PDWORD	pcbData
 )
 {
-	HRESULT				hrResult			= E_FAIL;
-	PDUMP_FILE_CONTEXT	ptContext			= (PDUMP_FILE_CONTEXT)hDump;
-	IDebugClient *		piDebugClient		= NULL;
-	IDebugDataSpaces3 *	piDebugDataSpaces	= NULL;
-	ULONG				cbData				= 0;
-	PVOID				pvData				= NULL;
-
-	C_ASSERT(sizeof(*pcbData) == sizeof(cbData));
+	HRESULT				hrResult		= E_FAIL;
+	PDUMP_FILE_CONTEXT	ptContext		= (PDUMP_FILE_CONTEXT)hDump;
+	ULONGLONG			cbDataOffset	= 0;
+	DWORD				cbData			= 0;
+	PVOID				pvData			= NULL;
 
 	if ((NULL == hDump) ||
 		(NULL == ptTag) ||
@@ -174,29 +1347,14 @@ DUMPPARSE_ReadTagged(
 		goto lblCleanup;
 	}
 
-	piDebugClient = ptContext->piDebugClient;
-
-	hrResult = piDebugClient->lpVtbl->QueryInterface(piDebugClient,
-													 &IID_IDebugDataSpaces3,
-													 &piDebugDataSpaces);
-	if (FAILED(hrResult))
-	{
-		PROGRESS("Failed obtaining the IDebugDataSpaces3 interface.");
-		goto lblCleanup;
-	}
-
-	hrResult = piDebugDataSpaces->lpVtbl->ReadTagged(piDebugDataSpaces,
-													 (LPGUID)ptTag,
-													 0,
-													 NULL, 0,
-													 &cbData);
+	hrResult = dumpparse_FindBlob(ptContext, ptTag, &cbDataOffset, &cbData);
 	if (FAILED(hrResult))
 	{
-		PROGRESS("Failed reading the tagged data. Is it even there?");
 		goto lblCleanup;
 	}
 
-	pvData = HEAPALLOC(cbData);
+	// Keep the allocation non-empty even for empty blobs.
+	pvData = HEAPALLOC(max(cbData, 1));
 	if (NULL == pvData)
 	{
 		PROGRESS("Oops. Ran out of memory.");
@@ -204,14 +1362,10 @@ DUMPPARSE_ReadTagged(
 		goto lblCleanup;
 	}
 
-	hrResult = piDebugDataSpaces->lpVtbl->ReadTagged(piDebugDataSpaces,
-													 (LPGUID)ptTag,
-													 0,
-													 pvData, cbData,
-													 NULL);
+	hrResult = dumpparse_ReadAt(ptContext->hFile, cbDataOffset, pvData, cbData);
 	if (FAILED(hrResult))
 	{
-		PROGRESS("Failed reading the tagged data. Is it even there?");
+		PROGRESS("Failed reading the tagged data.");
 		goto lblCleanup;
 	}
 
@@ -224,7 +1378,119 @@ DUMPPARSE_ReadTagged(
 
 lblCleanup:
 	HEAPFREE(pvData);
-	RELEASE(piDebugDataSpaces);
 
 	return hrResult;
 }
+
+HRESULT
+DUMPPARSE_MapTagged(
+	_In_									HDUMP		hDump,
+	_In_									LPCGUID		ptTag,
+	_Out_									PHDUMPVIEW	phView,
+	_Outptr_result_bytebuffer_(*pcbData)	LPCVOID *	ppvData,
+	_Out_									PDWORD		pcbData
+)
+{
+	HRESULT				hrResult		= E_FAIL;
+	PDUMP_FILE_CONTEXT	ptContext		= (PDUMP_FILE_CONTEXT)hDump;
+	SYSTEM_INFO			tSystemInfo		= { 0 };
+	ULONGLONG			cbDataOffset	= 0;
+	DWORD				cbData			= 0;
+	ULONGLONG			cbViewOffset	= 0;
+	ULONGLONG			cbView			= 0;
+	PVOID				pvView			= NULL;
+
+	if ((NULL == hDump) ||
+		(NULL == ptTag) ||
+		(NULL == phView) ||
+		(NULL == ppvData) ||
+		(NULL == pcbData))
+	{
+		PROGRESS("Invalid arguments specified.");
+		hrResult = E_INVALIDARG;
+		goto lblCleanup;
+	}
+
+	hrResult = dumpparse_FindBlob(ptContext, ptTag, &cbDataOffset, &cbData);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	if (0 == cbData)
+	{
+		// A zero-sized view would map everything up to the end of the file.
+		PROGRESS("The tagged data is empty.");
+		hrResult = HRESULT_FROM_WIN32(ERROR_NO_DATA);
+		goto lblCleanup;
+	}
+
+	if (NULL == ptContext->hMapping)
+	{
+		ptContext->hMapping = CreateFileMappingW(ptContext->hFile,
+												 NULL,
+												 PAGE_READONLY,
+												 0, 0,
+												 NULL);
+		if (NULL == ptContext->hMapping)
+		{
+			PROGRESS("Failed mapping the dump file.");
+			hrResult = HRESULT_FROM_WIN32(GetLastError());
+			goto lblCleanup;
+		}
+	}
+
+	// Views must start on an allocation granularity boundary.
+	GetSystemInfo(&tSystemInfo);
+	cbViewOffset = cbDataOffset - (cbDataOffset % tSystemInfo.dwAllocationGranularity);
+	cbView = (cbDataOffset - cbViewOffset) + cbData;
+	if (cbView > MAXSIZE_T)
+	{
+		PROGRESS("The tagged data is too large to map.");
+		hrResult = HRESULT_FROM_WIN32(ERROR_NOT_ENOUGH_MEMORY);
+		goto lblCleanup;
+	}
+
+	// FindBlob made sure the data lies within the file,
+	// so the view can't extend beyond it.
+	pvView = MapViewOfFile(ptContext->hMapping,
+						   FILE_MAP_READ,
+						   (DWORD)(cbViewOffset >> 32),
+						   (DWORD)(cbViewOffset & MAXDWORD),
+						   (SIZE_T)cbView);
+	if (NULL == pvView)
+	{
+		PROGRESS("Failed mapping the tagged data.");
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+
+	// Transfer ownership:
+	*ppvData = (CONST BYTE *)pvView + (cbDataOffset - cbViewOffset);
+	*pcbData = cbData;
+	*phView = (HDUMPVIEW)pvView;
+	pvView = NULL;
+
+	hrResult = S_OK;
+
+lblCleanup:
+	CLOSE(pvView, UnmapViewOfFile);
+
+	return hrResult;
+}
+
+VOID
+DUMPPARSE_Unmap(
+	_In_	HDUMPVIEW	hView
+)
+{
+	if (NULL == hView)
+	{
+		goto lblCleanup;
+	}
+
+	(VOID)UnmapViewOfFile(hView);
+
+lblCleanup:
+	return;
+}
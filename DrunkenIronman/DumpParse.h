@@ -12,6 +12,19 @@
 #include <Windows.h>
 
 
+/** Enums ***************************************************************/
+
+/**
+ * Flags for DUMPPARSE_Open.
+ */
+typedef enum _DUMPPARSE_OPEN_FLAGS
+{
+	// Load the secondary data index from a sidecar file
+	// next to the dump (<dump>.idx), creating it if necessary.
+	DUMPPARSE_OPEN_INDEX_CACHE = 0x00000001,
+} DUMPPARSE_OPEN_FLAGS, *PDUMPPARSE_OPEN_FLAGS;
+
+
 /** Typedefs ************************************************************/
 
 /**
@@ -20,6 +33,12 @@
 DECLARE_HANDLE(HDUMP);
 typedef HDUMP *PHDUMP;
 
+/**
+ * Handle to a mapped view of tagged data.
+ */
+DECLARE_HANDLE(HDUMPVIEW);
+typedef HDUMPVIEW *PHDUMPVIEW;
+
 
 /** Functions ***********************************************************/
 
@@ -29,13 +48,17 @@ typedef HDUMP *PHDUMP;
  * @param[in]	pwszPath	Path to the dump file.
  *							If not specified, the system crash dump
  *							will be opened (usually C:\Windows\MEMORY.DMP).
+ * @param[in]	fFlags		Combination of DUMPPARSE_OPEN_FLAGS.
  * @param[in]	phDump		Will receive a handle to the dump file.
  *
  * @returns HRESULT
+ *
+ * @remark The secondary data area is indexed once, when the file is opened.
  */
 HRESULT
 DUMPPARSE_Open(
 	_In_opt_	PCWSTR	pwszPath,
+	_In_		DWORD	fFlags,
 	_Out_		PHDUMP	phDump
 );
 
@@ -60,6 +83,8 @@ DUMPPARSE_Close(
  * @returns HRESULT
  *
  * @remark Free the returned buffer to the process heap.
+ * @remark Fails with HRESULT_FROM_WIN32(ERROR_NOT_FOUND) if there is
+ *         no data with the tag, without reporting it.
  */
 HRESULT
 DUMPPARSE_ReadTagged(
@@ -68,3 +93,39 @@ DUMPPARSE_ReadTagged(
 	_Outptr_result_bytebuffer_(*pcbData)	PVOID *	ppvData,
 	_Out_									PDWORD	pcbData
 );
+
+/**
+ * Maps tagged data from the dump file into memory.
+ *
+ * @param[in]	hDump	Dump file to map from.
+ * @param[in]	ptTag	Tag identifying the data to map.
+ * @param[out]	phView	Will receive a handle to the mapped view.
+ * @param[out]	ppvData	Will receive a pointer to the data.
+ * @param[out]	pcbData	Will receive the data's size, in bytes.
+ *
+ * @returns HRESULT
+ *
+ * @remark Fails with HRESULT_FROM_WIN32(ERROR_NOT_FOUND) if there is
+ *         no data with the tag, without reporting it.
+ * @remark The data is read-only, and is valid until the view is unmapped
+ *         with DUMPPARSE_Unmap. Only the tagged data itself is guaranteed
+ *         to be accessible through the view.
+ */
+HRESULT
+DUMPPARSE_MapTagged(
+	_In_									HDUMP		hDump,
+	_In_									LPCGUID		ptTag,
+	_Out_									PHDUMPVIEW	phView,
+	_Outptr_result_bytebuffer_(*pcbData)	LPCVOID *	ppvData,
+	_Out_									PDWORD		pcbData
+);
+
+/**
+ * Unmaps a view returned by DUMPPARSE_MapTagged.
+ *
+ * @param[in]	hView	View to unmap.
+ */
+VOID
+DUMPPARSE_Unmap(
+	_In_	HDUMPVIEW	hView
+);
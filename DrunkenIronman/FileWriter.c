@@ -0,0 +1,319 @@
+/**
+ * @file FileWriter.c
+ * @author biko
+ * @date 2026-10-17
+ *
+ * FileWriter module implementation.
+ */
+
+/** Headers *************************************************************/
+#include <Windows.h>
+#include <assert.h>
+
+#include "Util.h"
+
+#include "FileWriter.h"
+
+
+/** Typedefs ************************************************************/
+
+typedef struct _FILE_WRITER_CONTEXT
+{
+	HANDLE	hFile;
+	PWSTR	pwszPath;
+
+	// Data not yet written to the file.
+	PBYTE	pcBuffer;
+	DWORD	cbBuffered;
+
+	// Whether the file should be kept when the writer is closed.
+	BOOL	bCommitted;
+} FILE_WRITER_CONTEXT, *PFILE_WRITER_CONTEXT;
+typedef FILE_WRITER_CONTEXT CONST *PCFILE_WRITER_CONTEXT;
+
+
+/** Functions ***********************************************************/
+
+/**
+ * Writes data straight to the file.
+ *
+ * @param[in]	hFile	The file to write to.
+ * @param[in]	pvData	The data to write.
+ * @param[in]	cbData	Size of the data, in bytes.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+filewriter_WriteDirect(
+	_In_						HANDLE	hFile,
+	_In_reads_bytes_(cbData)	LPCVOID	pvData,
+	_In_						DWORD	cbData
+)
+{
+	HRESULT	hrResult	= E_FAIL;
+	DWORD	cbWritten	= 0;
+
+	assert(INVALID_HANDLE_VALUE != hFile);
+	assert((NULL != pvData) || (0 == cbData));
+
+	if (0 == cbData)
+	{
+		hrResult = S_OK;
+		goto lblCleanup;
+	}
+
+	if (!WriteFile(hFile, pvData, cbData, &cbWritten, NULL))
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+	if (cbData != cbWritten)
+	{
+		hrResult = E_UNEXPECTED;
+		goto lblCleanup;
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+/**
+ * Writes the buffered data to the file.
+ *
+ * @param[in,out]	ptContext	The writer.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+filewriter_Flush(
+	_Inout_	PFILE_WRITER_CONTEXT	ptContext
+)
+{
+	HRESULT	hrResult	= E_FAIL;
+
+	assert(NULL != ptContext);
+
+	hrResult = filewriter_WriteDirect(ptContext->hFile, ptContext->pcBuffer, ptContext->cbBuffered);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	ptContext->cbBuffered = 0;
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+HRESULT
+FILEWRITER_Create(
+	_In_	PCWSTR			pwszPath,
+	_Out_	PHFILEWRITER	phWriter
+)
+{
+	HRESULT					hrResult	= E_FAIL;
+	PFILE_WRITER_CONTEXT	ptContext	= NULL;
+	SIZE_T					cbPath		= 0;
+
+	if ((NULL == pwszPath) ||
+		(NULL == phWriter))
+	{
+		hrResult = E_INVALIDARG;
+		goto lblCleanup;
+	}
+
+	ptContext = HEAPALLOC(sizeof(*ptContext));
+	if (NULL == ptContext)
+	{
+		hrResult = E_OUTOFMEMORY;
+		goto lblCleanup;
+	}
+	ptContext->hFile = INVALID_HANDLE_VALUE;
+
+	ptContext->pcBuffer = HEAPALLOC(FILEWRITER_BUFFER_SIZE);
+	if (NULL == ptContext->pcBuffer)
+	{
+		hrResult = E_OUTOFMEMORY;
+		goto lblCleanup;
+	}
+
+	// Keep the path, to discard the file if writing it fails.
+	cbPath = (wcslen(pwszPath) + 1) * sizeof(*pwszPath);
+	ptContext->pwszPath = HEAPALLOC(cbPath);
+	if (NULL == ptContext->pwszPath)
+	{
+		hrResult = E_OUTOFMEMORY;
+		goto lblCleanup;
+	}
+	CopyMemory(ptContext->pwszPath, pwszPath, cbPath);
+
+	ptContext->hFile = CreateFileW(pwszPath,
+								   GENERIC_WRITE,
+								   0,
+								   NULL,
+								   CREATE_ALWAYS,
+								   FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+								   NULL);
+	if (INVALID_HANDLE_VALUE == ptContext->hFile)
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+
+	// Transfer ownership:
+	*phWriter = (HFILEWRITER)ptContext;
+	ptContext = NULL;
+
+	hrResult = S_OK;
+
+lblCleanup:
+	if (NULL != ptContext)
+	{
+		CLOSE_FILE_HANDLE(ptContext->hFile);
+		HEAPFREE(ptContext->pwszPath);
+		HEAPFREE(ptContext->pcBuffer);
+	}
+	HEAPFREE(ptContext);
+
+	return hrResult;
+}
+
+VOID
+FILEWRITER_Close(
+	_In_	HFILEWRITER	hWriter
+)
+{
+	PFILE_WRITER_CONTEXT	ptContext	= (PFILE_WRITER_CONTEXT)hWriter;
+
+	if (NULL == hWriter)
+	{
+		goto lblCleanup;
+	}
+
+	CLOSE_FILE_HANDLE(ptContext->hFile);
+	if (!ptContext->bCommitted)
+	{
+		(VOID)DeleteFileW(ptContext->pwszPath);
+	}
+
+	HEAPFREE(ptContext->pwszPath);
+	HEAPFREE(ptContext->pcBuffer);
+	HEAPFREE(ptContext);
+
+lblCleanup:
+	return;
+}
+
+HRESULT
+FILEWRITER_WriteGather(
+	_In_				HFILEWRITER			hWriter,
+	_In_reads_(nChunks)	PCFILEWRITER_CHUNK	atChunks,
+	_In_				DWORD				nChunks
+)
+{
+	HRESULT					hrResult	= E_FAIL;
+	PFILE_WRITER_CONTEXT	ptContext	= (PFILE_WRITER_CONTEXT)hWriter;
+	DWORD					nChunk		= 0;
+	CONST BYTE *			pcData		= NULL;
+	DWORD					cbData		= 0;
+	DWORD					cbToCopy	= 0;
+
+	if ((NULL == hWriter) ||
+		((NULL == atChunks) && (0 != nChunks)))
+	{
+		hrResult = E_INVALIDARG;
+		goto lblCleanup;
+	}
+
+	assert(!ptContext->bCommitted);
+
+	for (nChunk = 0; nChunk < nChunks; ++nChunk)
+	{
+		pcData = (CONST BYTE *)(atChunks[nChunk].pvData);
+		cbData = atChunks[nChunk].cbData;
+
+		while (cbData > 0)
+		{
+			// Large chunks don't need to go through the buffer.
+			if ((0 == ptContext->cbBuffered) &&
+				(cbData >= FILEWRITER_BUFFER_SIZE))
+			{
+				hrResult = filewriter_WriteDirect(ptContext->hFile, pcData, cbData);
+				if (FAILED(hrResult))
+				{
+					goto lblCleanup;
+				}
+				break;
+			}
+
+			cbToCopy = min(cbData, FILEWRITER_BUFFER_SIZE - ptContext->cbBuffered);
+			CopyMemory(ptContext->pcBuffer + ptContext->cbBuffered, pcData, cbToCopy);
+			ptContext->cbBuffered += cbToCopy;
+			pcData += cbToCopy;
+			cbData -= cbToCopy;
+
+			if (FILEWRITER_BUFFER_SIZE == ptContext->cbBuffered)
+			{
+				hrResult = filewriter_Flush(ptContext);
+				if (FAILED(hrResult))
+				{
+					goto lblCleanup;
+				}
+			}
+		}
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+HRESULT
+FILEWRITER_Write(
+	_In_						HFILEWRITER	hWriter,
+	_In_reads_bytes_(cbData)	LPCVOID		pvData,
+	_In_						DWORD		cbData
+)
+{
+	FILEWRITER_CHUNK	tChunk	= { 0 };
+
+	tChunk.pvData = pvData;
+	tChunk.cbData = cbData;
+
+	return FILEWRITER_WriteGather(hWriter, &tChunk, 1);
+}
+
+HRESULT
+FILEWRITER_Commit(
+	_In_	HFILEWRITER	hWriter
+)
+{
+	HRESULT					hrResult	= E_FAIL;
+	PFILE_WRITER_CONTEXT	ptContext	= (PFILE_WRITER_CONTEXT)hWriter;
+
+	if (NULL == hWriter)
+	{
+		hrResult = E_INVALIDARG;
+		goto lblCleanup;
+	}
+
+	hrResult = filewriter_Flush(ptContext);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	ptContext->bCommitted = TRUE;
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
@@ -0,0 +1,117 @@
+/**
+ * @file FileWriter.h
+ * @author biko
+ * @date 2026-10-17
+ *
+ * FileWriter module public header.
+ * Contains routines for writing output files through a fixed-size buffer.
+ */
+#pragma once
+
+/** Headers *************************************************************/
+#include <Windows.h>
+
+
+/** Constants ***********************************************************/
+
+/**
+ * Size of the buffer each writer holds, in bytes.
+ * This is all the memory a writer ever uses, regardless of the file's size.
+ */
+#define FILEWRITER_BUFFER_SIZE (64 * 1024)
+
+
+/** Typedefs ************************************************************/
+
+/**
+ * Handle to an output file.
+ */
+DECLARE_HANDLE(HFILEWRITER);
+typedef HFILEWRITER *PHFILEWRITER;
+
+/**
+ * A single piece of a gathered write.
+ */
+typedef struct _FILEWRITER_CHUNK
+{
+	LPCVOID	pvData;
+	DWORD	cbData;
+} FILEWRITER_CHUNK, *PFILEWRITER_CHUNK;
+typedef FILEWRITER_CHUNK CONST *PCFILEWRITER_CHUNK;
+
+
+/** Functions ***********************************************************/
+
+/**
+ * Creates an output file, overwriting any existing file.
+ *
+ * @param[in]	pwszPath	Path to the file.
+ * @param[out]	phWriter	Will receive a handle to the writer.
+ *
+ * @returns HRESULT
+ *
+ * @remark Unless FILEWRITER_Commit succeeds, the file
+ *         is deleted when the writer is closed.
+ */
+HRESULT
+FILEWRITER_Create(
+	_In_	PCWSTR			pwszPath,
+	_Out_	PHFILEWRITER	phWriter
+);
+
+/**
+ * Closes an output file.
+ *
+ * @param[in]	hWriter	Writer to close.
+ */
+VOID
+FILEWRITER_Close(
+	_In_	HFILEWRITER	hWriter
+);
+
+/**
+ * Appends several pieces of data to the file, in order.
+ *
+ * @param[in]	hWriter		Writer to write to.
+ * @param[in]	atChunks	The data to write.
+ * @param[in]	nChunks		Number of chunks.
+ *
+ * @returns HRESULT
+ *
+ * @remark Small chunks are coalesced in the writer's buffer.
+ *         Chunks at least as large as the buffer bypass it.
+ */
+HRESULT
+FILEWRITER_WriteGather(
+	_In_				HFILEWRITER			hWriter,
+	_In_reads_(nChunks)	PCFILEWRITER_CHUNK	atChunks,
+	_In_				DWORD				nChunks
+);
+
+/**
+ * Appends data to the file.
+ *
+ * @param[in]	hWriter	Writer to write to.
+ * @param[in]	pvData	The data to write.
+ * @param[in]	cbData	Size of the data, in bytes.
+ *
+ * @returns HRESULT
+ */
+HRESULT
+FILEWRITER_Write(
+	_In_						HFILEWRITER	hWriter,
+	_In_reads_bytes_(cbData)	LPCVOID		pvData,
+	_In_						DWORD		cbData
+);
+
+/**
+ * Flushes the buffered data, and keeps the file when the writer is closed.
+ *
+ * @param[in]	hWriter	Writer to commit.
+ *
+ * @returns HRESULT
+ */
+HRESULT
+FILEWRITER_Commit(
+	_In_	HFILEWRITER	hWriter
+);
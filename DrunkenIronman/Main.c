@@ -18,10 +18,15 @@
 #include <limits.h>
 
 #include <Drink.h>
+#include <Rle.h>
 
 #include "DrinkControl.h"
 #include "Util.h"
 #include "DumpParse.h"
+#include "FileWriter.h"
+#include "Deflate.h"
+#include "Png.h"
+#include "VgaPlanes.h"
 #include "Resource.h"
 #include "Debug.h"
 
@@ -39,6 +44,16 @@ STATIC CONST SUBFUNCTION_HANDLER_ENTRY g_atSubfunctionHandlers[] = {
 		&main_HandleConvert
 	},
 
+	{
+		L"batch",
+		&main_HandleBatch
+	},
+
+	{
+		L"watch",
+		&main_HandleWatch
+	},
+
 	{
 		L"load",
 		&main_HandleLoad
@@ -65,6 +80,11 @@ STATIC CONST SUBFUNCTION_HANDLER_ENTRY g_atSubfunctionHandlers[] = {
 	}
 };
 
+/**
+ * Signaled when the "watch" subfunction, or "bugshot auto -follow", should stop.
+ */
+STATIC HANDLE g_hWatchStopEvent = NULL;
+
 
 /** Functions ***********************************************************/
 
@@ -95,7 +115,13 @@ main_PrintUsage(VOID)
 				   pwszExecutableName);
 
 	(VOID)fwprintf(stderr,
-				   L"  convert [<input>] <output>\n    Extracts a screenshot from a memory dump.\n");
+				   L"  convert [-cache] [-frames] [-level <0-9>] [<input>] <output>\n    Extracts a screenshot from a memory dump.\n    The output is a PNG if its name ends with .png, and a BMP otherwise.\n    -cache keeps an index of the dump's tagged data in <input>.idx,\n    so that converting the same dump again doesn't rescan it.\n    -frames also writes an image of the screen after each frame\n    kept by 'bugshot -frames', with _frame<n> added to the name,\n    and prints the time each frame was drawn at.\n    -level sets the PNG compression level (0 stores, 9 is smallest).\n    On machines with several displays, each is written to its own image,\n    with _display<n> added to the name of all but the first.\n");
+
+	(VOID)fwprintf(stderr,
+				   L"  batch [-cache] [-png] [-level <0-9>] <directory | manifest> <output directory>\n    Extracts screenshots from all the dumps in a directory,\n    or listed in a manifest (one path per line), in parallel.\n    A summary is written to the output directory.\n    -png writes PNG files instead of BMP files.\n");
+
+	(VOID)fwprintf(stderr,
+				   L"  watch [-cache] [-png] [-level <0-9>] <directory> <output directory>\n    Converts dumps as they appear in a directory, once each dump\n    stops changing. Converted dumps are recorded in a journal\n    in the output directory, and skipped after a restart.\n");
 
 	(VOID)fwprintf(stderr,
 				   L"  load\n    Loads the driver.\n");
@@ -104,7 +130,7 @@ main_PrintUsage(VOID)
 				   L"  unload\n    Unloads the driver.\n");
 
 	(VOID)fwprintf(stderr,
-				   L"  bugshot [<width> <height>]\n    Instructs the driver to capture a screenshot\n    of the next BSoD.\n");
+				   L"  bugshot [-frames <count>] [auto [-follow] | <width> <height>]\n    Instructs the driver to capture a screenshot\n    of the next BSoD.\n    -frames also keeps the last <count> frames drawn (up to 512),\n    such as the progress of writing the dump (Windows 10+ only).\n    auto sizes the screenshot to the current display mode.\n    -follow keeps running, and resizes it whenever the mode changes.\n");
 
 	(VOID)fwprintf(stderr,
 				   L"  vanity <string>\n    Crashes the system and displays the specified string\n    on the BSoD.\n");
@@ -131,28 +157,26 @@ main_VgaDacEntryToRgb(
 }
 
 STATIC
-BYTE
-main_GetPixelBitFromPlane(
-	_In_	CONST BYTE *	pnPlane,
-	_In_	DWORD			nPixelIndex
+VOID
+main_VgaPaletteToRgb(
+	_In_											PCVGA_DUMP	ptDump,
+	_Out_writes_all_(VGA_BITMAP_PALETTE_ENTRIES)	RGBQUAD *	atColors
 )
 {
-	BYTE	nByteContainingPixel	= 0;
-	BYTE	nBit					= 0;
-
-	assert(NULL != pnPlane);
+	DWORD	nCurrentEntry	= 0;
 
-	// Find the byte containing the pixel data required
-	nByteContainingPixel = pnPlane[nPixelIndex / PIXELS_IN_BYTE];
+	assert(NULL != ptDump);
+	assert(NULL != atColors);
 
-	// Move the relevant bit to be the MSB
-	nBit = nByteContainingPixel;
-	nBit <<= (nPixelIndex % PIXELS_IN_BYTE);
-
-	// Move the relevant bit to be the LSB
-	nBit >>= (PIXELS_IN_BYTE - 1);
-
-	return nBit;
+	for (nCurrentEntry = 0;
+		 nCurrentEntry < VGA_BITMAP_PALETTE_ENTRIES;
+		 ++nCurrentEntry)
+	{
+		atColors[nCurrentEntry].rgbRed = main_VgaDacEntryToRgb(ptDump->atPaletteEntries[nCurrentEntry].nRed);
+		atColors[nCurrentEntry].rgbGreen = main_VgaDacEntryToRgb(ptDump->atPaletteEntries[nCurrentEntry].nGreen);
+		atColors[nCurrentEntry].rgbBlue = main_VgaDacEntryToRgb(ptDump->atPaletteEntries[nCurrentEntry].nBlue);
+		atColors[nCurrentEntry].rgbReserved = 0;
+	}
 }
 
 STATIC
@@ -162,12 +186,8 @@ main_VgaDumpToBitmap(
 	_Outptr_	PVGA_BITMAP *	pptBitmap
 )
 {
-	HRESULT		hrResult		= E_FAIL;
-	PVGA_BITMAP	ptBitmap		= NULL;
-	DWORD		nCurrentEntry	= 0;
-	DWORD		nCurrentPixel	= 0;
-	DWORD		nCurrentPlane	= 0;
-	BYTE		nCurrentBit		= 0;
+	HRESULT		hrResult	= E_FAIL;
+	PVGA_BITMAP	ptBitmap	= NULL;
 
 	PROGRESS("Converting raw VGA dump to BMP...");
 
@@ -192,35 +212,20 @@ main_VgaDumpToBitmap(
 	ptBitmap->tInfoHeader.biHeight = -SCREEN_HEIGHT_PIXELS;		// Negative because otherwise the bitmap
 																// is bottom-up :)
 	ptBitmap->tInfoHeader.biPlanes = 1;
-	ptBitmap->tInfoHeader.biBitCount = 8;
+	ptBitmap->tInfoHeader.biBitCount = 4;
 	ptBitmap->tInfoHeader.biCompression = BI_RGB;
+	ptBitmap->tInfoHeader.biClrUsed = ARRAYSIZE(ptBitmap->atColors);
 
 	// Initialize the color palette
 	PROGRESS("Writing the palette.");
-	for (nCurrentEntry = 0;
-		 nCurrentEntry < ARRAYSIZE(ptBitmap->atColors);
-		 ++nCurrentEntry)
-	{
-		ptBitmap->atColors[nCurrentEntry].rgbRed = main_VgaDacEntryToRgb(ptDump->atPaletteEntries[nCurrentEntry].nRed);
-		ptBitmap->atColors[nCurrentEntry].rgbGreen = main_VgaDacEntryToRgb(ptDump->atPaletteEntries[nCurrentEntry].nGreen);
-		ptBitmap->atColors[nCurrentEntry].rgbBlue = main_VgaDacEntryToRgb(ptDump->atPaletteEntries[nCurrentEntry].nBlue);
-	}
+	main_VgaPaletteToRgb(ptDump, ptBitmap->atColors);
 
-	// Set the pixel values
+	// Set the pixel values.
+	// Rows are a multiple of 4 bytes long, so there's no padding,
+	// and all of the planes can be converted at once.
+	C_ASSERT(0 == VGAPLANES_PACKED_BYTES_PER_ROW % sizeof(DWORD));
 	PROGRESS("Writing the pixel data.");
-	for (nCurrentPixel = 0;
-		 nCurrentPixel < ARRAYSIZE(ptBitmap->anPixels);
-		 ++nCurrentPixel)
-	{
-		for (nCurrentPlane = 0;
-			 nCurrentPlane < ARRAYSIZE(ptDump->atPlanes);
-			 ++nCurrentPlane)
-		{
-			nCurrentBit = main_GetPixelBitFromPlane(ptDump->atPlanes[nCurrentPlane],
-													nCurrentPixel);
-			ptBitmap->anPixels[nCurrentPixel] |= nCurrentBit << nCurrentPlane;
-		}
-	}
+	VGAPLANES_PlanarToPacked(ptDump, 0, sizeof(ptDump->atPlanes[0]), ptBitmap->anPixels);
 
 	// Transfer ownership:
 	*pptBitmap = ptBitmap;
@@ -234,25 +239,42 @@ lblCleanup:
 	return hrResult;
 }
 
+_Use_decl_annotations_
 STATIC
 HRESULT
-main_FramebufferDumpToBitmap(
-	_In_		PFRAMEBUFFER_DUMP		ptDump,
-	_Outptr_	PFRAMEBUFFER_BITMAP *	pptBitmap
+main_GetFramebufferImageSize(
+	PCFRAMEBUFFER_DUMP	ptDump,
+	DWORD				cbDump,
+	PULONG				pnWidth,
+	PULONG				pnHeight
 )
 {
-	HRESULT				hrResult		= E_FAIL;
-	ULONG				nBitmapWidth	= 0;
-	ULONG				nBitmapHeight	= 0;
-	DWORD				cbBitmap		= 0;
-	PFRAMEBUFFER_BITMAP	ptBitmap		= NULL;
-	ULONG				nRow			= 0;
+	HRESULT	hrResult		= E_FAIL;
+	ULONG	nImageWidth		= 0;
+	ULONG	nImageHeight	= 0;
+	DWORD	cbPixels		= 0;
+	DWORD	cbRequired		= 0;
+
+	assert(NULL != ptDump);
+	assert(NULL != pnWidth);
+	assert(NULL != pnHeight);
+
+	// The dump is read straight from the file,
+	// so make sure it really holds all the pixels it claims to.
+	if ((cbDump < FIELD_OFFSET(FRAMEBUFFER_DUMP, acPixels)) ||
+		FAILED(DWordMult(ptDump->nWidth, ptDump->nHeight, &cbPixels)) ||
+		FAILED(DWordMult(cbPixels, 4, &cbPixels)) ||
+		FAILED(DWordAdd(cbPixels, FIELD_OFFSET(FRAMEBUFFER_DUMP, acPixels), &cbRequired)) ||
+		(cbRequired > cbDump))
+	{
+		PROGRESS("The stored screenshot has a weird size.");
+		hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		goto lblCleanup;
+	}
 
 	// Invalid dumps will never be written by the kernel.
 	assert(ptDump->bValid);
 
-	PROGRESS("Converting framebuffer dump to BMP...");
-
 	if (ptDump->nMaxSeenWidth > ptDump->nWidth || ptDump->nMaxSeenHeight > ptDump->nHeight)
 	{
 		PROGRESS("Image truncated. Actual size was %lux%lu, but saved only %lux%lu",
@@ -262,96 +284,96 @@ main_FramebufferDumpToBitmap(
 				 ptDump->nHeight);
 	}
 
-	nBitmapWidth = min(ptDump->nWidth, ptDump->nMaxSeenWidth);
-	if (nBitmapWidth > LONG_MAX)
+	nImageWidth = min(ptDump->nWidth, ptDump->nMaxSeenWidth);
+	if (nImageWidth > LONG_MAX)
 	{
-		PROGRESS("Image too wide (%lu pixels)", nBitmapWidth);
+		PROGRESS("Image too wide (%lu pixels)", nImageWidth);
 		hrResult = E_DRAW;
 		goto lblCleanup;
 	}
 
-	nBitmapHeight = min(ptDump->nHeight, ptDump->nMaxSeenHeight);
-	if (nBitmapHeight > LONG_MAX)
+	nImageHeight = min(ptDump->nHeight, ptDump->nMaxSeenHeight);
+	if (nImageHeight > LONG_MAX)
 	{
-		PROGRESS("Image too tall (%lu pixels)", nBitmapHeight);
+		PROGRESS("Image too tall (%lu pixels)", nImageHeight);
 		hrResult = E_DRAW;
 		goto lblCleanup;
 	}
 
-	// Should be safe since the kernel already performed the same calculation.
-	cbBitmap = FIELD_OFFSET(FRAMEBUFFER_BITMAP, acPixels[nBitmapWidth * nBitmapHeight * 4]);
-
-	ptBitmap = HEAPALLOC(cbBitmap);
-	if (NULL == ptBitmap)
-	{
-		PROGRESS("Oops. Ran out of memory.");
-		hrResult = E_OUTOFMEMORY;
-		goto lblCleanup;
-	}
-
-	PROGRESS("Writing the BMP header.");
-
-	// Initialize the file header
-	ptBitmap->tFileHeader.bfType = 'MB';
-	ptBitmap->tFileHeader.bfSize = cbBitmap;
-	ptBitmap->tFileHeader.bfOffBits = FIELD_OFFSET(FRAMEBUFFER_BITMAP, acPixels);
-
-	// Initialize the info header
-	ptBitmap->tInfoHeader.biSize = sizeof(ptBitmap->tInfoHeader);
-	ptBitmap->tInfoHeader.biWidth = (LONG)nBitmapWidth;
-	ptBitmap->tInfoHeader.biHeight = -(LONG)nBitmapHeight;	// Negative because otherwise the bitmap
-															// is bottom-up :)
-	ptBitmap->tInfoHeader.biPlanes = 1;
-	ptBitmap->tInfoHeader.biBitCount = 32;
-	ptBitmap->tInfoHeader.biCompression = BI_RGB;
-
-	// Set the pixel values
-	PROGRESS("Writing the pixel data.");
-	for (nRow = 0; nRow < nBitmapHeight; ++nRow)
-	{
-		MoveMemory(&ptBitmap->acPixels[nRow * nBitmapWidth * 4],
-				   &ptDump->acPixels[nRow * ptDump->nWidth * 4],
-				   nBitmapWidth * 4);
-	}
-
-	// Transfer ownership:
-	*pptBitmap = ptBitmap;
-	ptBitmap = NULL;
+	*pnWidth = nImageWidth;
+	*pnHeight = nImageHeight;
 
 	hrResult = S_OK;
 
 lblCleanup:
-	HEAPFREE(ptBitmap);
-
 	return hrResult;
 }
 
 _Use_decl_annotations_
 STATIC
 HRESULT
-main_GetQrInfo(
-	PQR_INFO	ptInfo
+main_ValidateFramebufferDumpEx(
+	PCFRAMEBUFFER_DUMP_EX	ptDumpEx,
+	DWORD					cbDumpEx,
+	PDWORD					pcbDecompressed
 )
 {
 	HRESULT	hrResult	= E_FAIL;
-	DWORD	cbReturned	= 0;
+	DWORD	cbPixels	= 0;
+	DWORD	cbTiles		= 0;
 
-	assert(NULL != ptInfo);
+	assert(NULL != ptDumpEx);
+	assert(NULL != pcbDecompressed);
 
-	hrResult = DRINKCONTROL_ControlDriver(IOCTL_DRINK_QR_INFO,
-										  NULL, 0,
-										  ptInfo, sizeof(*ptInfo), &cbReturned);
-	if (FAILED(hrResult))
+	if ((cbDumpEx < FIELD_OFFSET(FRAMEBUFFER_DUMP_EX, tDump.acPixels)) ||
+		(ptDumpEx->cbPixels > cbDumpEx - FIELD_OFFSET(FRAMEBUFFER_DUMP_EX, tDump.acPixels)))
 	{
-		PROGRESS("Failed retrieving information (0x%08lX).", hrResult);
+		PROGRESS("The stored screenshot has a weird size.");
+		hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
 		goto lblCleanup;
 	}
 
-	if (cbReturned < sizeof(*ptInfo))
+	if (FRAMEBUFFER_DUMP_EX_VERSION != ptDumpEx->nVersion)
 	{
-		PROGRESS("Returned buffer is unexpectedly small (%lu).", cbReturned);
+		PROGRESS("The stored screenshot has an unsupported version (%lu).", ptDumpEx->nVersion);
+		hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		goto lblCleanup;
+	}
+
+	switch (ptDumpEx->eCompression)
+	{
+	case FRAMEBUFFER_COMPRESSION_NONE:
+		*pcbDecompressed = 0;
+		break;
+
+	case FRAMEBUFFER_COMPRESSION_RLE_TILE_POOL:
+		if (FAILED(DWordMult(ptDumpEx->tDump.nWidth, ptDumpEx->tDump.nHeight, &cbPixels)) ||
+			FAILED(DWordMult(cbPixels, RLE_PIXEL_SIZE, &cbPixels)) ||
+			FAILED(DWordAdd(cbPixels, FIELD_OFFSET(FRAMEBUFFER_DUMP, acPixels), pcbDecompressed)))
+		{
+			PROGRESS("The stored screenshot has a weird size.");
+			hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+			goto lblCleanup;
+		}
+
+		// The tile directory follows the pixels.
+		// The tile count can't overflow, since there are fewer tiles than pixels.
+		if (FAILED(DWordMult(FRAMEBUFFER_TILES(ptDumpEx->tDump.nWidth) * FRAMEBUFFER_TILES(ptDumpEx->tDump.nHeight),
+							 sizeof(FRAMEBUFFER_TILE),
+							 &cbTiles)) ||
+			(cbTiles > cbDumpEx - FIELD_OFFSET(FRAMEBUFFER_DUMP_EX, tDump.acPixels) - ptDumpEx->cbPixels))
+		{
+			PROGRESS("The stored screenshot has a weird size.");
+			hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+			goto lblCleanup;
+		}
+		break;
+
+	default:
+		PROGRESS("The stored screenshot has an unsupported compression (%lu).", ptDumpEx->eCompression);
+		hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		goto lblCleanup;
 	}
-	assert(sizeof(*ptInfo) == cbReturned);
 
 	hrResult = S_OK;
 
@@ -359,353 +381,3234 @@ lblCleanup:
 	return hrResult;
 }
 
+_Use_decl_annotations_
+STATIC
+VOID
+main_InitializeFramebufferRows(
+	PFRAMEBUFFER_ROWS	ptRows,
+	PCFRAMEBUFFER_DUMP	ptDump,
+	DWORD				cbDump
+)
+{
+	assert(NULL != ptRows);
+	assert(NULL != ptDump);
+
+	ZeroMemory(ptRows, sizeof(*ptRows));
+	ptRows->ptDump = ptDump;
+	ptRows->cbDump = cbDump;
+}
+
+_Use_decl_annotations_
+STATIC
+ULONGLONG
+main_GetCompressedFramebufferRowsSize(
+	PCFRAMEBUFFER_DUMP_EX	ptDumpEx
+)
+{
+	ULONGLONG	cbStrip		= 0;
+	ULONGLONG	cbPoolTiles	= 0;
+
+	assert(NULL != ptDumpEx);
+
+	// There are never more tiles in the pool than in the directory.
+	cbStrip = (ULONGLONG)ptDumpEx->tDump.nWidth *
+			  min(FRAMEBUFFER_TILE_SIZE, ptDumpEx->tDump.nHeight) *
+			  RLE_PIXEL_SIZE;
+	cbPoolTiles = (ULONGLONG)FRAMEBUFFER_TILES(ptDumpEx->tDump.nWidth) *
+				  FRAMEBUFFER_TILES(ptDumpEx->tDump.nHeight) *
+				  sizeof(RLE_DECODER);
+
+	return cbStrip + cbPoolTiles;
+}
+
 _Use_decl_annotations_
 STATIC
 HRESULT
-main_ConvertBitmapForQr(
-	PCWSTR	pwszFilename,
-	PVOID *	ppvPixels,
-	PDWORD	pcbPixels
+main_OpenCompressedFramebufferRows(
+	PFRAMEBUFFER_ROWS		ptRows,
+	PCFRAMEBUFFER_DUMP_EX	ptDumpEx,
+	DWORD					cbDecompressed
 )
 {
 	HRESULT				hrResult		= E_FAIL;
-	QR_INFO				tQrInfo			= { 0 };
-	PVOID				pvBitmap		= NULL;
-	SIZE_T				cbBitmap		= 0;
-	PBITMAPFILEHEADER	ptFileHeader	= NULL;
-	PBITMAPINFOHEADER	ptInfoHeader	= NULL;
-	PVOID				pvPixels		= NULL;
-	DWORD				cbPixels		= 0;
+	FRAMEBUFFER_ROWS	tRows			= { 0 };
+	CONST BYTE *		pcTiles			= NULL;
+	FRAMEBUFFER_TILE	tTile			= { 0 };
+	DWORD				nTiles			= 0;
+	DWORD				nTile			= 0;
+	DWORD				nDroppedTiles	= 0;
+	DWORD				nPoolTile		= 0;
+	RLE_DECODER			tDecoder;
+	DWORD				cbStrip			= 0;
+
+	assert(NULL != ptRows);
+	assert(NULL != ptDumpEx);
+	assert(FRAMEBUFFER_COMPRESSION_RLE_TILE_POOL == ptDumpEx->eCompression);
+
+	main_InitializeFramebufferRows(&tRows, &ptDumpEx->tDump, cbDecompressed);
+	tRows.ptDumpEx = ptDumpEx;
+
+	// Validated by main_ValidateFramebufferDumpEx.
+	pcTiles = &ptDumpEx->tDump.acPixels[ptDumpEx->cbPixels];
+	nTiles = FRAMEBUFFER_TILES(ptDumpEx->tDump.nWidth) * FRAMEBUFFER_TILES(ptDumpEx->tDump.nHeight);
+
+	for (nTile = 0; nTile < nTiles; ++nTile)
+	{
+		// The directory isn't aligned.
+		CopyMemory(&tTile, &pcTiles[nTile * sizeof(tTile)], sizeof(tTile));
 
-	assert(NULL != pwszFilename);
-	assert(NULL != ppvPixels);
-	assert(NULL != pcbPixels);
+		switch (tTile.eState)
+		{
+		case FRAMEBUFFER_TILE_STATE_CLEAN:
+		case FRAMEBUFFER_TILE_STATE_SOLID:
+			break;
 
-	hrResult = main_GetQrInfo(&tQrInfo);
-	if (FAILED(hrResult))
-	{
-		PROGRESS("main_GetQrInfo failed with code 0x%08lX.", hrResult);
-		goto lblCleanup;
+		case FRAMEBUFFER_TILE_STATE_POOLED:
+			++(tRows.nPoolTiles);
+			break;
+
+		case FRAMEBUFFER_TILE_STATE_DROPPED:
+			++nDroppedTiles;
+			break;
+
+		default:
+			PROGRESS("The stored screenshot is corrupt.");
+			hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+			goto lblCleanup;
+		}
 	}
 
-	// Kernel also supports 24-bit bitmaps, but I don't wanna deal with conversion :)
-	if (32 != tQrInfo.nBitCount)
+	if (0 != nDroppedTiles)
 	{
-		hrResult = E_NOTIMPL;
-		PROGRESS("Current QR bitmap has an unsupported BPP (%lu).", tQrInfo.nBitCount);
-		goto lblCleanup;
+		PROGRESS("WARNING: %lu tiles didn't fit in the driver's tile pool, and are missing from the image.",
+				 nDroppedTiles);
 	}
 
-	hrResult = UTIL_ReadFile(pwszFilename, &pvBitmap, &cbBitmap);
-	if (FAILED(hrResult))
+	// The pool holds the tiles in the order they were first drawn on,
+	// not in the order they are written out. Remember where each one starts,
+	// so that any strip can be decompressed on its own.
+	if (0 != tRows.nPoolTiles)
 	{
-		PROGRESS("Failed reading bitmap file (0x%08lX).", hrResult);
-		goto lblCleanup;
+		tRows.atPoolTiles = HEAPALLOC(tRows.nPoolTiles * sizeof(tRows.atPoolTiles[0]));
+		if (NULL == tRows.atPoolTiles)
+		{
+			PROGRESS("Oops. Ran out of memory.");
+			hrResult = E_OUTOFMEMORY;
+			goto lblCleanup;
+		}
 	}
 
-	if (cbBitmap > MAXDWORD)
+	RLE_InitializeDecoder(&tDecoder, ptDumpEx->tDump.acPixels, ptDumpEx->cbPixels);
+	for (nPoolTile = 0; nPoolTile < tRows.nPoolTiles; ++nPoolTile)
 	{
-		hrResult = HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
-		PROGRESS("Bitmap file is too large.");
-		goto lblCleanup;
+		tRows.atPoolTiles[nPoolTile] = tDecoder;
+		if (!RLE_SkipPixels(&tDecoder, FRAMEBUFFER_TILE_PIXELS))
+		{
+			break;
+		}
 	}
 
-	if (cbBitmap < sizeof(*ptFileHeader) + sizeof(*ptInfoHeader))
+	// Every pooled tile must be in the pool, and the pool must hold nothing else.
+	if ((nPoolTile != tRows.nPoolTiles) || !RLE_IsDecoderDone(&tDecoder))
 	{
-		hrResult = HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
-		PROGRESS("Bitmap file is too small.");
+		PROGRESS("The stored screenshot is corrupt.");
+		hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
 		goto lblCleanup;
 	}
 
-	ptFileHeader = (PBITMAPFILEHEADER)pvBitmap;
-
-	if ('MB' != ptFileHeader->bfType)
+	for (nTile = 0; nTile < nTiles; ++nTile)
 	{
-		hrResult = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
-		PROGRESS("Invalid magic for bitmap file.");
-		goto lblCleanup;
+		CopyMemory(&tTile, &pcTiles[nTile * sizeof(tTile)], sizeof(tTile));
+		if ((FRAMEBUFFER_TILE_STATE_POOLED == tTile.eState) &&
+			(tTile.nValue >= tRows.nPoolTiles))
+		{
+			PROGRESS("The stored screenshot is corrupt.");
+			hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+			goto lblCleanup;
+		}
 	}
 
-	ptInfoHeader = (PBITMAPINFOHEADER)(ptFileHeader + 1);
-
-	if (sizeof(*ptInfoHeader) != ptInfoHeader->biSize)
+	// Can't overflow, since the strip is no larger than the whole image.
+	cbStrip = ptDumpEx->tDump.nWidth * min(FRAMEBUFFER_TILE_SIZE, ptDumpEx->tDump.nHeight) * RLE_PIXEL_SIZE;
+	if (0 != cbStrip)
 	{
-		hrResult = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
-		PROGRESS("Invalid size for bitmap info header.");
-		goto lblCleanup;
+		tRows.pcStrip = HEAPALLOC(cbStrip);
+		if (NULL == tRows.pcStrip)
+		{
+			PROGRESS("Oops. Ran out of memory.");
+			hrResult = E_OUTOFMEMORY;
+			goto lblCleanup;
+		}
 	}
 
-	if (BI_RGB != ptInfoHeader->biCompression)
+	// Transfer ownership:
+	*ptRows = tRows;
+	ZeroMemory(&tRows, sizeof(tRows));
+
+	hrResult = S_OK;
+
+lblCleanup:
+	main_CloseFramebufferRows(&tRows);
+
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_DecompressStrip(
+	PFRAMEBUFFER_ROWS	ptRows,
+	DWORD				nTileRow
+)
+{
+	HRESULT				hrResult		= E_FAIL;
+	PCFRAMEBUFFER_DUMP	ptDump			= NULL;
+	CONST BYTE *		pcTiles			= NULL;
+	FRAMEBUFFER_TILE	tTile			= { 0 };
+	DWORD				nTileColumns	= 0;
+	DWORD				nTileColumn		= 0;
+	DWORD				nTop			= 0;
+	DWORD				nLeft			= 0;
+	DWORD				nWidth			= 0;
+	DWORD				nHeight			= 0;
+	DWORD				nRow			= 0;
+	DWORD				nColumn			= 0;
+	PBYTE				pcRow			= NULL;
+	RLE_DECODER			tDecoder;
+	BOOL				bDecoded		= TRUE;
+
+	assert(NULL != ptRows);
+	assert(NULL != ptRows->ptDumpEx);
+	assert(NULL != ptRows->pcStrip);
+
+	ptDump = ptRows->ptDump;
+	pcTiles = &ptRows->ptDumpEx->tDump.acPixels[ptRows->ptDumpEx->cbPixels];
+	nTileColumns = FRAMEBUFFER_TILES(ptDump->nWidth);
+	nTop = nTileRow * FRAMEBUFFER_TILE_SIZE;
+	nHeight = min(FRAMEBUFFER_TILE_SIZE, ptDump->nHeight - nTop);
+
+	ptRows->bStripValid = FALSE;
+
+	// Clean and dropped tiles come out black.
+	ZeroMemory(ptRows->pcStrip, ptDump->nWidth * nHeight * RLE_PIXEL_SIZE);
+
+	for (nTileColumn = 0; (nTileColumn < nTileColumns) && bDecoded; ++nTileColumn)
 	{
-		hrResult = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
-		PROGRESS("Unsupported bitmap compression.");
-		goto lblCleanup;
+		// The directory isn't aligned.
+		CopyMemory(&tTile,
+				   &pcTiles[(nTileRow * nTileColumns + nTileColumn) * sizeof(tTile)],
+				   sizeof(tTile));
+
+		nLeft = nTileColumn * FRAMEBUFFER_TILE_SIZE;
+		nWidth = min(FRAMEBUFFER_TILE_SIZE, ptDump->nWidth - nLeft);
+
+		switch (tTile.eState)
+		{
+		case FRAMEBUFFER_TILE_STATE_SOLID:
+			// The padding byte is junk.
+			tTile.nValue &= 0x00FFFFFF;
+
+			for (nRow = 0; nRow < nHeight; ++nRow)
+			{
+				pcRow = &ptRows->pcStrip[(nRow * ptDump->nWidth + nLeft) * RLE_PIXEL_SIZE];
+				for (nColumn = 0; nColumn < nWidth; ++nColumn)
+				{
+					CopyMemory(&pcRow[nColumn * RLE_PIXEL_SIZE], &tTile.nValue, RLE_PIXEL_SIZE);
+				}
+			}
+			break;
+
+		case FRAMEBUFFER_TILE_STATE_POOLED:
+			// Every pool entry is a whole tile, even on the edges of the framebuffer,
+			// so whatever lies outside the framebuffer is skipped.
+			// Validated by main_OpenCompressedFramebufferRows.
+			tDecoder = ptRows->atPoolTiles[tTile.nValue];
+			for (nRow = 0; (nRow < nHeight) && bDecoded; ++nRow)
+			{
+				bDecoded = RLE_DecodePixels(&tDecoder,
+											&ptRows->pcStrip[(nRow * ptDump->nWidth + nLeft) * RLE_PIXEL_SIZE],
+											nWidth) &&
+						   RLE_SkipPixels(&tDecoder, FRAMEBUFFER_TILE_SIZE - nWidth);
+			}
+			break;
+
+		default:
+			break;
+		}
 	}
 
-	if (32 != ptInfoHeader->biBitCount && 24 != ptInfoHeader->biBitCount)
+	if (!bDecoded)
 	{
-		hrResult = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
-		PROGRESS("Unsupported BPP value (%hu).", ptInfoHeader->biBitCount);
+		PROGRESS("The stored screenshot is corrupt.");
+		hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
 		goto lblCleanup;
 	}
 
-	if (ptInfoHeader->biWidth < 0)
+	ptRows->nStripTop = nTop;
+	ptRows->bStripValid = TRUE;
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_GetFramebufferRows(
+	PFRAMEBUFFER_ROWS	ptRows,
+	DWORD				nRow,
+	CONST BYTE **		ppcRows,
+	PDWORD				pnRows
+)
+{
+	HRESULT				hrResult	= E_FAIL;
+	PCFRAMEBUFFER_DUMP	ptDump		= NULL;
+	DWORD				nTileRow	= 0;
+
+	assert(NULL != ptRows);
+	assert(NULL != ppcRows);
+	assert(NULL != pnRows);
+
+	ptDump = ptRows->ptDump;
+	assert(nRow < ptDump->nHeight);
+
+	// Can't overflow, since the dump holds all of its pixels.
+	if (NULL == ptRows->ptDumpEx)
 	{
-		hrResult = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
-		PROGRESS("Bitmap width is negative.");
+		*ppcRows = &ptDump->acPixels[nRow * ptDump->nWidth * RLE_PIXEL_SIZE];
+		*pnRows = ptDump->nHeight - nRow;
+
+		hrResult = S_OK;
 		goto lblCleanup;
 	}
-	if ((ULONG)(ptInfoHeader->biWidth) != tQrInfo.nWidth)
+
+	nTileRow = nRow / FRAMEBUFFER_TILE_SIZE;
+	if (!ptRows->bStripValid || (nTileRow * FRAMEBUFFER_TILE_SIZE != ptRows->nStripTop))
 	{
-		hrResult = E_INVALIDARG;
-		PROGRESS("Bitmap width does not match existing QR image.");
-		goto lblCleanup;
+		hrResult = main_DecompressStrip(ptRows, nTileRow);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
 	}
 
-	if (llabs((LONGLONG)(ptInfoHeader->biHeight)) != (LONGLONG)(tQrInfo.nHeight))
+	*ppcRows = &ptRows->pcStrip[(nRow - ptRows->nStripTop) * ptDump->nWidth * RLE_PIXEL_SIZE];
+	*pnRows = min(ptRows->nStripTop + FRAMEBUFFER_TILE_SIZE, ptDump->nHeight) - nRow;
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+VOID
+main_CloseFramebufferRows(
+	PFRAMEBUFFER_ROWS	ptRows
+)
+{
+	assert(NULL != ptRows);
+
+	HEAPFREE(ptRows->atPoolTiles);
+	HEAPFREE(ptRows->pcStrip);
+	ptRows->bStripValid = FALSE;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_WriteFramebufferBitmap(
+	PFRAMEBUFFER_ROWS	ptRows,
+	HFILEWRITER			hWriter
+)
+{
+	HRESULT						hrResult		= E_FAIL;
+	PCFRAMEBUFFER_DUMP			ptDump			= NULL;
+	ULONG						nBitmapWidth	= 0;
+	ULONG						nBitmapHeight	= 0;
+	DWORD						cbBitmap		= 0;
+	FRAMEBUFFER_BITMAP_HEADER	tHeader			= { 0 };
+	FILEWRITER_CHUNK			atRows[FRAMEBUFFER_ROWS_PER_WRITE];
+	DWORD						nRows			= 0;
+	ULONG						nRow			= 0;
+	CONST BYTE *				pcRows			= NULL;
+	DWORD						nAvailable		= 0;
+	DWORD						nCurrent		= 0;
+
+	assert(NULL != ptRows);
+	assert(NULL != hWriter);
+
+	PROGRESS("Converting framebuffer dump to BMP...");
+
+	ptDump = ptRows->ptDump;
+
+	hrResult = main_GetFramebufferImageSize(ptDump, ptRows->cbDump, &nBitmapWidth, &nBitmapHeight);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	// Can't overflow, since the bitmap is no larger than the dump.
+	cbBitmap = sizeof(tHeader) + nBitmapWidth * nBitmapHeight * 4;
+
+	PROGRESS("Writing the BMP header.");
+
+	// Initialize the file header
+	tHeader.tFileHeader.bfType = 'MB';
+	tHeader.tFileHeader.bfSize = cbBitmap;
+	tHeader.tFileHeader.bfOffBits = sizeof(tHeader);
+
+	// Initialize the info header
+	tHeader.tInfoHeader.biSize = sizeof(tHeader.tInfoHeader);
+	tHeader.tInfoHeader.biWidth = (LONG)nBitmapWidth;
+	tHeader.tInfoHeader.biHeight = -(LONG)nBitmapHeight;	// Negative because otherwise the bitmap
+															// is bottom-up :)
+	tHeader.tInfoHeader.biPlanes = 1;
+	tHeader.tInfoHeader.biBitCount = 32;
+	tHeader.tInfoHeader.biCompression = BI_RGB;
+
+	hrResult = FILEWRITER_Write(hWriter, &tHeader, sizeof(tHeader));
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	// The rows are written straight from the dump, or from the decompressed strip.
+	PROGRESS("Writing the pixel data.");
+	for (nRow = 0; nRow < nBitmapHeight; nRow += nAvailable)
+	{
+		hrResult = main_GetFramebufferRows(ptRows, nRow, &pcRows, &nAvailable);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+		nAvailable = min(nAvailable, nBitmapHeight - nRow);
+
+		if (nBitmapWidth == ptDump->nWidth)
+		{
+			// No cropping, so the rows are contiguous.
+			hrResult = FILEWRITER_Write(hWriter, pcRows, nAvailable * nBitmapWidth * 4);
+			if (FAILED(hrResult))
+			{
+				goto lblCleanup;
+			}
+			continue;
+		}
+
+		// The strip is reused for the next rows, so whatever
+		// was gathered from it is written before moving on.
+		for (nCurrent = 0; nCurrent < nAvailable; ++nCurrent)
+		{
+			atRows[nRows].pvData = &pcRows[nCurrent * ptDump->nWidth * 4];
+			atRows[nRows].cbData = nBitmapWidth * 4;
+			++nRows;
+
+			if ((ARRAYSIZE(atRows) == nRows) || (nAvailable - 1 == nCurrent))
+			{
+				hrResult = FILEWRITER_WriteGather(hWriter, atRows, nRows);
+				if (FAILED(hrResult))
+				{
+					goto lblCleanup;
+				}
+				nRows = 0;
+			}
+		}
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_WriteFramebufferPng(
+	PFRAMEBUFFER_ROWS	ptRows,
+	DWORD				nLevel,
+	HFILEWRITER			hWriter
+)
+{
+	HRESULT			hrResult		= E_FAIL;
+	ULONG			nImageWidth		= 0;
+	ULONG			nImageHeight	= 0;
+	ULONG			nRow			= 0;
+	CONST BYTE *	pcRows			= NULL;
+	DWORD			nAvailable		= 0;
+	HPNG			hPng			= NULL;
+
+	assert(NULL != ptRows);
+	assert(NULL != hWriter);
+
+	PROGRESS("Converting framebuffer dump to PNG...");
+
+	hrResult = main_GetFramebufferImageSize(ptRows->ptDump, ptRows->cbDump, &nImageWidth, &nImageHeight);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	if ((0 == nImageWidth) || (0 == nImageHeight))
+	{
+		PROGRESS("The stored screenshot is empty.");
+		hrResult = E_DRAW;
+		goto lblCleanup;
+	}
+
+	hrResult = PNG_Create(hWriter,
+						  nImageWidth,
+						  nImageHeight,
+						  PNG_PIXEL_FORMAT_BGRX32,
+						  NULL,
+						  0,
+						  nLevel,
+						  &hPng);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	// The rows are compressed straight from the dump, or from the decompressed strip.
+	PROGRESS("Writing the pixel data.");
+	for (nRow = 0; nRow < nImageHeight; ++nRow)
+	{
+		hrResult = main_GetFramebufferRows(ptRows, nRow, &pcRows, &nAvailable);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+
+		hrResult = PNG_WriteRow(hPng, pcRows);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+	}
+
+	hrResult = PNG_Finish(hPng);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	CLOSE(hPng, PNG_Close);
+
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_WriteVgaPng(
+	PCVGA_DUMP	ptDump,
+	DWORD		nLevel,
+	HFILEWRITER	hWriter
+)
+{
+	HRESULT	hrResult	= E_FAIL;
+	RGBQUAD	atColors[VGA_BITMAP_PALETTE_ENTRIES];
+	BYTE	acRow[VGAPLANES_PACKED_BYTES_PER_ROW];
+	DWORD	nRow		= 0;
+	HPNG	hPng		= NULL;
+
+	assert(NULL != ptDump);
+	assert(NULL != hWriter);
+
+	PROGRESS("Converting raw VGA dump to PNG...");
+
+	main_VgaPaletteToRgb(ptDump, atColors);
+
+	hrResult = PNG_Create(hWriter,
+						  SCREEN_WIDTH_PIXELS,
+						  SCREEN_HEIGHT_PIXELS,
+						  PNG_PIXEL_FORMAT_INDEXED4,
+						  atColors,
+						  ARRAYSIZE(atColors),
+						  nLevel,
+						  &hPng);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	// Each row goes straight from the planes to the encoder.
+	PROGRESS("Writing the pixel data.");
+	for (nRow = 0; nRow < SCREEN_HEIGHT_PIXELS; ++nRow)
+	{
+		VGAPLANES_PlanarToPacked(ptDump,
+								 nRow * VGAPLANES_PLANE_BYTES_PER_ROW,
+								 VGAPLANES_PLANE_BYTES_PER_ROW,
+								 acRow);
+
+		hrResult = PNG_WriteRow(hPng, acRow);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+	}
+
+	hrResult = PNG_Finish(hPng);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	CLOSE(hPng, PNG_Close);
+
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+BOOL
+main_IsPngPath(
+	PCWSTR	pwszOutputPath
+)
+{
+	SIZE_T	cchPath			= 0;
+	SIZE_T	cchExtension	= 0;
+
+	assert(NULL != pwszOutputPath);
+
+	cchPath = wcslen(pwszOutputPath);
+	cchExtension = wcslen(PNG_OUTPUT_EXTENSION);
+
+	return (cchPath >= cchExtension) &&
+		   (0 == _wcsicmp(pwszOutputPath + cchPath - cchExtension, PNG_OUTPUT_EXTENSION));
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_GetQrInfo(
+	PQR_INFO	ptInfo
+)
+{
+	HRESULT	hrResult	= E_FAIL;
+	DWORD	cbReturned	= 0;
+
+	assert(NULL != ptInfo);
+
+	hrResult = DRINKCONTROL_ControlDriver(IOCTL_DRINK_QR_INFO,
+										  NULL, 0,
+										  ptInfo, sizeof(*ptInfo), &cbReturned);
+	if (FAILED(hrResult))
+	{
+		PROGRESS("Failed retrieving information (0x%08lX).", hrResult);
+		goto lblCleanup;
+	}
+
+	if (cbReturned < sizeof(*ptInfo))
+	{
+		PROGRESS("Returned buffer is unexpectedly small (%lu).", cbReturned);
+	}
+	assert(sizeof(*ptInfo) == cbReturned);
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_ConvertBitmapForQr(
+	PCWSTR	pwszFilename,
+	PVOID *	ppvPixels,
+	PDWORD	pcbPixels
+)
+{
+	HRESULT				hrResult		= E_FAIL;
+	QR_INFO				tQrInfo			= { 0 };
+	PVOID				pvBitmap		= NULL;
+	SIZE_T				cbBitmap		= 0;
+	PBITMAPFILEHEADER	ptFileHeader	= NULL;
+	PBITMAPINFOHEADER	ptInfoHeader	= NULL;
+	PVOID				pvPixels		= NULL;
+	DWORD				cbPixels		= 0;
+
+	assert(NULL != pwszFilename);
+	assert(NULL != ppvPixels);
+	assert(NULL != pcbPixels);
+
+	hrResult = main_GetQrInfo(&tQrInfo);
+	if (FAILED(hrResult))
+	{
+		PROGRESS("main_GetQrInfo failed with code 0x%08lX.", hrResult);
+		goto lblCleanup;
+	}
+
+	// Kernel also supports 24-bit bitmaps, but I don't wanna deal with conversion :)
+	if (32 != tQrInfo.nBitCount)
+	{
+		hrResult = E_NOTIMPL;
+		PROGRESS("Current QR bitmap has an unsupported BPP (%lu).", tQrInfo.nBitCount);
+		goto lblCleanup;
+	}
+
+	hrResult = UTIL_ReadFile(pwszFilename, &pvBitmap, &cbBitmap);
+	if (FAILED(hrResult))
+	{
+		PROGRESS("Failed reading bitmap file (0x%08lX).", hrResult);
+		goto lblCleanup;
+	}
+
+	if (cbBitmap > MAXDWORD)
+	{
+		hrResult = HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+		PROGRESS("Bitmap file is too large.");
+		goto lblCleanup;
+	}
+
+	if (cbBitmap < sizeof(*ptFileHeader) + sizeof(*ptInfoHeader))
+	{
+		hrResult = HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+		PROGRESS("Bitmap file is too small.");
+		goto lblCleanup;
+	}
+
+	ptFileHeader = (PBITMAPFILEHEADER)pvBitmap;
+
+	if ('MB' != ptFileHeader->bfType)
+	{
+		hrResult = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+		PROGRESS("Invalid magic for bitmap file.");
+		goto lblCleanup;
+	}
+
+	ptInfoHeader = (PBITMAPINFOHEADER)(ptFileHeader + 1);
+
+	if (sizeof(*ptInfoHeader) != ptInfoHeader->biSize)
+	{
+		hrResult = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+		PROGRESS("Invalid size for bitmap info header.");
+		goto lblCleanup;
+	}
+
+	if (BI_RGB != ptInfoHeader->biCompression)
+	{
+		hrResult = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+		PROGRESS("Unsupported bitmap compression.");
+		goto lblCleanup;
+	}
+
+	if (32 != ptInfoHeader->biBitCount && 24 != ptInfoHeader->biBitCount)
+	{
+		hrResult = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+		PROGRESS("Unsupported BPP value (%hu).", ptInfoHeader->biBitCount);
+		goto lblCleanup;
+	}
+
+	if (ptInfoHeader->biWidth < 0)
+	{
+		hrResult = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+		PROGRESS("Bitmap width is negative.");
+		goto lblCleanup;
+	}
+	if ((ULONG)(ptInfoHeader->biWidth) != tQrInfo.nWidth)
+	{
+		hrResult = E_INVALIDARG;
+		PROGRESS("Bitmap width does not match existing QR image.");
+		goto lblCleanup;
+	}
+
+	if (llabs((LONGLONG)(ptInfoHeader->biHeight)) != (LONGLONG)(tQrInfo.nHeight))
+	{
+		hrResult = E_INVALIDARG;
+		PROGRESS("Bitmap height does not match existing QR image.");
+		goto lblCleanup;
+	}
+
+	// YOLO: not dealing with overflow. It's from the kernel, so it's trusted :)
+	cbPixels = tQrInfo.nWidth * tQrInfo.nHeight * tQrInfo.nBitCount / 8;
+
+	// TODO: Validate source file has enough data
+
+	pvPixels = HEAPALLOC(cbPixels);
+	if (NULL == pvPixels)
+	{
+		hrResult = E_OUTOFMEMORY;
+		goto lblCleanup;
+	}
+
+	assert(32 == tQrInfo.nBitCount);	// The following code converts to 32 BPP
+	if (32 == ptInfoHeader->biBitCount)
+	{
+		// No need to deal with bitmap line alignment
+
+		if (ptInfoHeader->biHeight < 0)
+		{
+			// Top-down bitmap, just copy it.
+			RtlMoveMemory(pvPixels, ptInfoHeader + 1, cbPixels);
+		}
+		else
+		{
+			ULONG	cbRow		= ptInfoHeader->biBitCount * tQrInfo.nWidth;
+			PBYTE	pcSource	= (PBYTE)(ptInfoHeader + 1);
+			PBYTE	pcDest		= ((PBYTE)pvPixels) + ((tQrInfo.nHeight - 1) * cbRow);
+			ULONG	nRow		= 0;
+
+			// Bottom-up bitmap. Copy in reverse.
+
+			for (nRow = 0; nRow < tQrInfo.nHeight; ++nRow)
+			{
+				RtlMoveMemory(pcDest, pcSource, cbRow);
+				pcDest -= cbRow;
+				pcSource += cbRow;
+			}
+		}
+	}
+	else
+	{
+		ULONG		cbSourceRow	= (ptInfoHeader->biBitCount / 8 * tQrInfo.nWidth) + (4 - ptInfoHeader->biBitCount / 8 * tQrInfo.nWidth % 4);
+		LPRGBTRIPLE	ptSourceRow	= (LPRGBTRIPLE)(ptInfoHeader + 1);
+		ULONG		nRow		= 0;
+		ULONG		nColumn		= 0;
+
+		assert(24 == ptInfoHeader->biBitCount);
+
+		if (ptInfoHeader->biHeight < 0)
+		{
+			LPRGBQUAD	ptDestRow	= pvPixels;
+
+			// Top-down bitmap, copy normally.
+			
+			for (nRow = 0; nRow < tQrInfo.nHeight; ++nRow)
+			{
+				for (nColumn = 0; nColumn < tQrInfo.nWidth; ++nColumn)
+				{
+					ptDestRow[nColumn].rgbBlue = ptSourceRow[nColumn].rgbtBlue;
+					ptDestRow[nColumn].rgbGreen = ptSourceRow[nColumn].rgbtGreen;
+					ptDestRow[nColumn].rgbRed = ptSourceRow[nColumn].rgbtRed;
+					ptDestRow[nColumn].rgbReserved = 0;
+				}
+				ptSourceRow = (LPRGBTRIPLE)((PBYTE)ptSourceRow + cbSourceRow);
+				ptDestRow += tQrInfo.nWidth;
+			}
+		}
+		else
+		{
+			LPRGBQUAD	ptDestRow	= ((LPRGBQUAD)pvPixels) + ((tQrInfo.nHeight - 1) * tQrInfo.nWidth);
+
+			// Bottom-up bitmap. Copy in reverse.
+
+			for (nRow = 0; nRow < tQrInfo.nHeight; ++nRow)
+			{
+				for (nColumn = 0; nColumn < tQrInfo.nWidth; ++nColumn)
+				{
+					ptDestRow[nColumn].rgbBlue = ptSourceRow[nColumn].rgbtBlue;
+					ptDestRow[nColumn].rgbGreen = ptSourceRow[nColumn].rgbtGreen;
+					ptDestRow[nColumn].rgbRed = ptSourceRow[nColumn].rgbtRed;
+					ptDestRow[nColumn].rgbReserved = 0;
+				}
+				ptSourceRow = (LPRGBTRIPLE)((PBYTE)ptSourceRow + cbSourceRow);
+				ptDestRow -= tQrInfo.nWidth;
+			}
+		}
+	}
+
+	// Transfer ownership:
+	*ppvPixels = pvPixels;
+	pvPixels = NULL;
+	*pcbPixels = cbPixels;
+
+	hrResult = S_OK;
+
+lblCleanup:
+	HEAPFREE(pvPixels);
+	HEAPFREE(pvBitmap);
+
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_ParseConvertOptions(
+	PINT				pnArguments,
+	CONST PCWSTR **		pppwszArguments,
+	PCONVERT_OPTIONS	ptOptions
+)
+{
+	HRESULT			hrResult		= E_FAIL;
+	INT				nArguments		= 0;
+	CONST PCWSTR *	ppwszArguments	= NULL;
+	PWSTR			pwszEnd			= NULL;
+
+	assert(NULL != pnArguments);
+	assert(NULL != pppwszArguments);
+	assert(NULL != ptOptions);
+
+	nArguments = *pnArguments;
+	ppwszArguments = *pppwszArguments;
+
+	ZeroMemory(ptOptions, sizeof(*ptOptions));
+	ptOptions->nLevel = DEFLATE_DEFAULT_LEVEL;
+	ptOptions->pwszOutputExtension = BATCH_OUTPUT_EXTENSION;
+
+	// Consume the options preceding the positional arguments.
+	while ((nArguments > 0) && (L'-' == ppwszArguments[0][0]))
+	{
+		if (0 == _wcsicmp(ppwszArguments[0], CONVERT_OPTION_CACHE))
+		{
+			ptOptions->fOpenFlags |= DUMPPARSE_OPEN_INDEX_CACHE;
+		}
+		else if (0 == _wcsicmp(ppwszArguments[0], CONVERT_OPTION_PNG))
+		{
+			ptOptions->pwszOutputExtension = PNG_OUTPUT_EXTENSION;
+		}
+		else if (0 == _wcsicmp(ppwszArguments[0], CONVERT_OPTION_FRAMES))
+		{
+			ptOptions->bFrames = TRUE;
+		}
+		else if (0 == _wcsicmp(ppwszArguments[0], CONVERT_OPTION_LEVEL))
+		{
+			if (nArguments < 2)
+			{
+				PROGRESS("Option '%S' requires a value.", ppwszArguments[0]);
+				hrResult = E_INVALIDARG;
+				goto lblCleanup;
+			}
+
+			--nArguments;
+			++ppwszArguments;
+
+			ptOptions->nLevel = wcstoul(ppwszArguments[0], &pwszEnd, 10);
+			if ((pwszEnd == ppwszArguments[0]) ||
+				(L'\0' != *pwszEnd) ||
+				(ptOptions->nLevel > DEFLATE_MAX_LEVEL))
+			{
+				PROGRESS("The compression level must be between %d and %d.",
+						 DEFLATE_MIN_LEVEL,
+						 DEFLATE_MAX_LEVEL);
+				hrResult = E_INVALIDARG;
+				goto lblCleanup;
+			}
+		}
+		else
+		{
+			PROGRESS("Unknown option '%S'.", ppwszArguments[0]);
+			hrResult = E_INVALIDARG;
+			goto lblCleanup;
+		}
+
+		--nArguments;
+		++ppwszArguments;
+	}
+
+	*pnArguments = nArguments;
+	*pppwszArguments = ppwszArguments;
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+VOID
+main_AcquireBudget(
+	PMEMORY_BUDGET	ptBudget,
+	ULONGLONG		cbAmount
+)
+{
+	assert(NULL != ptBudget);
+
+	for (;;)
+	{
+		EnterCriticalSection(&(ptBudget->tLock));
+
+		// A request larger than the whole budget is let through
+		// when nothing else is in flight, so that it can't wait forever.
+		if ((0 == ptBudget->cbInUse) ||
+			((ptBudget->cbInUse <= ptBudget->cbLimit) &&
+			 (cbAmount <= ptBudget->cbLimit - ptBudget->cbInUse)))
+		{
+			ptBudget->cbInUse += cbAmount;
+			LeaveCriticalSection(&(ptBudget->tLock));
+			break;
+		}
+
+		// Reset under the lock, so that a release after this point
+		// is guaranteed to wake us up.
+		(VOID)ResetEvent(ptBudget->hReleasedEvent);
+
+		LeaveCriticalSection(&(ptBudget->tLock));
+
+		(VOID)WaitForSingleObject(ptBudget->hReleasedEvent, INFINITE);
+	}
+}
+
+_Use_decl_annotations_
+STATIC
+VOID
+main_ReleaseBudget(
+	PMEMORY_BUDGET	ptBudget,
+	ULONGLONG		cbAmount
+)
+{
+	assert(NULL != ptBudget);
+
+	EnterCriticalSection(&(ptBudget->tLock));
+
+	assert(ptBudget->cbInUse >= cbAmount);
+	ptBudget->cbInUse -= cbAmount;
+	(VOID)SetEvent(ptBudget->hReleasedEvent);
+
+	LeaveCriticalSection(&(ptBudget->tLock));
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_GetNumberedOutputPath(
+	PCWSTR	pwszOutputPath,
+	PCWSTR	pwszSuffix,
+	DWORD	nNumber,
+	PWSTR *	ppwszNumberedPath
+)
+{
+	HRESULT	hrResult			= E_FAIL;
+	PCWSTR	pwszFileName		= NULL;
+	PCWSTR	pwszExtension		= NULL;
+	SIZE_T	cchStem				= 0;
+	SIZE_T	cchNumberedPath		= 0;
+	PWSTR	pwszNumberedPath	= NULL;
+
+	assert(NULL != pwszOutputPath);
+	assert(NULL != pwszSuffix);
+	assert(NULL != ppwszNumberedPath);
+
+	pwszFileName = wcsrchr(pwszOutputPath, L'\\');
+	pwszFileName =
+		(NULL == pwszFileName)
+		? (pwszOutputPath)
+		: (pwszFileName + 1);
+	pwszExtension = wcsrchr(pwszFileName, L'.');
+	if (NULL == pwszExtension)
+	{
+		pwszExtension = pwszFileName + wcslen(pwszFileName);
+	}
+	cchStem = (SIZE_T)(pwszExtension - pwszOutputPath);
+
+	// Room for the stem, the suffix, the number, and the extension.
+	cchNumberedPath = cchStem + wcslen(pwszSuffix) + 16 + wcslen(pwszExtension) + 1;
+	pwszNumberedPath = HEAPALLOC(cchNumberedPath * sizeof(*pwszNumberedPath));
+	if (NULL == pwszNumberedPath)
+	{
+		PROGRESS("Oops. Ran out of memory.");
+		hrResult = E_OUTOFMEMORY;
+		goto lblCleanup;
+	}
+
+	hrResult = StringCchPrintfW(pwszNumberedPath,
+								cchNumberedPath,
+								L"%.*s%s%lu%s",
+								(INT)cchStem,
+								pwszOutputPath,
+								pwszSuffix,
+								nNumber,
+								pwszExtension);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	// Transfer ownership:
+	*ppwszNumberedPath = pwszNumberedPath;
+	pwszNumberedPath = NULL;
+
+	hrResult = S_OK;
+
+lblCleanup:
+	HEAPFREE(pwszNumberedPath);
+
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+VOID
+main_ReportBugshotStatistics(
+	LPCVOID	pvScreenshot,
+	DWORD	cbScreenshot,
+	LPCGUID	ptTag
+)
+{
+	BUGSHOT_STATISTICS	tStatistics	= { 0 };
+
+	assert(NULL != pvScreenshot);
+	assert(NULL != ptTag);
+
+	// Written by older versions of the driver, which kept no statistics.
+	if (IsEqualGUID(ptTag, &g_tFramebufferDumpGuid) || (cbScreenshot < sizeof(tStatistics)))
+	{
+		goto lblCleanup;
+	}
+
+	// The statistics end the stored data, and aren't necessarily aligned.
+	CopyMemory(&tStatistics, (CONST BYTE *)pvScreenshot + cbScreenshot - sizeof(tStatistics), sizeof(tStatistics));
+	if (BUGSHOT_STATISTICS_SIGNATURE != tStatistics.nSignature)
+	{
+		goto lblCleanup;
+	}
+
+	PROGRESS("The screen was drawn on %lu times, %lu of them clipped.",
+			 tStatistics.nBlits,
+			 tStatistics.nClippedBlits);
+	PROGRESS("Copying %I64u bytes of pixels took %I64u cycles (%I64u per draw).",
+			 tStatistics.cbCopied,
+			 tStatistics.nCopyCycles,
+			 (0 == tStatistics.nBlits) ? (0) : (tStatistics.nCopyCycles / tStatistics.nBlits));
+	PROGRESS("The bugcheck callback was invoked %lu times, and took %I64u cycles.",
+			 tStatistics.nCallbacks,
+			 tStatistics.nCallbackCycles);
+
+lblCleanup:
+	return;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_ConvertScreenshot(
+	LPCVOID				pvScreenshot,
+	DWORD				cbScreenshot,
+	LPCGUID				ptTag,
+	PCWSTR				pwszOutputPath,
+	PCCONVERT_OPTIONS	ptOptions,
+	PMEMORY_BUDGET		ptBudget
+)
+{
+	HRESULT					hrResult			= E_FAIL;
+	PCFRAMEBUFFER_DUMP_EX	ptFramebufferDumpEx	= NULL;
+	DWORD					cbDecompressed		= 0;
+	PCFRAMEBUFFER_DUMP		ptFramebufferDump	= NULL;
+	DWORD					cbFramebufferDump	= 0;
+	FRAMEBUFFER_ROWS		tFramebufferRows	= { 0 };
+	PCVGA_DUMP				ptDump				= NULL;
+	PVGA_BITMAP				ptBitmap			= NULL;
+	ULONGLONG				cbReserved			= 0;
+	HFILEWRITER				hWriter				= NULL;
+	BOOL					bPng				= FALSE;
+
+	assert(NULL != pvScreenshot);
+	assert(NULL != ptTag);
+	assert(NULL != pwszOutputPath);
+	assert(NULL != ptOptions);
+
+	bPng = main_IsPngPath(pwszOutputPath);
+
+	if (IsEqualGUID(ptTag, &g_tVgaDumpGuid))
+	{
+		// The statistics may follow the dump.
+		ptDump = pvScreenshot;
+		if ((sizeof(*ptDump) != cbScreenshot) &&
+			(sizeof(*ptDump) + sizeof(BUGSHOT_STATISTICS) != cbScreenshot))
+		{
+			PROGRESS("The stored screenshot has a weird size.");
+			hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+			goto lblCleanup;
+		}
+	}
+	else if (IsEqualGUID(ptTag, &g_tFramebufferDumpGuid))
+	{
+		// Written by older versions of the driver.
+		ptFramebufferDump = pvScreenshot;
+		cbFramebufferDump = cbScreenshot;
+	}
+	else
+	{
+		ptFramebufferDumpEx = pvScreenshot;
+
+		hrResult = main_ValidateFramebufferDumpEx(ptFramebufferDumpEx, cbScreenshot, &cbDecompressed);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+
+		ptFramebufferDump = &ptFramebufferDumpEx->tDump;
+		cbFramebufferDump = cbScreenshot - FIELD_OFFSET(FRAMEBUFFER_DUMP_EX, tDump);
+	}
+
+	main_ReportBugshotStatistics(pvScreenshot, cbScreenshot, ptTag);
+
+	// Only the VGA bitmap is built in memory. Uncompressed framebuffer rows
+	// go straight from the dump to the file, and a compressed framebuffer
+	// is decompressed one strip of tiles at a time.
+	if (NULL != ptBudget)
+	{
+		cbReserved = FILEWRITER_BUFFER_SIZE;
+		if ((NULL != ptDump) && !bPng)
+		{
+			cbReserved += sizeof(*ptBitmap);
+		}
+		if (bPng)
+		{
+			cbReserved += PNG_MEMORY_ESTIMATE;
+		}
+		if (0 != cbDecompressed)
+		{
+			cbReserved += main_GetCompressedFramebufferRowsSize(ptFramebufferDumpEx);
+		}
+		main_AcquireBudget(ptBudget, cbReserved);
+	}
+
+	if (0 != cbDecompressed)
+	{
+		hrResult = main_OpenCompressedFramebufferRows(&tFramebufferRows, ptFramebufferDumpEx, cbDecompressed);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+	}
+	else if (NULL != ptFramebufferDump)
+	{
+		main_InitializeFramebufferRows(&tFramebufferRows, ptFramebufferDump, cbFramebufferDump);
+	}
+
+	if (NULL != ptFramebufferDump)
+	{
+		hrResult = main_WriteFramebufferFile(&tFramebufferRows, pwszOutputPath, ptOptions);
+		goto lblCleanup;
+	}
+
+	hrResult = FILEWRITER_Create(pwszOutputPath, &hWriter);
+	if (FAILED(hrResult))
+	{
+		PROGRESS("Failed creating the output file.");
+		goto lblCleanup;
+	}
+
+	if (bPng)
+	{
+		hrResult = main_WriteVgaPng(ptDump, ptOptions->nLevel, hWriter);
+		if (FAILED(hrResult))
+		{
+			PROGRESS("Failed converting raw VGA dump to PNG.");
+			goto lblCleanup;
+		}
+	}
+	else
+	{
+		hrResult = main_VgaDumpToBitmap(ptDump, &ptBitmap);
+		if (FAILED(hrResult))
+		{
+			PROGRESS("Failed converting raw VGA dump to BMP.");
+			goto lblCleanup;
+		}
+
+		hrResult = FILEWRITER_Write(hWriter, ptBitmap, ptBitmap->tFileHeader.bfSize);
+		if (FAILED(hrResult))
+		{
+			PROGRESS("Failed writing to the output file.");
+			goto lblCleanup;
+		}
+	}
+
+	hrResult = FILEWRITER_Commit(hWriter);
+	if (FAILED(hrResult))
+	{
+		PROGRESS("Failed writing to the output file.");
+		goto lblCleanup;
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	CLOSE(hWriter, FILEWRITER_Close);
+	HEAPFREE(ptBitmap);
+	main_CloseFramebufferRows(&tFramebufferRows);
+	if (0 != cbReserved)
+	{
+		main_ReleaseBudget(ptBudget, cbReserved);
+	}
+
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_WriteFramebufferFile(
+	PFRAMEBUFFER_ROWS	ptRows,
+	PCWSTR				pwszOutputPath,
+	PCCONVERT_OPTIONS	ptOptions
+)
+{
+	HRESULT		hrResult	= E_FAIL;
+	HFILEWRITER	hWriter		= NULL;
+
+	assert(NULL != ptRows);
+	assert(NULL != pwszOutputPath);
+	assert(NULL != ptOptions);
+
+	hrResult = FILEWRITER_Create(pwszOutputPath, &hWriter);
+	if (FAILED(hrResult))
+	{
+		PROGRESS("Failed creating the output file.");
+		goto lblCleanup;
+	}
+
+	if (main_IsPngPath(pwszOutputPath))
+	{
+		hrResult = main_WriteFramebufferPng(ptRows, ptOptions->nLevel, hWriter);
+		if (FAILED(hrResult))
+		{
+			PROGRESS("Failed converting framebuffer dump to PNG.");
+			goto lblCleanup;
+		}
+	}
+	else
+	{
+		hrResult = main_WriteFramebufferBitmap(ptRows, hWriter);
+		if (FAILED(hrResult))
+		{
+			PROGRESS("Failed converting framebuffer dump to BMP.");
+			goto lblCleanup;
+		}
+	}
+
+	hrResult = FILEWRITER_Commit(hWriter);
+	if (FAILED(hrResult))
+	{
+		PROGRESS("Failed writing to the output file.");
+		goto lblCleanup;
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	CLOSE(hWriter, FILEWRITER_Close);
+
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_ValidateFramebufferHistory(
+	PCFRAMEBUFFER_HISTORY	ptHistory,
+	DWORD					cbHistory,
+	PCFRAMEBUFFER_FRAME **	papcFrames
+)
+{
+	HRESULT					hrResult		= E_FAIL;
+	PCFRAMEBUFFER_FRAME *	apcFrames		= NULL;
+	PCFRAMEBUFFER_FRAME		ptFrame			= NULL;
+	DWORD					nFirstSequence	= 0;
+	DWORD					nFrame			= 0;
+	DWORD					nIndex			= 0;
+	DWORD					cbOffset		= 0;
+
+	assert(NULL != ptHistory);
+	assert(NULL != papcFrames);
+
+	// The history is read straight from the file,
+	// so make sure it really holds all the frames it claims to.
+	if ((cbHistory < FIELD_OFFSET(FRAMEBUFFER_HISTORY, acFrames)) ||
+		(FRAMEBUFFER_HISTORY_VERSION != ptHistory->nVersion) ||
+		(ptHistory->cbFrames > cbHistory - FIELD_OFFSET(FRAMEBUFFER_HISTORY, acFrames)) ||
+		(ptHistory->nFrames > FRAMEBUFFER_MAX_HISTORY_FRAMES) ||
+		(ptHistory->nFrames > ptHistory->nFramesDrawn) ||
+		(0 == ptHistory->nFrequency))
+	{
+		PROGRESS("The stored history of the screen is corrupt.");
+		hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		goto lblCleanup;
+	}
+
+	// Zeroed, so that a frame stored twice can be told apart.
+	apcFrames = HEAPALLOC(ptHistory->nFrames * sizeof(*apcFrames));
+	if (NULL == apcFrames)
+	{
+		PROGRESS("Oops. Ran out of memory.");
+		hrResult = E_OUTOFMEMORY;
+		goto lblCleanup;
+	}
+
+	// The stored frames are the last ones drawn, so their sequence numbers
+	// tell where each one goes.
+	nFirstSequence = ptHistory->nFramesDrawn - ptHistory->nFrames;
+
+	for (nFrame = 0; nFrame < ptHistory->nFrames; ++nFrame)
+	{
+		if (ptHistory->cbFrames - cbOffset < FIELD_OFFSET(FRAMEBUFFER_FRAME, acTokens))
+		{
+			PROGRESS("The stored history of the screen is corrupt.");
+			hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+			goto lblCleanup;
+		}
+
+		ptFrame = (PCFRAMEBUFFER_FRAME)&ptHistory->acFrames[cbOffset];
+		nIndex = ptFrame->nSequence - nFirstSequence;
+
+		if ((ptFrame->cbFrame < FIELD_OFFSET(FRAMEBUFFER_FRAME, acTokens)) ||
+			(0 != ptFrame->cbFrame % FRAMEBUFFER_FRAME_ALIGNMENT) ||
+			(ptFrame->cbFrame > ptHistory->cbFrames - cbOffset) ||
+			(ptFrame->cbTokens > ptFrame->cbFrame - FIELD_OFFSET(FRAMEBUFFER_FRAME, acTokens)) ||
+			(ptFrame->nStoredRows > ptFrame->nHeight) ||
+			(ptFrame->nDisplay >= FRAMEBUFFER_MAX_DISPLAYS) ||
+			(ptFrame->nWidth > MAXDWORD - ptFrame->nLeft) ||
+			(ptFrame->nHeight > MAXDWORD - ptFrame->nTop) ||
+			(nIndex >= ptHistory->nFrames) ||
+			(NULL != apcFrames[nIndex]))
+		{
+			PROGRESS("The stored history of the screen is corrupt.");
+			hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+			goto lblCleanup;
+		}
+
+		apcFrames[nIndex] = ptFrame;
+		cbOffset += ptFrame->cbFrame;
+	}
+
+	if (cbOffset != ptHistory->cbFrames)
+	{
+		PROGRESS("The stored history of the screen is corrupt.");
+		hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		goto lblCleanup;
+	}
+
+	// Transfer ownership:
+	*papcFrames = apcFrames;
+	apcFrames = NULL;
+
+	hrResult = S_OK;
+
+lblCleanup:
+	HEAPFREE(apcFrames);
+
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_DrawFrame(
+	PFRAMEBUFFER_DUMP	ptCanvas,
+	PCFRAMEBUFFER_FRAME	ptFrame
+)
+{
+	HRESULT		hrResult	= E_FAIL;
+	RLE_DECODER	tDecoder;
+	ULONG		nRow		= 0;
+	BOOL		bDecoded	= TRUE;
+
+	assert(NULL != ptCanvas);
+	assert(NULL != ptFrame);
+	assert(ptFrame->nLeft + ptFrame->nWidth <= ptCanvas->nWidth);
+	assert(ptFrame->nTop + ptFrame->nHeight <= ptCanvas->nHeight);
+
+	// Runs continue from one row to the next.
+	RLE_InitializeDecoder(&tDecoder, ptFrame->acTokens, ptFrame->cbTokens);
+	for (nRow = 0; (nRow < ptFrame->nStoredRows) && bDecoded; ++nRow)
+	{
+		bDecoded = RLE_DecodePixels(&tDecoder,
+									&ptCanvas->acPixels[((ptFrame->nTop + nRow) * ptCanvas->nWidth +
+														 ptFrame->nLeft) * RLE_PIXEL_SIZE],
+									ptFrame->nWidth);
+	}
+
+	if (!bDecoded || !RLE_IsDecoderDone(&tDecoder))
+	{
+		PROGRESS("The stored history of the screen is corrupt.");
+		hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		goto lblCleanup;
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_ConvertFrames(
+	LPCVOID				pvHistory,
+	DWORD				cbHistory,
+	PCWSTR				pwszOutputPath,
+	PCCONVERT_OPTIONS	ptOptions
+)
+{
+	HRESULT					hrResult		= E_FAIL;
+	PCFRAMEBUFFER_HISTORY	ptHistory		= pvHistory;
+	PCFRAMEBUFFER_FRAME *	apcFrames		= NULL;
+	PCFRAMEBUFFER_FRAME		ptFrame			= NULL;
+	DWORD					nDisplay		= 0;
+	DWORD					nFrame			= 0;
+	DWORD					nDisplayFrames	= 0;
+	ULONG					nCanvasWidth	= 0;
+	ULONG					nCanvasHeight	= 0;
+	DWORD					cbCanvas		= 0;
+	PFRAMEBUFFER_DUMP		ptCanvas		= NULL;
+	FRAMEBUFFER_ROWS		tCanvasRows		= { 0 };
+	PWSTR					pwszDisplayPath	= NULL;
+	PWSTR					pwszFramePath	= NULL;
+	ULONGLONG				nMicroseconds	= 0;
+
+	assert(NULL != pvHistory);
+	assert(NULL != pwszOutputPath);
+	assert(NULL != ptOptions);
+
+	hrResult = main_ValidateFramebufferHistory(ptHistory, cbHistory, &apcFrames);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	PROGRESS("The history of the screen holds the last %lu of %lu frames drawn.",
+			 ptHistory->nFrames,
+			 ptHistory->nFramesDrawn);
+
+	for (nDisplay = 0; nDisplay < FRAMEBUFFER_MAX_DISPLAYS; ++nDisplay)
+	{
+		// The screen is only as large as the frames drawn on it.
+		nDisplayFrames = 0;
+		nCanvasWidth = 0;
+		nCanvasHeight = 0;
+		for (nFrame = 0; nFrame < ptHistory->nFrames; ++nFrame)
+		{
+			ptFrame = apcFrames[nFrame];
+			if (nDisplay != ptFrame->nDisplay)
+			{
+				continue;
+			}
+
+			nCanvasWidth = max(nCanvasWidth, ptFrame->nLeft + ptFrame->nWidth);
+			nCanvasHeight = max(nCanvasHeight, ptFrame->nTop + ptFrame->nHeight);
+			++nDisplayFrames;
+		}
+
+		if (0 == nDisplayFrames)
+		{
+			continue;
+		}
+
+		if (FAILED(DWordMult(nCanvasWidth, nCanvasHeight, &cbCanvas)) ||
+			FAILED(DWordMult(cbCanvas, 4, &cbCanvas)) ||
+			FAILED(DWordAdd(cbCanvas, FIELD_OFFSET(FRAMEBUFFER_DUMP, acPixels), &cbCanvas)))
+		{
+			PROGRESS("The stored history of the screen has a weird size.");
+			hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+			goto lblCleanup;
+		}
+
+		// Zeroed, so that the frames are drawn over a black screen.
+		ptCanvas = HEAPALLOC(cbCanvas);
+		if (NULL == ptCanvas)
+		{
+			PROGRESS("Oops. Ran out of memory.");
+			hrResult = E_OUTOFMEMORY;
+			goto lblCleanup;
+		}
+		ptCanvas->nWidth = nCanvasWidth;
+		ptCanvas->nHeight = nCanvasHeight;
+		ptCanvas->nMaxSeenWidth = nCanvasWidth;
+		ptCanvas->nMaxSeenHeight = nCanvasHeight;
+		ptCanvas->bValid = TRUE;
+
+		// Frames are named after the image of their display.
+		if (0 != nDisplay)
+		{
+			hrResult = main_GetNumberedOutputPath(pwszOutputPath,
+												  DISPLAY_OUTPUT_SUFFIX,
+												  nDisplay + 1,
+												  &pwszDisplayPath);
+			if (FAILED(hrResult))
+			{
+				goto lblCleanup;
+			}
+		}
+
+		nDisplayFrames = 0;
+		for (nFrame = 0; nFrame < ptHistory->nFrames; ++nFrame)
+		{
+			ptFrame = apcFrames[nFrame];
+			if (nDisplay != ptFrame->nDisplay)
+			{
+				continue;
+			}
+			++nDisplayFrames;
+
+			hrResult = main_DrawFrame(ptCanvas, ptFrame);
+			if (FAILED(hrResult))
+			{
+				goto lblCleanup;
+			}
+
+			hrResult = main_GetNumberedOutputPath((NULL == pwszDisplayPath) ? (pwszOutputPath) : (pwszDisplayPath),
+												  FRAME_OUTPUT_SUFFIX,
+												  nDisplayFrames,
+												  &pwszFramePath);
+			if (FAILED(hrResult))
+			{
+				goto lblCleanup;
+			}
+
+			// All the displays share the same clock.
+			nMicroseconds = (ptFrame->nTimestamp - apcFrames[0]->nTimestamp) * 1000000 / ptHistory->nFrequency;
+
+			PROGRESS("Frame %lu of display %lu was drawn at +%I64u us. Writing it to '%S'.",
+					 nDisplayFrames,
+					 nDisplay + 1,
+					 nMicroseconds,
+					 pwszFramePath);
+
+			main_InitializeFramebufferRows(&tCanvasRows, ptCanvas, cbCanvas);
+			hrResult = main_WriteFramebufferFile(&tCanvasRows, pwszFramePath, ptOptions);
+			if (FAILED(hrResult))
+			{
+				goto lblCleanup;
+			}
+
+			HEAPFREE(pwszFramePath);
+		}
+
+		HEAPFREE(pwszDisplayPath);
+		HEAPFREE(ptCanvas);
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	HEAPFREE(pwszFramePath);
+	HEAPFREE(pwszDisplayPath);
+	HEAPFREE(ptCanvas);
+	HEAPFREE(apcFrames);
+
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_ConvertDump(
+	PCWSTR				pwszDumpPath,
+	PCWSTR				pwszOutputPath,
+	PCCONVERT_OPTIONS	ptOptions,
+	PMEMORY_BUDGET		ptBudget
+)
+{
+	HRESULT		hrResult		= E_FAIL;
+	HDUMP		hDump			= NULL;
+	HDUMPVIEW	hView			= NULL;
+	LPCVOID		pvScreenshot	= NULL;
+	DWORD		cbScreenshot	= 0;
+	DWORD		nDisplay		= 0;
+	GUID		tTag			= { 0 };
+	DWORD		nScreenshots	= 0;
+	PWSTR		pwszDisplayPath	= NULL;
+
+	assert(NULL != pwszOutputPath);
+	assert(NULL != ptOptions);
+
+	hrResult = DUMPPARSE_Open(pwszDumpPath, ptOptions->fOpenFlags, &hDump);
+	if (FAILED(hrResult))
+	{
+		PROGRESS("Failed opening the dump file.");
+		goto lblCleanup;
+	}
+
+	// Each display is stored separately. The first one found
+	// goes to the requested path, and the others next to it.
+	for (nDisplay = 0; nDisplay < FRAMEBUFFER_MAX_DISPLAYS; ++nDisplay)
+	{
+		FRAMEBUFFER_GetDisplayDumpGuid(nDisplay, &tTag);
+
+		hrResult = DUMPPARSE_MapTagged(hDump,
+									   &tTag,
+									   &hView,
+									   &pvScreenshot,
+									   &cbScreenshot);
+		if (HRESULT_FROM_WIN32(ERROR_NOT_FOUND) == hrResult)
+		{
+			continue;
+		}
+		if (FAILED(hrResult))
+		{
+			PROGRESS("Failed reading the screenshot of display %lu.", nDisplay + 1);
+			goto lblCleanup;
+		}
+
+		if (0 != nScreenshots)
+		{
+			hrResult = main_GetNumberedOutputPath(pwszOutputPath,
+												  DISPLAY_OUTPUT_SUFFIX,
+												  nDisplay + 1,
+												  &pwszDisplayPath);
+			if (FAILED(hrResult))
+			{
+				goto lblCleanup;
+			}
+
+			PROGRESS("Writing the screenshot of display %lu to '%S'.", nDisplay + 1, pwszDisplayPath);
+		}
+
+		hrResult = main_ConvertScreenshot(pvScreenshot,
+										  cbScreenshot,
+										  &tTag,
+										  (NULL == pwszDisplayPath) ? (pwszOutputPath) : (pwszDisplayPath),
+										  ptOptions,
+										  ptBudget);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+
+		CLOSE(hView, DUMPPARSE_Unmap);
+		HEAPFREE(pwszDisplayPath);
+		++nScreenshots;
+	}
+
+	if ((0 != nScreenshots) && ptOptions->bFrames)
+	{
+		hrResult = DUMPPARSE_MapTagged(hDump,
+									   &g_tFramebufferHistoryGuid,
+									   &hView,
+									   &pvScreenshot,
+									   &cbScreenshot);
+		if (HRESULT_FROM_WIN32(ERROR_NOT_FOUND) == hrResult)
+		{
+			PROGRESS("The dump has no history of the screen. Was it kept with 'bugshot %S'?",
+					 BUGSHOT_OPTION_FRAMES);
+			goto lblCleanup;
+		}
+		if (FAILED(hrResult))
+		{
+			PROGRESS("Failed reading the history of the screen.");
+			goto lblCleanup;
+		}
+
+		hrResult = main_ConvertFrames(pvScreenshot, cbScreenshot, pwszOutputPath, ptOptions);
+		goto lblCleanup;
+	}
+
+	if (0 != nScreenshots)
+	{
+		hrResult = S_OK;
+		goto lblCleanup;
+	}
+
+	// Only Windows 10 and later keep a history of the screen.
+	if (ptOptions->bFrames)
+	{
+		PROGRESS("The dump has no history of the screen. Converting the screenshot alone.");
+	}
+
+	// Written by older versions of the driver.
+	hrResult = DUMPPARSE_MapTagged(hDump,
+								   &g_tFramebufferDumpGuid,
+								   &hView,
+								   &pvScreenshot,
+								   &cbScreenshot);
+	if (SUCCEEDED(hrResult))
+	{
+		hrResult = main_ConvertScreenshot(pvScreenshot,
+										  cbScreenshot,
+										  &g_tFramebufferDumpGuid,
+										  pwszOutputPath,
+										  ptOptions,
+										  ptBudget);
+		goto lblCleanup;
+	}
+	if (HRESULT_FROM_WIN32(ERROR_NOT_FOUND) != hrResult)
+	{
+		PROGRESS("Failed reading the saved screenshot.");
+		goto lblCleanup;
+	}
+
+	hrResult = DUMPPARSE_MapTagged(hDump,
+								   &g_tVgaDumpGuid,
+								   &hView,
+								   &pvScreenshot,
+								   &cbScreenshot);
+	if (FAILED(hrResult))
+	{
+		PROGRESS("Failed reading saved bugcheck screenshot. Did you save it?");
+		goto lblCleanup;
+	}
+
+	hrResult = main_ConvertScreenshot(pvScreenshot,
+									  cbScreenshot,
+									  &g_tVgaDumpGuid,
+									  pwszOutputPath,
+									  ptOptions,
+									  ptBudget);
+
+lblCleanup:
+	HEAPFREE(pwszDisplayPath);
+	CLOSE(hView, DUMPPARSE_Unmap);
+	CLOSE(hDump, DUMPPARSE_Close);
+
+	return hrResult;
+}
+
+STATIC
+HRESULT
+main_HandleConvert(
+	_In_					INT				nArguments,
+	_In_reads_(nArguments)	CONST PCWSTR *	ppwszArguments
+)
+{
+	HRESULT			hrResult		= E_FAIL;
+	CONVERT_OPTIONS	tOptions		= { 0 };
+	PCWSTR			pwszDumpPath	= NULL;
+	PCWSTR			pwszOutputPath	= NULL;
+
+	assert(NULL != ppwszArguments);
+
+	hrResult = main_ParseConvertOptions(&nArguments, &ppwszArguments, &tOptions);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	switch (nArguments)
+	{
+	case SUBFUNCTION_CONVERT_NO_INPUT_ARGS_COUNT:
+		pwszOutputPath = ppwszArguments[SUBFUNCTION_CONVERT_NO_INPUT_ARG_OUTPUT];
+		PROGRESS("Converting system memory dump to '%S'.", pwszOutputPath);
+		break;
+
+	case SUBFUNCTION_CONVERT_ARGS_COUNT:
+		pwszDumpPath = ppwszArguments[SUBFUNCTION_CONVERT_ARG_INPUT];
+		pwszOutputPath = ppwszArguments[SUBFUNCTION_CONVERT_ARG_OUTPUT];
+		PROGRESS("Converting dump '%S' to '%S'.", pwszDumpPath, pwszOutputPath);
+		break;
+
+	default:
+		PROGRESS("Invalid number of arguments specified.");
+		hrResult = E_INVALIDARG;
+		goto lblCleanup;
+	}
+
+	hrResult = main_ConvertDump(pwszDumpPath, pwszOutputPath, &tOptions, NULL);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_AddBatchJob(
+	PBATCH	ptBatch,
+	PCWSTR	pwszDumpPath
+)
+{
+	HRESULT		hrResult		= E_FAIL;
+	DWORD		nNewCapacity	= 0;
+	SIZE_T		cbNewJobs		= 0;
+	PBATCH_JOB	ptNewJobs		= NULL;
+	PCWSTR		pwszFileName	= NULL;
+	PCWSTR		pwszExtension	= NULL;
+	SIZE_T		cchStem			= 0;
+	SIZE_T		cchOutputPath	= 0;
+	PWSTR		pwszOutputPath	= NULL;
+	PWSTR		pwszDumpCopy	= NULL;
+	DWORD		nJob			= 0;
+	DWORD		nSuffix			= 0;
+	BOOL		bCollision		= FALSE;
+
+	assert(NULL != ptBatch);
+	assert(NULL != pwszDumpPath);
+
+	if (ptBatch->nJobs == ptBatch->nCapacity)
+	{
+		nNewCapacity = max(ptBatch->nCapacity * 2, BATCH_INITIAL_CAPACITY);
+		cbNewJobs = nNewCapacity * sizeof(*ptNewJobs);
+
+		ptNewJobs =
+			(NULL == ptBatch->ptJobs)
+			? (HEAPALLOC(cbNewJobs))
+			: (HeapReAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, ptBatch->ptJobs, cbNewJobs));
+		if (NULL == ptNewJobs)
+		{
+			PROGRESS("Oops. Ran out of memory.");
+			hrResult = E_OUTOFMEMORY;
+			goto lblCleanup;
+		}
+
+		ptBatch->ptJobs = ptNewJobs;
+		ptBatch->nCapacity = nNewCapacity;
+	}
+
+	// The output is named after the dump, minus its extension.
+	pwszFileName = wcsrchr(pwszDumpPath, L'\\');
+	pwszFileName =
+		(NULL == pwszFileName)
+		? (pwszDumpPath)
+		: (pwszFileName + 1);
+	pwszExtension = wcsrchr(pwszFileName, L'.');
+	cchStem =
+		(NULL == pwszExtension)
+		? (wcslen(pwszFileName))
+		: ((SIZE_T)(pwszExtension - pwszFileName));
+
+	// Room for the directory, the separator, the stem,
+	// a disambiguating suffix, and the extension.
+	cchOutputPath = wcslen(ptBatch->pwszOutputDirectory) + 1 + cchStem + 16 + wcslen(ptBatch->tOptions.pwszOutputExtension) + 1;
+	pwszOutputPath = HEAPALLOC(cchOutputPath * sizeof(*pwszOutputPath));
+	if (NULL == pwszOutputPath)
+	{
+		PROGRESS("Oops. Ran out of memory.");
+		hrResult = E_OUTOFMEMORY;
+		goto lblCleanup;
+	}
+
+	// Dumps collected from different machines tend to have the same name,
+	// so keep adding suffixes until the output doesn't clash with any job.
+	do
+	{
+		if (0 == nSuffix)
+		{
+			hrResult = StringCchPrintfW(pwszOutputPath,
+										cchOutputPath,
+										L"%s\\%.*s%s",
+										ptBatch->pwszOutputDirectory,
+										(INT)cchStem,
+										pwszFileName,
+										ptBatch->tOptions.pwszOutputExtension);
+		}
+		else
+		{
+			hrResult = StringCchPrintfW(pwszOutputPath,
+										cchOutputPath,
+										L"%s\\%.*s_%lu%s",
+										ptBatch->pwszOutputDirectory,
+										(INT)cchStem,
+										pwszFileName,
+										nSuffix,
+										ptBatch->tOptions.pwszOutputExtension);
+		}
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+
+		bCollision = FALSE;
+		for (nJob = 0; nJob < ptBatch->nJobs; ++nJob)
+		{
+			if (0 == _wcsicmp(ptBatch->ptJobs[nJob].pwszOutputPath, pwszOutputPath))
+			{
+				bCollision = TRUE;
+				break;
+			}
+		}
+
+		// There are only so many jobs, so this ends.
+		nSuffix = (0 == nSuffix) ? (ptBatch->nJobs) : (nSuffix + 1);
+	} while (bCollision);
+
+	pwszDumpCopy = HEAPALLOC((wcslen(pwszDumpPath) + 1) * sizeof(*pwszDumpCopy));
+	if (NULL == pwszDumpCopy)
+	{
+		PROGRESS("Oops. Ran out of memory.");
+		hrResult = E_OUTOFMEMORY;
+		goto lblCleanup;
+	}
+	CopyMemory(pwszDumpCopy, pwszDumpPath, wcslen(pwszDumpPath) * sizeof(*pwszDumpCopy));
+
+	// Transfer ownership:
+	ptBatch->ptJobs[ptBatch->nJobs].pwszDumpPath = pwszDumpCopy;
+	pwszDumpCopy = NULL;
+	ptBatch->ptJobs[ptBatch->nJobs].pwszOutputPath = pwszOutputPath;
+	pwszOutputPath = NULL;
+	ptBatch->ptJobs[ptBatch->nJobs].hrResult = E_PENDING;
+	++(ptBatch->nJobs);
+
+	hrResult = S_OK;
+
+lblCleanup:
+	HEAPFREE(pwszDumpCopy);
+	HEAPFREE(pwszOutputPath);
+
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_AddBatchJobsFromDirectory(
+	PBATCH	ptBatch,
+	PCWSTR	pwszDirectory
+)
+{
+	HRESULT				hrResult	= E_FAIL;
+	WCHAR				wszPattern[MAX_PATH];
+	WCHAR				wszDumpPath[MAX_PATH];
+	WIN32_FIND_DATAW	tFindData	= { 0 };
+	HANDLE				hFind		= INVALID_HANDLE_VALUE;
+
+	assert(NULL != ptBatch);
+	assert(NULL != pwszDirectory);
+
+	hrResult = StringCchPrintfW(wszPattern, ARRAYSIZE(wszPattern), L"%s\\%s", pwszDirectory, BATCH_DUMP_PATTERN);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	hFind = FindFirstFileW(wszPattern, &tFindData);
+	if (INVALID_HANDLE_VALUE == hFind)
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		if (HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND) == hrResult)
+		{
+			PROGRESS("No dumps found in '%S'.", pwszDirectory);
+			hrResult = S_OK;
+		}
+		goto lblCleanup;
+	}
+
+	do
+	{
+		if (0 != (tFindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		{
+			continue;
+		}
+
+		hrResult = StringCchPrintfW(wszDumpPath,
+									ARRAYSIZE(wszDumpPath),
+									L"%s\\%s",
+									pwszDirectory,
+									tFindData.cFileName);
+		if (FAILED(hrResult))
+		{
+			PROGRESS("Skipping '%S', the path is too long.", tFindData.cFileName);
+			continue;
+		}
+
+		hrResult = main_AddBatchJob(ptBatch, wszDumpPath);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+	} while (FindNextFileW(hFind, &tFindData));
+
+	if (ERROR_NO_MORE_FILES != GetLastError())
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	CLOSE_TO_VALUE(hFind, FindClose, INVALID_HANDLE_VALUE);
+
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_AddBatchJobsFromManifest(
+	PBATCH	ptBatch,
+	PCWSTR	pwszManifest
+)
+{
+	HRESULT	hrResult	= E_FAIL;
+	PVOID	pvManifest	= NULL;
+	SIZE_T	cbManifest	= 0;
+	PCSTR	pcText		= NULL;
+	INT		cchText		= 0;
+	UINT	nCodePage	= CP_ACP;
+	INT		cchWideText	= 0;
+	PWSTR	pwszText	= NULL;
+	PWSTR	pwszLine	= NULL;
+	PWSTR	pwszContext	= NULL;
+
+	assert(NULL != ptBatch);
+	assert(NULL != pwszManifest);
+
+	hrResult = UTIL_ReadFile(pwszManifest, &pvManifest, &cbManifest);
+	if (FAILED(hrResult))
+	{
+		PROGRESS("Failed reading the manifest.");
+		goto lblCleanup;
+	}
+	if (cbManifest > INT_MAX)
+	{
+		PROGRESS("The manifest is too large.");
+		hrResult = HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+		goto lblCleanup;
+	}
+
+	pcText = (PCSTR)pvManifest;
+	cchText = (INT)cbManifest;
+
+	// Honor a UTF-8 BOM. Otherwise, assume the ANSI code page.
+	if ((cchText >= 3) && (0 == memcmp(pcText, "\xEF\xBB\xBF", 3)))
+	{
+		nCodePage = CP_UTF8;
+		pcText += 3;
+		cchText -= 3;
+	}
+	if (0 == cchText)
+	{
+		hrResult = S_OK;
+		goto lblCleanup;
+	}
+
+	cchWideText = MultiByteToWideChar(nCodePage, 0, pcText, cchText, NULL, 0);
+	if (0 == cchWideText)
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+
+	pwszText = HEAPALLOC(((SIZE_T)cchWideText + 1) * sizeof(*pwszText));
+	if (NULL == pwszText)
+	{
+		PROGRESS("Oops. Ran out of memory.");
+		hrResult = E_OUTOFMEMORY;
+		goto lblCleanup;
+	}
+
+	if (0 == MultiByteToWideChar(nCodePage, 0, pcText, cchText, pwszText, cchWideText))
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+
+	// One dump path per line. Empty lines are skipped.
+	for (pwszLine = wcstok_s(pwszText, L"\r\n", &pwszContext);
+		 NULL != pwszLine;
+		 pwszLine = wcstok_s(NULL, L"\r\n", &pwszContext))
+	{
+		hrResult = main_AddBatchJob(ptBatch, pwszLine);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	HEAPFREE(pwszText);
+	HEAPFREE(pvManifest);
+
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+DWORD
+WINAPI
+main_BatchWorker(
+	PVOID	pvBatch
+)
+{
+	PBATCH		ptBatch	= (PBATCH)pvBatch;
+	LONG		nJob	= 0;
+	PBATCH_JOB	ptJob	= NULL;
+
+	assert(NULL != ptBatch);
+
+	for (;;)
+	{
+		nJob = InterlockedIncrement(&(ptBatch->nNextJob)) - 1;
+		if ((DWORD)nJob >= ptBatch->nJobs)
+		{
+			break;
+		}
+
+		ptJob = &(ptBatch->ptJobs[nJob]);
+
+		PROGRESS("Converting dump '%S' to '%S'.", ptJob->pwszDumpPath, ptJob->pwszOutputPath);
+		ptJob->hrResult = main_ConvertDump(ptJob->pwszDumpPath,
+										   ptJob->pwszOutputPath,
+										   &(ptBatch->tOptions),
+										   &(ptBatch->tBudget));
+	}
+
+	return 0;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_WriteBatchSummary(
+	PCBATCH	ptBatch,
+	PDWORD	pnSucceeded
+)
+{
+	HRESULT		hrResult	= E_FAIL;
+	WCHAR		wszSummaryPath[MAX_PATH];
+	FILE *		ptSummary	= NULL;
+	DWORD		nJob		= 0;
+	PCBATCH_JOB	ptJob		= NULL;
+	DWORD		nSucceeded	= 0;
+
+	assert(NULL != ptBatch);
+	assert(NULL != pnSucceeded);
+
+	hrResult = StringCchPrintfW(wszSummaryPath,
+								ARRAYSIZE(wszSummaryPath),
+								L"%s\\%s",
+								ptBatch->pwszOutputDirectory,
+								BATCH_SUMMARY_FILE_NAME);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	if (0 != _wfopen_s(&ptSummary, wszSummaryPath, L"w, ccs=UTF-8"))
+	{
+		PROGRESS("Failed creating the summary file.");
+		hrResult = E_FAIL;
+		goto lblCleanup;
+	}
+
+	for (nJob = 0; nJob < ptBatch->nJobs; ++nJob)
+	{
+		ptJob = &(ptBatch->ptJobs[nJob]);
+
+		if (SUCCEEDED(ptJob->hrResult))
+		{
+			++nSucceeded;
+			(VOID)fwprintf(ptSummary, L"OK\t%s\t%s\n", ptJob->pwszDumpPath, ptJob->pwszOutputPath);
+		}
+		else
+		{
+			(VOID)fwprintf(ptSummary, L"0x%08lX\t%s\n", ptJob->hrResult, ptJob->pwszDumpPath);
+		}
+	}
+
+	(VOID)fwprintf(ptSummary, L"\nConverted %lu of %lu dumps.\n", nSucceeded, ptBatch->nJobs);
+
+	*pnSucceeded = nSucceeded;
+
+	hrResult = S_OK;
+
+lblCleanup:
+	CLOSE(ptSummary, fclose);
+
+	return hrResult;
+}
+
+STATIC
+HRESULT
+main_HandleBatch(
+	_In_					INT				nArguments,
+	_In_reads_(nArguments)	CONST PCWSTR *	ppwszArguments
+)
+{
+	HRESULT			hrResult			= E_FAIL;
+	BATCH			tBatch				= { 0 };
+	BOOL			bLockInitialized	= FALSE;
+	PCWSTR			pwszInput			= NULL;
+	DWORD			fAttributes			= INVALID_FILE_ATTRIBUTES;
+	MEMORYSTATUSEX	tMemoryStatus		= { 0 };
+	SYSTEM_INFO		tSystemInfo			= { 0 };
+	HANDLE			ahWorkers[MAXIMUM_WAIT_OBJECTS];
+	DWORD			nWorkers			= 0;
+	DWORD			nWorker				= 0;
+	DWORD			nJob				= 0;
+	DWORD			nSucceeded			= 0;
+
+	assert(NULL != ppwszArguments);
+
+	ZeroMemory(ahWorkers, sizeof(ahWorkers));
+
+	hrResult = main_ParseConvertOptions(&nArguments, &ppwszArguments, &(tBatch.tOptions));
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	if (SUBFUNCTION_BATCH_ARGS_COUNT != nArguments)
+	{
+		PROGRESS("Invalid number of arguments specified.");
+		hrResult = E_INVALIDARG;
+		goto lblCleanup;
+	}
+
+	pwszInput = ppwszArguments[SUBFUNCTION_BATCH_ARG_INPUT];
+	tBatch.pwszOutputDirectory = ppwszArguments[SUBFUNCTION_BATCH_ARG_OUTPUT_DIRECTORY];
+
+	fAttributes = GetFileAttributesW(pwszInput);
+	if (INVALID_FILE_ATTRIBUTES == fAttributes)
+	{
+		PROGRESS("Failed accessing '%S'.", pwszInput);
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+
+	if (0 != (fAttributes & FILE_ATTRIBUTE_DIRECTORY))
+	{
+		PROGRESS("Collecting dumps from directory '%S'.", pwszInput);
+		hrResult = main_AddBatchJobsFromDirectory(&tBatch, pwszInput);
+	}
+	else
+	{
+		PROGRESS("Collecting dumps from manifest '%S'.", pwszInput);
+		hrResult = main_AddBatchJobsFromManifest(&tBatch, pwszInput);
+	}
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	if (0 == tBatch.nJobs)
+	{
+		PROGRESS("Nothing to convert.");
+		hrResult = S_OK;
+		goto lblCleanup;
+	}
+
+	if (!CreateDirectoryW(tBatch.pwszOutputDirectory, NULL) &&
+		(ERROR_ALREADY_EXISTS != GetLastError()))
+	{
+		PROGRESS("Failed creating the output directory.");
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+
+	// Let the conversions in flight use at most a fraction of the available memory.
+	tMemoryStatus.dwLength = sizeof(tMemoryStatus);
+	if (!GlobalMemoryStatusEx(&tMemoryStatus))
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+	tBatch.tBudget.cbLimit = max(tMemoryStatus.ullAvailPhys / BATCH_MEMORY_BUDGET_DIVISOR,
+								 BATCH_MIN_MEMORY_BUDGET);
+
+	InitializeCriticalSection(&(tBatch.tBudget.tLock));
+	bLockInitialized = TRUE;
+
+	tBatch.tBudget.hReleasedEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	if (NULL == tBatch.tBudget.hReleasedEvent)
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+
+	GetSystemInfo(&tSystemInfo);
+	nWorkers = min(tSystemInfo.dwNumberOfProcessors, tBatch.nJobs);
+	nWorkers = min(max(nWorkers, 1), ARRAYSIZE(ahWorkers));
+
+	PROGRESS("Converting %lu dumps on %lu threads, using up to %I64u MB.",
+			 tBatch.nJobs,
+			 nWorkers,
+			 tBatch.tBudget.cbLimit / (1024 * 1024));
+
+	for (nWorker = 0; nWorker < nWorkers; ++nWorker)
+	{
+		ahWorkers[nWorker] = CreateThread(NULL, 0, &main_BatchWorker, &tBatch, 0, NULL);
+		if (NULL == ahWorkers[nWorker])
+		{
+			// Make do with the threads we already have.
+			if (0 == nWorker)
+			{
+				hrResult = HRESULT_FROM_WIN32(GetLastError());
+				goto lblCleanup;
+			}
+			nWorkers = nWorker;
+			break;
+		}
+	}
+
+	(VOID)WaitForMultipleObjects(nWorkers, ahWorkers, TRUE, INFINITE);
+
+	hrResult = main_WriteBatchSummary(&tBatch, &nSucceeded);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	PROGRESS("Converted %lu of %lu dumps.", nSucceeded, tBatch.nJobs);
+
+	hrResult = (nSucceeded == tBatch.nJobs) ? (S_OK) : (E_FAIL);
+
+lblCleanup:
+	for (nWorker = 0; nWorker < ARRAYSIZE(ahWorkers); ++nWorker)
+	{
+		CLOSE_HANDLE(ahWorkers[nWorker]);
+	}
+	CLOSE_HANDLE(tBatch.tBudget.hReleasedEvent);
+	if (bLockInitialized)
+	{
+		DeleteCriticalSection(&(tBatch.tBudget.tLock));
+	}
+	if (NULL != tBatch.ptJobs)
+	{
+		for (nJob = 0; nJob < tBatch.nJobs; ++nJob)
+		{
+			HEAPFREE(tBatch.ptJobs[nJob].pwszDumpPath);
+			HEAPFREE(tBatch.ptJobs[nJob].pwszOutputPath);
+		}
+	}
+	HEAPFREE(tBatch.ptJobs);
+
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+BOOL
+WINAPI
+main_WatchConsoleCtrlHandler(
+	DWORD	eCtrlType
+)
+{
+	switch (eCtrlType)
+	{
+	case CTRL_C_EVENT:
+	case CTRL_BREAK_EVENT:
+	case CTRL_CLOSE_EVENT:
+		PROGRESS("Stopping.");
+		(VOID)SetEvent(g_hWatchStopEvent);
+		return TRUE;
+
+	default:
+		return FALSE;
+	}
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_WatchQueryFile(
+	PCWATCH		ptWatch,
+	PCWSTR		pwszName,
+	PULONGLONG	pcbFile,
+	PFILETIME	ptLastWriteTime
+)
+{
+	HRESULT						hrResult	= E_FAIL;
+	WCHAR						wszPath[MAX_PATH];
+	WIN32_FILE_ATTRIBUTE_DATA	tAttributes	= { 0 };
+
+	assert(NULL != ptWatch);
+	assert(NULL != pwszName);
+	assert(NULL != pcbFile);
+	assert(NULL != ptLastWriteTime);
+
+	hrResult = StringCchPrintfW(wszPath, ARRAYSIZE(wszPath), L"%s\\%s", ptWatch->pwszDirectory, pwszName);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	if (!GetFileAttributesExW(wszPath, GetFileExInfoStandard, &tAttributes))
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+
+	*pcbFile = ((ULONGLONG)(tAttributes.nFileSizeHigh) << 32) | tAttributes.nFileSizeLow;
+	*ptLastWriteTime = tAttributes.ftLastWriteTime;
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+PWATCH_FILE
+main_WatchFindFile(
+	PWATCH	ptWatch,
+	PCWSTR	pwszName
+)
+{
+	DWORD	nFile	= 0;
+
+	assert(NULL != ptWatch);
+	assert(NULL != pwszName);
+
+	for (nFile = 0; nFile < ptWatch->nFiles; ++nFile)
 	{
-		hrResult = E_INVALIDARG;
-		PROGRESS("Bitmap height does not match existing QR image.");
-		goto lblCleanup;
+		if (0 == _wcsicmp(ptWatch->ptFiles[nFile].pwszName, pwszName))
+		{
+			return &(ptWatch->ptFiles[nFile]);
+		}
 	}
 
-	// YOLO: not dealing with overflow. It's from the kernel, so it's trusted :)
-	cbPixels = tQrInfo.nWidth * tQrInfo.nHeight * tQrInfo.nBitCount / 8;
+	return NULL;
+}
 
-	// TODO: Validate source file has enough data
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_WatchAddFile(
+	PWATCH			ptWatch,
+	PCWSTR			pwszName,
+	PWATCH_FILE *	pptFile
+)
+{
+	HRESULT		hrResult		= E_FAIL;
+	DWORD		nNewCapacity	= 0;
+	SIZE_T		cbNewFiles		= 0;
+	PWATCH_FILE	ptNewFiles		= NULL;
+	SIZE_T		cbName			= 0;
+	PWSTR		pwszNameCopy	= NULL;
+	PWATCH_FILE	ptFile			= NULL;
+
+	assert(NULL != ptWatch);
+	assert(NULL != pwszName);
+	assert(NULL != pptFile);
+
+	if (ptWatch->nFiles == ptWatch->nCapacity)
+	{
+		nNewCapacity = max(ptWatch->nCapacity * 2, WATCH_INITIAL_CAPACITY);
+		cbNewFiles = nNewCapacity * sizeof(*ptNewFiles);
+
+		ptNewFiles =
+			(NULL == ptWatch->ptFiles)
+			? (HEAPALLOC(cbNewFiles))
+			: (HeapReAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, ptWatch->ptFiles, cbNewFiles));
+		if (NULL == ptNewFiles)
+		{
+			PROGRESS("Oops. Ran out of memory.");
+			hrResult = E_OUTOFMEMORY;
+			goto lblCleanup;
+		}
 
-	pvPixels = HEAPALLOC(cbPixels);
-	if (NULL == pvPixels)
+		ptWatch->ptFiles = ptNewFiles;
+		ptWatch->nCapacity = nNewCapacity;
+	}
+
+	cbName = (wcslen(pwszName) + 1) * sizeof(*pwszNameCopy);
+	pwszNameCopy = HEAPALLOC(cbName);
+	if (NULL == pwszNameCopy)
 	{
+		PROGRESS("Oops. Ran out of memory.");
 		hrResult = E_OUTOFMEMORY;
 		goto lblCleanup;
 	}
+	CopyMemory(pwszNameCopy, pwszName, cbName);
 
-	assert(32 == tQrInfo.nBitCount);	// The following code converts to 32 BPP
-	if (32 == ptInfoHeader->biBitCount)
+	ptFile = &(ptWatch->ptFiles[ptWatch->nFiles]);
+	ZeroMemory(ptFile, sizeof(*ptFile));
+
+	// Transfer ownership:
+	ptFile->pwszName = pwszNameCopy;
+	pwszNameCopy = NULL;
+	++(ptWatch->nFiles);
+
+	*pptFile = ptFile;
+
+	hrResult = S_OK;
+
+lblCleanup:
+	HEAPFREE(pwszNameCopy);
+
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_WatchNoteFile(
+	PWATCH	ptWatch,
+	PCWSTR	pwszName
+)
+{
+	HRESULT		hrResult		= E_FAIL;
+	ULONGLONG	cbFile			= 0;
+	FILETIME	tLastWriteTime	= { 0 };
+	PWATCH_FILE	ptFile			= NULL;
+
+	assert(NULL != ptWatch);
+	assert(NULL != pwszName);
+
+	hrResult = main_WatchQueryFile(ptWatch, pwszName, &cbFile, &tLastWriteTime);
+	if (FAILED(hrResult))
 	{
-		// No need to deal with bitmap line alignment
+		// Probably gone already. Not our problem.
+		hrResult = S_OK;
+		goto lblCleanup;
+	}
 
-		if (ptInfoHeader->biHeight < 0)
+	ptFile = main_WatchFindFile(ptWatch, pwszName);
+	if (NULL == ptFile)
+	{
+		hrResult = main_WatchAddFile(ptWatch, pwszName, &ptFile);
+		if (FAILED(hrResult))
 		{
-			// Top-down bitmap, just copy it.
-			RtlMoveMemory(pvPixels, ptInfoHeader + 1, cbPixels);
+			goto lblCleanup;
 		}
-		else
+	}
+	else if (ptFile->bDone &&
+			 (cbFile == ptFile->cbFile) &&
+			 (0 == CompareFileTime(&tLastWriteTime, &(ptFile->tLastWriteTime))))
+	{
+		// Already converted, and hasn't changed since.
+		hrResult = S_OK;
+		goto lblCleanup;
+	}
+	else if (!ptFile->bDone)
+	{
+		// Already waiting for it to settle. The poll will notice the change.
+		hrResult = S_OK;
+		goto lblCleanup;
+	}
+
+	PROGRESS("Waiting for '%S' to settle.", pwszName);
+
+	ptFile->cbFile = cbFile;
+	ptFile->tLastWriteTime = tLastWriteTime;
+	ptFile->nLastChangeTime = GetTickCount();
+	ptFile->bDone = FALSE;
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_WatchScanDirectory(
+	PWATCH	ptWatch
+)
+{
+	HRESULT				hrResult	= E_FAIL;
+	WCHAR				wszPattern[MAX_PATH];
+	WIN32_FIND_DATAW	tFindData	= { 0 };
+	HANDLE				hFind		= INVALID_HANDLE_VALUE;
+
+	assert(NULL != ptWatch);
+
+	hrResult = StringCchPrintfW(wszPattern, ARRAYSIZE(wszPattern), L"%s\\%s", ptWatch->pwszDirectory, BATCH_DUMP_PATTERN);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	hFind = FindFirstFileW(wszPattern, &tFindData);
+	if (INVALID_HANDLE_VALUE == hFind)
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		if (HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND) == hrResult)
 		{
-			ULONG	cbRow		= ptInfoHeader->biBitCount * tQrInfo.nWidth;
-			PBYTE	pcSource	= (PBYTE)(ptInfoHeader + 1);
-			PBYTE	pcDest		= ((PBYTE)pvPixels) + ((tQrInfo.nHeight - 1) * cbRow);
-			ULONG	nRow		= 0;
+			hrResult = S_OK;
+		}
+		goto lblCleanup;
+	}
 
-			// Bottom-up bitmap. Copy in reverse.
+	do
+	{
+		if (0 != (tFindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		{
+			continue;
+		}
 
-			for (nRow = 0; nRow < tQrInfo.nHeight; ++nRow)
+		hrResult = main_WatchNoteFile(ptWatch, tFindData.cFileName);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+	} while (FindNextFileW(hFind, &tFindData));
+
+	if (ERROR_NO_MORE_FILES != GetLastError())
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	CLOSE_TO_VALUE(hFind, FindClose, INVALID_HANDLE_VALUE);
+
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_WatchProcessNotifications(
+	PWATCH	ptWatch,
+	LPCVOID	pvNotifications
+)
+{
+	HRESULT						hrResult		= E_FAIL;
+	PCFILE_NOTIFY_INFORMATION	ptNotification	= NULL;
+	WCHAR						wszName[MAX_PATH];
+	SIZE_T						cchName			= 0;
+	SIZE_T						cchExtension	= 0;
+
+	assert(NULL != ptWatch);
+	assert(NULL != pvNotifications);
+
+	cchExtension = wcslen(WATCH_DUMP_EXTENSION);
+
+	ptNotification = (PCFILE_NOTIFY_INFORMATION)pvNotifications;
+	for (;;)
+	{
+		switch (ptNotification->Action)
+		{
+		case FILE_ACTION_ADDED:
+		case FILE_ACTION_MODIFIED:
+		case FILE_ACTION_RENAMED_NEW_NAME:
+			cchName = ptNotification->FileNameLength / sizeof(WCHAR);
+			if ((cchName <= cchExtension) ||
+				(cchName >= ARRAYSIZE(wszName)) ||
+				(0 != _wcsnicmp(&(ptNotification->FileName[cchName - cchExtension]),
+								WATCH_DUMP_EXTENSION,
+								cchExtension)))
 			{
-				RtlMoveMemory(pcDest, pcSource, cbRow);
-				pcDest -= cbRow;
-				pcSource += cbRow;
+				break;
+			}
+
+			CopyMemory(wszName, ptNotification->FileName, cchName * sizeof(WCHAR));
+			wszName[cchName] = L'\0';
+
+			hrResult = main_WatchNoteFile(ptWatch, wszName);
+			if (FAILED(hrResult))
+			{
+				goto lblCleanup;
 			}
+			break;
+
+		default:
+			// Removed files are noticed by the poll.
+			break;
+		}
+
+		if (0 == ptNotification->NextEntryOffset)
+		{
+			break;
 		}
+		ptNotification = (PCFILE_NOTIFY_INFORMATION)((CONST BYTE *)ptNotification + ptNotification->NextEntryOffset);
 	}
-	else
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_WatchConvertFile(
+	PWATCH		ptWatch,
+	PWATCH_FILE	ptFile
+)
+{
+	HRESULT	hrResult		= E_FAIL;
+	WCHAR	wszDumpPath[MAX_PATH];
+	WCHAR	wszOutputPath[MAX_PATH];
+	PCWSTR	pwszExtension	= NULL;
+	SIZE_T	cchStem			= 0;
+
+	assert(NULL != ptWatch);
+	assert(NULL != ptFile);
+
+	hrResult = StringCchPrintfW(wszDumpPath,
+								ARRAYSIZE(wszDumpPath),
+								L"%s\\%s",
+								ptWatch->pwszDirectory,
+								ptFile->pwszName);
+	if (FAILED(hrResult))
 	{
-		ULONG		cbSourceRow	= (ptInfoHeader->biBitCount / 8 * tQrInfo.nWidth) + (4 - ptInfoHeader->biBitCount / 8 * tQrInfo.nWidth % 4);
-		LPRGBTRIPLE	ptSourceRow	= (LPRGBTRIPLE)(ptInfoHeader + 1);
-		ULONG		nRow		= 0;
-		ULONG		nColumn		= 0;
+		goto lblCleanup;
+	}
 
-		assert(24 == ptInfoHeader->biBitCount);
+	// Same naming as in batch mode.
+	pwszExtension = wcsrchr(ptFile->pwszName, L'.');
+	cchStem =
+		(NULL == pwszExtension)
+		? (wcslen(ptFile->pwszName))
+		: ((SIZE_T)(pwszExtension - ptFile->pwszName));
+
+	hrResult = StringCchPrintfW(wszOutputPath,
+								ARRAYSIZE(wszOutputPath),
+								L"%s\\%.*s%s",
+								ptWatch->pwszOutputDirectory,
+								(INT)cchStem,
+								ptFile->pwszName,
+								ptWatch->tOptions.pwszOutputExtension);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
 
-		if (ptInfoHeader->biHeight < 0)
+	PROGRESS("Converting dump '%S' to '%S'.", wszDumpPath, wszOutputPath);
+	hrResult = main_ConvertDump(wszDumpPath, wszOutputPath, &(ptWatch->tOptions), NULL);
+	if (HRESULT_FROM_WIN32(ERROR_SHARING_VIOLATION) == hrResult)
+	{
+		// Someone is still writing it.
+		goto lblCleanup;
+	}
+
+	// Failures are journaled too, so that a broken dump
+	// isn't retried until it changes.
+	ptFile->bDone = TRUE;
+	ptFile->hrConversion = hrResult;
+
+	(VOID)fwprintf(ptWatch->ptJournal,
+				   L"%I64u\t%lu\t%lu\t0x%08lX\t%s\n",
+				   ptFile->cbFile,
+				   ptFile->tLastWriteTime.dwHighDateTime,
+				   ptFile->tLastWriteTime.dwLowDateTime,
+				   ptFile->hrConversion,
+				   ptFile->pwszName);
+	(VOID)fflush(ptWatch->ptJournal);
+
+lblCleanup:
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+VOID
+main_WatchPoll(
+	PWATCH	ptWatch
+)
+{
+	DWORD		nFile			= 0;
+	PWATCH_FILE	ptFile			= NULL;
+	ULONGLONG	cbFile			= 0;
+	FILETIME	tLastWriteTime	= { 0 };
+	HRESULT		hrResult		= E_FAIL;
+
+	assert(NULL != ptWatch);
+
+	nFile = 0;
+	while (nFile < ptWatch->nFiles)
+	{
+		ptFile = &(ptWatch->ptFiles[nFile]);
+
+		if (ptFile->bDone)
 		{
-			LPRGBQUAD	ptDestRow	= pvPixels;
+			++nFile;
+			continue;
+		}
 
-			// Top-down bitmap, copy normally.
-			
-			for (nRow = 0; nRow < tQrInfo.nHeight; ++nRow)
-			{
-				for (nColumn = 0; nColumn < tQrInfo.nWidth; ++nColumn)
-				{
-					ptDestRow[nColumn].rgbBlue = ptSourceRow[nColumn].rgbtBlue;
-					ptDestRow[nColumn].rgbGreen = ptSourceRow[nColumn].rgbtGreen;
-					ptDestRow[nColumn].rgbRed = ptSourceRow[nColumn].rgbtRed;
-					ptDestRow[nColumn].rgbReserved = 0;
-				}
-				ptSourceRow = (LPRGBTRIPLE)((PBYTE)ptSourceRow + cbSourceRow);
-				ptDestRow += tQrInfo.nWidth;
-			}
+		hrResult = main_WatchQueryFile(ptWatch, ptFile->pwszName, &cbFile, &tLastWriteTime);
+		if ((HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND) == hrResult) ||
+			(HRESULT_FROM_WIN32(ERROR_PATH_NOT_FOUND) == hrResult))
+		{
+			// Deleted before it settled. Forget about it.
+			HEAPFREE(ptFile->pwszName);
+			*ptFile = ptWatch->ptFiles[ptWatch->nFiles - 1];
+			--(ptWatch->nFiles);
+			continue;
 		}
-		else
+		++nFile;
+		if (FAILED(hrResult))
 		{
-			LPRGBQUAD	ptDestRow	= ((LPRGBQUAD)pvPixels) + ((tQrInfo.nHeight - 1) * tQrInfo.nWidth);
+			continue;
+		}
 
-			// Bottom-up bitmap. Copy in reverse.
+		if ((cbFile != ptFile->cbFile) ||
+			(0 != CompareFileTime(&tLastWriteTime, &(ptFile->tLastWriteTime))))
+		{
+			// Still growing.
+			ptFile->cbFile = cbFile;
+			ptFile->tLastWriteTime = tLastWriteTime;
+			ptFile->nLastChangeTime = GetTickCount();
+			continue;
+		}
 
-			for (nRow = 0; nRow < tQrInfo.nHeight; ++nRow)
+		if (GetTickCount() - ptFile->nLastChangeTime < WATCH_SETTLE_TIME_MS)
+		{
+			continue;
+		}
+
+		if (HRESULT_FROM_WIN32(ERROR_SHARING_VIOLATION) == main_WatchConvertFile(ptWatch, ptFile))
+		{
+			// Give the writer another settle period.
+			ptFile->nLastChangeTime = GetTickCount();
+		}
+	}
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_WatchOpenJournal(
+	PWATCH	ptWatch
+)
+{
+	HRESULT		hrResult		= E_FAIL;
+	WCHAR		wszJournalPath[MAX_PATH];
+	WCHAR		wszTempPath[MAX_PATH];
+	BOOL		bTempCreated	= FALSE;
+	BOOL		bWriteFailed	= FALSE;
+	FILE *		ptJournal		= NULL;
+	WCHAR		wszLine[MAX_PATH + 64];
+	ULONGLONG	cbFile			= 0;
+	FILETIME	tLastWriteTime	= { 0 };
+	HRESULT		hrConversion	= E_FAIL;
+	INT			cchPrefix		= 0;
+	PWSTR		pwszName		= NULL;
+	PWATCH_FILE	ptFile			= NULL;
+	DWORD		nFile			= 0;
+
+	assert(NULL != ptWatch);
+	assert(NULL == ptWatch->ptJournal);
+
+	hrResult = StringCchPrintfW(wszJournalPath,
+								ARRAYSIZE(wszJournalPath),
+								L"%s\\%s",
+								ptWatch->pwszOutputDirectory,
+								WATCH_JOURNAL_FILE_NAME);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	hrResult = StringCchPrintfW(wszTempPath,
+								ARRAYSIZE(wszTempPath),
+								L"%s.tmp",
+								wszJournalPath);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	// Load the existing journal, if any.
+	// Later lines override earlier ones.
+	if (0 == _wfopen_s(&ptJournal, wszJournalPath, L"r, ccs=UTF-8"))
+	{
+		while (NULL != fgetws(wszLine, ARRAYSIZE(wszLine), ptJournal))
+		{
+			cchPrefix = 0;
+			if ((4 != swscanf_s(wszLine,
+								L"%I64u\t%lu\t%lu\t%lx\t%n",
+								&cbFile,
+								&(tLastWriteTime.dwHighDateTime),
+								&(tLastWriteTime.dwLowDateTime),
+								&hrConversion,
+								&cchPrefix)) ||
+				(0 == cchPrefix))
 			{
-				for (nColumn = 0; nColumn < tQrInfo.nWidth; ++nColumn)
+				continue;
+			}
+
+			pwszName = &(wszLine[cchPrefix]);
+			pwszName[wcscspn(pwszName, L"\r\n")] = L'\0';
+			if (L'\0' == pwszName[0])
+			{
+				continue;
+			}
+
+			ptFile = main_WatchFindFile(ptWatch, pwszName);
+			if (NULL == ptFile)
+			{
+				hrResult = main_WatchAddFile(ptWatch, pwszName, &ptFile);
+				if (FAILED(hrResult))
 				{
-					ptDestRow[nColumn].rgbBlue = ptSourceRow[nColumn].rgbtBlue;
-					ptDestRow[nColumn].rgbGreen = ptSourceRow[nColumn].rgbtGreen;
-					ptDestRow[nColumn].rgbRed = ptSourceRow[nColumn].rgbtRed;
-					ptDestRow[nColumn].rgbReserved = 0;
-				}
-				ptSourceRow = (LPRGBTRIPLE)((PBYTE)ptSourceRow + cbSourceRow);
-				ptDestRow -= tQrInfo.nWidth;
+					goto lblCleanup;
+				}
 			}
+
+			ptFile->cbFile = cbFile;
+			ptFile->tLastWriteTime = tLastWriteTime;
+			ptFile->hrConversion = hrConversion;
+			ptFile->bDone = TRUE;
 		}
+
+		CLOSE(ptJournal, fclose);
+
+		PROGRESS("Loaded %lu journal entries.", ptWatch->nFiles);
+	}
+
+	// Rewrite the journal with one line per dump,
+	// so that it doesn't grow forever. The new journal is written
+	// next to the old one, and only replaces it once it's complete,
+	// so a crash halfway through doesn't lose the old one.
+	if (0 != _wfopen_s(&ptJournal, wszTempPath, L"w, ccs=UTF-8"))
+	{
+		PROGRESS("Failed creating the new journal.");
+		hrResult = E_FAIL;
+		goto lblCleanup;
+	}
+	bTempCreated = TRUE;
+
+	for (nFile = 0; nFile < ptWatch->nFiles; ++nFile)
+	{
+		ptFile = &(ptWatch->ptFiles[nFile]);
+
+		(VOID)fwprintf(ptJournal,
+					   L"%I64u\t%lu\t%lu\t0x%08lX\t%s\n",
+					   ptFile->cbFile,
+					   ptFile->tLastWriteTime.dwHighDateTime,
+					   ptFile->tLastWriteTime.dwLowDateTime,
+					   ptFile->hrConversion,
+					   ptFile->pwszName);
+	}
+
+	bWriteFailed = (0 != ferror(ptJournal));
+	if (0 != fclose(ptJournal))
+	{
+		bWriteFailed = TRUE;
+	}
+	ptJournal = NULL;
+	if (bWriteFailed)
+	{
+		PROGRESS("Failed writing the new journal.");
+		hrResult = E_FAIL;
+		goto lblCleanup;
+	}
+
+	if (!MoveFileExW(wszTempPath,
+					 wszJournalPath,
+					 MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		PROGRESS("Failed replacing the journal.");
+		goto lblCleanup;
+	}
+	bTempCreated = FALSE;
+
+	if (0 != _wfopen_s(&ptJournal, wszJournalPath, L"a, ccs=UTF-8"))
+	{
+		PROGRESS("Failed opening the journal.");
+		hrResult = E_FAIL;
+		goto lblCleanup;
 	}
 
 	// Transfer ownership:
-	*ppvPixels = pvPixels;
-	pvPixels = NULL;
-	*pcbPixels = cbPixels;
+	ptWatch->ptJournal = ptJournal;
+	ptJournal = NULL;
 
 	hrResult = S_OK;
 
 lblCleanup:
-	HEAPFREE(pvPixels);
-	HEAPFREE(pvBitmap);
+	CLOSE(ptJournal, fclose);
+	if (bTempCreated)
+	{
+		(VOID)DeleteFileW(wszTempPath);
+	}
 
 	return hrResult;
 }
 
 STATIC
 HRESULT
-main_HandleConvert(
+main_HandleWatch(
 	_In_					INT				nArguments,
 	_In_reads_(nArguments)	CONST PCWSTR *	ppwszArguments
 )
 {
-	HRESULT				hrResult			= E_FAIL;
-	PCWSTR				pwszDumpPath		= NULL;
-	PCWSTR				pwszOutputPath		= NULL;
-	HDUMP				hDump				= NULL;
-	PFRAMEBUFFER_DUMP	ptFramebufferDump	= NULL;
-	DWORD				cbFramebufferDump	= 0;
-	PFRAMEBUFFER_BITMAP	ptFramebufferBitmap	= NULL;
-	PVGA_DUMP			ptDump				= NULL;
-	DWORD				cbDump				= 0;
-	PVGA_BITMAP			ptBitmap			= NULL;
-	PVOID				pvToWrite			= NULL;
-	DWORD				cbToWrite			= 0;
-	HANDLE				hOutputFile			= INVALID_HANDLE_VALUE;
-	DWORD				cbWritten			= 0;
+	HRESULT		hrResult			= E_FAIL;
+	WATCH		tWatch				= { 0 };
+	BOOL		bHandlerInstalled	= FALSE;
+	HANDLE		hDirectory			= INVALID_HANDLE_VALUE;
+	OVERLAPPED	tOverlapped			= { 0 };
+	PVOID		pvNotifications		= NULL;
+	BOOL		bReadPending		= FALSE;
+	BOOL		bRescan				= TRUE;
+	HANDLE		ahWaitObjects[2];
+	DWORD		eWaitResult			= WAIT_FAILED;
+	DWORD		cbNotifications		= 0;
+	DWORD		nFile				= 0;
 
 	assert(NULL != ppwszArguments);
 
-	switch (nArguments)
+	hrResult = main_ParseConvertOptions(&nArguments, &ppwszArguments, &(tWatch.tOptions));
+	if (FAILED(hrResult))
 	{
-	case SUBFUNCTION_CONVERT_NO_INPUT_ARGS_COUNT:
-		pwszOutputPath = ppwszArguments[SUBFUNCTION_CONVERT_NO_INPUT_ARG_OUTPUT];
-		PROGRESS("Converting system memory dump to '%S'.", pwszOutputPath);
-		break;
-
-	case SUBFUNCTION_CONVERT_ARGS_COUNT:
-		pwszDumpPath = ppwszArguments[SUBFUNCTION_CONVERT_ARG_INPUT];
-		pwszOutputPath = ppwszArguments[SUBFUNCTION_CONVERT_ARG_OUTPUT];
-		PROGRESS("Converting dump '%S' to '%S'.", pwszDumpPath, pwszOutputPath);
-		break;
+		goto lblCleanup;
+	}
 
-	default:
+	if (SUBFUNCTION_WATCH_ARGS_COUNT != nArguments)
+	{
 		PROGRESS("Invalid number of arguments specified.");
 		hrResult = E_INVALIDARG;
 		goto lblCleanup;
 	}
 
-	hrResult = DUMPPARSE_Open(pwszDumpPath, &hDump);
+	tWatch.pwszDirectory = ppwszArguments[SUBFUNCTION_WATCH_ARG_DIRECTORY];
+	tWatch.pwszOutputDirectory = ppwszArguments[SUBFUNCTION_WATCH_ARG_OUTPUT_DIRECTORY];
+
+	if (!CreateDirectoryW(tWatch.pwszOutputDirectory, NULL) &&
+		(ERROR_ALREADY_EXISTS != GetLastError()))
+	{
+		PROGRESS("Failed creating the output directory.");
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+
+	hrResult = main_WatchOpenJournal(&tWatch);
 	if (FAILED(hrResult))
 	{
-		PROGRESS("Failed opening the dump file.");
 		goto lblCleanup;
 	}
 
-	hrResult = DUMPPARSE_ReadTagged(hDump,
-									&g_tFramebufferDumpGuid,
-									(PVOID *)&ptFramebufferDump,
-									&cbFramebufferDump);
-	if (SUCCEEDED(hrResult))
+	hDirectory = CreateFileW(tWatch.pwszDirectory,
+							 FILE_LIST_DIRECTORY,
+							 FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+							 NULL,
+							 OPEN_EXISTING,
+							 FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+							 NULL);
+	if (INVALID_HANDLE_VALUE == hDirectory)
 	{
-		hrResult = main_FramebufferDumpToBitmap(ptFramebufferDump, &ptFramebufferBitmap);
-		if (FAILED(hrResult))
-		{
-			PROGRESS("Failed converting framebuffer dump to BMP.");
-			goto lblCleanup;
-		}
+		PROGRESS("Failed opening '%S'.", tWatch.pwszDirectory);
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
 
-		pvToWrite = ptFramebufferBitmap;
-		cbToWrite = ptFramebufferBitmap->tFileHeader.bfSize;
+	pvNotifications = HEAPALLOC(WATCH_NOTIFICATION_BUFFER_SIZE);
+	if (NULL == pvNotifications)
+	{
+		PROGRESS("Oops. Ran out of memory.");
+		hrResult = E_OUTOFMEMORY;
+		goto lblCleanup;
 	}
-	else
+
+	tOverlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	if (NULL == tOverlapped.hEvent)
 	{
-		hrResult = DUMPPARSE_ReadTagged(hDump,
-										&g_tVgaDumpGuid,
-										(PVOID *)&ptDump,
-										&cbDump);
-		if (FAILED(hrResult))
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+
+	g_hWatchStopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	if (NULL == g_hWatchStopEvent)
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+
+	if (!SetConsoleCtrlHandler(&main_WatchConsoleCtrlHandler, TRUE))
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+	bHandlerInstalled = TRUE;
+
+	ahWaitObjects[0] = g_hWatchStopEvent;
+	ahWaitObjects[1] = tOverlapped.hEvent;
+
+	PROGRESS("Watching '%S'. Press Ctrl+C to stop.", tWatch.pwszDirectory);
+
+	for (;;)
+	{
+		if (!bReadPending)
 		{
-			PROGRESS("Failed reading saved bugcheck screenshot. Did you save it?");
-			goto lblCleanup;
+			if (!ReadDirectoryChangesW(hDirectory,
+									   pvNotifications,
+									   WATCH_NOTIFICATION_BUFFER_SIZE,
+									   FALSE,
+									   FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE,
+									   NULL,
+									   &tOverlapped,
+									   NULL))
+			{
+				PROGRESS("Failed watching the directory.");
+				hrResult = HRESULT_FROM_WIN32(GetLastError());
+				goto lblCleanup;
+			}
+			bReadPending = TRUE;
 		}
-		if (sizeof(*ptDump) != cbDump)
+
+		// Scan only after the read is issued,
+		// so that nothing slips between the two.
+		if (bRescan)
 		{
-			PROGRESS("The stored screenshot has a weird size.");
-			hrResult = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+			hrResult = main_WatchScanDirectory(&tWatch);
+			if (FAILED(hrResult))
+			{
+				goto lblCleanup;
+			}
+			bRescan = FALSE;
+		}
+
+		main_WatchPoll(&tWatch);
+
+		eWaitResult = WaitForMultipleObjects(ARRAYSIZE(ahWaitObjects),
+											 ahWaitObjects,
+											 FALSE,
+											 WATCH_POLL_INTERVAL_MS);
+		if (WAIT_OBJECT_0 == eWaitResult)
+		{
+			break;
+		}
+		if (WAIT_TIMEOUT == eWaitResult)
+		{
+			continue;
+		}
+		if (WAIT_OBJECT_0 + 1 != eWaitResult)
+		{
+			hrResult = HRESULT_FROM_WIN32(GetLastError());
 			goto lblCleanup;
 		}
 
-		hrResult = main_VgaDumpToBitmap(ptDump, &ptBitmap);
+		bReadPending = FALSE;
+		if (!GetOverlappedResult(hDirectory, &tOverlapped, &cbNotifications, FALSE))
+		{
+			if (ERROR_NOTIFY_ENUM_DIR != GetLastError())
+			{
+				hrResult = HRESULT_FROM_WIN32(GetLastError());
+				goto lblCleanup;
+			}
+			cbNotifications = 0;
+		}
+
+		if (0 == cbNotifications)
+		{
+			// The buffer overflowed, and the changes were lost.
+			bRescan = TRUE;
+			continue;
+		}
+
+		hrResult = main_WatchProcessNotifications(&tWatch, pvNotifications);
 		if (FAILED(hrResult))
 		{
-			PROGRESS("Failed converting raw VGA dump to BMP.");
 			goto lblCleanup;
 		}
-
-		pvToWrite = ptBitmap;
-		cbToWrite = ptBitmap->tFileHeader.bfSize;
 	}
 
-	hOutputFile = CreateFileW(pwszOutputPath,
-							  GENERIC_WRITE,
-							  0,
-							  NULL,
-							  CREATE_ALWAYS,
-							  FILE_ATTRIBUTE_NORMAL,
-							  NULL);
-	if (INVALID_HANDLE_VALUE == hOutputFile)
+	hrResult = S_OK;
+
+lblCleanup:
+	if (bReadPending)
 	{
-		PROGRESS("Failed creating the output file.");
-		hrResult = HRESULT_FROM_WIN32(GetLastError());
-		goto lblCleanup;
+		(VOID)CancelIo(hDirectory);
+		(VOID)GetOverlappedResult(hDirectory, &tOverlapped, &cbNotifications, TRUE);
 	}
-
-	if (!WriteFile(hOutputFile,
-				   pvToWrite,
-				   cbToWrite,
-				   &cbWritten,
-				   NULL))
+	if (bHandlerInstalled)
 	{
-		PROGRESS("Failed writing to the output file.");
-		hrResult = HRESULT_FROM_WIN32(GetLastError());
-		goto lblCleanup;
+		(VOID)SetConsoleCtrlHandler(&main_WatchConsoleCtrlHandler, FALSE);
 	}
-	if (cbToWrite != cbWritten)
+	CLOSE_HANDLE(g_hWatchStopEvent);
+	CLOSE_HANDLE(tOverlapped.hEvent);
+	HEAPFREE(pvNotifications);
+	CLOSE_FILE_HANDLE(hDirectory);
+	CLOSE(tWatch.ptJournal, fclose);
+	if (NULL != tWatch.ptFiles)
 	{
-		PROGRESS("Not all data written to the output file. Strange...");
-		hrResult = E_UNEXPECTED;
-		goto lblCleanup;
+		for (nFile = 0; nFile < tWatch.nFiles; ++nFile)
+		{
+			HEAPFREE(tWatch.ptFiles[nFile].pwszName);
+		}
 	}
-
-	hrResult = S_OK;
-
-lblCleanup:
-	CLOSE_FILE_HANDLE(hOutputFile);
-	HEAPFREE(ptBitmap);
-	HEAPFREE(ptDump);
-	HEAPFREE(ptFramebufferBitmap);
-	HEAPFREE(ptFramebufferDump);
-	CLOSE(hDump, DUMPPARSE_Close);
+	HEAPFREE(tWatch.ptFiles);
 
 	return hrResult;
 }
@@ -764,6 +3667,147 @@ lblCleanup:
 	return hrResult;
 }
 
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_GetDisplayModeSize(
+	PRESOLUTION	ptResolution
+)
+{
+	HRESULT			hrResult	= E_FAIL;
+	DISPLAY_DEVICEW	tDevice		= { 0 };
+	DEVMODEW		tMode		= { 0 };
+	DWORD			nDevice		= 0;
+	RESOLUTION		tLargest	= { 0 };
+
+	assert(NULL != ptResolution);
+
+	// The driver can't tell which display each hooked adapter drives,
+	// so all of them get room for the largest mode.
+	for (nDevice = 0; ; ++nDevice)
+	{
+		ZeroMemory(&tDevice, sizeof(tDevice));
+		tDevice.cb = sizeof(tDevice);
+		if (!EnumDisplayDevicesW(NULL, nDevice, &tDevice, 0))
+		{
+			break;
+		}
+
+		if (0 == (tDevice.StateFlags & DISPLAY_DEVICE_ATTACHED_TO_DESKTOP))
+		{
+			continue;
+		}
+
+		ZeroMemory(&tMode, sizeof(tMode));
+		tMode.dmSize = sizeof(tMode);
+		if (!EnumDisplaySettingsW(tDevice.DeviceName, ENUM_CURRENT_SETTINGS, &tMode))
+		{
+			continue;
+		}
+
+		tLargest.nWidth = max(tLargest.nWidth, tMode.dmPelsWidth);
+		tLargest.nHeight = max(tLargest.nHeight, tMode.dmPelsHeight);
+	}
+
+	if ((0 == tLargest.nWidth) || (0 == tLargest.nHeight))
+	{
+		hrResult = HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+		goto lblCleanup;
+	}
+
+	// Transfer ownership:
+	*ptResolution = tLargest;
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+_Use_decl_annotations_
+STATIC
+HRESULT
+main_BugshotFollow(
+	PBUGSHOT_PARAMETERS	ptParameters
+)
+{
+	HRESULT		hrResult			= E_FAIL;
+	BOOL		bHandlerInstalled	= FALSE;
+	DWORD		eWaitResult			= WAIT_FAILED;
+	RESOLUTION	tResolution			= { 0 };
+
+	assert(NULL != ptParameters);
+
+	g_hWatchStopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	if (NULL == g_hWatchStopEvent)
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+
+	if (!SetConsoleCtrlHandler(&main_WatchConsoleCtrlHandler, TRUE))
+	{
+		hrResult = HRESULT_FROM_WIN32(GetLastError());
+		goto lblCleanup;
+	}
+	bHandlerInstalled = TRUE;
+
+	PROGRESS("Following the display mode. Press Ctrl+C to stop.");
+
+	for (;;)
+	{
+		eWaitResult = WaitForSingleObject(g_hWatchStopEvent, BUGSHOT_FOLLOW_INTERVAL_MS);
+		if (WAIT_OBJECT_0 == eWaitResult)
+		{
+			break;
+		}
+		if (WAIT_TIMEOUT != eWaitResult)
+		{
+			hrResult = HRESULT_FROM_WIN32(GetLastError());
+			goto lblCleanup;
+		}
+
+		// While the mode is being switched there may be no display at all,
+		// so try again later.
+		hrResult = main_GetDisplayModeSize(&tResolution);
+		if (FAILED(hrResult))
+		{
+			continue;
+		}
+
+		if ((tResolution.nWidth == ptParameters->tResolution.nWidth) &&
+			(tResolution.nHeight == ptParameters->tResolution.nHeight))
+		{
+			continue;
+		}
+
+		PROGRESS("The display mode changed. Resizing the screenshot to %lux%lu.",
+				 tResolution.nWidth,
+				 tResolution.nHeight);
+
+		ptParameters->tResolution = tResolution;
+		hrResult = DRINKCONTROL_ControlDriver(IOCTL_DRINK_BUGSHOT,
+											  ptParameters, sizeof(*ptParameters),
+											  NULL, 0, NULL);
+		if (FAILED(hrResult))
+		{
+			PROGRESS("Failed resizing the screenshot.");
+			goto lblCleanup;
+		}
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	if (bHandlerInstalled)
+	{
+		(VOID)SetConsoleCtrlHandler(&main_WatchConsoleCtrlHandler, FALSE);
+	}
+	CLOSE_HANDLE(g_hWatchStopEvent);
+
+	return hrResult;
+}
+
 STATIC
 HRESULT
 main_HandleBugshot(
@@ -771,23 +3815,81 @@ main_HandleBugshot(
 	_In_reads_(nArguments)	CONST PCWSTR *	ppwszArguments
 )
 {
-	HRESULT		hrResult	= E_FAIL;
-	RESOLUTION	tResolution	= { 0 };
-	ULONGLONG	nWidth		= 0;
-	ULONGLONG	nHeight		= 0;
+	HRESULT				hrResult	= E_FAIL;
+	BUGSHOT_PARAMETERS	tParameters	= { 0 };
+	ULONGLONG			nWidth		= 0;
+	ULONGLONG			nHeight		= 0;
+	PWSTR				pwszEnd		= NULL;
+	BOOL				bFollow		= FALSE;
+
+	if ((nArguments > 0) && (0 == _wcsicmp(ppwszArguments[0], BUGSHOT_OPTION_FRAMES)))
+	{
+		if (nArguments < 2)
+		{
+			PROGRESS("Option '%S' requires a value.", ppwszArguments[0]);
+			hrResult = E_INVALIDARG;
+			goto lblCleanup;
+		}
 
-	if (SUBFUNCTION_BUGSHOT_ARGS_COUNT != nArguments && 0 != nArguments)
+		tParameters.nHistoryFrames = wcstoul(ppwszArguments[1], &pwszEnd, 10);
+		if ((pwszEnd == ppwszArguments[1]) ||
+			(L'\0' != *pwszEnd) ||
+			(0 == tParameters.nHistoryFrames) ||
+			(tParameters.nHistoryFrames > FRAMEBUFFER_MAX_HISTORY_FRAMES))
+		{
+			PROGRESS("The number of frames must be between 1 and %d.", FRAMEBUFFER_MAX_HISTORY_FRAMES);
+			hrResult = E_INVALIDARG;
+			goto lblCleanup;
+		}
+
+		PROGRESS("Keeping the last %lu frames drawn on the screen.", tParameters.nHistoryFrames);
+
+		nArguments -= 2;
+		ppwszArguments += 2;
+	}
+
+	if ((nArguments > 0) && (0 == _wcsicmp(ppwszArguments[0], BUGSHOT_ARG_AUTO)))
+	{
+		if (nArguments > 2)
+		{
+			PROGRESS("Invalid number of arguments specified.");
+			hrResult = E_INVALIDARG;
+			goto lblCleanup;
+		}
+
+		if (2 == nArguments)
+		{
+			if (0 != _wcsicmp(ppwszArguments[1], BUGSHOT_OPTION_FOLLOW))
+			{
+				PROGRESS("Unknown option '%S'.", ppwszArguments[1]);
+				hrResult = E_INVALIDARG;
+				goto lblCleanup;
+			}
+			bFollow = TRUE;
+		}
+
+		hrResult = main_GetDisplayModeSize(&tParameters.tResolution);
+		if (FAILED(hrResult))
+		{
+			PROGRESS("Failed retrieving the display mode.");
+			goto lblCleanup;
+		}
+
+		PROGRESS("Using the display mode, %lux%lu.",
+				 tParameters.tResolution.nWidth,
+				 tParameters.tResolution.nHeight);
+	}
+	else if (SUBFUNCTION_BUGSHOT_ARGS_COUNT != nArguments && 0 != nArguments)
 	{
 		PROGRESS("Invalid number of arguments specified.");
 		hrResult = E_INVALIDARG;
 		goto lblCleanup;
 	}
-
-	if (0 == nArguments)
+	else if (0 == nArguments)
 	{
 		PROGRESS("No resolution specified. Defaulting to 640x480.");
-		tResolution.nWidth = 640;
-		tResolution.nHeight = 480;
+		tParameters.tResolution.nWidth = 640;
+		tParameters.tResolution.nHeight = 480;
 	}
 	else
 	{
@@ -803,16 +3905,18 @@ main_HandleBugshot(
 			PROGRESS("Invalid height specified (%ws)", ppwszArguments[SUBFUNCTION_BUGSHOT_ARG_HEIGHT]);
 		}
 
-		tResolution.nWidth = (ULONG)nWidth;
-		tResolution.nHeight = (ULONG)nHeight;
+		tParameters.tResolution.nWidth = (ULONG)nWidth;
+		tParameters.tResolution.nHeight = (ULONG)nHeight;
 
-		PROGRESS("Using max resolution of %lux%lu.", tResolution.nWidth, tResolution.nHeight);
+		PROGRESS("Using max resolution of %lux%lu.",
+				 tParameters.tResolution.nWidth,
+				 tParameters.tResolution.nHeight);
 	}
 
 	PROGRESS("Registering callback to take a bugcheck snapshot.");
 
 	hrResult = DRINKCONTROL_ControlDriver(IOCTL_DRINK_BUGSHOT,
-										  &tResolution, sizeof(tResolution),
+										  &tParameters, sizeof(tParameters),
 										  NULL, 0, NULL);
 	if (FAILED(hrResult))
 	{
@@ -820,6 +3924,15 @@ main_HandleBugshot(
 		goto lblCleanup;
 	}
 
+	if (bFollow)
+	{
+		hrResult = main_BugshotFollow(&tParameters);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+	}
+
 	hrResult = S_OK;
 
 lblCleanup:
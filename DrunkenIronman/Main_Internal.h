@@ -9,6 +9,7 @@
 
 /** Headers *************************************************************/
 #include <Windows.h>
+#include <stdio.h>
 
 #include <Drink.h>
 
@@ -20,6 +21,147 @@
  */
 #define VANITY_FORMAT_STRING ("%S\r\n")
 
+/**
+ * Option for the "convert" subfunction that enables the dump index cache.
+ */
+#define CONVERT_OPTION_CACHE (L"-cache")
+
+/**
+ * Option for the "batch" and "watch" subfunctions
+ * that writes PNG files instead of BMP files.
+ */
+#define CONVERT_OPTION_PNG (L"-png")
+
+/**
+ * Option that sets the PNG compression level.
+ * Followed by the level itself.
+ */
+#define CONVERT_OPTION_LEVEL (L"-level")
+
+/**
+ * Option for the "convert" subfunction that also writes
+ * an image for each frame in the history of the screen.
+ */
+#define CONVERT_OPTION_FRAMES (L"-frames")
+
+/**
+ * Option for the "bugshot" subfunction that keeps a history of the screen.
+ * Followed by the number of frames to keep.
+ */
+#define BUGSHOT_OPTION_FRAMES (L"-frames")
+
+/**
+ * Argument for the "bugshot" subfunction that sizes the screenshot
+ * from the current mode of the displays.
+ */
+#define BUGSHOT_ARG_AUTO (L"auto")
+
+/**
+ * Option for "bugshot auto" that keeps running,
+ * and resizes the screenshot whenever the display mode changes.
+ */
+#define BUGSHOT_OPTION_FOLLOW (L"-follow")
+
+/**
+ * Extension of PNG output files.
+ * "convert" picks the format by the extension of the output path.
+ */
+#define PNG_OUTPUT_EXTENSION (L".png")
+
+/**
+ * Added to the name of the image of each display but the first,
+ * followed by the display's number.
+ */
+#define DISPLAY_OUTPUT_SUFFIX (L"_display")
+
+/**
+ * Added to the name of the image of each frame in the history of the screen,
+ * followed by the frame's number.
+ */
+#define FRAME_OUTPUT_SUFFIX (L"_frame")
+
+/**
+ * Approximate amount of memory used by the PNG encoder, in bytes.
+ */
+#define PNG_MEMORY_ESTIMATE (512 * 1024)
+
+/**
+ * Number of palette entries in a converted VGA dump.
+ * The screen is in mode 12h, so only the first 16 DAC entries are ever used.
+ */
+#define VGA_BITMAP_PALETTE_ENTRIES (16)
+
+/**
+ * Number of framebuffer rows handed to the file writer at once.
+ */
+#define FRAMEBUFFER_ROWS_PER_WRITE (64)
+
+/**
+ * Initial capacity of the batch job list, in jobs.
+ */
+#define BATCH_INITIAL_CAPACITY (64)
+
+/**
+ * Pattern of the dump files picked up from a batch input directory.
+ */
+#define BATCH_DUMP_PATTERN (L"*.dmp")
+
+/**
+ * Default extension of the images written by the "batch" subfunction.
+ */
+#define BATCH_OUTPUT_EXTENSION (L".bmp")
+
+/**
+ * Name of the summary file written to the batch output directory.
+ */
+#define BATCH_SUMMARY_FILE_NAME (L"summary.txt")
+
+/**
+ * Conversions in flight may use at most
+ * 1/BATCH_MEMORY_BUDGET_DIVISOR of the available physical memory...
+ */
+#define BATCH_MEMORY_BUDGET_DIVISOR (4)
+
+/**
+ * ...but are always allowed at least this much.
+ */
+#define BATCH_MIN_MEMORY_BUDGET (64 * 1024 * 1024ULL)
+
+/**
+ * Initial capacity of the watched file list, in files.
+ */
+#define WATCH_INITIAL_CAPACITY (64)
+
+/**
+ * Extension of the dump files picked up by the "watch" subfunction.
+ */
+#define WATCH_DUMP_EXTENSION (L".dmp")
+
+/**
+ * Name of the journal of converted dumps, kept in the output directory.
+ */
+#define WATCH_JOURNAL_FILE_NAME (L"watch.journal")
+
+/**
+ * A dump is converted once it hasn't changed for this long.
+ */
+#define WATCH_SETTLE_TIME_MS (5000)
+
+/**
+ * Interval at which the pending dumps are checked.
+ */
+#define WATCH_POLL_INTERVAL_MS (1000)
+
+/**
+ * Interval at which "bugshot auto -follow" checks the display mode.
+ */
+#define BUGSHOT_FOLLOW_INTERVAL_MS (1000)
+
+/**
+ * Size of the buffer receiving directory change notifications.
+ */
+#define WATCH_NOTIFICATION_BUFFER_SIZE (64 * 1024)
+
 
 /** Enums ***************************************************************/
 
@@ -64,6 +206,36 @@ typedef enum _SUBFUNCTION_CONVERT_ARGS
 	SUBFUNCTION_CONVERT_ARGS_COUNT
 } SUBFUNCTION_CONVERT_ARGS, *PSUBFUNCTION_CONVERT_ARGS;
 
+/**
+ * Command line argument positions for the "batch" subfunction.
+ */
+typedef enum _SUBFUNCTION_BATCH_ARGS
+{
+	// Directory containing the dumps, or a manifest listing them.
+	SUBFUNCTION_BATCH_ARG_INPUT = 0,
+
+	// Directory that will receive the images and the summary.
+	SUBFUNCTION_BATCH_ARG_OUTPUT_DIRECTORY,
+
+	// Must be last:
+	SUBFUNCTION_BATCH_ARGS_COUNT
+} SUBFUNCTION_BATCH_ARGS, *PSUBFUNCTION_BATCH_ARGS;
+
+/**
+ * Command line argument positions for the "watch" subfunction.
+ */
+typedef enum _SUBFUNCTION_WATCH_ARGS
+{
+	// Directory to watch for new dumps.
+	SUBFUNCTION_WATCH_ARG_DIRECTORY = 0,
+
+	// Directory that will receive the images and the journal.
+	SUBFUNCTION_WATCH_ARG_OUTPUT_DIRECTORY,
+
+	// Must be last:
+	SUBFUNCTION_WATCH_ARGS_COUNT
+} SUBFUNCTION_WATCH_ARGS, *PSUBFUNCTION_WATCH_ARGS;
+
 /**
  * Command line argument positions for the "bugshot" subfunction.
  */
@@ -136,6 +308,113 @@ typedef struct _SUBFUNCTION_HANDLER_ENTRY
 } SUBFUNCTION_HANDLER_ENTRY, *PSUBFUNCTION_HANDLER_ENTRY;
 typedef CONST SUBFUNCTION_HANDLER_ENTRY *PCSUBFUNCTION_HANDLER_ENTRY;
 
+/**
+ * Options controlling the conversion of a dump.
+ */
+typedef struct _CONVERT_OPTIONS
+{
+	// Flags for DUMPPARSE_Open.
+	DWORD	fOpenFlags;
+
+	// PNG compression level.
+	DWORD	nLevel;
+
+	// Extension of the images written by "batch" and "watch".
+	PCWSTR	pwszOutputExtension;
+
+	// Whether to write the frames in the history of the screen.
+	BOOL	bFrames;
+} CONVERT_OPTIONS, *PCONVERT_OPTIONS;
+typedef CONVERT_OPTIONS CONST *PCCONVERT_OPTIONS;
+
+/**
+ * Limits the amount of memory used by concurrent conversions.
+ */
+typedef struct _MEMORY_BUDGET
+{
+	CRITICAL_SECTION	tLock;
+
+	// Manual-reset event, set whenever memory is returned to the budget.
+	HANDLE				hReleasedEvent;
+
+	ULONGLONG			cbLimit;
+	ULONGLONG			cbInUse;
+} MEMORY_BUDGET, *PMEMORY_BUDGET;
+typedef MEMORY_BUDGET CONST *PCMEMORY_BUDGET;
+
+/**
+ * A single dump to convert in batch mode.
+ */
+typedef struct _BATCH_JOB
+{
+	PWSTR	pwszDumpPath;
+	PWSTR	pwszOutputPath;
+
+	// Result of the conversion.
+	HRESULT	hrResult;
+} BATCH_JOB, *PBATCH_JOB;
+typedef BATCH_JOB CONST *PCBATCH_JOB;
+
+/**
+ * State shared by the batch worker threads.
+ */
+typedef struct _BATCH
+{
+	PBATCH_JOB		ptJobs;
+	DWORD			nJobs;
+	DWORD			nCapacity;
+
+	PCWSTR			pwszOutputDirectory;
+	CONVERT_OPTIONS	tOptions;
+
+	// Index of the next job to be picked up by a worker.
+	volatile LONG	nNextJob;
+
+	MEMORY_BUDGET	tBudget;
+} BATCH, *PBATCH;
+typedef BATCH CONST *PCBATCH;
+
+/**
+ * A dump seen by the "watch" subfunction.
+ */
+typedef struct _WATCH_FILE
+{
+	// Name of the dump, relative to the watched directory.
+	PWSTR		pwszName;
+
+	// Last seen size and modification time.
+	ULONGLONG	cbFile;
+	FILETIME	tLastWriteTime;
+
+	// Tick count at which the size or time last changed.
+	DWORD		nLastChangeTime;
+
+	// Whether the dump, as described above, has been converted.
+	BOOL		bDone;
+	HRESULT		hrConversion;
+} WATCH_FILE, *PWATCH_FILE;
+typedef WATCH_FILE CONST *PCWATCH_FILE;
+
+/**
+ * State of the "watch" subfunction.
+ */
+typedef struct _WATCH
+{
+	PCWSTR			pwszDirectory;
+	PCWSTR			pwszOutputDirectory;
+	CONVERT_OPTIONS	tOptions;
+
+	PWATCH_FILE		ptFiles;
+	DWORD			nFiles;
+	DWORD			nCapacity;
+
+	// Journal of converted dumps, opened for appending.
+	FILE *			ptJournal;
+} WATCH, *PWATCH;
+typedef WATCH CONST *PCWATCH;
+
+typedef FILE_NOTIFY_INFORMATION CONST *PCFILE_NOTIFY_INFORMATION;
+
 /**
  * Structure of the finished BMP on disk.
  */
@@ -144,25 +423,55 @@ typedef struct _VGA_BITMAP
 {
 	BITMAPFILEHEADER	tFileHeader;
 	BITMAPINFOHEADER	tInfoHeader;
-	RGBQUAD				atColors[VGA_DAC_PALETTE_ENTRIES];
-	BYTE				anPixels[SCREEN_WIDTH_PIXELS * SCREEN_HEIGHT_PIXELS];
+	RGBQUAD				atColors[VGA_BITMAP_PALETTE_ENTRIES];
+	BYTE				anPixels[VGAPLANES_PACKED_BYTES_PER_ROW * SCREEN_HEIGHT_PIXELS];
 } VGA_BITMAP, *PVGA_BITMAP;
 typedef CONST VGA_BITMAP *PCVGA_BITMAP;
 #pragma pack(pop)
 
 /**
- * Structure of the finished BMP on disk.
+ * Headers of the finished BMP on disk.
+ * The pixels follow immediately.
  */
 #pragma pack(push, 1)
-typedef struct _FRAMEBUFFER_BITMAP
+typedef struct _FRAMEBUFFER_BITMAP_HEADER
 {
 	BITMAPFILEHEADER	tFileHeader;
 	BITMAPINFOHEADER	tInfoHeader;
-	BYTE				acPixels[ANYSIZE_ARRAY];
-} FRAMEBUFFER_BITMAP, *PFRAMEBUFFER_BITMAP;
-typedef FRAMEBUFFER_BITMAP CONST *PCFRAMEBUFFER_BITMAP;
+} FRAMEBUFFER_BITMAP_HEADER, *PFRAMEBUFFER_BITMAP_HEADER;
+typedef FRAMEBUFFER_BITMAP_HEADER CONST *PCFRAMEBUFFER_BITMAP_HEADER;
 #pragma pack(pop)
 
+/**
+ * Rows of a framebuffer image. They are read straight from an uncompressed
+ * dump, and a compressed dump is decompressed one strip of tiles at a time.
+ *
+ * @remark Set up with main_InitializeFramebufferRows
+ *         or main_OpenCompressedFramebufferRows,
+ *         and clean up with main_CloseFramebufferRows.
+ */
+typedef struct _FRAMEBUFFER_ROWS
+{
+	// The dump's header. The pixels of an uncompressed dump follow it.
+	PCFRAMEBUFFER_DUMP		ptDump;
+
+	// Size of the dump, in bytes, as if it were uncompressed.
+	DWORD					cbDump;
+
+	// The compressed dump, or NULL if it isn't compressed.
+	PCFRAMEBUFFER_DUMP_EX	ptDumpEx;
+
+	// Decompression state at the start of each tile in the pool.
+	PRLE_DECODER			atPoolTiles;
+	DWORD					nPoolTiles;
+
+	// The last strip of tiles decompressed, and its first row.
+	PBYTE					pcStrip;
+	DWORD					nStripTop;
+	BOOL					bStripValid;
+} FRAMEBUFFER_ROWS, *PFRAMEBUFFER_ROWS;
+typedef FRAMEBUFFER_ROWS CONST *PCFRAMEBUFFER_ROWS;
+
 
 /** Functions ***********************************************************/
 
@@ -188,24 +497,20 @@ main_VgaDacEntryToRgb(
 );
 
 /**
- * Extracts the bit value of a pixel from a single VGA plane.
- * The bit values from all 4 planes should be combined
- * to obtain the index into the Palette RAM.
- *
- * @param[in]	pnPlane		The plane data.
- * @param[in]	nPixelIndex	Index of the pixel.
+ * Converts the palette used by a VGA dump to RGB values.
  *
- * @returns BYTE (contains just one bit, the LSB)
+ * @param[in]	ptDump		The dump.
+ * @param[out]	atColors	Will receive the palette.
  */
 STATIC
-BYTE
-main_GetPixelBitFromPlane(
-	_In_	CONST BYTE *	pnPlane,
-	_In_	DWORD			nPixelIndex
+VOID
+main_VgaPaletteToRgb(
+	_In_											PCVGA_DUMP	ptDump,
+	_Out_writes_all_(VGA_BITMAP_PALETTE_ENTRIES)	RGBQUAD *	atColors
 );
 
 /**
- * Converts a VGA dump to a bitmap.
+ * Converts a VGA dump to a 4 BPP bitmap.
  *
  * @param[in]	ptDump		Dump to convert.
  * @param[out]	pptBitmap	Will receive the converted bitmap.
@@ -220,96 +525,820 @@ main_VgaDumpToBitmap(
 );
 
 /**
- * @brief Gets the current QR bitmap information.
+ * Converts a framebuffer dump to a bitmap, and writes it out.
  *
- * @param[out] ptInfo Will receive the info.
+ * @param[in,out]	ptRows	Rows of the dump to convert.
+ * @param[in]		hWriter	Output file.
  *
- * @return HRESULT
-*/
+ * @returns HRESULT
+ *
+ * @remark The rows are written straight from the dump, or from
+ *         the decompressed strip, so the bitmap is never held in memory.
+ */
 STATIC
 HRESULT
-main_GetQrInfo(
-	_Out_	PQR_INFO	ptInfo
+main_WriteFramebufferBitmap(
+	_Inout_	PFRAMEBUFFER_ROWS	ptRows,
+	_In_	HFILEWRITER			hWriter
 );
 
 /**
- * @brief Converts a bitmap file to be used as a bugcheck QR image.
+ * Validates the header of a possibly compressed framebuffer dump.
  *
- * @param pwszFilename	Name of the bitmap file.
- * @param ppvPixels		Will receive the converted pixel data.
- * @param pcbPixels		Will receive the size of the pixel data, in bytes.
+ * @param[in]	ptDumpEx		Dump to validate.
+ * @param[in]	cbDumpEx		Size of the dump, in bytes.
+ * @param[out]	pcbDecompressed	Will receive the size of the decompressed
+ *								FRAMEBUFFER_DUMP, in bytes, or 0 if the
+ *								dump isn't compressed.
  *
- * @return HRESULT
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_ValidateFramebufferDumpEx(
+	_In_reads_bytes_(cbDumpEx)	PCFRAMEBUFFER_DUMP_EX	ptDumpEx,
+	_In_						DWORD					cbDumpEx,
+	_Out_						PDWORD					pcbDecompressed
+);
+
+/**
+ * Sets up reading the rows of an uncompressed framebuffer dump.
  *
- * @remark Free the returned buffer to the process heap.
-*/
+ * @param[out]	ptRows	Will receive the rows.
+ * @param[in]	ptDump	The dump. Must outlive the rows.
+ * @param[in]	cbDump	Size of the dump, in bytes.
+ */
+STATIC
+VOID
+main_InitializeFramebufferRows(
+	_Out_						PFRAMEBUFFER_ROWS	ptRows,
+	_In_reads_bytes_(cbDump)	PCFRAMEBUFFER_DUMP	ptDump,
+	_In_						DWORD				cbDump
+);
+
+/**
+ * Computes how much memory main_OpenCompressedFramebufferRows
+ * may allocate for a dump.
+ *
+ * @param[in]	ptDumpEx	The dump.
+ *							Must have been validated with main_ValidateFramebufferDumpEx,
+ *							and must be compressed.
+ *
+ * @returns ULONGLONG
+ */
+STATIC
+ULONGLONG
+main_GetCompressedFramebufferRowsSize(
+	_In_	PCFRAMEBUFFER_DUMP_EX	ptDumpEx
+);
+
+/**
+ * Sets up decompressing the rows of a framebuffer dump
+ * stored with FRAMEBUFFER_COMPRESSION_RLE_TILE_POOL.
+ *
+ * @param[out]	ptRows			Will receive the rows.
+ * @param[in]	ptDumpEx		The dump. Must outlive the rows.
+ *								Must have been validated with main_ValidateFramebufferDumpEx,
+ *								and must be compressed.
+ * @param[in]	cbDecompressed	Size of the decompressed dump, in bytes,
+ *								as returned by main_ValidateFramebufferDumpEx.
+ *
+ * @returns HRESULT
+ *
+ * @remark The whole dump is checked here, so that reading
+ *         the rows later only fails if memory runs out.
+ * @remark Only a single strip of tiles is held in memory at a time.
+ */
 STATIC
 HRESULT
-main_ConvertBitmapForQr(
-	_In_									PCWSTR	pwszFilename,
-	_Outptr_result_bytebuffer_(*pcbPixels)	PVOID *	ppvPixels,
-	_Out_									PDWORD	pcbPixels
+main_OpenCompressedFramebufferRows(
+	_Out_	PFRAMEBUFFER_ROWS		ptRows,
+	_In_	PCFRAMEBUFFER_DUMP_EX	ptDumpEx,
+	_In_	DWORD					cbDecompressed
 );
 
 /**
- * Handler for the "convert" subfunction.
- * Extracts a VGA dump from a memory dump file
- * and converts it to a BMP file.
+ * Decompresses a strip of tiles of a compressed framebuffer dump.
  *
- * @param[in]	nArguments		Number of command line arguments.
- * @param[in]	ppwszArguments	The command line arguments.
+ * @param[in,out]	ptRows		Rows of the dump,
+ *								set up with main_OpenCompressedFramebufferRows.
+ * @param[in]		nTileRow	The strip to decompress.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_DecompressStrip(
+	_Inout_	PFRAMEBUFFER_ROWS	ptRows,
+	_In_	DWORD				nTileRow
+);
+
+/**
+ * Gets rows of a framebuffer image.
+ *
+ * @param[in,out]	ptRows		The rows.
+ * @param[in]		nRow		First row to get.
+ * @param[out]		ppcRows		Will receive the first row. The rows that follow
+ *								it are ptRows->ptDump->nWidth pixels apart.
+ * @param[out]		pnRows		Will receive the number of rows available,
+ *								starting with nRow.
  *
  * @returns HRESULT
  *
- * @see SUBFUNCTION_CONVERT_NO_INPUT_ARGS
- *      SUBFUNCTION_CONVERT_ARGS
+ * @remark The rows stay valid until the next call.
  */
 STATIC
 HRESULT
-main_HandleConvert(
-	_In_					INT				nArguments,
-	_In_reads_(nArguments)	CONST PCWSTR *	ppwszArguments
+main_GetFramebufferRows(
+	_Inout_	PFRAMEBUFFER_ROWS	ptRows,
+	_In_	DWORD				nRow,
+	_Out_	CONST BYTE **		ppcRows,
+	_Out_	PDWORD				pnRows
 );
 
 /**
- * Handler for the "load" subfunction.
- * Loads the driver.
+ * Frees whatever was allocated for the rows of a framebuffer image.
  *
- * @param[in]	nArguments		Ignored.
- * @param[in]	ppwszArguments	Ignored.
+ * @param[in,out]	ptRows	The rows.
+ */
+STATIC
+VOID
+main_CloseFramebufferRows(
+	_Inout_	PFRAMEBUFFER_ROWS	ptRows
+);
+
+/**
+ * Validates a framebuffer dump, and computes the size
+ * of the image it holds.
+ *
+ * @param[in]	ptDump		Dump to validate.
+ * @param[in]	cbDump		Size of the dump, in bytes.
+ * @param[out]	pnWidth		Will receive the width of the image, in pixels.
+ * @param[out]	pnHeight	Will receive the height of the image, in pixels.
  *
  * @returns HRESULT
  */
 STATIC
 HRESULT
-main_HandleLoad(
-	_In_					INT				nArguments,
-	_In_reads_(nArguments)	CONST PCWSTR *	ppwszArguments
+main_GetFramebufferImageSize(
+	_In_reads_bytes_(cbDump)	PCFRAMEBUFFER_DUMP	ptDump,
+	_In_						DWORD				cbDump,
+	_Out_						PULONG				pnWidth,
+	_Out_						PULONG				pnHeight
 );
 
 /**
- * Handler for the "unload" subfunction.
- * Unloads the driver.
+ * Converts a framebuffer dump to a PNG, and writes it out.
  *
- * @param[in]	nArguments		Ignored.
- * @param[in]	ppwszArguments	Ignored.
+ * @param[in,out]	ptRows	Rows of the dump to convert.
+ * @param[in]		nLevel	Compression level.
+ * @param[in]		hWriter	Output file.
  *
  * @returns HRESULT
  */
 STATIC
 HRESULT
-main_HandleUnload(
-	_In_					INT				nArguments,
-	_In_reads_(nArguments)	CONST PCWSTR *	ppwszArguments
+main_WriteFramebufferPng(
+	_Inout_	PFRAMEBUFFER_ROWS	ptRows,
+	_In_	DWORD				nLevel,
+	_In_	HFILEWRITER			hWriter
 );
 
 /**
- * Handler for the "bugshot" subfunction.
- * Instructs the driver to take
- * a screenshot on the next bugheck.
+ * Converts a VGA dump to a 4 BPP PNG, and writes it out.
  *
- * @param[in]	nArguments		Ignored.
- * @param[in]	ppwszArguments	Ignored.
+ * @param[in]	ptDump	Dump to convert.
+ * @param[in]	nLevel	Compression level.
+ * @param[in]	hWriter	Output file.
+ *
+ * @returns HRESULT
+ *
+ * @remark The rows are converted from the planes one at a time,
+ *         so the image is never held in memory.
+ */
+STATIC
+HRESULT
+main_WriteVgaPng(
+	_In_	PCVGA_DUMP	ptDump,
+	_In_	DWORD		nLevel,
+	_In_	HFILEWRITER	hWriter
+);
+
+/**
+ * Determines whether an output path names a PNG file.
+ *
+ * @param[in]	pwszOutputPath	The path.
+ *
+ * @returns BOOL
+ */
+STATIC
+BOOL
+main_IsPngPath(
+	_In_	PCWSTR	pwszOutputPath
+);
+
+/**
+ * @brief Gets the current QR bitmap information.
+ *
+ * @param[out] ptInfo Will receive the info.
+ *
+ * @return HRESULT
+*/
+STATIC
+HRESULT
+main_GetQrInfo(
+	_Out_	PQR_INFO	ptInfo
+);
+
+/**
+ * @brief Converts a bitmap file to be used as a bugcheck QR image.
+ *
+ * @param pwszFilename	Name of the bitmap file.
+ * @param ppvPixels		Will receive the converted pixel data.
+ * @param pcbPixels		Will receive the size of the pixel data, in bytes.
+ *
+ * @return HRESULT
+ *
+ * @remark Free the returned buffer to the process heap.
+*/
+STATIC
+HRESULT
+main_ConvertBitmapForQr(
+	_In_									PCWSTR	pwszFilename,
+	_Outptr_result_bytebuffer_(*pcbPixels)	PVOID *	ppvPixels,
+	_Out_									PDWORD	pcbPixels
+);
+
+/**
+ * Consumes the options preceding the positional arguments
+ * of the "convert", "batch" and "watch" subfunctions.
+ *
+ * @param[in,out]	pnArguments		Number of command line arguments.
+ *									Will receive the number of remaining arguments.
+ * @param[in,out]	pppwszArguments	The command line arguments.
+ *									Will receive the remaining arguments.
+ * @param[out]		ptOptions		Will receive the parsed options.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_ParseConvertOptions(
+	_Inout_		PINT				pnArguments,
+	_Inout_		CONST PCWSTR **		pppwszArguments,
+	_Out_		PCONVERT_OPTIONS	ptOptions
+);
+
+/**
+ * Takes memory from a budget, waiting until enough is available.
+ *
+ * @param[in,out]	ptBudget	The budget.
+ * @param[in]		cbAmount	Amount of memory to take, in bytes.
+ */
+STATIC
+VOID
+main_AcquireBudget(
+	_Inout_	PMEMORY_BUDGET	ptBudget,
+	_In_	ULONGLONG		cbAmount
+);
+
+/**
+ * Returns memory taken with main_AcquireBudget.
+ *
+ * @param[in,out]	ptBudget	The budget.
+ * @param[in]		cbAmount	Amount of memory to return, in bytes.
+ */
+STATIC
+VOID
+main_ReleaseBudget(
+	_Inout_	PMEMORY_BUDGET	ptBudget,
+	_In_	ULONGLONG		cbAmount
+);
+
+/**
+ * Computes the path of an image written next to the requested one,
+ * such as that of an additional display, or of a frame.
+ *
+ * @param[in]	pwszOutputPath		Path to the requested image.
+ * @param[in]	pwszSuffix			Added to the name, followed by the number.
+ * @param[in]	nNumber				Number of the image.
+ * @param[out]	ppwszNumberedPath	Will receive the path, with the suffix and
+ *									the number added before the extension.
+ *
+ * @returns HRESULT
+ *
+ * @remark Free the returned path to the process heap.
+ */
+STATIC
+HRESULT
+main_GetNumberedOutputPath(
+	_In_		PCWSTR	pwszOutputPath,
+	_In_		PCWSTR	pwszSuffix,
+	_In_		DWORD	nNumber,
+	_Outptr_	PWSTR *	ppwszNumberedPath
+);
+
+/**
+ * Prints what taking a screenshot cost the driver,
+ * if the screenshot was stored along with its statistics.
+ *
+ * @param[in]	pvScreenshot	The screenshot, as stored in the dump.
+ * @param[in]	cbScreenshot	Size of the screenshot, in bytes.
+ * @param[in]	ptTag			Tag the screenshot was stored with.
+ */
+STATIC
+VOID
+main_ReportBugshotStatistics(
+	_In_reads_bytes_(cbScreenshot)	LPCVOID	pvScreenshot,
+	_In_							DWORD	cbScreenshot,
+	_In_							LPCGUID	ptTag
+);
+
+/**
+ * Writes a single screenshot, read from a memory dump file, to an image file.
+ *
+ * @param[in]		pvScreenshot	The screenshot, as stored in the dump.
+ * @param[in]		cbScreenshot	Size of the screenshot, in bytes.
+ * @param[in]		ptTag			Tag the screenshot was stored with,
+ *									which determines its format.
+ * @param[in]		pwszOutputPath	Path to the resulting image.
+ * @param[in]		ptOptions		Conversion options.
+ * @param[in,out]	ptBudget		Optional budget to charge the conversion's memory to.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_ConvertScreenshot(
+	_In_reads_bytes_(cbScreenshot)	LPCVOID				pvScreenshot,
+	_In_							DWORD				cbScreenshot,
+	_In_							LPCGUID				ptTag,
+	_In_							PCWSTR				pwszOutputPath,
+	_In_							PCCONVERT_OPTIONS	ptOptions,
+	_Inout_opt_						PMEMORY_BUDGET		ptBudget
+);
+
+/**
+ * Writes a framebuffer dump to an image file.
+ *
+ * @param[in,out]	ptRows			Rows of the dump to write.
+ * @param[in]		pwszOutputPath	Path to the resulting image.
+ *									It is a PNG if the path ends with .png,
+ *									and a BMP otherwise.
+ * @param[in]		ptOptions		Conversion options.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_WriteFramebufferFile(
+	_Inout_	PFRAMEBUFFER_ROWS	ptRows,
+	_In_	PCWSTR				pwszOutputPath,
+	_In_	PCCONVERT_OPTIONS	ptOptions
+);
+
+/**
+ * Makes sure the history of the screen, as read from a dump file,
+ * is consistent, and puts its frames in the order they were drawn.
+ *
+ * @param[in]	ptHistory	The history, as stored in the dump.
+ * @param[in]	cbHistory	Size of the history, in bytes.
+ * @param[out]	papcFrames	Will receive the frames, oldest first.
+ *							There are ptHistory->nFrames of them.
+ *
+ * @returns HRESULT
+ *
+ * @remark Free the returned array to the process heap.
+ */
+STATIC
+HRESULT
+main_ValidateFramebufferHistory(
+	_In_reads_bytes_(cbHistory)	PCFRAMEBUFFER_HISTORY	ptHistory,
+	_In_						DWORD					cbHistory,
+	_Outptr_					PCFRAMEBUFFER_FRAME **	papcFrames
+);
+
+/**
+ * Draws a frame from the history of the screen.
+ *
+ * @param[in,out]	ptCanvas	Framebuffer of the frame's display.
+ *								Must be large enough to hold the whole frame.
+ * @param[in]		ptFrame		The frame to draw.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_DrawFrame(
+	_Inout_	PFRAMEBUFFER_DUMP	ptCanvas,
+	_In_	PCFRAMEBUFFER_FRAME	ptFrame
+);
+
+/**
+ * Writes an image of the screen for each frame in its history.
+ *
+ * @param[in]	pvHistory		The history, as stored in the dump.
+ * @param[in]	cbHistory		Size of the history, in bytes.
+ * @param[in]	pwszOutputPath	Path to the image of the first display.
+ *								Frames are written next to it,
+ *								with _frame<n> added to the name.
+ * @param[in]	ptOptions		Conversion options.
+ *
+ * @returns HRESULT
+ *
+ * @remark The frames of each display are drawn one over the other,
+ *         starting from a black screen. The time each one was drawn at
+ *         is printed, relative to the first frame.
+ */
+STATIC
+HRESULT
+main_ConvertFrames(
+	_In_reads_bytes_(cbHistory)	LPCVOID				pvHistory,
+	_In_						DWORD				cbHistory,
+	_In_						PCWSTR				pwszOutputPath,
+	_In_						PCCONVERT_OPTIONS	ptOptions
+);
+
+/**
+ * Extracts the screenshots from a memory dump file
+ * and writes them to image files.
+ *
+ * @param[in]		pwszDumpPath	Path to the dump file.
+ *									If not specified, the system crash dump is used.
+ * @param[in]		pwszOutputPath	Path to the resulting image.
+ *									Displays other than the first are written
+ *									next to it, see main_GetNumberedOutputPath.
+ * @param[in]		ptOptions		Conversion options.
+ * @param[in,out]	ptBudget		Optional budget to charge the conversion's memory to.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_ConvertDump(
+	_In_opt_	PCWSTR				pwszDumpPath,
+	_In_		PCWSTR				pwszOutputPath,
+	_In_		PCCONVERT_OPTIONS	ptOptions,
+	_Inout_opt_	PMEMORY_BUDGET		ptBudget
+);
+
+/**
+ * Handler for the "convert" subfunction.
+ * Extracts a VGA dump from a memory dump file
+ * and converts it to a BMP file.
+ *
+ * @param[in]	nArguments		Number of command line arguments.
+ * @param[in]	ppwszArguments	The command line arguments.
+ *
+ * @returns HRESULT
+ *
+ * @see SUBFUNCTION_CONVERT_NO_INPUT_ARGS
+ *      SUBFUNCTION_CONVERT_ARGS
+ */
+STATIC
+HRESULT
+main_HandleConvert(
+	_In_					INT				nArguments,
+	_In_reads_(nArguments)	CONST PCWSTR *	ppwszArguments
+);
+
+/**
+ * Adds a dump to the batch.
+ * The output is named after the dump.
+ *
+ * @param[in,out]	ptBatch			The batch.
+ * @param[in]		pwszDumpPath	Path to the dump file.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_AddBatchJob(
+	_Inout_	PBATCH	ptBatch,
+	_In_	PCWSTR	pwszDumpPath
+);
+
+/**
+ * Adds all the dumps in a directory to the batch.
+ *
+ * @param[in,out]	ptBatch			The batch.
+ * @param[in]		pwszDirectory	The directory.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_AddBatchJobsFromDirectory(
+	_Inout_	PBATCH	ptBatch,
+	_In_	PCWSTR	pwszDirectory
+);
+
+/**
+ * Adds all the dumps listed in a manifest to the batch.
+ * The manifest is a text file with one path per line.
+ *
+ * @param[in,out]	ptBatch			The batch.
+ * @param[in]		pwszManifest	Path to the manifest.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_AddBatchJobsFromManifest(
+	_Inout_	PBATCH	ptBatch,
+	_In_	PCWSTR	pwszManifest
+);
+
+/**
+ * Batch worker thread.
+ * Converts dumps until there are none left.
+ *
+ * @param[in]	pvBatch	The batch (PBATCH).
+ *
+ * @returns DWORD
+ */
+STATIC
+DWORD
+WINAPI
+main_BatchWorker(
+	_In_	PVOID	pvBatch
+);
+
+/**
+ * Writes the results of a batch to the summary file.
+ *
+ * @param[in]	ptBatch		The finished batch.
+ * @param[out]	pnSucceeded	Will receive the number of converted dumps.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_WriteBatchSummary(
+	_In_	PCBATCH	ptBatch,
+	_Out_	PDWORD	pnSucceeded
+);
+
+/**
+ * Handler for the "batch" subfunction.
+ * Converts many dumps in parallel.
+ *
+ * @param[in]	nArguments		Number of command line arguments.
+ * @param[in]	ppwszArguments	The command line arguments.
+ *
+ * @returns HRESULT
+ *
+ * @see SUBFUNCTION_BATCH_ARGS
+ */
+STATIC
+HRESULT
+main_HandleBatch(
+	_In_					INT				nArguments,
+	_In_reads_(nArguments)	CONST PCWSTR *	ppwszArguments
+);
+
+/**
+ * Console control handler for the "watch" subfunction,
+ * and for "bugshot auto -follow".
+ * Signals g_hWatchStopEvent.
+ *
+ * @param[in]	eCtrlType	Type of the control signal.
+ *
+ * @returns BOOL
+ */
+STATIC
+BOOL
+WINAPI
+main_WatchConsoleCtrlHandler(
+	_In_	DWORD	eCtrlType
+);
+
+/**
+ * Retrieves the size and modification time of a watched file.
+ *
+ * @param[in]	ptWatch			The watch.
+ * @param[in]	pwszName		Name of the file, relative to the watched directory.
+ * @param[out]	pcbFile			Will receive the file's size.
+ * @param[out]	ptLastWriteTime	Will receive the file's modification time.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_WatchQueryFile(
+	_In_	PCWATCH		ptWatch,
+	_In_	PCWSTR		pwszName,
+	_Out_	PULONGLONG	pcbFile,
+	_Out_	PFILETIME	ptLastWriteTime
+);
+
+/**
+ * Looks up a file in the watch.
+ *
+ * @param[in]	ptWatch		The watch.
+ * @param[in]	pwszName	Name of the file.
+ *
+ * @returns The file, or NULL if it isn't known.
+ */
+STATIC
+PWATCH_FILE
+main_WatchFindFile(
+	_In_	PWATCH	ptWatch,
+	_In_	PCWSTR	pwszName
+);
+
+/**
+ * Adds a new, zeroed file entry to the watch.
+ *
+ * @param[in,out]	ptWatch		The watch.
+ * @param[in]		pwszName	Name of the file.
+ * @param[out]		pptFile		Will receive the new entry.
+ *
+ * @returns HRESULT
+ *
+ * @remark Pointers to existing entries are invalidated.
+ */
+STATIC
+HRESULT
+main_WatchAddFile(
+	_Inout_	PWATCH			ptWatch,
+	_In_	PCWSTR			pwszName,
+	_Out_	PWATCH_FILE *	pptFile
+);
+
+/**
+ * Records that a file may have been created or changed.
+ * New and changed dumps start waiting to settle.
+ *
+ * @param[in,out]	ptWatch		The watch.
+ * @param[in]		pwszName	Name of the file.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_WatchNoteFile(
+	_Inout_	PWATCH	ptWatch,
+	_In_	PCWSTR	pwszName
+);
+
+/**
+ * Notes all the dumps currently in the watched directory.
+ *
+ * @param[in,out]	ptWatch	The watch.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_WatchScanDirectory(
+	_Inout_	PWATCH	ptWatch
+);
+
+/**
+ * Notes the dumps mentioned in a batch of change notifications.
+ *
+ * @param[in,out]	ptWatch			The watch.
+ * @param[in]		pvNotifications	Notifications returned by ReadDirectoryChangesW.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_WatchProcessNotifications(
+	_Inout_	PWATCH	ptWatch,
+	_In_	LPCVOID	pvNotifications
+);
+
+/**
+ * Converts a settled dump, and records the result in the journal.
+ *
+ * @param[in,out]	ptWatch	The watch.
+ * @param[in,out]	ptFile	The dump.
+ *
+ * @returns HRESULT
+ *
+ * @remark If the dump is still open for writing, nothing is recorded
+ *         and HRESULT_FROM_WIN32(ERROR_SHARING_VIOLATION) is returned.
+ */
+STATIC
+HRESULT
+main_WatchConvertFile(
+	_Inout_	PWATCH		ptWatch,
+	_Inout_	PWATCH_FILE	ptFile
+);
+
+/**
+ * Checks the dumps waiting to settle, and converts those that have.
+ *
+ * @param[in,out]	ptWatch	The watch.
+ */
+STATIC
+VOID
+main_WatchPoll(
+	_Inout_	PWATCH	ptWatch
+);
+
+/**
+ * Loads the journal of converted dumps from the output directory,
+ * compacts it, and opens it for appending.
+ *
+ * @param[in,out]	ptWatch	The watch.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_WatchOpenJournal(
+	_Inout_	PWATCH	ptWatch
+);
+
+/**
+ * Handler for the "watch" subfunction.
+ * Converts dumps as they appear in a directory.
+ *
+ * @param[in]	nArguments		Number of command line arguments.
+ * @param[in]	ppwszArguments	The command line arguments.
+ *
+ * @returns HRESULT
+ *
+ * @see SUBFUNCTION_WATCH_ARGS
+ */
+STATIC
+HRESULT
+main_HandleWatch(
+	_In_					INT				nArguments,
+	_In_reads_(nArguments)	CONST PCWSTR *	ppwszArguments
+);
+
+/**
+ * Handler for the "load" subfunction.
+ * Loads the driver.
+ *
+ * @param[in]	nArguments		Ignored.
+ * @param[in]	ppwszArguments	Ignored.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_HandleLoad(
+	_In_					INT				nArguments,
+	_In_reads_(nArguments)	CONST PCWSTR *	ppwszArguments
+);
+
+/**
+ * Handler for the "unload" subfunction.
+ * Unloads the driver.
+ *
+ * @param[in]	nArguments		Ignored.
+ * @param[in]	ppwszArguments	Ignored.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_HandleUnload(
+	_In_					INT				nArguments,
+	_In_reads_(nArguments)	CONST PCWSTR *	ppwszArguments
+);
+
+/**
+ * Retrieves the size of the largest current mode
+ * among the displays attached to the desktop.
+ *
+ * @param[out]	ptResolution	Will receive the size.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_GetDisplayModeSize(
+	_Out_	PRESOLUTION	ptResolution
+);
+
+/**
+ * Re-sizes the screenshot whenever the display mode changes,
+ * until Ctrl+C is pressed.
+ *
+ * @param[in,out]	ptParameters	The parameters the screenshot was set up with.
+ *									Receives the last size set.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+main_BugshotFollow(
+	_Inout_	PBUGSHOT_PARAMETERS	ptParameters
+);
+
+/**
+ * Handler for the "bugshot" subfunction.
+ * Instructs the driver to take
+ * a screenshot on the next bugheck.
+ *
+ * @param[in]	nArguments		Number of command line arguments.
+ * @param[in]	ppwszArguments	The command line arguments.
  *
  * @returns HRESULT
  */
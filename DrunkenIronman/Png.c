@@ -0,0 +1,797 @@
+/**
+ * @file Png.c
+ * @author biko
+ * @date 2026-10-17
+ *
+ * Png module implementation.
+ *
+ * Rows are filtered as they arrive, picking the filter with the smallest
+ * sum of absolute residuals for each row, and are compressed straight
+ * into IDAT chunks. Only the current and previous rows are kept.
+ */
+
+/** Headers *************************************************************/
+#include <Windows.h>
+#include <assert.h>
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#define PNG_SSE2
+#endif
+
+#include "Util.h"
+#include "FileWriter.h"
+#include "Deflate.h"
+
+#include "Png.h"
+
+
+/** Constants ***********************************************************/
+
+/**
+ * Chunk types.
+ */
+#define PNG_CHUNK_IHDR ('IHDR')
+#define PNG_CHUNK_PLTE ('PLTE')
+#define PNG_CHUNK_IDAT ('IDAT')
+#define PNG_CHUNK_IEND ('IEND')
+
+/**
+ * Colour types, as stored in the IHDR chunk.
+ */
+#define PNG_COLOR_TYPE_TRUECOLOR (2)
+#define PNG_COLOR_TYPE_INDEXED (3)
+
+/**
+ * Maximal number of palette entries.
+ */
+#define PNG_MAX_PALETTE_ENTRIES (256)
+
+/**
+ * The file signature.
+ */
+STATIC CONST BYTE g_acPngSignature[] = {
+	0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+};
+
+/**
+ * CRC-32 (ISO 3309) of each byte value.
+ */
+STATIC CONST DWORD g_anCrcTable[256] = {
+	0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+	0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+	0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+	0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+	0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+	0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+	0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+	0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+	0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+	0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+	0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+	0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+	0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+	0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+	0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+	0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+	0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+	0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+	0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+	0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+	0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+	0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+	0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+	0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+	0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+	0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+	0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+	0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+	0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+	0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+	0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+	0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+	0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+	0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+	0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+	0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+	0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+	0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+	0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+	0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+	0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+	0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+	0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+};
+
+
+/** Enums ***************************************************************/
+
+/**
+ * Row filter types.
+ */
+typedef enum _PNG_FILTER
+{
+	PNG_FILTER_NONE = 0,
+	PNG_FILTER_SUB,
+	PNG_FILTER_UP,
+	PNG_FILTER_AVERAGE,
+	PNG_FILTER_PAETH,
+
+	// Must be last:
+	PNG_FILTER_COUNT
+} PNG_FILTER, *PPNG_FILTER;
+
+
+/** Typedefs ************************************************************/
+
+#pragma pack(push, 1)
+
+/**
+ * Contents of the IHDR chunk.
+ * All fields are big-endian.
+ */
+typedef struct _PNG_IHDR
+{
+	BYTE	acWidth[4];
+	BYTE	acHeight[4];
+	BYTE	nBitDepth;
+	BYTE	eColorType;
+	BYTE	eCompressionMethod;
+	BYTE	eFilterMethod;
+	BYTE	eInterlaceMethod;
+} PNG_IHDR, *PPNG_IHDR;
+typedef PNG_IHDR CONST *PCPNG_IHDR;
+
+#pragma pack(pop)
+
+typedef struct _PNG_CONTEXT
+{
+	HFILEWRITER			hWriter;
+	HDEFLATE			hDeflate;
+
+	PNG_PIXEL_FORMAT	ePixelFormat;
+	DWORD				nHeight;
+	DWORD				nRowsWritten;
+
+	// Size of an unfiltered row, in bytes.
+	DWORD				cbRow;
+
+	// Distance between corresponding bytes of adjacent pixels.
+	DWORD				cbPixel;
+
+	// The previous row, and the row being written.
+	PBYTE				pcPreviousRow;
+	PBYTE				pcCurrentRow;
+
+	// Filtered rows, each prefixed by its filter type.
+	PBYTE				pcBestRow;
+	PBYTE				pcCandidateRow;
+
+	BOOL				bUseSse2;
+} PNG_CONTEXT, *PPNG_CONTEXT;
+typedef PNG_CONTEXT CONST *PCPNG_CONTEXT;
+
+
+/** Functions ***********************************************************/
+
+/**
+ * Stores a DWORD in big-endian byte order.
+ *
+ * @param[out]	pcBuffer	Will receive the value.
+ * @param[in]	nValue		The value.
+ */
+STATIC
+FORCEINLINE
+VOID
+png_StoreBigEndian(
+	_Out_writes_bytes_(4)	PBYTE	pcBuffer,
+	_In_					DWORD	nValue
+)
+{
+	pcBuffer[0] = (BYTE)(nValue >> 24);
+	pcBuffer[1] = (BYTE)(nValue >> 16);
+	pcBuffer[2] = (BYTE)(nValue >> 8);
+	pcBuffer[3] = (BYTE)(nValue);
+}
+
+/**
+ * Continues a CRC-32 computation.
+ *
+ * @param[in]	nCrc	CRC of the preceding data, pre-inverted.
+ * @param[in]	pvData	The data.
+ * @param[in]	cbData	Size of the data, in bytes.
+ *
+ * @returns The updated CRC, pre-inverted.
+ */
+STATIC
+DWORD
+png_UpdateCrc(
+	_In_						DWORD	nCrc,
+	_In_reads_bytes_(cbData)	LPCVOID	pvData,
+	_In_						DWORD	cbData
+)
+{
+	CONST BYTE *	pcData	= (CONST BYTE *)pvData;
+	DWORD			nIndex	= 0;
+
+	for (nIndex = 0; nIndex < cbData; ++nIndex)
+	{
+		nCrc = g_anCrcTable[(nCrc ^ pcData[nIndex]) & 0xFF] ^ (nCrc >> 8);
+	}
+
+	return nCrc;
+}
+
+/**
+ * Writes a chunk to the file.
+ *
+ * @param[in]	hWriter	The file.
+ * @param[in]	nType	Type of the chunk.
+ * @param[in]	pvData	Contents of the chunk.
+ * @param[in]	cbData	Size of the contents, in bytes.
+ *
+ * @returns HRESULT
+ */
+STATIC
+HRESULT
+png_WriteChunk(
+	_In_							HFILEWRITER	hWriter,
+	_In_							DWORD		nType,
+	_In_reads_bytes_opt_(cbData)	LPCVOID		pvData,
+	_In_							DWORD		cbData
+)
+{
+	BYTE				acLength[4];
+	BYTE				acType[4];
+	BYTE				acCrc[4];
+	DWORD				nCrc		= 0;
+	FILEWRITER_CHUNK	atChunks[4];
+
+	png_StoreBigEndian(acLength, cbData);
+	png_StoreBigEndian(acType, nType);
+
+	// The CRC covers the type and the contents, but not the length.
+	nCrc = png_UpdateCrc(MAXDWORD, acType, sizeof(acType));
+	nCrc = png_UpdateCrc(nCrc, pvData, cbData);
+	png_StoreBigEndian(acCrc, ~nCrc);
+
+	atChunks[0].pvData = acLength;
+	atChunks[0].cbData = sizeof(acLength);
+	atChunks[1].pvData = acType;
+	atChunks[1].cbData = sizeof(acType);
+	atChunks[2].pvData = pvData;
+	atChunks[2].cbData = cbData;
+	atChunks[3].pvData = acCrc;
+	atChunks[3].cbData = sizeof(acCrc);
+
+	return FILEWRITER_WriteGather(hWriter, atChunks, ARRAYSIZE(atChunks));
+}
+
+/**
+ * Deflate output callback.
+ * Wraps the compressed data in an IDAT chunk.
+ */
+STATIC
+HRESULT
+png_DeflateOutput(
+	_In_opt_					PVOID	pvContext,
+	_In_reads_bytes_(cbData)	LPCVOID	pvData,
+	_In_						DWORD	cbData
+)
+{
+	PCPNG_CONTEXT	ptContext	= (PCPNG_CONTEXT)pvContext;
+
+	assert(NULL != ptContext);
+
+	return png_WriteChunk(ptContext->hWriter, PNG_CHUNK_IDAT, pvData, cbData);
+}
+
+/**
+ * The Paeth predictor.
+ *
+ * @param[in]	nLeft		Byte to the left.
+ * @param[in]	nUp			Byte above.
+ * @param[in]	nUpLeft		Byte above and to the left.
+ *
+ * @returns The predicted byte.
+ */
+STATIC
+FORCEINLINE
+BYTE
+png_Paeth(
+	_In_	BYTE	nLeft,
+	_In_	BYTE	nUp,
+	_In_	BYTE	nUpLeft
+)
+{
+	INT	nEstimate		= 0;
+	INT	nDistanceLeft	= 0;
+	INT	nDistanceUp		= 0;
+	INT	nDistanceUpLeft	= 0;
+
+	nEstimate = (INT)nLeft + nUp - nUpLeft;
+	nDistanceLeft = abs(nEstimate - nLeft);
+	nDistanceUp = abs(nEstimate - nUp);
+	nDistanceUpLeft = abs(nEstimate - nUpLeft);
+
+	if ((nDistanceLeft <= nDistanceUp) && (nDistanceLeft <= nDistanceUpLeft))
+	{
+		return nLeft;
+	}
+	if (nDistanceUp <= nDistanceUpLeft)
+	{
+		return nUp;
+	}
+	return nUpLeft;
+}
+
+/**
+ * Applies a filter to the current row.
+ *
+ * @param[in]	ptContext	The PNG.
+ * @param[in]	eFilter		Filter to apply.
+ * @param[out]	pcFiltered	Will receive the filter type and the filtered row.
+ */
+STATIC
+VOID
+png_FilterRow(
+	_In_							PCPNG_CONTEXT	ptContext,
+	_In_							PNG_FILTER		eFilter,
+	_Out_writes_bytes_(cbRow + 1)	PBYTE			pcFiltered
+)
+{
+	CONST BYTE *	pcRow		= ptContext->pcCurrentRow;
+	CONST BYTE *	pcPrevious	= ptContext->pcPreviousRow;
+	DWORD			cbRow		= ptContext->cbRow;
+	DWORD			cbPixel		= ptContext->cbPixel;
+	PBYTE			pcOutput	= pcFiltered + 1;
+	DWORD			nIndex		= 0;
+#ifdef PNG_SSE2
+	__m128i			xmmRow;
+	__m128i			xmmOther;
+	__m128i			xmmAverage;
+#endif
+
+	pcFiltered[0] = (BYTE)eFilter;
+
+	// The first pixel has no left neighbour.
+	switch (eFilter)
+	{
+	case PNG_FILTER_NONE:
+		CopyMemory(pcOutput, pcRow, cbRow);
+		return;
+
+	case PNG_FILTER_SUB:
+		for (nIndex = 0; nIndex < cbPixel; ++nIndex)
+		{
+			pcOutput[nIndex] = pcRow[nIndex];
+		}
+#ifdef PNG_SSE2
+		if (ptContext->bUseSse2)
+		{
+			for (; nIndex + 16 <= cbRow; nIndex += 16)
+			{
+				xmmRow = _mm_loadu_si128((CONST __m128i *)&pcRow[nIndex]);
+				xmmOther = _mm_loadu_si128((CONST __m128i *)&pcRow[nIndex - cbPixel]);
+				_mm_storeu_si128((__m128i *)&pcOutput[nIndex], _mm_sub_epi8(xmmRow, xmmOther));
+			}
+		}
+#endif
+		for (; nIndex < cbRow; ++nIndex)
+		{
+			pcOutput[nIndex] = pcRow[nIndex] - pcRow[nIndex - cbPixel];
+		}
+		return;
+
+	case PNG_FILTER_UP:
+#ifdef PNG_SSE2
+		if (ptContext->bUseSse2)
+		{
+			for (; nIndex + 16 <= cbRow; nIndex += 16)
+			{
+				xmmRow = _mm_loadu_si128((CONST __m128i *)&pcRow[nIndex]);
+				xmmOther = _mm_loadu_si128((CONST __m128i *)&pcPrevious[nIndex]);
+				_mm_storeu_si128((__m128i *)&pcOutput[nIndex], _mm_sub_epi8(xmmRow, xmmOther));
+			}
+		}
+#endif
+		for (; nIndex < cbRow; ++nIndex)
+		{
+			pcOutput[nIndex] = pcRow[nIndex] - pcPrevious[nIndex];
+		}
+		return;
+
+	case PNG_FILTER_AVERAGE:
+		for (nIndex = 0; nIndex < cbPixel; ++nIndex)
+		{
+			pcOutput[nIndex] = pcRow[nIndex] - (pcPrevious[nIndex] >> 1);
+		}
+#ifdef PNG_SSE2
+		if (ptContext->bUseSse2)
+		{
+			for (; nIndex + 16 <= cbRow; nIndex += 16)
+			{
+				xmmRow = _mm_loadu_si128((CONST __m128i *)&pcRow[nIndex - cbPixel]);
+				xmmOther = _mm_loadu_si128((CONST __m128i *)&pcPrevious[nIndex]);
+
+				// _mm_avg_epu8 rounds up, while PNG rounds down.
+				xmmAverage = _mm_sub_epi8(_mm_avg_epu8(xmmRow, xmmOther),
+										  _mm_and_si128(_mm_xor_si128(xmmRow, xmmOther), _mm_set1_epi8(1)));
+
+				xmmRow = _mm_loadu_si128((CONST __m128i *)&pcRow[nIndex]);
+				_mm_storeu_si128((__m128i *)&pcOutput[nIndex], _mm_sub_epi8(xmmRow, xmmAverage));
+			}
+		}
+#endif
+		for (; nIndex < cbRow; ++nIndex)
+		{
+			pcOutput[nIndex] = pcRow[nIndex] - (BYTE)(((DWORD)pcRow[nIndex - cbPixel] + pcPrevious[nIndex]) >> 1);
+		}
+		return;
+
+	case PNG_FILTER_PAETH:
+		for (nIndex = 0; nIndex < cbPixel; ++nIndex)
+		{
+			pcOutput[nIndex] = pcRow[nIndex] - pcPrevious[nIndex];
+		}
+		for (; nIndex < cbRow; ++nIndex)
+		{
+			pcOutput[nIndex] = pcRow[nIndex] - png_Paeth(pcRow[nIndex - cbPixel],
+														 pcPrevious[nIndex],
+														 pcPrevious[nIndex - cbPixel]);
+		}
+		return;
+
+	default:
+		assert(FALSE);
+		return;
+	}
+}
+
+/**
+ * Scores a filtered row.
+ * Lower scores tend to compress better.
+ *
+ * @param[in]	ptContext	The PNG.
+ * @param[in]	pcFiltered	The filtered row, without the filter type.
+ *
+ * @returns The sum of the absolute values of the bytes, taken as signed.
+ */
+STATIC
+DWORD
+png_ScoreRow(
+	_In_								PCPNG_CONTEXT	ptContext,
+	_In_reads_bytes_(ptContext->cbRow)	CONST BYTE *	pcFiltered
+)
+{
+	DWORD	nScore	= 0;
+	DWORD	nIndex	= 0;
+#ifdef PNG_SSE2
+	__m128i	xmmBytes;
+	__m128i	xmmAbsolute;
+	__m128i	xmmSum		= _mm_setzero_si128();
+#endif
+
+#ifdef PNG_SSE2
+	if (ptContext->bUseSse2)
+	{
+		for (; nIndex + 16 <= ptContext->cbRow; nIndex += 16)
+		{
+			// |x| of a signed byte is the smaller of x and -x, taken as unsigned.
+			xmmBytes = _mm_loadu_si128((CONST __m128i *)&pcFiltered[nIndex]);
+			xmmAbsolute = _mm_min_epu8(xmmBytes, _mm_sub_epi8(_mm_setzero_si128(), xmmBytes));
+			xmmSum = _mm_add_epi64(xmmSum, _mm_sad_epu8(xmmAbsolute, _mm_setzero_si128()));
+		}
+		nScore = (DWORD)_mm_cvtsi128_si32(xmmSum) + (DWORD)_mm_cvtsi128_si32(_mm_srli_si128(xmmSum, 8));
+	}
+#endif
+
+	for (; nIndex < ptContext->cbRow; ++nIndex)
+	{
+		nScore += (DWORD)abs((CHAR)pcFiltered[nIndex]);
+	}
+
+	return nScore;
+}
+
+HRESULT
+PNG_Create(
+	_In_								HFILEWRITER			hWriter,
+	_In_								DWORD				nWidth,
+	_In_								DWORD				nHeight,
+	_In_								PNG_PIXEL_FORMAT	ePixelFormat,
+	_In_reads_opt_(nPaletteEntries)		CONST RGBQUAD *		atPalette,
+	_In_								DWORD				nPaletteEntries,
+	_In_								DWORD				nLevel,
+	_Out_								PHPNG				phPng
+)
+{
+	HRESULT			hrResult	= E_FAIL;
+	PPNG_CONTEXT	ptContext	= NULL;
+	PNG_IHDR		tHeader		= { 0 };
+	BYTE			acPalette[PNG_MAX_PALETTE_ENTRIES * 3];
+	DWORD			nEntry		= 0;
+
+	if ((NULL == hWriter) ||
+		(0 == nWidth) ||
+		(0 == nHeight) ||
+		(nWidth > MAXLONG) ||
+		(nHeight > MAXLONG) ||
+		(nLevel > DEFLATE_MAX_LEVEL) ||
+		(NULL == phPng))
+	{
+		hrResult = E_INVALIDARG;
+		goto lblCleanup;
+	}
+
+	ptContext = HEAPALLOC(sizeof(*ptContext));
+	if (NULL == ptContext)
+	{
+		hrResult = E_OUTOFMEMORY;
+		goto lblCleanup;
+	}
+
+	ptContext->hWriter = hWriter;
+	ptContext->ePixelFormat = ePixelFormat;
+	ptContext->nHeight = nHeight;
+
+	png_StoreBigEndian(tHeader.acWidth, nWidth);
+	png_StoreBigEndian(tHeader.acHeight, nHeight);
+
+	switch (ePixelFormat)
+	{
+	case PNG_PIXEL_FORMAT_BGRX32:
+		if (nWidth > MAXDWORD / 3)
+		{
+			hrResult = E_INVALIDARG;
+			goto lblCleanup;
+		}
+		ptContext->cbRow = nWidth * 3;
+		ptContext->cbPixel = 3;
+		tHeader.nBitDepth = 8;
+		tHeader.eColorType = PNG_COLOR_TYPE_TRUECOLOR;
+		break;
+
+	case PNG_PIXEL_FORMAT_INDEXED8:
+		ptContext->cbRow = nWidth;
+		ptContext->cbPixel = 1;
+		tHeader.nBitDepth = 8;
+		tHeader.eColorType = PNG_COLOR_TYPE_INDEXED;
+		break;
+
+	case PNG_PIXEL_FORMAT_INDEXED4:
+		ptContext->cbRow = (nWidth + 1) / 2;
+		ptContext->cbPixel = 1;
+		tHeader.nBitDepth = 4;
+		tHeader.eColorType = PNG_COLOR_TYPE_INDEXED;
+		break;
+
+	default:
+		hrResult = E_INVALIDARG;
+		goto lblCleanup;
+	}
+
+	if ((PNG_COLOR_TYPE_INDEXED == tHeader.eColorType) &&
+		((NULL == atPalette) ||
+		 (0 == nPaletteEntries) ||
+		 (nPaletteEntries > (1UL << tHeader.nBitDepth))))
+	{
+		hrResult = E_INVALIDARG;
+		goto lblCleanup;
+	}
+
+	// Allocate one extra byte per row, so that the filter type
+	// can be prepended to the filtered rows.
+	ptContext->pcPreviousRow = HEAPALLOC(ptContext->cbRow);
+	ptContext->pcCurrentRow = HEAPALLOC(ptContext->cbRow);
+	ptContext->pcBestRow = HEAPALLOC(ptContext->cbRow + 1);
+	ptContext->pcCandidateRow = HEAPALLOC(ptContext->cbRow + 1);
+	if ((NULL == ptContext->pcPreviousRow) ||
+		(NULL == ptContext->pcCurrentRow) ||
+		(NULL == ptContext->pcBestRow) ||
+		(NULL == ptContext->pcCandidateRow))
+	{
+		hrResult = E_OUTOFMEMORY;
+		goto lblCleanup;
+	}
+
+#ifdef PNG_SSE2
+#ifdef _M_X64
+	ptContext->bUseSse2 = TRUE;
+#else
+	ptContext->bUseSse2 = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+#endif
+#endif
+
+	hrResult = DEFLATE_Create(nLevel, &png_DeflateOutput, ptContext, &(ptContext->hDeflate));
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	hrResult = FILEWRITER_Write(hWriter, g_acPngSignature, sizeof(g_acPngSignature));
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	hrResult = png_WriteChunk(hWriter, PNG_CHUNK_IHDR, &tHeader, sizeof(tHeader));
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	if (PNG_COLOR_TYPE_INDEXED == tHeader.eColorType)
+	{
+		for (nEntry = 0; nEntry < nPaletteEntries; ++nEntry)
+		{
+			acPalette[nEntry * 3 + 0] = atPalette[nEntry].rgbRed;
+			acPalette[nEntry * 3 + 1] = atPalette[nEntry].rgbGreen;
+			acPalette[nEntry * 3 + 2] = atPalette[nEntry].rgbBlue;
+		}
+
+		hrResult = png_WriteChunk(hWriter, PNG_CHUNK_PLTE, acPalette, nPaletteEntries * 3);
+		if (FAILED(hrResult))
+		{
+			goto lblCleanup;
+		}
+	}
+
+	// Transfer ownership:
+	*phPng = (HPNG)ptContext;
+	ptContext = NULL;
+
+	hrResult = S_OK;
+
+lblCleanup:
+	if (NULL != ptContext)
+	{
+		PNG_Close((HPNG)ptContext);
+		ptContext = NULL;
+	}
+
+	return hrResult;
+}
+
+VOID
+PNG_Close(
+	_In_	HPNG	hPng
+)
+{
+	PPNG_CONTEXT	ptContext	= (PPNG_CONTEXT)hPng;
+
+	if (NULL == hPng)
+	{
+		goto lblCleanup;
+	}
+
+	CLOSE(ptContext->hDeflate, DEFLATE_Close);
+	HEAPFREE(ptContext->pcCandidateRow);
+	HEAPFREE(ptContext->pcBestRow);
+	HEAPFREE(ptContext->pcCurrentRow);
+	HEAPFREE(ptContext->pcPreviousRow);
+	HEAPFREE(ptContext);
+
+lblCleanup:
+	return;
+}
+
+HRESULT
+PNG_WriteRow(
+	_In_	HPNG	hPng,
+	_In_	LPCVOID	pvRow
+)
+{
+	HRESULT			hrResult	= E_FAIL;
+	PPNG_CONTEXT	ptContext	= (PPNG_CONTEXT)hPng;
+	CONST BYTE *	pcPixel		= (CONST BYTE *)pvRow;
+	DWORD			nIndex		= 0;
+	PNG_FILTER		eFilter		= PNG_FILTER_NONE;
+	DWORD			nScore		= 0;
+	DWORD			nBestScore	= MAXDWORD;
+	PBYTE			pcSwap		= NULL;
+
+	if ((NULL == hPng) ||
+		(NULL == pvRow))
+	{
+		hrResult = E_INVALIDARG;
+		goto lblCleanup;
+	}
+
+	if (ptContext->nRowsWritten == ptContext->nHeight)
+	{
+		hrResult = E_UNEXPECTED;
+		goto lblCleanup;
+	}
+
+	if (PNG_PIXEL_FORMAT_BGRX32 == ptContext->ePixelFormat)
+	{
+		for (nIndex = 0; nIndex < ptContext->cbRow; nIndex += 3)
+		{
+			ptContext->pcCurrentRow[nIndex + 0] = pcPixel[2];
+			ptContext->pcCurrentRow[nIndex + 1] = pcPixel[1];
+			ptContext->pcCurrentRow[nIndex + 2] = pcPixel[0];
+			pcPixel += 4;
+		}
+	}
+	else
+	{
+		CopyMemory(ptContext->pcCurrentRow, pvRow, ptContext->cbRow);
+	}
+
+	// Try every filter, and keep the best one.
+	for (eFilter = PNG_FILTER_NONE; eFilter < PNG_FILTER_COUNT; ++eFilter)
+	{
+		png_FilterRow(ptContext, eFilter, ptContext->pcCandidateRow);
+
+		nScore = png_ScoreRow(ptContext, ptContext->pcCandidateRow + 1);
+		if (nScore < nBestScore)
+		{
+			nBestScore = nScore;
+
+			pcSwap = ptContext->pcBestRow;
+			ptContext->pcBestRow = ptContext->pcCandidateRow;
+			ptContext->pcCandidateRow = pcSwap;
+
+			if (0 == nScore)
+			{
+				break;
+			}
+		}
+	}
+
+	hrResult = DEFLATE_Write(ptContext->hDeflate, ptContext->pcBestRow, ptContext->cbRow + 1);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	pcSwap = ptContext->pcPreviousRow;
+	ptContext->pcPreviousRow = ptContext->pcCurrentRow;
+	ptContext->pcCurrentRow = pcSwap;
+
+	++(ptContext->nRowsWritten);
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
+
+HRESULT
+PNG_Finish(
+	_In_	HPNG	hPng
+)
+{
+	HRESULT			hrResult	= E_FAIL;
+	PPNG_CONTEXT	ptContext	= (PPNG_CONTEXT)hPng;
+
+	if (NULL == hPng)
+	{
+		hrResult = E_INVALIDARG;
+		goto lblCleanup;
+	}
+
+	if (ptContext->nRowsWritten != ptContext->nHeight)
+	{
+		hrResult = E_UNEXPECTED;
+		goto lblCleanup;
+	}
+
+	hrResult = DEFLATE_Finish(ptContext->hDeflate);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	hrResult = png_WriteChunk(ptContext->hWriter, PNG_CHUNK_IEND, NULL, 0);
+	if (FAILED(hrResult))
+	{
+		goto lblCleanup;
+	}
+
+	hrResult = S_OK;
+
+lblCleanup:
+	return hrResult;
+}
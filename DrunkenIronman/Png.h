@@ -0,0 +1,108 @@
+/**
+ * @file Png.h
+ * @author biko
+ * @date 2026-10-17
+ *
+ * Png module public header.
+ * Contains a streaming PNG encoder.
+ */
+#pragma once
+
+/** Headers *************************************************************/
+#include <Windows.h>
+
+#include "FileWriter.h"
+
+
+/** Enums ***************************************************************/
+
+/**
+ * Formats of the rows passed to PNG_WriteRow.
+ */
+typedef enum _PNG_PIXEL_FORMAT
+{
+	// 32 bits per pixel, blue first, the 4th byte ignored.
+	// Encoded as 24-bit truecolour.
+	PNG_PIXEL_FORMAT_BGRX32 = 0,
+
+	// 8-bit palette indices.
+	PNG_PIXEL_FORMAT_INDEXED8,
+
+	// 4-bit palette indices, two per byte, leftmost pixel in the high nibble.
+	PNG_PIXEL_FORMAT_INDEXED4,
+} PNG_PIXEL_FORMAT, *PPNG_PIXEL_FORMAT;
+
+
+/** Typedefs ************************************************************/
+
+/**
+ * Handle to a PNG being written.
+ */
+DECLARE_HANDLE(HPNG);
+typedef HPNG *PHPNG;
+
+
+/** Functions ***********************************************************/
+
+/**
+ * Starts writing a PNG.
+ *
+ * @param[in]	hWriter			Output file.
+ * @param[in]	nWidth			Width of the image, in pixels.
+ * @param[in]	nHeight			Height of the image, in pixels.
+ * @param[in]	ePixelFormat	Format of the rows.
+ * @param[in]	atPalette		The palette, for indexed formats.
+ * @param[in]	nPaletteEntries	Number of palette entries.
+ * @param[in]	nLevel			Deflate compression level.
+ * @param[out]	phPng			Will receive a handle to the PNG.
+ *
+ * @returns HRESULT
+ */
+HRESULT
+PNG_Create(
+	_In_							HFILEWRITER			hWriter,
+	_In_							DWORD				nWidth,
+	_In_							DWORD				nHeight,
+	_In_							PNG_PIXEL_FORMAT	ePixelFormat,
+	_In_reads_opt_(nPaletteEntries)	CONST RGBQUAD *		atPalette,
+	_In_							DWORD				nPaletteEntries,
+	_In_							DWORD				nLevel,
+	_Out_							PHPNG				phPng
+);
+
+/**
+ * Releases a PNG.
+ * Does not close the output file.
+ *
+ * @param[in]	hPng	PNG to release.
+ */
+VOID
+PNG_Close(
+	_In_	HPNG	hPng
+);
+
+/**
+ * Writes the next row of the image, top to bottom.
+ *
+ * @param[in]	hPng	The PNG.
+ * @param[in]	pvRow	The row, in the format given to PNG_Create.
+ *
+ * @returns HRESULT
+ */
+HRESULT
+PNG_WriteRow(
+	_In_	HPNG	hPng,
+	_In_	LPCVOID	pvRow
+);
+
+/**
+ * Completes the PNG, once all rows have been written.
+ *
+ * @param[in]	hPng	The PNG.
+ *
+ * @returns HRESULT
+ */
+HRESULT
+PNG_Finish(
+	_In_	HPNG	hPng
+);
@@ -0,0 +1,296 @@
+/**
+ * @file VgaPlanes.c
+ * @author biko
+ * @date 2026-10-17
+ *
+ * VgaPlanes module implementation.
+ */
+
+/** Headers *************************************************************/
+#include <Windows.h>
+#include <assert.h>
+#include <string.h>
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#define VGAPLANES_SSE2
+#endif
+
+#include <Drink.h>
+
+#include "VgaPlanes.h"
+
+
+/** Constants ***********************************************************/
+
+/**
+ * Spreads the 8 bits of a plane byte over 8 packed pixels.
+ * Bit 7 (the leftmost pixel) lands in bit 4 of the result, bit 6 in bit 0,
+ * bit 5 in bit 12, and so on, so that the result read as a little-endian
+ * DWORD holds the 8 pixels in order, one per nibble.
+ * Shifting the result left by n places the bits in plane n's position.
+ */
+STATIC CONST DWORD g_anPlaneSpread[256] = {
+	0x00000000, 0x01000000, 0x10000000, 0x11000000, 0x00010000, 0x01010000, 0x10010000, 0x11010000,
+	0x00100000, 0x01100000, 0x10100000, 0x11100000, 0x00110000, 0x01110000, 0x10110000, 0x11110000,
+	0x00000100, 0x01000100, 0x10000100, 0x11000100, 0x00010100, 0x01010100, 0x10010100, 0x11010100,
+	0x00100100, 0x01100100, 0x10100100, 0x11100100, 0x00110100, 0x01110100, 0x10110100, 0x11110100,
+	0x00001000, 0x01001000, 0x10001000, 0x11001000, 0x00011000, 0x01011000, 0x10011000, 0x11011000,
+	0x00101000, 0x01101000, 0x10101000, 0x11101000, 0x00111000, 0x01111000, 0x10111000, 0x11111000,
+	0x00001100, 0x01001100, 0x10001100, 0x11001100, 0x00011100, 0x01011100, 0x10011100, 0x11011100,
+	0x00101100, 0x01101100, 0x10101100, 0x11101100, 0x00111100, 0x01111100, 0x10111100, 0x11111100,
+	0x00000001, 0x01000001, 0x10000001, 0x11000001, 0x00010001, 0x01010001, 0x10010001, 0x11010001,
+	0x00100001, 0x01100001, 0x10100001, 0x11100001, 0x00110001, 0x01110001, 0x10110001, 0x11110001,
+	0x00000101, 0x01000101, 0x10000101, 0x11000101, 0x00010101, 0x01010101, 0x10010101, 0x11010101,
+	0x00100101, 0x01100101, 0x10100101, 0x11100101, 0x00110101, 0x01110101, 0x10110101, 0x11110101,
+	0x00001001, 0x01001001, 0x10001001, 0x11001001, 0x00011001, 0x01011001, 0x10011001, 0x11011001,
+	0x00101001, 0x01101001, 0x10101001, 0x11101001, 0x00111001, 0x01111001, 0x10111001, 0x11111001,
+	0x00001101, 0x01001101, 0x10001101, 0x11001101, 0x00011101, 0x01011101, 0x10011101, 0x11011101,
+	0x00101101, 0x01101101, 0x10101101, 0x11101101, 0x00111101, 0x01111101, 0x10111101, 0x11111101,
+	0x00000010, 0x01000010, 0x10000010, 0x11000010, 0x00010010, 0x01010010, 0x10010010, 0x11010010,
+	0x00100010, 0x01100010, 0x10100010, 0x11100010, 0x00110010, 0x01110010, 0x10110010, 0x11110010,
+	0x00000110, 0x01000110, 0x10000110, 0x11000110, 0x00010110, 0x01010110, 0x10010110, 0x11010110,
+	0x00100110, 0x01100110, 0x10100110, 0x11100110, 0x00110110, 0x01110110, 0x10110110, 0x11110110,
+	0x00001010, 0x01001010, 0x10001010, 0x11001010, 0x00011010, 0x01011010, 0x10011010, 0x11011010,
+	0x00101010, 0x01101010, 0x10101010, 0x11101010, 0x00111010, 0x01111010, 0x10111010, 0x11111010,
+	0x00001110, 0x01001110, 0x10001110, 0x11001110, 0x00011110, 0x01011110, 0x10011110, 0x11011110,
+	0x00101110, 0x01101110, 0x10101110, 0x11101110, 0x00111110, 0x01111110, 0x10111110, 0x11111110,
+	0x00000011, 0x01000011, 0x10000011, 0x11000011, 0x00010011, 0x01010011, 0x10010011, 0x11010011,
+	0x00100011, 0x01100011, 0x10100011, 0x11100011, 0x00110011, 0x01110011, 0x10110011, 0x11110011,
+	0x00000111, 0x01000111, 0x10000111, 0x11000111, 0x00010111, 0x01010111, 0x10010111, 0x11010111,
+	0x00100111, 0x01100111, 0x10100111, 0x11100111, 0x00110111, 0x01110111, 0x10110111, 0x11110111,
+	0x00001011, 0x01001011, 0x10001011, 0x11001011, 0x00011011, 0x01011011, 0x10011011, 0x11011011,
+	0x00101011, 0x01101011, 0x10101011, 0x11101011, 0x00111011, 0x01111011, 0x10111011, 0x11111011,
+	0x00001111, 0x01001111, 0x10001111, 0x11001111, 0x00011111, 0x01011111, 0x10011111, 0x11011111,
+	0x00101111, 0x01101111, 0x10101111, 0x11101111, 0x00111111, 0x01111111, 0x10111111, 0x11111111
+};
+
+
+/**
+ * Number of bytes taken from each plane by a single
+ * iteration of the SSE2 kernel.
+ */
+#define VGAPLANES_SSE2_BLOCK_SIZE (16)
+
+
+/** Functions ***********************************************************/
+
+/**
+ * Converts pixels from the four VGA planes to 4 bits per pixel,
+ * one plane byte at a time.
+ *
+ * @param[in]	apcPlanes		The planes to convert.
+ * @param[in]	cbPlaneBytes	Number of bytes to convert from each plane.
+ * @param[out]	pcPacked		Will receive the pixels.
+ *
+ * @see VGAPLANES_PlanarToPacked
+ */
+STATIC
+VOID
+vgaplanes_PlanarToPackedScalar(
+	_In_reads_(VGA_PLANES)						CONST BYTE * CONST *	apcPlanes,
+	_In_										DWORD					cbPlaneBytes,
+	_Out_writes_bytes_all_(cbPlaneBytes * 4)	PBYTE					pcPacked
+)
+{
+	DWORD	nByte	= 0;
+	DWORD	nPixels	= 0;
+
+	C_ASSERT(4 == VGA_PLANES);
+
+	for (nByte = 0; nByte < cbPlaneBytes; ++nByte)
+	{
+		nPixels = g_anPlaneSpread[apcPlanes[0][nByte]] |
+				  (g_anPlaneSpread[apcPlanes[1][nByte]] << 1) |
+				  (g_anPlaneSpread[apcPlanes[2][nByte]] << 2) |
+				  (g_anPlaneSpread[apcPlanes[3][nByte]] << 3);
+
+		pcPacked[0] = (BYTE)(nPixels);
+		pcPacked[1] = (BYTE)(nPixels >> 8);
+		pcPacked[2] = (BYTE)(nPixels >> 16);
+		pcPacked[3] = (BYTE)(nPixels >> 24);
+		pcPacked += 4;
+	}
+}
+
+#ifdef VGAPLANES_SSE2
+
+/**
+ * Exchanges the bits selected by a mask with the bits
+ * a fixed distance above them, in each DWORD.
+ *
+ * @param[in]	xmmValue	The DWORDs.
+ * @param[in]	nDelta		Distance between the exchanged bits.
+ * @param[in]	xmmMask		Selects the lower bit of each exchanged pair.
+ *
+ * @returns The DWORDs, with the bits exchanged.
+ */
+STATIC
+FORCEINLINE
+__m128i
+vgaplanes_DeltaSwap(
+	_In_	__m128i	xmmValue,
+	_In_	INT		nDelta,
+	_In_	__m128i	xmmMask
+)
+{
+	__m128i	xmmChanged;
+
+	xmmChanged = _mm_and_si128(_mm_xor_si128(_mm_srli_epi32(xmmValue, nDelta), xmmValue), xmmMask);
+
+	return _mm_xor_si128(xmmValue, _mm_xor_si128(xmmChanged, _mm_slli_epi32(xmmChanged, nDelta)));
+}
+
+/**
+ * Transposes four DWORDs, each holding a byte from every plane
+ * (plane 0 in the low byte), into the packed pixels of those bytes.
+ *
+ * Bit b of plane j sits at bit 8j + b, and has to end up in bit j
+ * of the nibble holding pixel 7 - b. Viewing the bit's index as
+ * (j1 j0 h1 h0 l), where b = 2h + l, its destination is (~h1 ~h0 l j1 j0),
+ * which takes four exchanges of index bits. All but one of them
+ * also complement the bits they exchange.
+ *
+ * @param[in]	xmmPlanes	The plane bytes.
+ *
+ * @returns The pixels.
+ */
+STATIC
+FORCEINLINE
+__m128i
+vgaplanes_TransposeSse2(
+	_In_	__m128i	xmmPlanes
+)
+{
+	// (j1 j0 h1 h0 l) -> (~h1 j0 ~j1 h0 l)
+	xmmPlanes = vgaplanes_DeltaSwap(xmmPlanes, 20, _mm_set1_epi32(0x00000F0F));
+
+	// -> (~h1 ~h0 ~j1 ~j0 l)
+	xmmPlanes = vgaplanes_DeltaSwap(xmmPlanes, 10, _mm_set1_epi32(0x00330033));
+
+	// -> (~h1 ~h0 l ~j0 ~j1)
+	xmmPlanes = vgaplanes_DeltaSwap(xmmPlanes, 3, _mm_set1_epi32(0x0A0A0A0A));
+
+	// -> (~h1 ~h0 l j1 j0)
+	return vgaplanes_DeltaSwap(xmmPlanes, 3, _mm_set1_epi32(0x11111111));
+}
+
+/**
+ * Converts pixels from the four VGA planes to 4 bits per pixel,
+ * VGAPLANES_SSE2_BLOCK_SIZE plane bytes at a time.
+ *
+ * @param[in]	apcPlanes		The planes to convert.
+ * @param[in]	cbPlaneBytes	Number of bytes to convert from each plane.
+ *								Must be a multiple of VGAPLANES_SSE2_BLOCK_SIZE.
+ * @param[out]	pcPacked		Will receive the pixels.
+ *
+ * @see VGAPLANES_PlanarToPacked
+ */
+STATIC
+VOID
+vgaplanes_PlanarToPackedSse2(
+	_In_reads_(VGA_PLANES)						CONST BYTE * CONST *	apcPlanes,
+	_In_										DWORD					cbPlaneBytes,
+	_Out_writes_bytes_all_(cbPlaneBytes * 4)	PBYTE					pcPacked
+)
+{
+	DWORD			nByte		= 0;
+	__m128i			xmmPlane0;
+	__m128i			xmmPlane1;
+	__m128i			xmmPlane2;
+	__m128i			xmmPlane3;
+	__m128i			xmmLow01;
+	__m128i			xmmLow23;
+	__m128i			xmmHigh01;
+	__m128i			xmmHigh23;
+#ifdef _DEBUG
+	BYTE			acExpected[VGAPLANES_SSE2_BLOCK_SIZE * 4];
+	CONST BYTE *	apcBlock[VGA_PLANES];
+#endif
+
+	C_ASSERT(4 == VGA_PLANES);
+
+	assert(0 == cbPlaneBytes % VGAPLANES_SSE2_BLOCK_SIZE);
+
+	for (nByte = 0; nByte < cbPlaneBytes; nByte += VGAPLANES_SSE2_BLOCK_SIZE)
+	{
+		xmmPlane0 = _mm_loadu_si128((CONST __m128i *)&apcPlanes[0][nByte]);
+		xmmPlane1 = _mm_loadu_si128((CONST __m128i *)&apcPlanes[1][nByte]);
+		xmmPlane2 = _mm_loadu_si128((CONST __m128i *)&apcPlanes[2][nByte]);
+		xmmPlane3 = _mm_loadu_si128((CONST __m128i *)&apcPlanes[3][nByte]);
+
+		// Gather the bytes of all the planes at each offset into a single DWORD.
+		xmmLow01 = _mm_unpacklo_epi8(xmmPlane0, xmmPlane1);
+		xmmLow23 = _mm_unpacklo_epi8(xmmPlane2, xmmPlane3);
+		xmmHigh01 = _mm_unpackhi_epi8(xmmPlane0, xmmPlane1);
+		xmmHigh23 = _mm_unpackhi_epi8(xmmPlane2, xmmPlane3);
+
+		_mm_storeu_si128((__m128i *)&pcPacked[0],
+						 vgaplanes_TransposeSse2(_mm_unpacklo_epi16(xmmLow01, xmmLow23)));
+		_mm_storeu_si128((__m128i *)&pcPacked[16],
+						 vgaplanes_TransposeSse2(_mm_unpackhi_epi16(xmmLow01, xmmLow23)));
+		_mm_storeu_si128((__m128i *)&pcPacked[32],
+						 vgaplanes_TransposeSse2(_mm_unpacklo_epi16(xmmHigh01, xmmHigh23)));
+		_mm_storeu_si128((__m128i *)&pcPacked[48],
+						 vgaplanes_TransposeSse2(_mm_unpackhi_epi16(xmmHigh01, xmmHigh23)));
+
+#ifdef _DEBUG
+		// The kernels must agree bit for bit.
+		apcBlock[0] = &apcPlanes[0][nByte];
+		apcBlock[1] = &apcPlanes[1][nByte];
+		apcBlock[2] = &apcPlanes[2][nByte];
+		apcBlock[3] = &apcPlanes[3][nByte];
+		vgaplanes_PlanarToPackedScalar(apcBlock, VGAPLANES_SSE2_BLOCK_SIZE, acExpected);
+		assert(0 == memcmp(acExpected, pcPacked, sizeof(acExpected)));
+#endif
+
+		pcPacked += VGAPLANES_SSE2_BLOCK_SIZE * 4;
+	}
+}
+
+#endif // VGAPLANES_SSE2
+
+
+VOID
+VGAPLANES_PlanarToPacked(
+	_In_										PCVGA_DUMP	ptDump,
+	_In_										DWORD		nFirstByte,
+	_In_										DWORD		cbPlaneBytes,
+	_Out_writes_bytes_all_(cbPlaneBytes * 4)	PBYTE		pcPacked
+)
+{
+	CONST BYTE *	apcPlanes[VGA_PLANES];
+	DWORD			nPlane		= 0;
+	DWORD			cbVector	= 0;
+
+	assert(NULL != ptDump);
+	assert(NULL != pcPacked);
+	assert(nFirstByte <= sizeof(ptDump->atPlanes[0]));
+	assert(cbPlaneBytes <= sizeof(ptDump->atPlanes[0]) - nFirstByte);
+
+	for (nPlane = 0; nPlane < ARRAYSIZE(apcPlanes); ++nPlane)
+	{
+		apcPlanes[nPlane] = &ptDump->atPlanes[nPlane][nFirstByte];
+	}
+
+#ifdef VGAPLANES_SSE2
+#ifdef _M_X64
+	cbVector = cbPlaneBytes - cbPlaneBytes % VGAPLANES_SSE2_BLOCK_SIZE;
+#else
+	if (IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+	{
+		cbVector = cbPlaneBytes - cbPlaneBytes % VGAPLANES_SSE2_BLOCK_SIZE;
+	}
+#endif
+
+	vgaplanes_PlanarToPackedSse2(apcPlanes, cbVector, pcPacked);
+
+	for (nPlane = 0; nPlane < ARRAYSIZE(apcPlanes); ++nPlane)
+	{
+		apcPlanes[nPlane] += cbVector;
+	}
+#endif
+
+	// Whatever is left is converted one byte at a time.
+	vgaplanes_PlanarToPackedScalar(apcPlanes, cbPlaneBytes - cbVector, pcPacked + cbVector * 4);
+}
@@ -0,0 +1,50 @@
+/**
+ * @file VgaPlanes.h
+ * @author biko
+ * @date 2026-10-17
+ *
+ * VgaPlanes module public header.
+ * Contains routines for converting planar VGA memory to packed pixels.
+ */
+#pragma once
+
+/** Headers *************************************************************/
+#include <Windows.h>
+
+#include <Drink.h>
+
+
+/** Constants ***********************************************************/
+
+/**
+ * Number of bytes in each plane holding a single screen row.
+ */
+#define VGAPLANES_PLANE_BYTES_PER_ROW (SCREEN_WIDTH_PIXELS / PIXELS_IN_BYTE)
+
+/**
+ * Number of bytes holding a single screen row, at 4 bits per pixel.
+ */
+#define VGAPLANES_PACKED_BYTES_PER_ROW (SCREEN_WIDTH_PIXELS / 2)
+
+
+/** Functions ***********************************************************/
+
+/**
+ * Converts pixels from the four VGA planes to 4 bits per pixel.
+ * Plane n supplies bit n of each pixel, and the leftmost pixel
+ * of each output byte is in its high nibble.
+ *
+ * @param[in]	ptDump			The planes to convert.
+ * @param[in]	nFirstByte		Offset in each plane of the first byte to convert.
+ * @param[in]	cbPlaneBytes	Number of bytes to convert from each plane.
+ *								Each byte holds 8 pixels.
+ * @param[out]	pcPacked		Will receive the pixels.
+ *								Must be 4 * cbPlaneBytes bytes long.
+ */
+VOID
+VGAPLANES_PlanarToPacked(
+	_In_										PCVGA_DUMP	ptDump,
+	_In_										DWORD		nFirstByte,
+	_In_										DWORD		cbPlaneBytes,
+	_Out_writes_bytes_all_(cbPlaneBytes * 4)	PBYTE		pcPacked
+);
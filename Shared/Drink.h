@@ -36,6 +36,12 @@ C_ASSERT(PIXELS_IN_BYTE == 8);
  */
 #define VGA_DAC_PALETTE_ENTRIES (256)
 
+/**
+ * Number of DAC palette entries used by 16-colour modes,
+ * like that of the bugcheck screen.
+ */
+#define VGA_16_COLOR_PALETTE_ENTRIES (16)
+
 /**
  * {ab490092-9446-4088-901b-b6a801cd6c75}
  * GUID for tagging the saved VGA dump in the dump file.
@@ -50,6 +56,78 @@ EXTERN_C CONST GUID DECLSPEC_SELECTANY g_tVgaDumpGuid =
 EXTERN_C CONST GUID DECLSPEC_SELECTANY g_tFramebufferDumpGuid = 
 { 0x80aeec5f, 0xde92, 0x435d, { 0x9a, 0x5, 0xd2, 0x3e, 0xca, 0xd9, 0x27, 0x2e } };
 
+/**
+ * {6A07074E-7153-47E0-A73C-79236310B8C4}
+ * GUID for tagging the saved framebuffer dump in the dump file,
+ * when it is stored as a FRAMEBUFFER_DUMP_EX.
+ */
+EXTERN_C CONST GUID DECLSPEC_SELECTANY g_tFramebufferDumpExGuid =
+{ 0x6a07074e, 0x7153, 0x47e0, { 0xa7, 0x3c, 0x79, 0x23, 0x63, 0x10, 0xb8, 0xc4 } };
+
+/**
+ * Maximal number of displays whose framebuffers are dumped.
+ * Each display's number has to fit in the last byte of its tag.
+ */
+#define FRAMEBUFFER_MAX_DISPLAYS (64)
+C_ASSERT(FRAMEBUFFER_MAX_DISPLAYS <= 0x100);
+
+/**
+ * {DA4D367D-93EA-4ED6-B97A-40CB1D5D3900}
+ * GUID for tagging the saved framebuffer dumps of all displays but the first
+ * in the dump file. The last byte holds the number of the display.
+ */
+EXTERN_C CONST GUID DECLSPEC_SELECTANY g_tFramebufferDisplayDumpGuid =
+{ 0xda4d367d, 0x93ea, 0x4ed6, { 0xb9, 0x7a, 0x40, 0xcb, 0x1d, 0x5d, 0x39, 0x00 } };
+
+/**
+ * {2E6B1F0C-8A57-4D93-B1C4-7F0E35A9D862}
+ * GUID for tagging the saved history of the screen in the dump file.
+ */
+EXTERN_C CONST GUID DECLSPEC_SELECTANY g_tFramebufferHistoryGuid =
+{ 0x2e6b1f0c, 0x8a57, 0x4d93, { 0xb1, 0xc4, 0x7f, 0x0e, 0x35, 0xa9, 0xd8, 0x62 } };
+
+/**
+ * Current version of the FRAMEBUFFER_DUMP_EX structure.
+ */
+#define FRAMEBUFFER_DUMP_EX_VERSION (1)
+
+/**
+ * Width and height of a tile of a framebuffer dump, in pixels.
+ */
+#define FRAMEBUFFER_TILE_SIZE (64)
+
+/**
+ * Number of pixels in a tile.
+ */
+#define FRAMEBUFFER_TILE_PIXELS (FRAMEBUFFER_TILE_SIZE * FRAMEBUFFER_TILE_SIZE)
+
+/**
+ * Number of tiles needed to cover a number of pixels.
+ */
+#define FRAMEBUFFER_TILES(nPixels) \
+	((nPixels) / FRAMEBUFFER_TILE_SIZE + (0 != (nPixels) % FRAMEBUFFER_TILE_SIZE))
+
+/**
+ * Signature of a BUGSHOT_STATISTICS structure,
+ * which tells whether the tagged data ends with one.
+ */
+#define BUGSHOT_STATISTICS_SIGNATURE ('tSgB')
+
+/**
+ * Current version of the FRAMEBUFFER_HISTORY structure.
+ */
+#define FRAMEBUFFER_HISTORY_VERSION (1)
+
+/**
+ * Maximal number of frames kept in the history of the screen.
+ */
+#define FRAMEBUFFER_MAX_HISTORY_FRAMES (512)
+
+/**
+ * Alignment of the frames in the history of the screen, in bytes.
+ */
+#define FRAMEBUFFER_FRAME_ALIGNMENT (8)
+
 /**
  * Name of the Drink control device.
  */
@@ -63,8 +141,14 @@ EXTERN_C CONST GUID DECLSPEC_SELECTANY g_tFramebufferDumpGuid =
 /**
  * IOCTL for setting-up a bugcheck screenshot.
  *
- * Input:	None.
+ * Input:	BUGSHOT_PARAMETERS structure.
  * Output:	None.
+ *
+ * Once the framebuffers are hooked (Windows 10+), issuing the IOCTL again
+ * only resizes the captured image. nHistoryFrames must then match the
+ * value the screenshot was set up with, or STATUS_ALREADY_COMMITTED
+ * is returned. On earlier systems, issuing it again always returns
+ * STATUS_ALREADY_COMMITTED.
  */
 #define IOCTL_DRINK_BUGSHOT \
 	(CTL_CODE(DRINK_DEVICE_TYPE, 0x800, METHOD_BUFFERED, FILE_ANY_ACCESS))
@@ -150,9 +234,204 @@ typedef struct _FRAMEBUFFER_DUMP
 } FRAMEBUFFER_DUMP, *PFRAMEBUFFER_DUMP;
 typedef FRAMEBUFFER_DUMP CONST *PCFRAMEBUFFER_DUMP;
 
+/**
+ * Ways in which the pixels of a FRAMEBUFFER_DUMP_EX can be stored.
+ */
+typedef enum _FRAMEBUFFER_COMPRESSION
+{
+	// The pixels are stored as is.
+	FRAMEBUFFER_COMPRESSION_NONE = 0,
+
+	// Only the tiles that were given room in the driver's tile pool are stored,
+	// in pool order, each a full tile row by row, and compressed with
+	// RLE_CompressPixels. A FRAMEBUFFER_TILE for each tile of the framebuffer,
+	// in raster order, follows the compressed pixels.
+	FRAMEBUFFER_COMPRESSION_RLE_TILE_POOL,
+} FRAMEBUFFER_COMPRESSION, *PFRAMEBUFFER_COMPRESSION;
+
+/**
+ * What is known about a tile of a framebuffer dump.
+ */
+typedef enum _FRAMEBUFFER_TILE_STATE
+{
+	// Nothing was drawn on the tile.
+	FRAMEBUFFER_TILE_STATE_CLEAN = 0,
+
+	// The tile is a single colour, stored in the tile's nValue.
+	FRAMEBUFFER_TILE_STATE_SOLID,
+
+	// The tile's pixels are stored in the tile pool,
+	// at the index stored in the tile's nValue.
+	FRAMEBUFFER_TILE_STATE_POOLED,
+
+	// The tile was drawn on, but the tile pool had no more room.
+	FRAMEBUFFER_TILE_STATE_DROPPED,
+} FRAMEBUFFER_TILE_STATE, *PFRAMEBUFFER_TILE_STATE;
+
+/**
+ * Directory entry of a single tile of a framebuffer dump.
+ */
+typedef struct _FRAMEBUFFER_TILE
+{
+	// One of FRAMEBUFFER_TILE_STATE.
+	ULONG	eState;
+
+	// Depends on the state.
+	ULONG	nValue;
+} FRAMEBUFFER_TILE, *PFRAMEBUFFER_TILE;
+typedef FRAMEBUFFER_TILE CONST *PCFRAMEBUFFER_TILE;
+
+/**
+ * A framebuffer dump, possibly compressed.
+ */
+typedef struct _FRAMEBUFFER_DUMP_EX
+{
+	// FRAMEBUFFER_DUMP_EX_VERSION.
+	ULONG				nVersion;
+
+	// One of FRAMEBUFFER_COMPRESSION.
+	ULONG				eCompression;
+
+	// Size of the stored pixel data, in bytes.
+	// Doesn't include the tile directory.
+	ULONG				cbPixels;
+
+	FRAMEBUFFER_DUMP	tDump;
+} FRAMEBUFFER_DUMP_EX, *PFRAMEBUFFER_DUMP_EX;
+typedef FRAMEBUFFER_DUMP_EX CONST *PCFRAMEBUFFER_DUMP_EX;
+
+/**
+ * What taking a screenshot cost, while the system was crashing.
+ * Appended to the tagged data of a VGA_DUMP or a FRAMEBUFFER_DUMP_EX,
+ * not necessarily aligned.
+ *
+ * Cycles are counted with the processor's time stamp counter.
+ */
+typedef struct _BUGSHOT_STATISTICS
+{
+	// BUGSHOT_STATISTICS_SIGNATURE.
+	ULONG		nSignature;
+
+	// Number of times the screen was drawn on,
+	// and how many of them fell partly or wholly outside the screenshot.
+	ULONG		nBlits;
+	ULONG		nClippedBlits;
+
+	// Number of times the bugcheck callback was invoked.
+	ULONG		nCallbacks;
+
+	// Pixel bytes copied into the screenshot,
+	// and the cycles it took to copy them.
+	ULONGLONG	cbCopied;
+	ULONGLONG	nCopyCycles;
+
+	// Cycles spent in the bugcheck callback.
+	ULONGLONG	nCallbackCycles;
+} BUGSHOT_STATISTICS, *PBUGSHOT_STATISTICS;
+typedef BUGSHOT_STATISTICS CONST *PCBUGSHOT_STATISTICS;
+
+/**
+ * A single drawing on the screen, kept in the history of the screen.
+ */
+typedef struct _FRAMEBUFFER_FRAME
+{
+	// Size of the frame, including the tokens and the padding after them,
+	// in bytes. A multiple of FRAMEBUFFER_FRAME_ALIGNMENT.
+	ULONG		cbFrame;
+
+	// Number of frames drawn before this one.
+	ULONG		nSequence;
+
+	// When the frame was drawn, in ticks of the history's nFrequency.
+	ULONGLONG	nTimestamp;
+
+	// Number of the display that was drawn on.
+	ULONG		nDisplay;
+
+	// The drawn rectangle, in pixels.
+	ULONG		nLeft;
+	ULONG		nTop;
+	ULONG		nWidth;
+	ULONG		nHeight;
+
+	// Number of rows stored, from the top. The rest didn't fit.
+	ULONG		nStoredRows;
+
+	// Size of the stored rows, compressed with RLE_EncodePixels, in bytes.
+	ULONG		cbTokens;
+	UCHAR		acTokens[ANYSIZE_ARRAY];
+} FRAMEBUFFER_FRAME, *PFRAMEBUFFER_FRAME;
+typedef FRAMEBUFFER_FRAME CONST *PCFRAMEBUFFER_FRAME;
+
+/**
+ * The last frames drawn on the screen, on all displays.
+ */
+typedef struct _FRAMEBUFFER_HISTORY
+{
+	// FRAMEBUFFER_HISTORY_VERSION.
+	ULONG		nVersion;
+
+	// Number of frames stored, and of frames drawn.
+	// The frames that weren't stored were overwritten by later ones.
+	ULONG		nFrames;
+	ULONG		nFramesDrawn;
+
+	// Size of the stored frames, in bytes.
+	ULONG		cbFrames;
+
+	// Ticks per second of the frames' timestamps.
+	ULONGLONG	nFrequency;
+
+	// The stored frames, one after the other, not necessarily in order.
+	UCHAR		acFrames[ANYSIZE_ARRAY];
+} FRAMEBUFFER_HISTORY, *PFRAMEBUFFER_HISTORY;
+typedef FRAMEBUFFER_HISTORY CONST *PCFRAMEBUFFER_HISTORY;
+
 typedef struct _RESOLUTION
 {
 	ULONG	nWidth;
 	ULONG	nHeight;
 } RESOLUTION, *PRESOLUTION;
 typedef RESOLUTION CONST *PCRESOLUTION;
+
+/**
+ * Input of IOCTL_DRINK_BUGSHOT.
+ */
+typedef struct _BUGSHOT_PARAMETERS
+{
+	// Maximal size of the captured image.
+	RESOLUTION	tResolution;
+
+	// Number of frames to keep in the history of the screen.
+	// 0 keeps no history.
+	ULONG		nHistoryFrames;
+} BUGSHOT_PARAMETERS, *PBUGSHOT_PARAMETERS;
+typedef BUGSHOT_PARAMETERS CONST *PCBUGSHOT_PARAMETERS;
+
+
+/** Functions ***********************************************************/
+
+/**
+ * Gets the GUID the saved framebuffer dump of a display is tagged with.
+ *
+ * @param[in]	nDisplay	Number of the display, starting from 0.
+ * @param[out]	ptTag		Will receive the GUID.
+ */
+STATIC
+FORCEINLINE
+VOID
+FRAMEBUFFER_GetDisplayDumpGuid(
+	_In_	ULONG	nDisplay,
+	_Out_	LPGUID	ptTag
+)
+{
+	if (0 == nDisplay)
+	{
+		*ptTag = g_tFramebufferDumpExGuid;
+	}
+	else
+	{
+		*ptTag = g_tFramebufferDisplayDumpGuid;
+		ptTag->Data4[7] = (UCHAR)nDisplay;
+	}
+}
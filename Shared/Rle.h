@@ -0,0 +1,395 @@
+/**
+ * @file Rle.h
+ * @author biko
+ * @date 2026-10-17
+ *
+ * Run-length coding of 32 BPP framebuffer pixels.
+ * The driver compresses the screenshot with it while the system is
+ * crashing, and the application decompresses it.
+ *
+ * A compressed image is a sequence of 4-byte tokens, each one a pixel
+ * whose padding byte (the 4th) holds the length of a run of that colour,
+ * minus one. Since a token is never larger than the pixels it describes,
+ * compression can be done in place, without any additional memory.
+ *
+ * Only the basic integer types are used, so that the codec
+ * can be built anywhere, not just in the driver and the application.
+ */
+#pragma once
+
+/** Constants ***********************************************************/
+
+/**
+ * Size of a single pixel, and of a single token, in bytes.
+ */
+#define RLE_PIXEL_SIZE (4)
+
+/**
+ * Longest run a single token can describe, in pixels.
+ */
+#define RLE_MAX_RUN (256)
+
+
+/** Typedefs ************************************************************/
+
+/**
+ * State of a compression in progress.
+ */
+typedef struct _RLE_ENCODER
+{
+	// Where the tokens are written, and how much room there is.
+	PUCHAR	pcOutput;
+	ULONG	cbWritten;
+	ULONG	cbCapacity;
+
+	// The run being collected.
+	UCHAR	acColor[3];
+	ULONG	nRun;
+} RLE_ENCODER, *PRLE_ENCODER;
+typedef RLE_ENCODER CONST *PCRLE_ENCODER;
+
+/**
+ * State of a decompression in progress.
+ */
+typedef struct _RLE_DECODER
+{
+	CONST UCHAR *	pcTokens;
+	ULONG			cbTokens;
+	ULONG			cbRead;
+
+	// What's left of the current token.
+	UCHAR			acColor[3];
+	ULONG			nRemaining;
+} RLE_DECODER, *PRLE_DECODER;
+typedef RLE_DECODER CONST *PCRLE_DECODER;
+
+
+/** Functions ***********************************************************/
+
+/**
+ * Starts a compression.
+ *
+ * @param[out]	ptEncoder	The compression state.
+ * @param[in]	pcOutput	Where the tokens will be written.
+ * @param[in]	cbCapacity	Size of the output, in bytes.
+ *
+ * @remark The pixels may be compressed into the very buffer that
+ *         holds them, as long as they are passed to RLE_EncodePixels
+ *         in order of increasing address, and the output starts
+ *         no later than the first of them.
+ */
+STATIC
+FORCEINLINE
+VOID
+RLE_InitializeEncoder(
+	_Out_	PRLE_ENCODER	ptEncoder,
+	_In_	PUCHAR			pcOutput,
+	_In_	ULONG			cbCapacity
+)
+{
+	ptEncoder->pcOutput = pcOutput;
+	ptEncoder->cbWritten = 0;
+	ptEncoder->cbCapacity = cbCapacity;
+	ptEncoder->nRun = 0;
+}
+
+/**
+ * Writes out the run being collected, if any.
+ *
+ * @param[in,out]	ptEncoder	The compression state.
+ */
+STATIC
+FORCEINLINE
+VOID
+RLE_FlushEncoder(
+	_Inout_	PRLE_ENCODER	ptEncoder
+)
+{
+	PUCHAR	pcToken	= NULL;
+
+	if (0 == ptEncoder->nRun)
+	{
+		return;
+	}
+
+	pcToken = &ptEncoder->pcOutput[ptEncoder->cbWritten];
+	pcToken[0] = ptEncoder->acColor[0];
+	pcToken[1] = ptEncoder->acColor[1];
+	pcToken[2] = ptEncoder->acColor[2];
+	pcToken[3] = (UCHAR)(ptEncoder->nRun - 1);
+
+	ptEncoder->cbWritten += RLE_PIXEL_SIZE;
+	ptEncoder->nRun = 0;
+}
+
+/**
+ * Compresses pixels.
+ * Runs continue across calls.
+ *
+ * @param[in,out]	ptEncoder	The compression state.
+ * @param[in]		acPixels	The pixels.
+ * @param[in]		nPixels		Number of pixels.
+ *
+ * @returns TRUE on success, FALSE if a token didn't fit in the output.
+ *
+ * @remark On failure, the pixels before the one that didn't fit
+ *         are compressed, and the compression can still be finished.
+ */
+STATIC
+FORCEINLINE
+BOOLEAN
+RLE_EncodePixels(
+	_Inout_										PRLE_ENCODER	ptEncoder,
+	_In_reads_bytes_(nPixels * RLE_PIXEL_SIZE)	CONST UCHAR *	acPixels,
+	_In_										ULONG			nPixels
+)
+{
+	ULONG	nPixel	= 0;
+	UCHAR	acColor[3];
+
+	for (nPixel = 0; nPixel < nPixels; ++nPixel)
+	{
+		// Read the pixel before anything is written,
+		// in case the output catches up with it.
+		acColor[0] = acPixels[nPixel * RLE_PIXEL_SIZE + 0];
+		acColor[1] = acPixels[nPixel * RLE_PIXEL_SIZE + 1];
+		acColor[2] = acPixels[nPixel * RLE_PIXEL_SIZE + 2];
+
+		if ((0 != ptEncoder->nRun) &&
+			(RLE_MAX_RUN != ptEncoder->nRun) &&
+			(acColor[0] == ptEncoder->acColor[0]) &&
+			(acColor[1] == ptEncoder->acColor[1]) &&
+			(acColor[2] == ptEncoder->acColor[2]))
+		{
+			++(ptEncoder->nRun);
+			continue;
+		}
+
+		// The new run needs a token too, and there must
+		// always be room to write out the run being collected.
+		if (ptEncoder->cbCapacity - ptEncoder->cbWritten <
+			((0 != ptEncoder->nRun) ? (2 * RLE_PIXEL_SIZE) : (RLE_PIXEL_SIZE)))
+		{
+			return FALSE;
+		}
+
+		RLE_FlushEncoder(ptEncoder);
+
+		ptEncoder->acColor[0] = acColor[0];
+		ptEncoder->acColor[1] = acColor[1];
+		ptEncoder->acColor[2] = acColor[2];
+		ptEncoder->nRun = 1;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Finishes a compression.
+ *
+ * @param[in,out]	ptEncoder	The compression state.
+ *
+ * @returns Size of the compressed tokens, in bytes.
+ */
+STATIC
+FORCEINLINE
+ULONG
+RLE_FinishEncoder(
+	_Inout_	PRLE_ENCODER	ptEncoder
+)
+{
+	RLE_FlushEncoder(ptEncoder);
+
+	return ptEncoder->cbWritten;
+}
+
+/**
+ * Compresses pixels in place.
+ *
+ * @param[in,out]	acPixels	The pixels.
+ *								Will receive the compressed tokens.
+ * @param[in]		nPixels		Number of pixels.
+ *
+ * @returns Size of the compressed tokens, in bytes.
+ *
+ * @remark The padding bytes of the pixels are not preserved.
+ */
+STATIC
+FORCEINLINE
+ULONG
+RLE_CompressPixels(
+	_Inout_updates_bytes_(nPixels * RLE_PIXEL_SIZE)	PUCHAR	acPixels,
+	_In_											ULONG	nPixels
+)
+{
+	RLE_ENCODER	tEncoder;
+
+	// A token is never larger than the pixels it describes, so this can't fail.
+	RLE_InitializeEncoder(&tEncoder, acPixels, nPixels * RLE_PIXEL_SIZE);
+	(VOID)RLE_EncodePixels(&tEncoder, acPixels, nPixels);
+
+	return RLE_FinishEncoder(&tEncoder);
+}
+
+/**
+ * Starts a decompression.
+ *
+ * @param[out]	ptDecoder	The decompression state.
+ * @param[in]	acTokens	The compressed tokens.
+ * @param[in]	cbTokens	Size of the tokens, in bytes.
+ */
+STATIC
+FORCEINLINE
+VOID
+RLE_InitializeDecoder(
+	_Out_						PRLE_DECODER	ptDecoder,
+	_In_reads_bytes_(cbTokens)	CONST UCHAR *	acTokens,
+	_In_						ULONG			cbTokens
+)
+{
+	ptDecoder->pcTokens = acTokens;
+	ptDecoder->cbTokens = cbTokens;
+	ptDecoder->cbRead = 0;
+	ptDecoder->nRemaining = 0;
+}
+
+/**
+ * Decompresses pixels.
+ *
+ * @param[in,out]	ptDecoder	The decompression state.
+ * @param[out]		acPixels	Will receive the pixels.
+ *								Their padding bytes are set to zero.
+ * @param[in]		nPixels		Number of pixels to decompress.
+ *
+ * @returns TRUE on success, FALSE if the tokens ran out.
+ */
+STATIC
+FORCEINLINE
+BOOLEAN
+RLE_DecodePixels(
+	_Inout_											PRLE_DECODER	ptDecoder,
+	_Out_writes_bytes_(nPixels * RLE_PIXEL_SIZE)	PUCHAR			acPixels,
+	_In_											ULONG			nPixels
+)
+{
+	CONST UCHAR *	pcToken	= NULL;
+	PUCHAR			pcPixel	= acPixels;
+
+	for (; nPixels > 0; --nPixels)
+	{
+		if (0 == ptDecoder->nRemaining)
+		{
+			if (ptDecoder->cbTokens - ptDecoder->cbRead < RLE_PIXEL_SIZE)
+			{
+				return FALSE;
+			}
+
+			pcToken = &ptDecoder->pcTokens[ptDecoder->cbRead];
+			ptDecoder->acColor[0] = pcToken[0];
+			ptDecoder->acColor[1] = pcToken[1];
+			ptDecoder->acColor[2] = pcToken[2];
+			ptDecoder->nRemaining = (ULONG)pcToken[3] + 1;
+			ptDecoder->cbRead += RLE_PIXEL_SIZE;
+		}
+
+		pcPixel[0] = ptDecoder->acColor[0];
+		pcPixel[1] = ptDecoder->acColor[1];
+		pcPixel[2] = ptDecoder->acColor[2];
+		pcPixel[3] = 0;
+		pcPixel += RLE_PIXEL_SIZE;
+
+		--(ptDecoder->nRemaining);
+	}
+
+	return TRUE;
+}
+
+/**
+ * Skips over pixels without writing them anywhere.
+ *
+ * @param[in,out]	ptDecoder	The decompression state.
+ * @param[in]		nPixels		Number of pixels to skip.
+ *
+ * @returns TRUE on success, FALSE if the tokens ran out.
+ */
+STATIC
+FORCEINLINE
+BOOLEAN
+RLE_SkipPixels(
+	_Inout_	PRLE_DECODER	ptDecoder,
+	_In_	ULONG			nPixels
+)
+{
+	CONST UCHAR *	pcToken		= NULL;
+	ULONG			nSkipped	= 0;
+
+	while (nPixels > 0)
+	{
+		if (0 == ptDecoder->nRemaining)
+		{
+			if (ptDecoder->cbTokens - ptDecoder->cbRead < RLE_PIXEL_SIZE)
+			{
+				return FALSE;
+			}
+
+			// The colour is kept, in case decompression resumes in the middle of the run.
+			pcToken = &ptDecoder->pcTokens[ptDecoder->cbRead];
+			ptDecoder->acColor[0] = pcToken[0];
+			ptDecoder->acColor[1] = pcToken[1];
+			ptDecoder->acColor[2] = pcToken[2];
+			ptDecoder->nRemaining = (ULONG)pcToken[3] + 1;
+			ptDecoder->cbRead += RLE_PIXEL_SIZE;
+		}
+
+		nSkipped = (nPixels < ptDecoder->nRemaining) ? (nPixels) : (ptDecoder->nRemaining);
+		ptDecoder->nRemaining -= nSkipped;
+		nPixels -= nSkipped;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Checks whether all the tokens have been decompressed.
+ *
+ * @param[in]	ptDecoder	The decompression state.
+ *
+ * @returns BOOLEAN
+ */
+STATIC
+FORCEINLINE
+BOOLEAN
+RLE_IsDecoderDone(
+	_In_	PCRLE_DECODER	ptDecoder
+)
+{
+	return (0 == ptDecoder->nRemaining) && (ptDecoder->cbRead == ptDecoder->cbTokens);
+}
+
+/**
+ * Decompresses pixels compressed with RLE_CompressPixels.
+ *
+ * @param[in]	acTokens	The compressed tokens.
+ * @param[in]	cbTokens	Size of the tokens, in bytes.
+ * @param[out]	acPixels	Will receive the pixels.
+ *							Their padding bytes are set to zero.
+ * @param[in]	nPixels		Number of pixels to decompress.
+ *
+ * @returns TRUE if the tokens describe exactly nPixels pixels, FALSE otherwise.
+ */
+STATIC
+FORCEINLINE
+BOOLEAN
+RLE_DecompressPixels(
+	_In_reads_bytes_(cbTokens)						CONST UCHAR *	acTokens,
+	_In_											ULONG			cbTokens,
+	_Out_writes_bytes_(nPixels * RLE_PIXEL_SIZE)	PUCHAR			acPixels,
+	_In_											ULONG			nPixels
+)
+{
+	RLE_DECODER	tDecoder;
+
+	RLE_InitializeDecoder(&tDecoder, acTokens, cbTokens);
+
+	return RLE_DecodePixels(&tDecoder, acPixels, nPixels) && RLE_IsDecoderDone(&tDecoder);
+}